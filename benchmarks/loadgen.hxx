@@ -0,0 +1,455 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <future>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <couchbase/cluster.hxx>
+#include <couchbase/transactions.hxx>
+#include <couchbase/transactions/internal/utils.hxx>
+
+#include "../src/transactions/attempt_context_testing_hooks.hxx"
+#include "../src/transactions/cleanup_testing_hooks.hxx"
+#include "../mock/mock_kv_client.hxx"
+#include "workload.hxx"
+
+namespace couchbase::transactions
+{
+
+// What the load generating tools share: where to run, and what.
+struct loadgen_options {
+    std::string backend{ "cluster" };
+    std::string api{ "sync" };
+    std::string connection_string{ "couchbase://127.0.0.1" };
+    std::string username{ "Administrator" };
+    std::string password{ "password" };
+    bool preload{ true };
+    bool json{ false };
+    durability_level durability{ durability_level::MAJORITY };
+    std::chrono::milliseconds expiration_time{ std::chrono::seconds(15) };
+    mock_kv_latency mock_latency{ std::chrono::microseconds(100), std::chrono::microseconds(200), std::chrono::microseconds(800) };
+    workload_config workload{};
+};
+
+constexpr const char* loadgen_usage =
+  R"(  --backend=cluster|mock       run against a cluster, or an in-process mock of its KV service (default cluster)
+  --api=sync|async             the transactions API to use (default sync)
+  --connection-string=STRING   (default couchbase://127.0.0.1)
+  --username=STRING            (default Administrator)
+  --password=STRING            (default password)
+  --bucket=NAME                (default default)
+
+  --docs=N                     documents to choose from (default 10000)
+  --docs-per-txn=N             (default 4)
+  --write-ratio=R              fraction of the documents in a transaction that are replaced, not just read (default 0.5)
+  --doc-size=BYTES             (default 256)
+  --distribution=uniform|zipfian
+                               how documents are chosen (default uniform)
+  --zipf-theta=T               the closer to 1, the hotter the hot documents (default 0.99)
+  --concurrency=N              transactions in flight at once (default 16)
+  --duration=SECONDS           (default 30)
+  --seed=N                     (default 0)
+  --no-preload                 don't write the documents first
+
+  --durability=NONE|MAJORITY|MAJORITY_AND_PERSIST_TO_ACTIVE|PERSIST_TO_MAJORITY
+                               (default MAJORITY)
+  --expiration-ms=MS           (default 15000)
+  --mock-read-us=US            latency of each read by the mock (default 100)
+  --mock-write-us=US           latency of each write by the mock (default 200)
+  --mock-durable-us=US         added to each durable write by the mock (default 800)
+
+  --json                       report as JSON
+)";
+
+inline durability_level
+parse_durability(const std::string& value)
+{
+    for (auto level : { durability_level::NONE,
+                        durability_level::MAJORITY,
+                        durability_level::MAJORITY_AND_PERSIST_TO_ACTIVE,
+                        durability_level::PERSIST_TO_MAJORITY }) {
+        if (durability_level_to_string(level) == value) {
+            return level;
+        }
+    }
+    throw std::invalid_argument("unknown durability level " + value);
+}
+
+// "--name=value" as its name and value, which is empty for a flag.
+inline std::pair<std::string, std::string>
+split_option(const std::string& arg)
+{
+    auto eq = arg.find('=');
+    return { arg.substr(0, eq), eq == std::string::npos ? std::string() : arg.substr(eq + 1) };
+}
+
+// Applies one of the options in loadgen_usage to options, or returns false if it isn't one of them.
+inline bool
+parse_loadgen_option(const std::string& name, const std::string& value, loadgen_options& options)
+{
+    auto& workload = options.workload;
+    if (name == "--backend" && (value == "cluster" || value == "mock")) {
+        options.backend = value;
+    } else if (name == "--api" && (value == "sync" || value == "async")) {
+        options.api = value;
+    } else if (name == "--connection-string") {
+        options.connection_string = value;
+    } else if (name == "--username") {
+        options.username = value;
+    } else if (name == "--password") {
+        options.password = value;
+    } else if (name == "--bucket") {
+        workload.bucket = value;
+    } else if (name == "--docs") {
+        workload.num_docs = std::max<size_t>(std::stoul(value), 1);
+    } else if (name == "--docs-per-txn") {
+        workload.docs_per_txn = std::max<size_t>(std::stoul(value), 1);
+    } else if (name == "--write-ratio") {
+        workload.write_ratio = std::clamp(std::stod(value), 0.0, 1.0);
+    } else if (name == "--doc-size") {
+        workload.doc_size = std::stoul(value);
+    } else if (name == "--distribution" && (value == "uniform" || value == "zipfian")) {
+        workload.distribution = value == "zipfian" ? key_distribution::zipfian : key_distribution::uniform;
+    } else if (name == "--zipf-theta") {
+        workload.zipf_theta = std::stod(value);
+    } else if (name == "--concurrency") {
+        workload.concurrency = std::max<size_t>(std::stoul(value), 1);
+    } else if (name == "--duration") {
+        workload.duration = std::chrono::seconds(std::stoul(value));
+    } else if (name == "--seed") {
+        workload.seed = std::stoull(value);
+    } else if (name == "--no-preload") {
+        options.preload = false;
+    } else if (name == "--durability") {
+        options.durability = parse_durability(value);
+    } else if (name == "--expiration-ms") {
+        options.expiration_time = std::chrono::milliseconds(std::stoul(value));
+    } else if (name == "--mock-read-us") {
+        options.mock_latency.read = std::chrono::microseconds(std::stoul(value));
+    } else if (name == "--mock-write-us") {
+        options.mock_latency.write = std::chrono::microseconds(std::stoul(value));
+    } else if (name == "--mock-durable-us") {
+        options.mock_latency.durable_write = std::chrono::microseconds(std::stoul(value));
+    } else if (name == "--json") {
+        options.json = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline std::string
+cause_name(external_exception cause)
+{
+    switch (cause) {
+        case UNKNOWN:
+            return "UNKNOWN";
+        case ACTIVE_TRANSACTION_RECORD_ENTRY_NOT_FOUND:
+            return "ACTIVE_TRANSACTION_RECORD_ENTRY_NOT_FOUND";
+        case ACTIVE_TRANSACTION_RECORD_FULL:
+            return "ACTIVE_TRANSACTION_RECORD_FULL";
+        case ACTIVE_TRANSACTION_RECORD_NOT_FOUND:
+            return "ACTIVE_TRANSACTION_RECORD_NOT_FOUND";
+        case DOCUMENT_ALREADY_IN_TRANSACTION:
+            return "DOCUMENT_ALREADY_IN_TRANSACTION";
+        case DOCUMENT_EXISTS_EXCEPTION:
+            return "DOCUMENT_EXISTS_EXCEPTION";
+        case DOCUMENT_NOT_FOUND_EXCEPTION:
+            return "DOCUMENT_NOT_FOUND_EXCEPTION";
+        case NOT_SET:
+            return "NOT_SET";
+        case FEATURE_NOT_AVAILABLE_EXCEPTION:
+            return "FEATURE_NOT_AVAILABLE_EXCEPTION";
+        case TRANSACTION_ABORTED_EXTERNALLY:
+            return "TRANSACTION_ABORTED_EXTERNALLY";
+        case PREVIOUS_OPERATION_FAILED:
+            return "PREVIOUS_OPERATION_FAILED";
+        case FORWARD_COMPATIBILITY_FAILURE:
+            return "FORWARD_COMPATIBILITY_FAILURE";
+        case PARSING_FAILURE:
+            return "PARSING_FAILURE";
+        case ILLEGAL_STATE_EXCEPTION:
+            return "ILLEGAL_STATE_EXCEPTION";
+        case COUCHBASE_EXCEPTION:
+            return "COUCHBASE_EXCEPTION";
+        case SERVICE_NOT_AVAILABLE_EXCEPTION:
+            return "SERVICE_NOT_AVAILABLE_EXCEPTION";
+        case REQUEST_CANCELED_EXCEPTION:
+            return "REQUEST_CANCELED_EXCEPTION";
+        case CONCURRENT_OPERATIONS_DETECTED_ON_SAME_DOCUMENT:
+            return "CONCURRENT_OPERATIONS_DETECTED_ON_SAME_DOCUMENT";
+        case COMMIT_NOT_PERMITTED:
+            return "COMMIT_NOT_PERMITTED";
+        case ROLLBACK_NOT_PERMITTED:
+            return "ROLLBACK_NOT_PERMITTED";
+        case TRANSACTION_ALREADY_ABORTED:
+            return "TRANSACTION_ALREADY_ABORTED";
+        case TRANSACTION_ALREADY_COMMITTED:
+            return "TRANSACTION_ALREADY_COMMITTED";
+    }
+    return "UNKNOWN";
+}
+
+// The library doesn't say why the attempts before the last one failed, so only the transaction's own failure is reported.
+inline txn_outcome
+outcome_of(const std::optional<transaction_exception>& err, const std::optional<transaction_result>& result)
+{
+    txn_outcome outcome;
+    if (!err) {
+        outcome.committed = true;
+        outcome.attempts = result ? result->attempts : 1;
+        if (result && !result->unstaging_complete) {
+            outcome.errors.push_back("unstaging_incomplete");
+        }
+        return outcome;
+    }
+    outcome.attempts = err->get_transaction_result().attempts;
+    switch (err->type()) {
+        case failure_type::FAIL:
+            outcome.errors.push_back("transaction_failed: " + cause_name(err->cause()));
+            break;
+        case failure_type::EXPIRY:
+            outcome.errors.push_back("transaction_expired: " + cause_name(err->cause()));
+            break;
+        case failure_type::COMMIT_AMBIGUOUS:
+            outcome.errors.push_back("transaction_commit_ambiguous: " + cause_name(err->cause()));
+            break;
+    }
+    return outcome;
+}
+
+inline void
+preload_cluster(couchbase::cluster& cluster, const workload_config& workload)
+{
+    txn_chooser chooser(workload);
+    auto body = doc_body(0, workload.doc_size).dump();
+    constexpr size_t batch_size = 256;
+    for (size_t first = 0; first < workload.num_docs; first += batch_size) {
+        std::vector<std::future<couchbase::operations::upsert_response>> batch;
+        for (size_t i = first; i < std::min(first + batch_size, workload.num_docs); i++) {
+            couchbase::operations::upsert_request req{ chooser.doc_id(i) };
+            req.value = couchbase::utils::to_binary(body);
+            auto barrier = std::make_shared<std::promise<couchbase::operations::upsert_response>>();
+            batch.push_back(barrier->get_future());
+            cluster.execute(req, [barrier](couchbase::operations::upsert_response resp) { barrier->set_value(std::move(resp)); });
+        }
+        for (auto& f : batch) {
+            auto resp = f.get();
+            if (resp.ctx.ec) {
+                throw std::runtime_error("could not write " + resp.ctx.id.key() + ": " + resp.ctx.ec.message());
+            }
+        }
+    }
+}
+
+inline void
+preload_mock(mock_kv& kv, const workload_config& workload)
+{
+    txn_chooser chooser(workload);
+    auto body = doc_body(0, workload.doc_size).dump();
+    for (size_t i = 0; i < workload.num_docs; i++) {
+        kv.upsert({ chooser.doc_id(i), body });
+    }
+}
+
+// The workload, run by txns with the sync or async API as options say.
+inline workload_stats
+run_transactions(transactions& txns, const loadgen_options& options)
+{
+    const auto& workload = options.workload;
+    if (options.api == "sync") {
+        return run_workload(workload, [&](const std::vector<txn_doc>& docs) {
+            try {
+                auto result = txns.run([&](attempt_context& ctx) {
+                    for (const auto& doc : docs) {
+                        auto got = ctx.get(doc.id);
+                        if (doc.write) {
+                            ctx.replace(got, next_doc_body(got.content<nlohmann::json>(), workload.doc_size));
+                        }
+                    }
+                });
+                return outcome_of({}, result);
+            } catch (const transaction_exception& e) {
+                return outcome_of(e, {});
+            }
+        });
+    }
+    return run_workload_async(workload, [&](const std::vector<txn_doc>& docs, std::function<void(txn_outcome)> done) {
+        txns.run(
+          [docs, doc_size = workload.doc_size](async_attempt_context& ctx) {
+              // all the gets at once, and each replace as soon as its get is done
+              for (const auto& doc : docs) {
+                  ctx.get(doc.id, [&ctx, doc, doc_size](std::exception_ptr err, std::optional<transaction_get_result> got) {
+                      if (err || !doc.write) {
+                          return;
+                      }
+                      ctx.replace(*got,
+                                  next_doc_body(got->content<nlohmann::json>(), doc_size),
+                                  [](std::exception_ptr, std::optional<transaction_get_result>) {});
+                  });
+              }
+          },
+          [done](std::optional<transaction_exception> err, std::optional<transaction_result> result) { done(outcome_of(err, result)); });
+    });
+}
+
+inline transaction_config
+loadgen_config(const loadgen_options& options, attempt_context_testing_hooks& attempt_hooks, cleanup_testing_hooks& cleanup_hooks)
+{
+    transaction_config config;
+    config.durability_level(options.durability);
+    config.expiration_time(options.expiration_time);
+    config.test_factories(attempt_hooks, cleanup_hooks);
+    return config;
+}
+
+/**
+ * Where the workload runs.  Each run is of the whole workload, by a transactions object of its own that has the given testing
+ * hooks, so that runs with different hooks can be compared.
+ */
+class loadgen_backend
+{
+  public:
+    virtual ~loadgen_backend() = default;
+
+    virtual workload_stats run(const attempt_context_testing_hooks& hooks) = 0;
+};
+
+// The library, against a cluster that is connected to, and preloaded, once for all the runs.
+class cluster_backend : public loadgen_backend
+{
+  public:
+    explicit cluster_backend(const loadgen_options& options)
+      : options_(options)
+      , cluster_(couchbase::cluster::create(io_))
+    {
+        for (unsigned i = 0; i < std::max(2U, std::thread::hardware_concurrency()); i++) {
+            io_threads_.emplace_back([this]() { io_.run(); });
+        }
+        try {
+            couchbase::cluster_credentials auth{};
+            auth.username = options_.username;
+            auth.password = options_.password;
+            auto barrier = std::make_shared<std::promise<std::error_code>>();
+            auto f = barrier->get_future();
+            cluster_->open(couchbase::origin(auth, couchbase::utils::parse_connection_string(options_.connection_string)),
+                           [barrier](std::error_code ec) { barrier->set_value(ec); });
+            if (auto ec = f.get(); ec) {
+                throw std::runtime_error("could not open cluster: " + ec.message());
+            }
+            get_and_open_buckets(*cluster_);
+            if (options_.preload) {
+                preload_cluster(*cluster_, options_.workload);
+            }
+        } catch (...) {
+            // the destructor won't, as it was never constructed
+            close();
+            throw;
+        }
+    }
+
+    ~cluster_backend() override
+    {
+        close();
+    }
+
+    workload_stats run(const attempt_context_testing_hooks& hooks) override
+    {
+        attempt_context_testing_hooks attempt_hooks(hooks);
+        cleanup_testing_hooks cleanup_hooks;
+        transactions txns(*cluster_, loadgen_config(options_, attempt_hooks, cleanup_hooks));
+        auto stats = run_transactions(txns, options_);
+        txns.close();
+        return stats;
+    }
+
+  private:
+    void close()
+    {
+        if (io_threads_.empty()) {
+            return;
+        }
+        auto barrier = std::make_shared<std::promise<void>>();
+        auto f = barrier->get_future();
+        cluster_->close([barrier]() { barrier->set_value(); });
+        f.get();
+        for (auto& t : io_threads_) {
+            t.join();
+        }
+        io_threads_.clear();
+    }
+
+    const loadgen_options options_;
+    asio::io_context io_;
+    std::shared_ptr<couchbase::cluster> cluster_;
+    std::list<std::thread> io_threads_;
+};
+
+/**
+ * The library, over a mock_kv_client, against a mock_kv that is preloaded afresh for each run.  Everything but the KV service
+ * is real, so this measures the library itself, but nothing it does outside of KV: the workload makes no queries, and lost
+ * attempts cleanup, which finds the buckets through the cluster, is off.  The transactions still need a cluster, so they get one
+ * that is never opened.
+ */
+class mock_backend : public loadgen_backend
+{
+  public:
+    explicit mock_backend(const loadgen_options& options)
+      : options_(options)
+      , cluster_(couchbase::cluster::create(io_))
+    {
+    }
+
+    workload_stats run(const attempt_context_testing_hooks& hooks) override
+    {
+        mock_kv kv(options_.mock_latency, options_.workload.seed);
+        if (options_.preload) {
+            preload_mock(kv, options_.workload);
+        }
+        attempt_context_testing_hooks attempt_hooks(hooks);
+        cleanup_testing_hooks cleanup_hooks;
+        auto config = loadgen_config(options_, attempt_hooks, cleanup_hooks);
+        config.cleanup_lost_attempts(false);
+        // mock_kv sleeps out each op's latency on the thread running it, so there are enough threads for every transaction to
+        // have each of its documents in flight at once, as it could against a cluster.
+        auto threads = options_.workload.concurrency * std::max<size_t>(options_.workload.docs_per_txn, 2);
+        transactions txns(*cluster_, config, std::make_shared<mock_kv_client>(kv, threads));
+        auto stats = run_transactions(txns, options_);
+        txns.close();
+        return stats;
+    }
+
+  private:
+    const loadgen_options options_;
+    asio::io_context io_;
+    std::shared_ptr<couchbase::cluster> cluster_;
+};
+
+inline std::unique_ptr<loadgen_backend>
+make_backend(const loadgen_options& options)
+{
+    if (options.backend == "mock") {
+        return std::make_unique<mock_backend>(options);
+    }
+    return std::make_unique<cluster_backend>(options);
+}
+} // namespace couchbase::transactions
@@ -0,0 +1,310 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Microbenchmarks for the parts of a transaction that run on the client, with no cluster involved.  Run the
+ * run_transactions_bench target to get the results as JSON, or pass the usual --benchmark_* flags to transactions_bench.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include <couchbase/transactions/internal/exceptions_internal.hxx>
+#include <couchbase/transactions/internal/transaction_fields.hxx>
+#include <couchbase/transactions/internal/utils.hxx>
+#include <couchbase/transactions/transaction_get_result.hxx>
+
+#include "../src/transactions/active_transaction_record.hxx"
+#include "../src/transactions/atr_ids.hxx"
+#include "../src/transactions/attempt_context_impl.hxx"
+#include "../src/transactions/staged_mutation.hxx"
+#include "../src/transactions/waitable_op_list.hxx"
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const std::string bucket_name{ "default" };
+const std::string transaction_id{ "7d1a4c5e-8c3b-4f3e-9a8e-0c5f3b2d1e40" };
+const std::string attempt_id{ "0b5c6f1d-3e2a-4d7b-8f9c-1a2b3c4d5e6f" };
+const std::string doc_content{ R"({"name":"Alice","balance":1000,"tags":["gold","verified"],"address":{"city":"Manchester"}})" };
+// a CAS in the byte-swapped hex form the ${Mutation.CAS} macro expands to
+const std::string mutation_cas{ "0x000058a71dd25c15" };
+
+couchbase::document_id
+doc_id(size_t i)
+{
+    return { bucket_name, "_default", "_default", "doc-" + std::to_string(i) };
+}
+
+transaction_get_result
+fetched_doc(size_t i)
+{
+    return transaction_get_result(doc_id(i),
+                                  nlohmann::json{ { "cas", 1000 + i },
+                                                  { "scas", std::to_string(1000 + i) },
+                                                  { "doc", nlohmann::json::parse(doc_content) } });
+}
+
+std::vector<staged_mutation>
+staged_replaces(size_t count)
+{
+    std::vector<staged_mutation> mutations;
+    mutations.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        auto doc = fetched_doc(i);
+        mutations.emplace_back(doc, doc_content, staged_mutation_type::REPLACE);
+    }
+    return mutations;
+}
+
+nlohmann::json
+doc_records(size_t count, size_t first)
+{
+    auto docs = nlohmann::json::array();
+    for (size_t i = 0; i < count; i++) {
+        docs.push_back({ { ATR_FIELD_PER_DOC_ID, "doc-" + std::to_string(first + i) },
+                         { ATR_FIELD_PER_DOC_BUCKET, bucket_name },
+                         { ATR_FIELD_PER_DOC_SCOPE, "_default" },
+                         { ATR_FIELD_PER_DOC_COLLECTION, "_default" } });
+    }
+    return docs;
+}
+
+// An ATR as it looks to cleanup: a mix of attempts in each state, each with a few documents.
+couchbase::operations::lookup_in_response
+atr_lookup(size_t num_attempts, size_t docs_per_attempt)
+{
+    static const std::vector<std::string> states{ "PENDING", "COMMITTED", "COMPLETED", "ABORTED", "ROLLED_BACK" };
+    auto attempts = nlohmann::json::object();
+    for (size_t i = 0; i < num_attempts; i++) {
+        nlohmann::json attempt{ { ATR_FIELD_TRANSACTION_ID, transaction_id },
+                                { ATR_FIELD_STATUS, states[i % states.size()] },
+                                { ATR_FIELD_START_TIMESTAMP, mutation_cas },
+                                { ATR_FIELD_EXPIRES_AFTER_MSECS, 15000 },
+                                { ATR_FIELD_DURABILITY_LEVEL, "m" } };
+        attempt[ATR_FIELD_DOCS_INSERTED] = doc_records(docs_per_attempt, i * docs_per_attempt * 3);
+        attempt[ATR_FIELD_DOCS_REPLACED] = doc_records(docs_per_attempt, (i * 3 + 1) * docs_per_attempt);
+        attempt[ATR_FIELD_DOCS_REMOVED] = doc_records(docs_per_attempt, (i * 3 + 2) * docs_per_attempt);
+        attempts[attempt_id + "-" + std::to_string(i)] = attempt;
+    }
+    couchbase::operations::lookup_in_response resp;
+    resp.ctx.id = { bucket_name, "_default", "_default", atr_ids::atr_id_for_vbucket(0) };
+    resp.cas.value = 1000;
+    resp.fields.resize(2);
+    resp.fields[0].status = couchbase::protocol::status::success;
+    resp.fields[0].value = attempts.dump();
+    resp.fields[1].status = couchbase::protocol::status::success;
+    resp.fields[1].value = R"({"HLC":{"now":"1637000000","mode":"real"}})";
+    return resp;
+}
+
+// The lookup a get does of a document staged for replace by another transaction, in the order create_from expects.
+couchbase::operations::lookup_in_response
+staged_doc_lookup()
+{
+    std::vector<std::string> values{
+        R"(")" + atr_ids::atr_id_for_vbucket(0) + R"(")",
+        R"(")" + transaction_id + R"(")",
+        R"(")" + attempt_id + R"(")",
+        doc_content,
+        R"(")" + bucket_name + R"(")",
+        R"("_default")",
+        R"("_default")",
+        R"({"CAS":"0x000058a71dd25c15","revid":"12","exptime":0})",
+        R"("replace")",
+        R"({"CAS":"0x000058a71dd25c15","revid":"12","exptime":0,"value_crc32c":"0x1cf1d44c"})",
+        R"("0x1cf1d44c")",
+        R"({})",
+        doc_content,
+    };
+    couchbase::operations::lookup_in_response resp;
+    resp.ctx.id = doc_id(0);
+    resp.cas.value = 1000;
+    resp.fields.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        resp.fields[i].status = couchbase::protocol::status::success;
+        resp.fields[i].value = values[i];
+    }
+    return resp;
+}
+} // namespace
+
+static void
+BM_create_staging_request_insert(benchmark::State& state)
+{
+    auto id = doc_id(0);
+    couchbase::document_id atr_id{ bucket_name, "_default", "_default", atr_ids::atr_id_for_vbucket(0) };
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          attempt_context_impl::create_staging_request(id, nullptr, "insert", doc_content, transaction_id, attempt_id, atr_id));
+    }
+}
+BENCHMARK(BM_create_staging_request_insert);
+
+static void
+BM_create_staging_request_replace(benchmark::State& state)
+{
+    auto doc = fetched_doc(0);
+    couchbase::document_id atr_id{ bucket_name, "_default", "_default", atr_ids::atr_id_for_vbucket(0) };
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          attempt_context_impl::create_staging_request(doc.id(), &doc, "replace", doc_content, transaction_id, attempt_id, atr_id));
+    }
+}
+BENCHMARK(BM_create_staging_request_replace);
+
+// Staging every document of a transaction of the given size.
+static void
+BM_staged_mutation_queue_add(benchmark::State& state)
+{
+    auto mutations = staged_replaces(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        staged_mutation_queue queue;
+        for (const auto& mutation : mutations) {
+            queue.add(mutation);
+        }
+        benchmark::DoNotOptimize(queue.empty());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_staged_mutation_queue_add)->RangeMultiplier(10)->Range(10, 10000)->Complexity();
+
+// Looking up documents in a transaction of the given size, as each get, replace and remove does.
+static void
+BM_staged_mutation_queue_find_any(benchmark::State& state)
+{
+    auto count = static_cast<size_t>(state.range(0));
+    staged_mutation_queue queue;
+    for (const auto& mutation : staged_replaces(count)) {
+        queue.add(mutation);
+    }
+    // half that are there, half that aren't
+    std::vector<couchbase::document_id> ids;
+    for (size_t i = 0; i < 64; i++) {
+        ids.push_back(doc_id(i % 2 == 0 ? (i * 7919) % count : count + i));
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(queue.find_any(ids[i++ % ids.size()]));
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_staged_mutation_queue_find_any)->RangeMultiplier(10)->Range(10, 10000)->Complexity();
+
+// An ATR with the given number of attempts, each with 3 documents of each kind.
+static void
+BM_map_to_atr(benchmark::State& state)
+{
+    auto resp = atr_lookup(static_cast<size_t>(state.range(0)), 3);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(active_transaction_record::map_to_atr(resp));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(resp.fields[0].value.size()));
+}
+BENCHMARK(BM_map_to_atr)->Arg(0)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+static void
+BM_transaction_get_result_create_from(benchmark::State& state)
+{
+    auto resp = staged_doc_lookup();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(transaction_get_result::create_from(resp));
+    }
+}
+BENCHMARK(BM_transaction_get_result_create_from);
+
+// Every operation in an attempt goes through the op list, so this is the cost of concurrent async operations contending on it.
+static void
+BM_waitable_op_list(benchmark::State& state)
+{
+    // shared by all the threads of a run, and back to no ops after each
+    static waitable_op_list op_list;
+    for (auto _ : state) {
+        op_list.increment_ops();
+        op_list.decrement_in_flight();
+        op_list.decrement_ops();
+    }
+}
+BENCHMARK(BM_waitable_op_list)->ThreadRange(1, 8)->UseRealTime();
+
+static void
+BM_vbucket_for_key(benchmark::State& state)
+{
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 1024; i++) {
+        keys.push_back("customer::" + std::to_string(i * 104729));
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(atr_ids::vbucket_for_key(keys[i++ % keys.size()]));
+    }
+}
+BENCHMARK(BM_vbucket_for_key);
+
+// Forced conflicts: each op fails, as if it lost a CAS race, this many times before it succeeds.
+constexpr int conflicts_per_op = 10;
+
+// The commit path used to signal each retry by throwing retry_operation...
+static void
+BM_retry_with_exceptions(benchmark::State& state)
+{
+    for (auto _ : state) {
+        int conflicts = 0;
+        retry_op_constant_delay<void>(std::chrono::milliseconds(0), conflicts_per_op, [&] {
+            if (conflicts++ < conflicts_per_op) {
+                throw retry_operation("conflict");
+            }
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * conflicts_per_op);
+}
+BENCHMARK(BM_retry_with_exceptions)->ThreadRange(1, 8)->UseRealTime();
+
+// ...and now returns an empty optional from retry_expected instead.
+static void
+BM_retry_with_expected(benchmark::State& state)
+{
+    for (auto _ : state) {
+        int conflicts = 0;
+        auto delay = constant_delay(std::chrono::milliseconds(0), conflicts_per_op);
+        auto outcome = retry_expected<void, client_error>(delay, [&]() -> std::optional<expected<void, client_error>> {
+            if (conflicts++ < conflicts_per_op) {
+                return {};
+            }
+            return expected<void, client_error>();
+        });
+        benchmark::DoNotOptimize(outcome);
+    }
+    state.SetItemsProcessed(state.iterations() * conflicts_per_op);
+}
+BENCHMARK(BM_retry_with_expected)->ThreadRange(1, 8)->UseRealTime();
+
+// Every retry delay calls this, from every thread doing retries, so it is the per-thread throughput that matters.
+static void
+BM_jitter(benchmark::State& state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(jitter());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_jitter)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,83 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Runs transactions of a configurable shape as fast as it can, for a while, and reports the throughput, the latency, the
+ * attempts each transaction took and why attempts and transactions failed.  Run with --help for the options.
+ *
+ * With --backend=cluster (the default) it uses the library against a real cluster.  With --backend=mock it uses the library
+ * against an in-process mock_kv instead, with configurable latencies, for when there isn't one.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "loadgen.hxx"
+
+using namespace couchbase::transactions;
+
+namespace
+{
+std::string
+usage()
+{
+    return std::string("usage: transactions_loadgen [--option=value ...]\n\n") + loadgen_usage;
+}
+
+loadgen_options
+parse_options(int argc, const char* argv[])
+{
+    loadgen_options options;
+    for (int i = 1; i < argc; i++) {
+        auto [name, value] = split_option(argv[i]);
+        if (name == "--help") {
+            std::cout << usage();
+            exit(0);
+        } else if (!parse_loadgen_option(name, value, options)) {
+            throw std::invalid_argument("unknown option " + std::string(argv[i]));
+        }
+    }
+    return options;
+}
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    loadgen_options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n\n" << usage();
+        return 1;
+    }
+    try {
+        auto stats = make_backend(options)->run({});
+        if (options.json) {
+            auto j = stats.to_json();
+            j["backend"] = options.backend;
+            j["api"] = options.api;
+            std::cout << j.dump(2) << std::endl;
+        } else {
+            stats.print(std::cout);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,478 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Runs the transactions_loadgen workload once for each of a list of fault scenarios, injecting the scenario's faults through
+ * the testing hooks as it goes, and compares the throughput and latency of each run with a run with no faults.  So it shows
+ * what each of the library's recovery paths costs under load.  Run with --help for the options.
+ */
+
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "loadgen.hxx"
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const char* scenarios_usage = R"(usage: transactions_scenarios [--option=value ...]
+
+  --scenarios=NAME,...         the scenarios to run, from the built in ones and those in --scenario-file (default all of them)
+  --scenario-file=FILE         more scenarios, as JSON (see below)
+  --fault-rate=R               chance of each fault firing, each time its hook is called, where a scenario doesn't say
+                               (default 0.05)
+  --list                       list the scenarios, and stop
+
+A scenario file is a list of scenarios like this, where only "hook" is needed for each fault:
+
+  [ { "name": "slow_atr", "description": "...",
+      "faults": [ { "hook": "before_atr_pending", "error": "FAIL_TRANSIENT", "rate": 0.1, "from_s": 5, "until_s": 10 },
+                  { "hook": "has_expired_client_side", "stage": "commitDoc" } ] } ]
+
+"hook" is any of the attempt_context_testing_hooks that return an error_class and are called for gets, replaces, commit or
+rollback, or has_expired_client_side, for which "stage" says which stage to expire in (any, if not given).  "error" defaults
+to FAIL_TRANSIENT.  "from_s" and "until_s" limit the fault to a window of the run.
+
+)";
+
+// One fault to inject: hook returns error (or says the attempt has expired) at rate, in the window [from_s, until_s).
+struct fault_rule {
+    std::string hook;
+    error_class error{ FAIL_TRANSIENT };
+    // or the --fault-rate if not given
+    std::optional<double> rate{};
+    // for has_expired_client_side
+    std::optional<std::string> stage{};
+    double from_s{ 0 };
+    std::optional<double> until_s{};
+};
+
+struct scenario {
+    std::string name;
+    std::string description;
+    std::vector<fault_rule> faults{};
+};
+
+// The hooks a fault can be on.  The workload only gets and replaces, so these are those the library calls on the way through
+// gets, replaces, commit and rollback: a hook for inserts, removes or queries, or one the library doesn't call at all, would
+// never fire, and a scenario using it would measure nothing.
+const std::map<std::string, error_func1 attempt_context_testing_hooks::*> error_hooks1{
+    { "before_atr_commit", &attempt_context_testing_hooks::before_atr_commit },
+    { "before_atr_commit_ambiguity_resolution", &attempt_context_testing_hooks::before_atr_commit_ambiguity_resolution },
+    { "after_atr_commit", &attempt_context_testing_hooks::after_atr_commit },
+    { "after_atr_pending", &attempt_context_testing_hooks::after_atr_pending },
+    { "before_atr_pending", &attempt_context_testing_hooks::before_atr_pending },
+    { "before_atr_complete", &attempt_context_testing_hooks::before_atr_complete },
+    { "before_atr_rolled_back", &attempt_context_testing_hooks::before_atr_rolled_back },
+    { "after_atr_complete", &attempt_context_testing_hooks::after_atr_complete },
+    { "before_atr_aborted", &attempt_context_testing_hooks::before_atr_aborted },
+    { "after_atr_aborted", &attempt_context_testing_hooks::after_atr_aborted },
+    { "after_atr_rolled_back", &attempt_context_testing_hooks::after_atr_rolled_back },
+};
+
+const std::map<std::string, error_func2 attempt_context_testing_hooks::*> error_hooks2{
+    { "before_doc_committed", &attempt_context_testing_hooks::before_doc_committed },
+    { "after_doc_committed_before_saving_cas", &attempt_context_testing_hooks::after_doc_committed_before_saving_cas },
+    { "after_doc_committed", &attempt_context_testing_hooks::after_doc_committed },
+    { "before_staged_replace", &attempt_context_testing_hooks::before_staged_replace },
+    { "before_doc_rolled_back", &attempt_context_testing_hooks::before_doc_rolled_back },
+    { "after_get_complete", &attempt_context_testing_hooks::after_get_complete },
+    { "after_staged_replace_complete", &attempt_context_testing_hooks::after_staged_replace_complete },
+    { "after_rollback_replace_or_remove", &attempt_context_testing_hooks::after_rollback_replace_or_remove },
+    { "before_check_atr_entry_for_blocking_doc", &attempt_context_testing_hooks::before_check_atr_entry_for_blocking_doc },
+    { "before_doc_get", &attempt_context_testing_hooks::before_doc_get },
+};
+
+const std::string expiry_hook{ "has_expired_client_side" };
+
+std::vector<scenario>
+built_in_scenarios()
+{
+    return {
+        { "baseline", "no faults, for the others to be compared with" },
+        { "ambiguous_atr_commit",
+          "the ATR commit succeeds but reports an ambiguous result, so it is retried and the ATR entry read to resolve it",
+          { { "after_atr_commit", FAIL_AMBIGUOUS } } },
+        { "transient_staging",
+          "staging a replace fails transiently, so the attempt is rolled back and the transaction retried",
+          { { "before_staged_replace", FAIL_TRANSIENT } } },
+        { "expiry_during_commit",
+          "the transaction expires while unstaging, so it gets one more go at finishing; unstaging writes also fail "
+          "ambiguously, which is retried, except after expiry, when what is left is for cleanup",
+          { { expiry_hook, FAIL_EXPIRY, {}, STAGE_COMMIT_DOC }, { "before_doc_committed", FAIL_AMBIGUOUS } } },
+        { "atr_full",
+          "setting the ATR entry to PENDING finds the ATR full, which fails the transaction",
+          { { "before_atr_pending", FAIL_ATR_FULL } } },
+    };
+}
+
+std::string
+error_name(error_class ec)
+{
+    std::ostringstream os;
+    os << ec;
+    return os.str();
+}
+
+error_class
+parse_error_class(const std::string& name)
+{
+    for (int i = FAIL_HARD; i <= FAIL_EXPIRY; i++) {
+        if (error_name(static_cast<error_class>(i)) == name) {
+            return static_cast<error_class>(i);
+        }
+    }
+    throw std::invalid_argument("unknown error class " + name);
+}
+
+void
+check_hook(const std::string& hook)
+{
+    if (hook != expiry_hook && error_hooks1.count(hook) == 0 && error_hooks2.count(hook) == 0) {
+        throw std::invalid_argument("unknown hook " + hook + ", or one the workload never calls");
+    }
+}
+
+std::vector<scenario>
+load_scenarios(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::invalid_argument("could not read " + path);
+    }
+    std::vector<scenario> loaded;
+    for (const auto& s : nlohmann::json::parse(in)) {
+        scenario sc{ s.at("name").get<std::string>(), s.value("description", "") };
+        for (const auto& f : s.value("faults", nlohmann::json::array())) {
+            fault_rule rule{ f.at("hook").get<std::string>() };
+            check_hook(rule.hook);
+            rule.error = parse_error_class(f.value("error", "FAIL_TRANSIENT"));
+            if (f.contains("rate")) {
+                rule.rate = std::clamp(f["rate"].get<double>(), 0.0, 1.0);
+            }
+            if (f.contains("stage")) {
+                rule.stage = f["stage"].get<std::string>();
+            }
+            rule.from_s = f.value("from_s", 0.0);
+            if (f.contains("until_s")) {
+                rule.until_s = f["until_s"].get<double>();
+            }
+            sc.faults.push_back(rule);
+        }
+        loaded.push_back(sc);
+    }
+    return loaded;
+}
+
+/**
+ * Testing hooks that fire a scenario's faults, and count how often each did.  The hooks are only good for as long as this is,
+ * and the run's clock starts when this is made.
+ *
+ * Each thread the hooks are called on draws from a generator of its own, seeded from the workload's seed and the order in
+ * which the threads first called them.
+ */
+class fault_injector
+{
+  public:
+    fault_injector(const scenario& sc, double default_rate, uint64_t seed)
+      : started_(std::chrono::steady_clock::now())
+      , seed_(seed)
+    {
+        for (const auto& rule : sc.faults) {
+            armed_.emplace_back(rule, rule.rate.value_or(default_rate));
+        }
+    }
+
+    attempt_context_testing_hooks hooks()
+    {
+        attempt_context_testing_hooks hooks;
+        std::map<std::string, std::vector<armed_rule*>> by_hook;
+        for (auto& armed : armed_) {
+            by_hook[armed.rule.hook].push_back(&armed);
+        }
+        for (const auto& [hook, rules] : by_hook) {
+            if (hook == expiry_hook) {
+                hooks.has_expired_client_side =
+                  [this, rules = rules](attempt_context*, const std::string& stage, std::optional<const std::string>) {
+                      for (auto* armed : rules) {
+                          if ((!armed->rule.stage || armed->rule.stage == stage) && fires(*armed)) {
+                              return true;
+                          }
+                      }
+                      return false;
+                  };
+            } else if (auto hook1 = error_hooks1.find(hook); hook1 != error_hooks1.end()) {
+                hooks.*(hook1->second) = [this, rules = rules](attempt_context*) { return first_to_fire(rules); };
+            } else if (auto hook2 = error_hooks2.find(hook); hook2 != error_hooks2.end()) {
+                hooks.*(hook2->second) = [this, rules = rules](attempt_context*, const std::string&) { return first_to_fire(rules); };
+            }
+        }
+        return hooks;
+    }
+
+    // the faults that fired, by the hook they were on
+    CB_NODISCARD std::map<std::string, size_t> fired() const
+    {
+        std::map<std::string, size_t> fired;
+        for (const auto& armed : armed_) {
+            fired[armed.rule.hook] += armed.fired;
+        }
+        return fired;
+    }
+
+  private:
+    struct armed_rule {
+        armed_rule(fault_rule r, double p)
+          : rule(std::move(r))
+          , rate(p)
+        {
+        }
+
+        const fault_rule rule;
+        const double rate;
+        std::atomic<size_t> fired{ 0 };
+    };
+
+    bool fires(armed_rule& armed)
+    {
+        auto since = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+        if (since < armed.rule.from_s || (armed.rule.until_s && since >= *armed.rule.until_s)) {
+            return false;
+        }
+        if (std::uniform_real_distribution<double>(0, 1)(random_for_this_thread()) >= armed.rate) {
+            return false;
+        }
+        armed.fired++;
+        return true;
+    }
+
+    // only ever used by the thread it is for, so can be used without the lock
+    std::mt19937_64& random_for_this_thread()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, added] = randoms_.try_emplace(std::this_thread::get_id());
+        if (added) {
+            // mixed, rather than added, so as not to give the same draws as the workload's thread with that index
+            auto index = static_cast<uint32_t>(randoms_.size() - 1);
+            std::seed_seq seq{ static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32), index };
+            it->second.seed(seq);
+        }
+        return it->second;
+    }
+
+    std::optional<error_class> first_to_fire(const std::vector<armed_rule*>& rules)
+    {
+        for (auto* armed : rules) {
+            if (fires(*armed)) {
+                return armed->rule.error;
+            }
+        }
+        return {};
+    }
+
+    const std::chrono::steady_clock::time_point started_;
+    const uint64_t seed_;
+    // a deque, so that the hooks can point into it
+    std::deque<armed_rule> armed_;
+    std::mutex mutex_;
+    std::map<std::thread::id, std::mt19937_64> randoms_;
+};
+
+struct scenarios_options {
+    loadgen_options loadgen{};
+    std::vector<std::string> names{};
+    std::optional<std::string> scenario_file{};
+    double fault_rate{ 0.05 };
+    bool list{ false };
+};
+
+std::string
+usage()
+{
+    return std::string(scenarios_usage) + loadgen_usage;
+}
+
+scenarios_options
+parse_options(int argc, const char* argv[])
+{
+    scenarios_options options;
+    for (int i = 1; i < argc; i++) {
+        auto [name, value] = split_option(argv[i]);
+        if (name == "--help") {
+            std::cout << usage();
+            exit(0);
+        } else if (name == "--scenarios") {
+            std::istringstream names(value);
+            for (std::string n; std::getline(names, n, ',');) {
+                options.names.push_back(n);
+            }
+        } else if (name == "--scenario-file") {
+            options.scenario_file = value;
+        } else if (name == "--fault-rate") {
+            options.fault_rate = std::clamp(std::stod(value), 0.0, 1.0);
+        } else if (name == "--list") {
+            options.list = true;
+        } else if (!parse_loadgen_option(name, value, options.loadgen)) {
+            throw std::invalid_argument("unknown option " + std::string(argv[i]));
+        }
+    }
+    return options;
+}
+
+// The scenarios to run, in the order asked for, with the baseline first whether asked for or not.
+std::vector<scenario>
+chosen_scenarios(const scenarios_options& options)
+{
+    auto all = built_in_scenarios();
+    if (options.scenario_file) {
+        auto loaded = load_scenarios(*options.scenario_file);
+        all.insert(all.end(), loaded.begin(), loaded.end());
+    }
+    if (options.names.empty()) {
+        return all;
+    }
+    std::vector<scenario> chosen{ all.front() };
+    for (const auto& name : options.names) {
+        auto found = std::find_if(all.begin(), all.end(), [&](const scenario& s) { return s.name == name; });
+        if (found == all.end()) {
+            throw std::invalid_argument("unknown scenario " + name);
+        }
+        if (found != all.begin()) {
+            chosen.push_back(*found);
+        }
+    }
+    return chosen;
+}
+
+struct scenario_result {
+    const scenario& sc;
+    workload_stats stats;
+    std::map<std::string, size_t> fired;
+};
+
+// as a percentage of the baseline, or blank if there isn't anything to compare with
+std::string
+change(double value, double baseline)
+{
+    if (baseline <= 0) {
+        return "";
+    }
+    std::ostringstream os;
+    os << std::showpos << std::fixed << std::setprecision(1) << (value - baseline) * 100 / baseline << "%";
+    return os.str();
+}
+
+void
+print_results(const std::vector<scenario_result>& results, std::ostream& os)
+{
+    const auto& baseline = results.front().stats;
+    os << std::left << std::setw(24) << "scenario" << std::right << std::setw(12) << "commits/s" << std::setw(9) << "vs base"
+       << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(9) << "vs base" << std::setw(10) << "p999 us"
+       << std::setw(10) << "attempts" << std::setw(9) << "failed" << std::setw(9) << "faults" << "\n";
+    for (const auto& r : results) {
+        size_t faults = 0;
+        for (const auto& [hook, count] : r.fired) {
+            faults += count;
+        }
+        os << std::left << std::setw(24) << r.sc.name << std::right << std::fixed << std::setprecision(1) << std::setw(12)
+           << r.stats.throughput() << std::setw(9) << change(r.stats.throughput(), baseline.throughput()) << std::setw(10)
+           << r.stats.latency_percentile(0.5) << std::setw(10) << r.stats.latency_percentile(0.99) << std::setw(9)
+           << change(static_cast<double>(r.stats.latency_percentile(0.99)), static_cast<double>(baseline.latency_percentile(0.99)))
+           << std::setw(10) << r.stats.latency_percentile(0.999) << std::setprecision(2) << std::setw(10) << r.stats.mean_attempts()
+           << std::setw(9) << r.stats.failed() << std::setw(9) << faults << "\n";
+    }
+    for (const auto& r : results) {
+        if (r.stats.errors().empty()) {
+            continue;
+        }
+        os << "\n" << r.sc.name << ":\n";
+        for (const auto& [error, count] : r.stats.errors()) {
+            os << "  " << error << ": " << count << "\n";
+        }
+    }
+}
+
+nlohmann::json
+results_json(const std::vector<scenario_result>& results, const scenarios_options& options)
+{
+    auto j = nlohmann::json::array();
+    const auto& baseline = results.front().stats;
+    for (const auto& r : results) {
+        auto s = r.stats.to_json();
+        s["scenario"] = r.sc.name;
+        s["description"] = r.sc.description;
+        s["backend"] = options.loadgen.backend;
+        s["api"] = options.loadgen.api;
+        s["faults_fired"] = r.fired;
+        s["vs_baseline"] = { { "throughput", r.stats.throughput() / std::max(baseline.throughput(), 1e-9) },
+                             { "p99", static_cast<double>(r.stats.latency_percentile(0.99)) /
+                                        static_cast<double>(std::max<uint64_t>(baseline.latency_percentile(0.99), 1)) } };
+        j.push_back(s);
+    }
+    return j;
+}
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    scenarios_options options;
+    std::vector<scenario> scenarios;
+    try {
+        options = parse_options(argc, argv);
+        scenarios = chosen_scenarios(options);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n\n" << usage();
+        return 1;
+    }
+    if (options.list) {
+        for (const auto& sc : scenarios) {
+            std::cout << sc.name << ": " << sc.description << "\n";
+        }
+        return 0;
+    }
+    try {
+        auto backend = make_backend(options.loadgen);
+        std::vector<scenario_result> results;
+        for (const auto& sc : scenarios) {
+            if (!options.loadgen.json) {
+                std::cerr << "running " << sc.name << "..." << std::endl;
+            }
+            fault_injector injector(sc, options.fault_rate, options.loadgen.workload.seed);
+            auto stats = backend->run(injector.hooks());
+            results.push_back({ sc, stats, injector.fired() });
+        }
+        if (options.loadgen.json) {
+            std::cout << results_json(results, options).dump(2) << std::endl;
+        } else {
+            print_results(results, std::cout);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
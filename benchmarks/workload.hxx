@@ -0,0 +1,410 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <couchbase/document_id.hxx>
+#include <couchbase/internal/nlohmann/json.hpp>
+#include <couchbase/support.hxx>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace couchbase::transactions
+{
+
+enum class key_distribution { uniform, zipfian };
+
+// The shape of the transactions to run, and how hard to run them.
+struct workload_config {
+    std::string bucket{ "default" };
+    std::string key_prefix{ "loadgen-" };
+    size_t num_docs{ 10000 };
+    size_t docs_per_txn{ 4 };
+    // the fraction of the documents in each transaction that are replaced rather than just read
+    double write_ratio{ 0.5 };
+    // roughly, in bytes of JSON
+    size_t doc_size{ 256 };
+    key_distribution distribution{ key_distribution::uniform };
+    // for zipfian: the closer to 1, the hotter the hot keys
+    double zipf_theta{ 0.99 };
+    // transactions in flight at once
+    size_t concurrency{ 16 };
+    std::chrono::milliseconds duration{ std::chrono::seconds(30) };
+    uint64_t seed{ 0 };
+};
+
+struct txn_doc {
+    couchbase::document_id id;
+    bool write{ false };
+};
+
+// What happened to one transaction.
+struct txn_outcome {
+    bool committed{ false };
+    size_t attempts{ 0 };
+    // the error class of each failed attempt, where the backend knows it, then of the transaction if it failed
+    std::vector<std::string> errors{};
+};
+
+/**
+ * Zipfian over [0, n), as YCSB generates it (from Gray et al, "Quickly generating billion-record synthetic databases"): key 0
+ * is the hottest, key 1 the next hottest, and so on.  With the usual theta of 0.99 and 10k keys, the hottest 1% of the keys
+ * get around half of the traffic.
+ */
+class zipfian_generator
+{
+  public:
+    zipfian_generator(uint64_t n, double theta)
+      : n_(std::max<uint64_t>(n, 2))
+      , theta_(std::clamp(theta, 0.01, 0.999))
+      , alpha_(1 / (1 - theta_))
+      , zetan_(zeta(n_, theta_))
+      , eta_((1 - std::pow(2.0 / static_cast<double>(n_), 1 - theta_)) / (1 - zeta(2, theta_) / zetan_))
+    {
+    }
+
+    template<typename Random>
+    uint64_t next(Random& random) const
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(random);
+        double uz = u * zetan_;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        return std::min(n_ - 1, static_cast<uint64_t>(static_cast<double>(n_) * std::pow(eta_ * u - eta_ + 1, alpha_)));
+    }
+
+  private:
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+    const uint64_t n_;
+    const double theta_;
+    const double alpha_;
+    const double zetan_;
+    const double eta_;
+};
+
+// Picks the documents for each transaction, all different, with the configured distribution and write ratio.
+class txn_chooser
+{
+  public:
+    explicit txn_chooser(const workload_config& config)
+      : config_(config)
+      , zipf_(config.num_docs, config.zipf_theta)
+    {
+    }
+
+    CB_NODISCARD couchbase::document_id doc_id(uint64_t index) const
+    {
+        return { config_.bucket, "_default", "_default", config_.key_prefix + std::to_string(index) };
+    }
+
+    // Draws each document, redrawing those already picked.  When a transaction has most of the documents in it, or the
+    // distribution is skewed enough, that could take a long time, so after a bounded number of draws the rest are the next
+    // documents not yet picked after the last one drawn.
+    template<typename Random>
+    std::vector<txn_doc> next(Random& random) const
+    {
+        auto count = std::min(config_.docs_per_txn, config_.num_docs);
+        std::vector<uint64_t> picked;
+        picked.reserve(count);
+        uint64_t index = 0;
+        for (size_t draws = 0; picked.size() < count && draws < count * max_draws_per_doc; draws++) {
+            index = config_.distribution == key_distribution::zipfian
+                      ? zipf_.next(random)
+                      : std::uniform_int_distribution<uint64_t>(0, config_.num_docs - 1)(random);
+            if (std::find(picked.begin(), picked.end(), index) == picked.end()) {
+                picked.push_back(index);
+            }
+        }
+        while (picked.size() < count) {
+            index = (index + 1) % config_.num_docs;
+            if (std::find(picked.begin(), picked.end(), index) == picked.end()) {
+                picked.push_back(index);
+            }
+        }
+        std::vector<txn_doc> docs;
+        docs.reserve(count);
+        std::bernoulli_distribution write(config_.write_ratio);
+        for (auto index : picked) {
+            docs.push_back({ doc_id(index), write(random) });
+        }
+        return docs;
+    }
+
+  private:
+    static constexpr size_t max_draws_per_doc = 8;
+
+    const workload_config config_;
+    const zipfian_generator zipf_;
+};
+
+// The body of each document: a counter each write bumps, padded out to the configured size.
+inline nlohmann::json
+doc_body(uint64_t counter, size_t size)
+{
+    return { { "n", counter }, { "pad", std::string(size > 24 ? size - 24 : 0, 'x') } };
+}
+
+inline nlohmann::json
+next_doc_body(const nlohmann::json& current, size_t size)
+{
+    return doc_body(current.value("n", uint64_t{ 0 }) + 1, size);
+}
+
+// Latency, attempts and errors of the transactions run by a workload.  Not thread safe: keep one per thread, and merge.
+class workload_stats
+{
+  public:
+    void record(std::chrono::nanoseconds latency, const txn_outcome& outcome)
+    {
+        latencies_us_.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+        (outcome.committed ? committed_ : failed_)++;
+        attempts_ += outcome.attempts;
+        max_attempts_ = std::max(max_attempts_, outcome.attempts);
+        attempts_histogram_[std::min<size_t>(outcome.attempts, 10)]++;
+        for (const auto& error : outcome.errors) {
+            errors_[error]++;
+        }
+    }
+
+    void merge(const workload_stats& other)
+    {
+        latencies_us_.insert(latencies_us_.end(), other.latencies_us_.begin(), other.latencies_us_.end());
+        committed_ += other.committed_;
+        failed_ += other.failed_;
+        attempts_ += other.attempts_;
+        max_attempts_ = std::max(max_attempts_, other.max_attempts_);
+        elapsed_ = std::max(elapsed_, other.elapsed_);
+        for (const auto& [attempts, count] : other.attempts_histogram_) {
+            attempts_histogram_[attempts] += count;
+        }
+        for (const auto& [error, count] : other.errors_) {
+            errors_[error] += count;
+        }
+    }
+
+    CB_NODISCARD size_t transactions() const
+    {
+        return committed_ + failed_;
+    }
+
+    CB_NODISCARD size_t committed() const
+    {
+        return committed_;
+    }
+
+    CB_NODISCARD size_t failed() const
+    {
+        return failed_;
+    }
+
+    CB_NODISCARD const std::map<std::string, size_t>& errors() const
+    {
+        return errors_;
+    }
+
+    // in microseconds, with p in [0, 1]
+    CB_NODISCARD uint64_t latency_percentile(double p) const
+    {
+        if (latencies_us_.empty()) {
+            return 0;
+        }
+        std::vector<uint64_t> sorted(latencies_us_);
+        auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(std::clamp(p, 0.0, 1.0) * static_cast<double>(sorted.size() - 1));
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        return *nth;
+    }
+
+    // committed transactions a second
+    CB_NODISCARD double throughput() const
+    {
+        auto seconds = std::chrono::duration<double>(elapsed_).count();
+        return seconds > 0 ? static_cast<double>(committed_) / seconds : 0;
+    }
+
+    CB_NODISCARD double mean_attempts() const
+    {
+        return transactions() == 0 ? 0 : static_cast<double>(attempts_) / static_cast<double>(transactions());
+    }
+
+    // how long the workload ran for
+    void elapsed(std::chrono::nanoseconds elapsed)
+    {
+        elapsed_ = elapsed;
+    }
+
+    CB_NODISCARD nlohmann::json to_json() const
+    {
+        auto seconds = std::chrono::duration<double>(elapsed_).count();
+        nlohmann::json j{ { "elapsed_s", seconds },
+                          { "transactions", transactions() },
+                          { "committed", committed_ },
+                          { "failed", failed_ },
+                          { "throughput_per_s", throughput() },
+                          { "latency_us",
+                            { { "p50", latency_percentile(0.5) },
+                              { "p99", latency_percentile(0.99) },
+                              { "p999", latency_percentile(0.999) },
+                              { "max", latency_percentile(1) } } },
+                          { "attempts", { { "mean", mean_attempts() }, { "max", max_attempts_ } } },
+                          { "errors", errors_ } };
+        auto& histogram = j["attempts"]["histogram"] = nlohmann::json::object();
+        for (const auto& [attempts, count] : attempts_histogram_) {
+            histogram[attempts == 10 ? "10+" : std::to_string(attempts)] = count;
+        }
+        return j;
+    }
+
+    void print(std::ostream& os) const
+    {
+        auto seconds = std::chrono::duration<double>(elapsed_).count();
+        os << "transactions:  " << transactions() << " (" << committed_ << " committed, " << failed_ << " failed) in " << seconds
+           << "s\n";
+        os << "throughput:    " << throughput() << " committed/s\n";
+        os << "latency (us):  p50 " << latency_percentile(0.5) << ", p99 " << latency_percentile(0.99) << ", p999 "
+           << latency_percentile(0.999) << ", max " << latency_percentile(1) << "\n";
+        os << "attempts:      mean " << mean_attempts() << ", max " << max_attempts_ << "\n";
+        for (const auto& [attempts, count] : attempts_histogram_) {
+            os << "  " << (attempts == 10 ? "10+" : std::to_string(attempts)) << ": " << count << "\n";
+        }
+        os << "errors:" << (errors_.empty() ? "        none" : "") << "\n";
+        for (const auto& [error, count] : errors_) {
+            os << "  " << error << ": " << count << "\n";
+        }
+    }
+
+  private:
+    std::chrono::nanoseconds elapsed_{ 0 };
+    std::vector<uint64_t> latencies_us_;
+    size_t committed_{ 0 };
+    size_t failed_{ 0 };
+    size_t attempts_{ 0 };
+    size_t max_attempts_{ 0 };
+    std::map<size_t, size_t> attempts_histogram_;
+    std::map<std::string, size_t> errors_;
+};
+
+/**
+ * Runs transactions for the configured duration, with config.concurrency threads each running one at a time.  run_txn runs a
+ * transaction on the given documents, and says what happened.
+ */
+inline workload_stats
+run_workload(const workload_config& config, const std::function<txn_outcome(const std::vector<txn_doc>&)>& run_txn)
+{
+    txn_chooser chooser(config);
+    auto started = std::chrono::steady_clock::now();
+    auto deadline = started + config.duration;
+    std::vector<workload_stats> stats(config.concurrency);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.concurrency; i++) {
+        threads.emplace_back([&, i]() {
+            std::mt19937_64 random(config.seed + i);
+            while (std::chrono::steady_clock::now() < deadline) {
+                auto docs = chooser.next(random);
+                auto start = std::chrono::steady_clock::now();
+                auto outcome = run_txn(docs);
+                stats[i].record(std::chrono::steady_clock::now() - start, outcome);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    workload_stats total;
+    for (const auto& s : stats) {
+        total.merge(s);
+    }
+    total.elapsed(std::chrono::steady_clock::now() - started);
+    return total;
+}
+
+/**
+ * As run_workload, but for asynchronous transactions: start_txn starts a transaction on the given documents, and calls the
+ * callback it is given with what happened, from another thread.  config.concurrency transactions are kept in flight.
+ */
+inline workload_stats
+run_workload_async(const workload_config& config,
+                   const std::function<void(const std::vector<txn_doc>&, std::function<void(txn_outcome)>)>& start_txn)
+{
+    txn_chooser chooser(config);
+    auto started = std::chrono::steady_clock::now();
+    auto deadline = started + config.duration;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::mt19937_64 random(config.seed);
+    workload_stats stats;
+    size_t in_flight = 0;
+
+    // each of the config.concurrency slots runs one transaction after another, until the deadline
+    std::function<void()> start_next = [&]() {
+        std::vector<txn_doc> docs;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            docs = chooser.next(random);
+        }
+        auto start = std::chrono::steady_clock::now();
+        start_txn(docs, [&, start](txn_outcome outcome) {
+            auto now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.record(now - start, outcome);
+                if (now >= deadline) {
+                    if (--in_flight == 0) {
+                        cv.notify_all();
+                    }
+                    return;
+                }
+            }
+            start_next();
+        });
+    };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight = config.concurrency;
+    }
+    for (size_t i = 0; i < config.concurrency; i++) {
+        start_next();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return in_flight == 0; });
+    stats.elapsed(std::chrono::steady_clock::now() - started);
+    return stats;
+}
+} // namespace couchbase::transactions
@@ -18,6 +18,7 @@
 
 #include <cmath>
 #include <functional>
+#include <memory>
 #include <thread>
 
 #include <couchbase/cluster.hxx>
@@ -45,6 +46,10 @@ namespace transactions
      */
     class transactions_cleanup;
 
+    /** @internal
+     */
+    class kv_client;
+
     /** @brief Transaction logic should be contained in a lambda of this form */
     using logic = std::function<void(attempt_context&)>;
 
@@ -139,6 +144,12 @@ namespace transactions
          */
         transactions(cluster& cluster, const transaction_config& config);
 
+        /**
+         * @internal
+         * As above, but reaching KV through kv rather than the cluster.  Used for testing.
+         */
+        transactions(cluster& cluster, const transaction_config& config, std::shared_ptr<kv_client> kv);
+
         /**
          * @brief Destructor
          */
@@ -239,8 +250,18 @@ namespace transactions
             return cluster_;
         }
 
+        /**
+         * @internal
+         * How the transactions reach KV
+         */
+        CB_NODISCARD kv_client& kv()
+        {
+            return *kv_;
+        }
+
       private:
         cluster& cluster_;
+        std::shared_ptr<kv_client> kv_;
         transaction_config config_;
         std::unique_ptr<transactions_cleanup> cleanup_;
         const size_t max_attempts_{ 1000 };
@@ -0,0 +1,82 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <couchbase/transactions/attempt_state.hxx>
+
+namespace couchbase
+{
+namespace transactions
+{
+    /**
+     * @brief How full an ATR was when it was scanned.
+     * @volatile
+     */
+    struct atr_occupancy {
+        std::string atr_id;
+        size_t entries{ 0 };
+        /** Size of its attempts.  Transactions fail with FAIL_ATR_FULL when this reaches the maximum size of an xattr. */
+        size_t bytes{ 0 };
+    };
+
+    /**
+     * @brief What one pass of the lost attempts cleanup did in one bucket.
+     * @volatile
+     *
+     * Returned by @ref transactions_cleanup::lost_attempts_reports(), and passed to @ref
+     * transaction_config::cleanup_report_callback() if set, at the end of each pass.
+     */
+    struct lost_attempts_report {
+        /** How many of the fullest ATRs are listed. */
+        static constexpr size_t max_fullest_atrs = 10;
+        /** ATRs with attempts bigger than this are counted as near full. */
+        static constexpr size_t near_full_bytes = 768 * 1024;
+
+        std::string bucket_name;
+        /** Number of active clients the ATRs were shared between. */
+        size_t num_active_clients{ 0 };
+        /** ATRs this client was responsible for, and of those, how many were scanned, and how many lookups failed. */
+        size_t atrs_assigned{ 0 };
+        size_t atrs_scanned{ 0 };
+        size_t atrs_failed{ 0 };
+        /** ATRs which had any attempts in them, and which were near full. */
+        size_t atrs_occupied{ 0 };
+        size_t atrs_near_full{ 0 };
+        /** Attempts found in the ATRs, by state. */
+        std::map<attempt_state, size_t> entries_by_state;
+        /** Attempts which had expired and were cleaned up, and those which failed to be. */
+        size_t entries_cleaned{ 0 };
+        size_t entries_failed{ 0 };
+        /** Size of the attempts fetched from the ATRs. */
+        size_t bytes_read{ 0 };
+        /** How long the pass took, and how long it was meant to take (the cleanup window). */
+        std::chrono::milliseconds elapsed{ 0 };
+        std::chrono::milliseconds budget{ 0 };
+        /** The ATRs with the largest attempts, largest first. */
+        std::vector<atr_occupancy> fullest_atrs;
+    };
+
+    using lost_attempts_report_handler = std::function<void(const lost_attempts_report&)>;
+} // namespace transactions
+} // namespace couchbase
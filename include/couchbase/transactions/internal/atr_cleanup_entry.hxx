@@ -18,14 +18,21 @@
 
 #include "atr_entry.hxx"
 #include <chrono>
+#include <condition_variable>
 #include <couchbase/transactions/durability_level.hxx>
 #include <couchbase/transactions/transaction_get_result.hxx>
+#include <exception>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
-#include <queue>
+#include <set>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "logging.hxx"
 
@@ -42,11 +49,48 @@ namespace transactions
     // need forward declaration for compare
     class atr_cleanup_entry;
 
+    // Removals of cleaned up entries from their ATRs, saved up so that those in the same ATR can be removed together in as few
+    // mutate_ins as the subdoc spec limit allows, rather than with one durable write each.
+    class atr_removal_batch
+    {
+      public:
+        // max number of specs in one subdoc request
+        static constexpr size_t max_specs = 16;
+
+        struct removal {
+            std::string attempt_id;
+            // a PENDING entry needs an extra spec, see atr_cleanup_entry::cleanup_entry
+            bool pending;
+        };
+
+        // removes the entries from the ATR in one request, raising a client_error if that fails.
+        using remove_fn =
+          std::function<void(const couchbase::document_id& atr_id, const std::vector<removal>& entries, durability_level dl)>;
+
+        void add(const couchbase::document_id& atr_id, durability_level dl, removal entry);
+
+        // Removes all the saved entries.  If removing a group of entries fails, they are retried one at a time, so one bad
+        // entry doesn't stop the rest being removed.  Errors removing single entries are logged, not raised.
+        void flush(const transactions_cleanup& cleanup, std::shared_ptr<spdlog::logger> logger);
+        // As above, but removing them with the given function.
+        void flush(const remove_fn& remove, std::shared_ptr<spdlog::logger> logger);
+
+        CB_NODISCARD size_t size() const;
+
+      private:
+        struct atr_removals {
+            couchbase::document_id atr_id;
+            durability_level dl;
+            std::vector<removal> entries;
+        };
+        std::vector<atr_removals> atrs_;
+    };
+
     // comparator class for ordering queue
     class compare_atr_entries
     {
       public:
-        bool operator()(atr_cleanup_entry& lhs, atr_cleanup_entry& rhs);
+        bool operator()(const atr_cleanup_entry& lhs, const atr_cleanup_entry& rhs) const;
     };
 
     // represents an atr entry we would like to clean
@@ -61,14 +105,21 @@ namespace transactions
         bool check_if_expired_;
         const transactions_cleanup* cleanup_;
         static const uint32_t safety_margin_ms_;
+        static const size_t max_docs_in_flight_;
 
         // we may construct from an atr_entry -- if so hold on to it and avoid lookup
         // later.
         const atr_entry* atr_entry_;
 
+        // if set, the entry removal is left to this batch rather than done immediately.
+        atr_removal_batch* removal_batch_{ nullptr };
+
+        // when it was put on the cleanup queue, if it was
+        std::chrono::time_point<std::chrono::steady_clock> queued_at_{};
+
         friend class compare_atr_entries;
 
-        void check_atr_and_cleanup(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result);
+        bool check_atr_and_cleanup(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result);
         void cleanup_docs(std::shared_ptr<spdlog::logger> logger, durability_level dl);
         void cleanup_entry(std::shared_ptr<spdlog::logger> logger, durability_level dl);
         void commit_docs(std::shared_ptr<spdlog::logger> logger, std::optional<std::vector<doc_record>> docs, durability_level dl);
@@ -77,10 +128,13 @@ namespace transactions
                                             std::optional<std::vector<doc_record>> docs,
                                             durability_level dl);
         void remove_txn_links(std::shared_ptr<spdlog::logger> logger, std::optional<std::vector<doc_record>> docs, durability_level dl);
+        using doc_done_fn = std::function<void(std::exception_ptr)>;
+        // Cleans a document, either raising an error or calling done (from any thread) once its KV op completes, never both.
+        using per_doc_fn = std::function<void(std::shared_ptr<spdlog::logger>, transaction_get_result&, bool, doc_done_fn)>;
         void do_per_doc(std::shared_ptr<spdlog::logger> logger,
                         std::vector<doc_record> docs,
                         bool require_crc_to_match,
-                        const std::function<void(std::shared_ptr<spdlog::logger>, transaction_get_result&, bool)>& call);
+                        const per_doc_fn& call);
 
       public:
         explicit atr_cleanup_entry(attempt_context& ctx);
@@ -93,7 +147,10 @@ namespace transactions
                                    const std::string& attempt_id,
                                    const transactions_cleanup& cleanup);
 
-        void clean(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result = nullptr);
+        // Returns false if there was nothing to clean: the attempt has gone from the ATR, or has yet to expire.
+        bool clean(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result = nullptr);
+        // As above, but the removal of the entry from the ATR is added to the batch, for the caller to flush.
+        bool clean(std::shared_ptr<spdlog::logger> logger, atr_removal_batch& batch);
         bool ready() const;
 
         template<typename OStream>
@@ -111,21 +168,115 @@ namespace transactions
         {
             min_start_time_ = new_time;
         }
+        CB_NODISCARD std::chrono::time_point<std::chrono::steady_clock> min_start_time() const
+        {
+            return min_start_time_;
+        }
+        CB_NODISCARD const couchbase::document_id& atr_id() const
+        {
+            return atr_id_;
+        }
+        CB_NODISCARD const std::string& attempt_id() const
+        {
+            return attempt_id_;
+        }
+        void queued_at(std::chrono::time_point<std::chrono::steady_clock> time)
+        {
+            queued_at_ = time;
+        }
+        CB_NODISCARD std::chrono::time_point<std::chrono::steady_clock> queued_at() const
+        {
+            return queued_at_;
+        }
+    };
+
+    struct atr_cleanup_queue_stats {
+        // entries added to the queue
+        size_t queued{ 0 };
+        // entries not added as they were already on the queue
+        size_t deduplicated{ 0 };
+        // entries not added as the queue was full.  Lost attempts cleanup will find them eventually.
+        size_t dropped{ 0 };
+        // most entries ever on the queue at once
+        size_t high_water_mark{ 0 };
+        // entries released after cleaning (see atr_cleanup_queue::release), and how long they took from being queued to then
+        size_t cleaned{ 0 };
+        std::chrono::microseconds total_latency{ 0 };
+        std::chrono::microseconds max_latency{ 0 };
+
+        CB_NODISCARD std::chrono::microseconds mean_latency() const
+        {
+            return cleaned == 0 ? std::chrono::microseconds(0) : total_latency / static_cast<int64_t>(cleaned);
+        }
     };
 
-    // holds sorted atr entries for cleaning
+    // Holds atr entries for cleaning, ordered by when they can be cleaned.  An attempt is only queued once, and the queue is
+    // bounded, so a burst of failures can't make it grow without limit.  Any number of threads can wait on it for the next
+    // entry to be ready.
+    //
+    // A pop can also claim the entry's ATR, in which case no other claiming pop returns an entry in that ATR until it is
+    // released.  So several workers can clean at once, while the entries in any one ATR are still cleaned one at a time, in
+    // order.
+    //
+    // The entries are kept per ATR, with the ATRs ordered by their first entry, so pushing and popping take O(log n) however
+    // many entries are held back behind claimed ATRs.
     class atr_cleanup_queue
     {
-      private:
-        mutable std::mutex mutex_;
-        std::priority_queue<atr_cleanup_entry, std::vector<atr_cleanup_entry>, compare_atr_entries> queue_;
-
       public:
+        static constexpr size_t default_capacity = 10000;
+
+        explicit atr_cleanup_queue(size_t capacity = default_capacity)
+          : capacity_(capacity)
+        {
+        }
+
         // pop, but only if the front entry's min_start_time_ is before now
-        std::optional<atr_cleanup_entry> pop(bool check_time = true);
-        void push(attempt_context& ctx);
-        void push(const atr_cleanup_entry& entry);
+        std::optional<atr_cleanup_entry> pop(bool check_time = true, bool claim_atr = false);
+        // Wait until the front entry is ready, and pop it.  Returns an empty optional once the queue is closed.
+        std::optional<atr_cleanup_entry> wait_pop(bool claim_atr = false);
+        // Release the ATR claimed by popping the entry, and record how long the entry took to clean.
+        void release(const atr_cleanup_entry& entry);
+        // Returns false if the entry was not queued, because it is already on the queue, or the queue is full.
+        bool push(attempt_context& ctx);
+        bool push(const atr_cleanup_entry& entry);
+        // Wakes anyone in wait_pop(), and makes all future calls return immediately.
+        void close();
         size_t size() const;
+        atr_cleanup_queue_stats stats() const;
+
+      private:
+        using clock = std::chrono::steady_clock;
+        // when an ATR's first entry is ready, and the ATR
+        using atr_front = std::pair<clock::time_point, std::string>;
+
+        struct atr_entries {
+            // in order of readiness, then of being pushed
+            std::multimap<clock::time_point, atr_cleanup_entry> entries;
+            bool claimed{ false };
+        };
+
+        static std::string key_for(const atr_cleanup_entry& entry);
+        static std::string atr_key_for(const atr_cleanup_entry& entry);
+        // The rest are called with the lock held.  The next ATR to take an entry from, if its first entry is ready (or
+        // readiness doesn't matter).
+        std::optional<std::string> next_atr(bool check_time, bool claim_atr) const;
+        atr_cleanup_entry take(const std::string& atr_key, bool claim_atr);
+        // remove an ATR from the fronts before changing its entries or claim, and add it back after.
+        void unlink(const std::string& atr_key, const atr_entries& atr);
+        void link(const std::string& atr_key, const atr_entries& atr);
+
+        const size_t capacity_;
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        // each ATR with entries queued or claimed
+        std::unordered_map<std::string, atr_entries> atrs_;
+        // the first entry of each ATR with entries queued, earliest first, and just those whose ATR isn't claimed
+        std::set<atr_front> fronts_;
+        std::set<atr_front> unclaimed_fronts_;
+        size_t size_{ 0 };
+        std::set<std::string> keys_;
+        atr_cleanup_queue_stats stats_;
+        bool closed_{ false };
     };
 
 } // namespace transactions
@@ -18,7 +18,11 @@
 
 #include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -28,12 +32,189 @@
 #include <couchbase/transactions/attempt_state.hxx>
 
 #include "doc_record.hxx"
+#include "transaction_fields.hxx"
 
 namespace couchbase
 {
 namespace transactions
 {
 
+    /**
+     * The lists of documents inserted, replaced and removed by an ATR entry, parsed out of the raw ATR attempts only when they are
+     * first asked for.  Cleanup discards most entries without looking at their documents, so there is no point building them up
+     * front.  Each entry only parses its own slice of the raw attempts, found by index(), so looking at the documents of every
+     * entry costs about the same as parsing the ATR once.  Entries copied from one another share the same lists, so they are
+     * parsed at most once.
+     */
+    class lazy_doc_records
+    {
+      public:
+        // where an entry is in the raw attempts
+        struct span {
+            size_t offset;
+            size_t length;
+        };
+
+        // An entry with no span has no documents.
+        lazy_doc_records(std::shared_ptr<const std::string> raw_attempts, std::optional<span> entry)
+          : raw_attempts_(std::move(raw_attempts))
+          , entry_(entry)
+        {
+        }
+
+        /**
+         * Finds the span of each entry in the raw attempts, in one pass and without parsing them.  Throws std::runtime_error if
+         * the attempts aren't a JSON object.
+         */
+        static std::unordered_map<std::string, span> index(const std::string& raw_attempts)
+        {
+            std::unordered_map<std::string, span> spans;
+            auto pos = skip_whitespace(raw_attempts, 0);
+            expect(raw_attempts, pos, '{');
+            pos = skip_whitespace(raw_attempts, pos + 1);
+            if (pos < raw_attempts.size() && raw_attempts[pos] == '}') {
+                return spans;
+            }
+            while (true) {
+                expect(raw_attempts, pos, '"');
+                auto key_end = end_of_string(raw_attempts, pos);
+                auto key = raw_attempts.find('\\', pos) < key_end
+                             ? nlohmann::json::parse(raw_attempts.begin() + pos, raw_attempts.begin() + key_end).get<std::string>()
+                             : raw_attempts.substr(pos + 1, key_end - pos - 2);
+                pos = skip_whitespace(raw_attempts, key_end);
+                expect(raw_attempts, pos, ':');
+                pos = skip_whitespace(raw_attempts, pos + 1);
+                auto value_end = end_of_value(raw_attempts, pos);
+                spans[key] = { pos, value_end - pos };
+                pos = skip_whitespace(raw_attempts, value_end);
+                if (pos < raw_attempts.size() && raw_attempts[pos] == ',') {
+                    pos = skip_whitespace(raw_attempts, pos + 1);
+                    continue;
+                }
+                expect(raw_attempts, pos, '}');
+                return spans;
+            }
+        }
+
+        CB_NODISCARD const std::optional<std::vector<doc_record>>& inserted_ids() const
+        {
+            parse();
+            return inserted_ids_;
+        }
+
+        CB_NODISCARD const std::optional<std::vector<doc_record>>& replaced_ids() const
+        {
+            parse();
+            return replaced_ids_;
+        }
+
+        CB_NODISCARD const std::optional<std::vector<doc_record>>& removed_ids() const
+        {
+            parse();
+            return removed_ids_;
+        }
+
+      private:
+        void parse() const
+        {
+            std::call_once(parsed_, [this]() {
+                if (entry_) {
+                    auto begin = raw_attempts_->begin() + static_cast<std::ptrdiff_t>(entry_->offset);
+                    auto entry = nlohmann::json::parse(begin, begin + static_cast<std::ptrdiff_t>(entry_->length));
+                    inserted_ids_ = docs_from(entry, ATR_FIELD_DOCS_INSERTED);
+                    replaced_ids_ = docs_from(entry, ATR_FIELD_DOCS_REPLACED);
+                    removed_ids_ = docs_from(entry, ATR_FIELD_DOCS_REMOVED);
+                }
+                // don't need to hang on to the raw ATR anymore
+                raw_attempts_.reset();
+            });
+        }
+
+        static std::optional<std::vector<doc_record>> docs_from(nlohmann::json& entry, const std::string& key)
+        {
+            if (entry.count(key) == 0) {
+                return {};
+            }
+            std::vector<doc_record> records;
+            records.reserve(entry[key].size());
+            for (auto& record : entry[key]) {
+                records.push_back(doc_record::create_from(record));
+            }
+            return records;
+        }
+
+        static size_t skip_whitespace(const std::string& raw, size_t pos)
+        {
+            while (pos < raw.size() && (raw[pos] == ' ' || raw[pos] == '\t' || raw[pos] == '\n' || raw[pos] == '\r')) {
+                pos++;
+            }
+            return pos;
+        }
+
+        static void expect(const std::string& raw, size_t pos, char c)
+        {
+            if (pos >= raw.size() || raw[pos] != c) {
+                throw std::runtime_error(std::string("malformed ATR attempts, expected '") + c + "' at " + std::to_string(pos));
+            }
+        }
+
+        // pos is the opening quote, returns just past the closing one
+        static size_t end_of_string(const std::string& raw, size_t pos)
+        {
+            for (pos++; pos < raw.size(); pos++) {
+                if (raw[pos] == '\\') {
+                    pos++;
+                } else if (raw[pos] == '"') {
+                    return pos + 1;
+                }
+            }
+            throw std::runtime_error("malformed ATR attempts, unterminated string");
+        }
+
+        // returns just past the value starting at pos
+        static size_t end_of_value(const std::string& raw, size_t pos)
+        {
+            size_t depth = 0;
+            while (pos < raw.size()) {
+                switch (raw[pos]) {
+                    case '"':
+                        pos = end_of_string(raw, pos);
+                        if (depth == 0) {
+                            return pos;
+                        }
+                        continue;
+                    case '{':
+                    case '[':
+                        depth++;
+                        break;
+                    case '}':
+                    case ']':
+                        if (depth == 0) {
+                            return pos;
+                        }
+                        if (--depth == 0) {
+                            return pos + 1;
+                        }
+                        break;
+                    case ',':
+                        if (depth == 0) {
+                            return pos;
+                        }
+                        break;
+                }
+                pos++;
+            }
+            throw std::runtime_error("malformed ATR attempts, unterminated value");
+        }
+
+        mutable std::shared_ptr<const std::string> raw_attempts_;
+        const std::optional<span> entry_;
+        mutable std::once_flag parsed_;
+        mutable std::optional<std::vector<doc_record>> inserted_ids_;
+        mutable std::optional<std::vector<doc_record>> replaced_ids_;
+        mutable std::optional<std::vector<doc_record>> removed_ids_;
+    };
+
     struct atr_entry {
       public:
         atr_entry() = default;
@@ -72,6 +253,38 @@ namespace transactions
         {
         }
 
+        // As above, but the document lists are only parsed if needed.
+        atr_entry(std::string atr_bucket,
+                  std::string atr_id,
+                  std::string attempt_id,
+                  attempt_state state,
+                  std::optional<std::uint64_t> timestamp_start_ms,
+                  std::optional<std::uint64_t> timestamp_commit_ms,
+                  std::optional<std::uint64_t> timestamp_complete_ms,
+                  std::optional<std::uint64_t> timestamp_rollback_ms,
+                  std::optional<std::uint64_t> timestamp_rolled_back_ms,
+                  std::optional<std::uint32_t> expires_after_ms,
+                  std::shared_ptr<const lazy_doc_records> doc_records,
+                  std::optional<nlohmann::json> forward_compat,
+                  std::uint64_t cas,
+                  std::optional<std::string> durability_level)
+          : atr_bucket_(std::move(atr_bucket))
+          , atr_id_(std::move(atr_id))
+          , attempt_id_(std::move(attempt_id))
+          , state_(state)
+          , timestamp_start_ms_(timestamp_start_ms)
+          , timestamp_commit_ms_(timestamp_commit_ms)
+          , timestamp_complete_ms_(timestamp_complete_ms)
+          , timestamp_rollback_ms_(timestamp_rollback_ms)
+          , timestamp_rolled_back_ms_(timestamp_rolled_back_ms)
+          , expires_after_ms_(expires_after_ms)
+          , lazy_doc_records_(std::move(doc_records))
+          , forward_compat_(std::move(forward_compat))
+          , cas_(cas)
+          , durability_level_(durability_level)
+        {
+        }
+
         CB_NODISCARD bool has_expired(std::uint32_t safety_margin = 0) const
         {
             uint64_t cas_ms = cas_ / 1000000;
@@ -128,17 +341,17 @@ namespace transactions
 
         CB_NODISCARD std::optional<std::vector<doc_record>> inserted_ids() const
         {
-            return inserted_ids_;
+            return lazy_doc_records_ ? lazy_doc_records_->inserted_ids() : inserted_ids_;
         }
 
         CB_NODISCARD std::optional<std::vector<doc_record>> replaced_ids() const
         {
-            return replaced_ids_;
+            return lazy_doc_records_ ? lazy_doc_records_->replaced_ids() : replaced_ids_;
         }
 
         CB_NODISCARD std::optional<std::vector<doc_record>> removed_ids() const
         {
-            return removed_ids_;
+            return lazy_doc_records_ ? lazy_doc_records_->removed_ids() : removed_ids_;
         }
 
         CB_NODISCARD std::optional<nlohmann::json> forward_compat() const
@@ -175,6 +388,7 @@ namespace transactions
         std::optional<std::vector<doc_record>> inserted_ids_;
         std::optional<std::vector<doc_record>> replaced_ids_;
         std::optional<std::vector<doc_record>> removed_ids_;
+        std::shared_ptr<const lazy_doc_records> lazy_doc_records_;
         std::optional<nlohmann::json> forward_compat_;
         std::uint64_t cas_{};
         // ExtStoreDurability
@@ -0,0 +1,164 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <couchbase/support.hxx>
+
+namespace couchbase
+{
+namespace transactions
+{
+    struct cleanup_throttle_state {
+        // fraction of its full rate that cleanup is currently allowed, between the configured minimum and 1.
+        double level{ 1.0 };
+        // why the level is what it is
+        std::string reason{ "no foreground latency measured yet" };
+        // foreground KV latency percentiles over the recent window, if there were enough samples
+        std::optional<std::chrono::microseconds> p50;
+        std::optional<std::chrono::microseconds> p99;
+        size_t samples{ 0 };
+    };
+
+    /**
+     * Slows cleanup down when it looks to be hurting foreground transactions.
+     *
+     * Transactions record the latency of each of their KV ops here.  Every so often the p99 of the recent latencies is compared
+     * with the target: if it is over, the level cleanup runs at is halved, and when it is comfortably under, the level creeps back
+     * up (so, AIMD).  The level never goes below the configured minimum, so cleanup can't be starved altogether.
+     */
+    class cleanup_throttle
+    {
+      public:
+        // samples older than this are ignored
+        static constexpr std::chrono::seconds sample_window{ 10 };
+        // how often the level can change, by default
+        static constexpr std::chrono::milliseconds default_evaluation_interval{ 1000 };
+        // fewer samples than this in the window, and we don't trust the percentiles
+        static constexpr size_t min_samples = 20;
+
+        cleanup_throttle(std::optional<std::chrono::milliseconds> latency_target,
+                         double min_level,
+                         std::chrono::milliseconds evaluation_interval = default_evaluation_interval)
+          : latency_target_(latency_target)
+          , min_level_(std::clamp(min_level, 0.01, 1.0))
+          , evaluation_interval_(evaluation_interval)
+        {
+        }
+
+        // Record the latency of a foreground KV op.  Cheap, and safe to call from any thread.
+        void record(std::chrono::steady_clock::duration latency)
+        {
+            if (!latency_target_) {
+                return;
+            }
+            auto idx = next_++ % samples_.size();
+            samples_[idx].latency_us.store(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(),
+                                           std::memory_order_relaxed);
+            samples_[idx].at.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        // The current level, re-evaluated if it is due.
+        double level()
+        {
+            return state().level;
+        }
+
+        cleanup_throttle_state state()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_evaluation_ >= evaluation_interval_) {
+                last_evaluation_ = now;
+                evaluate(now);
+            }
+            return state_;
+        }
+
+      private:
+        struct sample {
+            std::atomic<int64_t> latency_us{ 0 };
+            std::atomic<std::chrono::steady_clock::rep> at{ 0 };
+        };
+
+        void evaluate(std::chrono::steady_clock::time_point now)
+        {
+            if (!latency_target_) {
+                state_.reason = "throttling disabled";
+                return;
+            }
+            auto oldest = (now - sample_window).time_since_epoch().count();
+            std::vector<int64_t> recent;
+            recent.reserve(samples_.size());
+            for (const auto& s : samples_) {
+                if (s.at.load(std::memory_order_relaxed) > oldest) {
+                    recent.push_back(s.latency_us.load(std::memory_order_relaxed));
+                }
+            }
+            state_.samples = recent.size();
+            if (recent.size() < min_samples) {
+                state_.p50.reset();
+                state_.p99.reset();
+                raise("too little foreground traffic to measure");
+                return;
+            }
+            std::sort(recent.begin(), recent.end());
+            state_.p50 = std::chrono::microseconds(recent[recent.size() / 2]);
+            state_.p99 = std::chrono::microseconds(recent[std::min(recent.size() - 1, recent.size() * 99 / 100)]);
+            auto target = std::chrono::duration_cast<std::chrono::microseconds>(*latency_target_);
+            if (*state_.p99 > target) {
+                state_.level = std::max(min_level_, state_.level / 2);
+                state_.reason = "foreground p99 " + std::to_string(state_.p99->count()) + "us is over the target of " +
+                                std::to_string(target.count()) + "us";
+                if (state_.level == min_level_) {
+                    state_.reason += ", held at minimum rate";
+                }
+            } else if (*state_.p99 < target * 8 / 10) {
+                raise("foreground p99 " + std::to_string(state_.p99->count()) + "us is under the target of " +
+                      std::to_string(target.count()) + "us");
+            } else {
+                state_.reason = "foreground p99 " + std::to_string(state_.p99->count()) + "us is close to the target of " +
+                                std::to_string(target.count()) + "us, holding";
+            }
+        }
+
+        void raise(const std::string& reason)
+        {
+            state_.level = std::min(1.0, state_.level + 0.1);
+            state_.reason = reason;
+        }
+
+        const std::optional<std::chrono::milliseconds> latency_target_;
+        const double min_level_;
+        const std::chrono::milliseconds evaluation_interval_;
+        std::array<sample, 1024> samples_;
+        std::atomic<size_t> next_{ 0 };
+        std::mutex mutex_;
+        std::chrono::steady_clock::time_point last_evaluation_{};
+        cleanup_throttle_state state_;
+    };
+} // namespace transactions
+} // namespace couchbase
@@ -33,6 +33,11 @@ namespace transactions
         uint32_t num_expired_clients;
         bool client_is_new;
         std::vector<std::string> expired_client_ids;
+        // sorted, and including this client
+        std::vector<std::string> active_client_ids;
+        // changes to the active clients since the last heartbeat in this bucket
+        std::vector<std::string> joined_client_ids;
+        std::vector<std::string> left_client_ids;
         bool override_enabled;
         bool override_active;
         uint64_t override_expires;
@@ -54,6 +59,14 @@ namespace transactions
             for (auto& id : details.expired_client_ids) {
                 os << id << ",";
             }
+            os << "], joined_client_ids: [";
+            for (auto& id : details.joined_client_ids) {
+                os << id << ",";
+            }
+            os << "], left_client_ids: [";
+            for (auto& id : details.left_client_ids) {
+                os << id << ",";
+            }
             os << "]}";
             return os;
         }
@@ -0,0 +1,156 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <variant>
+
+#include <couchbase/support.hxx>
+
+namespace couchbase
+{
+namespace transactions
+{
+    template<typename E>
+    class unexpected
+    {
+      public:
+        explicit unexpected(E error)
+          : error_(std::move(error))
+        {
+        }
+
+        E& error()
+        {
+            return error_;
+        }
+
+      private:
+        E error_;
+    };
+
+    template<typename E>
+    unexpected<E> make_unexpected(E error)
+    {
+        return unexpected<E>(std::move(error));
+    }
+
+    /**
+     * A value or an error, in the style of std::expected (not available until C++23).
+     *
+     * Used internally on hot retry paths, where an operation failing is the common case under contention and
+     * throwing (and unwinding) an exception per failure is too expensive.  Exceptions are only thrown once we
+     * are back at the public API boundary.
+     */
+    template<typename T, typename E>
+    class expected
+    {
+      public:
+        expected(T value)
+          : storage_(std::in_place_index<0>, std::move(value))
+        {
+        }
+
+        expected(unexpected<E> err)
+          : storage_(std::in_place_index<1>, std::move(err.error()))
+        {
+        }
+
+        CB_NODISCARD bool has_value() const
+        {
+            return storage_.index() == 0;
+        }
+
+        explicit operator bool() const
+        {
+            return has_value();
+        }
+
+        T& value()
+        {
+            if (!has_value()) {
+                throw std::logic_error("expected has no value");
+            }
+            return std::get<0>(storage_);
+        }
+
+        const T& value() const
+        {
+            if (!has_value()) {
+                throw std::logic_error("expected has no value");
+            }
+            return std::get<0>(storage_);
+        }
+
+        E& error()
+        {
+            return std::get<1>(storage_);
+        }
+
+        const E& error() const
+        {
+            return std::get<1>(storage_);
+        }
+
+      private:
+        std::variant<T, E> storage_;
+    };
+
+    template<typename E>
+    class expected<void, E>
+    {
+      public:
+        expected() = default;
+
+        expected(unexpected<E> err)
+          : error_(std::move(err.error()))
+        {
+        }
+
+        CB_NODISCARD bool has_value() const
+        {
+            return !error_;
+        }
+
+        explicit operator bool() const
+        {
+            return has_value();
+        }
+
+        void value() const
+        {
+            if (!has_value()) {
+                throw std::logic_error("expected has no value");
+            }
+        }
+
+        E& error()
+        {
+            return *error_;
+        }
+
+        const E& error() const
+        {
+            return *error_;
+        }
+
+      private:
+        std::optional<E> error_;
+    };
+} // namespace transactions
+} // namespace couchbase
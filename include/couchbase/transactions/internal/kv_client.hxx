@@ -0,0 +1,80 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <functional>
+#include <utility>
+
+#include <couchbase/cluster.hxx>
+
+namespace couchbase
+{
+namespace transactions
+{
+    /**
+     * The KV operations the transactions code uses, as cluster::execute() does them.  Everything reaches KV through one of
+     * these, so that it can be run over something other than a cluster: see mock/mock_kv_client.hxx.
+     *
+     * The handler is called exactly once, from any thread, with the response.
+     */
+    class kv_client
+    {
+      public:
+        template<typename Response>
+        using handler = std::function<void(Response)>;
+
+        virtual ~kv_client() = default;
+
+        virtual void execute(operations::lookup_in_request req, handler<operations::lookup_in_response> handler) = 0;
+        virtual void execute(operations::mutate_in_request req, handler<operations::mutate_in_response> handler) = 0;
+        virtual void execute(operations::insert_request req, handler<operations::insert_response> handler) = 0;
+        virtual void execute(operations::remove_request req, handler<operations::remove_response> handler) = 0;
+    };
+
+    // Reaches KV through the cluster, as normal.
+    class cluster_kv_client : public kv_client
+    {
+      public:
+        explicit cluster_kv_client(cluster& cluster)
+          : cluster_(cluster)
+        {
+        }
+
+        void execute(operations::lookup_in_request req, handler<operations::lookup_in_response> handler) override
+        {
+            cluster_.execute(std::move(req), std::move(handler));
+        }
+
+        void execute(operations::mutate_in_request req, handler<operations::mutate_in_response> handler) override
+        {
+            cluster_.execute(std::move(req), std::move(handler));
+        }
+
+        void execute(operations::insert_request req, handler<operations::insert_response> handler) override
+        {
+            cluster_.execute(std::move(req), std::move(handler));
+        }
+
+        void execute(operations::remove_request req, handler<operations::remove_response> handler) override
+        {
+            cluster_.execute(std::move(req), std::move(handler));
+        }
+
+      private:
+        cluster& cluster_;
+    };
+} // namespace transactions
+} // namespace couchbase
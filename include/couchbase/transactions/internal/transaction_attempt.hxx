@@ -17,6 +17,7 @@
 #pragma once
 
 #include <couchbase/transactions/attempt_state.hxx>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -27,6 +28,8 @@ namespace transactions
     struct transaction_attempt {
         std::string id;
         attempt_state state;
+        // number of retries each stage of the commit used
+        std::map<std::string, size_t> commit_retries;
         transaction_attempt();
     };
 } // namespace transactions
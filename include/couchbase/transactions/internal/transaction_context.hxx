@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "transaction_attempt.hxx"
+#include "kv_client.hxx"
 #include "transactions_cleanup.hxx"
 #include <couchbase/transactions.hxx>
 #include <couchbase/transactions/async_attempt_context.hxx>
@@ -79,6 +80,11 @@ namespace transactions
             return transactions_.cluster_ref();
         }
 
+        CB_NODISCARD kv_client& kv()
+        {
+            return transactions_.kv();
+        }
+
         transaction_config& config()
         {
             return config_;
@@ -123,8 +129,23 @@ namespace transactions
 
         CB_NODISCARD transaction_result get_transaction_result() const
         {
-            return transaction_result{ transaction_id(), current_attempt().state == attempt_state::COMPLETED };
+            transaction_result result{ transaction_id(), current_attempt().state == attempt_state::COMPLETED, num_attempts() };
+            for (const auto& attempt : attempts_) {
+                for (const auto& [stage, retries] : attempt.commit_retries) {
+                    result.commit_retries[stage] += retries;
+                }
+            }
+            return result;
+        }
+
+        CB_NODISCARD transaction_priority priority() const
+        {
+            return priority_;
         }
+
+        // Multiplier for backoff delays: smaller for high priority transactions, and shrinking as a transaction makes more
+        // attempts, so long-running transactions aren't starved by fresh ones.
+        CB_NODISCARD double backoff_scale() const;
         void new_attempt_context()
         {
             auto barrier = std::make_shared<std::promise<void>>();
@@ -177,6 +198,8 @@ namespace transactions
 
         transactions& transactions_;
 
+        const transaction_priority priority_;
+
         /**
          * Will be non-zero only when resuming a deferred transaction. It records how much time has elapsed in total in the deferred
          * transaction, including the time spent in the original transaction plus any time spent while deferred.
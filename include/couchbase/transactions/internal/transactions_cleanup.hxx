@@ -17,14 +17,20 @@
 #pragma once
 
 #include <couchbase/cluster.hxx>
+#include <couchbase/transactions/cleanup_report.hxx>
 #include <couchbase/transactions/transaction_config.hxx>
 
 #include <atomic>
 #include <condition_variable>
+#include <map>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include "atr_cleanup_entry.hxx"
+#include "cleanup_throttle.hxx"
 #include "client_record.hxx"
+#include "kv_client.hxx"
 
 namespace couchbase
 {
@@ -35,6 +41,11 @@ namespace client
 
 namespace transactions
 {
+    class active_transaction_record;
+    class bucket_scan_scheduler;
+    class cleanup_checkpoint;
+    class cleanup_journal;
+
     // only really used when we force cleanup, in tests
     class transactions_cleanup_attempt
     {
@@ -81,10 +92,15 @@ namespace transactions
     struct atr_cleanup_stats {
         bool exists;
         size_t num_entries;
+        // entries which were cleaned up, and which cleanup failed for.  The rest had nothing to clean.
+        size_t num_cleaned;
+        size_t num_failed;
 
         atr_cleanup_stats()
           : exists(false)
           , num_entries(0)
+          , num_cleaned(0)
+          , num_failed(0)
         {
         }
     };
@@ -92,7 +108,7 @@ namespace transactions
     class transactions_cleanup
     {
       public:
-        transactions_cleanup(couchbase::cluster& cluster, const transaction_config& config);
+        transactions_cleanup(couchbase::cluster& cluster, std::shared_ptr<kv_client> kv, const transaction_config& config);
         ~transactions_cleanup();
 
         CB_NODISCARD couchbase::cluster& cluster_ref() const
@@ -100,6 +116,12 @@ namespace transactions
             return cluster_;
         };
 
+        // All the KV ops of cleanup go through this, rather than the cluster.
+        CB_NODISCARD kv_client& kv() const
+        {
+            return *kv_;
+        }
+
         CB_NODISCARD const transaction_config& config() const
         {
             return config_;
@@ -113,6 +135,28 @@ namespace transactions
             return atr_queue_.size();
         }
 
+        CB_NODISCARD atr_cleanup_queue_stats cleanup_queue_stats() const
+        {
+            return atr_queue_.stats();
+        }
+
+        // The report of the last complete lost attempts pass over each bucket.
+        CB_NODISCARD std::vector<lost_attempts_report> lost_attempts_reports() const;
+
+        // transactions record the latency of their KV ops here, so cleanup can back off if it is slowing them down.
+        CB_NODISCARD cleanup_throttle& throttle()
+        {
+            return throttle_;
+        }
+
+        CB_NODISCARD cleanup_throttle_state throttle_state()
+        {
+            return throttle_.state();
+        }
+
+        // Record an attempt's progress in the local journal, if there is one.  See transaction_config::cleanup_journal_path().
+        void journal_attempt(const couchbase::document_id& atr_id, const std::string& attempt_id, attempt_state state);
+
         // only used for testing.
         void force_cleanup_attempts(std::vector<transactions_cleanup_attempt>& results);
         // only used for testing
@@ -125,16 +169,36 @@ namespace transactions
 
       private:
         couchbase::cluster& cluster_;
+        // shared with the lookups still in flight when cleanup stops, which may complete after this is gone
+        std::shared_ptr<kv_client> kv_;
         const transaction_config& config_;
         const std::chrono::milliseconds cleanup_loop_delay_{ 100 };
+        // how often the lost attempts cleanup looks for buckets being created or dropped.
+        const std::chrono::seconds bucket_refresh_interval_{ 60 };
+        // each heartbeat comes up to this fraction of its interval early.
+        const double heartbeat_jitter_{ 0.2 };
 
         std::thread lost_attempts_thr_;
-        std::thread cleanup_thr_;
+        std::vector<std::thread> cleanup_thrs_;
         atr_cleanup_queue atr_queue_;
         mutable std::condition_variable cv_;
         mutable std::mutex mutex_;
 
         const std::string client_uuid_;
+        // where this is registered in the lost_attempts_registry, if it cleans up lost attempts at all.
+        std::string lost_attempts_key_;
+        std::unique_ptr<cleanup_journal> journal_;
+        cleanup_throttle throttle_;
+
+        // what each ATR had in it and when it was last looked at, by bucket, so the next scan can look at the likeliest first.
+        std::unique_ptr<cleanup_checkpoint> checkpoint_;
+
+        mutable std::mutex reports_mutex_;
+        std::map<std::string, lost_attempts_report> reports_;
+
+        // the active clients as of the last heartbeat in each bucket, so scans needn't read the client record themselves.
+        std::mutex membership_mutex_;
+        std::map<std::string, client_record_details> membership_;
 
         void attempts_loop();
 
@@ -143,9 +207,21 @@ namespace transactions
 
         void lost_attempts_loop();
         void clean_lost_attempts_in_bucket(const std::string& bucket_name);
+        // logs rather than raises a failure, as the checkpoint is only a hint
+        void save_checkpoint();
+        void refresh_buckets(bucket_scan_scheduler& scans, bucket_scan_scheduler& heartbeats);
+        void heartbeat(const std::string& bucket_name);
+        client_record_details membership(const std::string& bucket_name);
         void create_client_record(const std::string& bucket_name);
         const atr_cleanup_stats handle_atr_cleanup(const couchbase::document_id& atr_id,
                                                    std::vector<transactions_cleanup_attempt>* result = nullptr);
+        // Cleans the entry, leaving its removal from the ATR to the batch.  Errors are logged rather than raised: returns whether
+        // there was anything to clean, or nothing if cleaning it failed.
+        std::optional<bool> clean_entry(atr_cleanup_entry& entry, atr_removal_batch& batch, std::shared_ptr<spdlog::logger> logger);
+        void flush_removals(atr_removal_batch& batch, std::shared_ptr<spdlog::logger> logger);
+        const atr_cleanup_stats clean_atr_entries(const couchbase::document_id& atr_id,
+                                                  const active_transaction_record& atr,
+                                                  std::vector<transactions_cleanup_attempt>* result = nullptr);
         std::atomic<bool> running_{ false };
     };
 } // namespace transactions
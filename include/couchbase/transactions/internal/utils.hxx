@@ -16,6 +16,8 @@
 #pragma once
 #include "../../../../src/transactions/result.hxx"
 #include "couchbase/transactions/internal/exceptions_internal.hxx"
+#include "couchbase/transactions/internal/expected.hxx"
+#include <algorithm>
 #include <chrono>
 #include <couchbase/errors.hxx>
 #include <couchbase/operations.hxx>
@@ -122,28 +124,78 @@ namespace transactions
         return req;
     }
 
-    static inline result wrap_operation_future(std::future<result>& fut, bool ignore_subdoc_errors = true)
+    /**
+     * As above, but never let the request's timeout exceed max_timeout.  Used to propagate a deadline (like the time left
+     * before a transaction expires) down to individual KV ops, so they don't outlive the work they are part of.  An empty
+     * max_timeout means no cap, just the configured kv timeout.
+     */
+    template<typename T>
+    T& wrap_request(T&& req, const transaction_config& config, std::optional<std::chrono::milliseconds> max_timeout)
+    {
+        wrap_request(req, config);
+        if (max_timeout) {
+            req.timeout = std::max(std::chrono::milliseconds(1), std::min<std::chrono::milliseconds>(req.timeout, *max_timeout));
+        }
+        return req;
+    }
+
+    template<typename T>
+    T& wrap_durable_request(T&& req, const transaction_config& config, std::optional<std::chrono::milliseconds> max_timeout)
+    {
+        wrap_request(req, config, max_timeout);
+        req.durability_level = durability(config.durability_level());
+        return req;
+    }
+
+    template<typename T>
+    T& wrap_durable_request(T&& req,
+                            const transaction_config& config,
+                            durability_level dl,
+                            std::optional<std::chrono::milliseconds> max_timeout)
+    {
+        wrap_request(req, config, max_timeout);
+        req.durability_level = durability(dl);
+        return req;
+    }
+
+    // time left until the given deadline, as a cap for wrap_request (never negative)
+    static inline std::chrono::milliseconds time_until(std::chrono::steady_clock::time_point deadline)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        return std::max(std::chrono::milliseconds(0), left);
+    }
+
+    // Non-throwing version of wrap_operation_future, for the hot retry paths.
+    static inline expected<result, client_error> check_operation_result(result res, bool ignore_subdoc_errors = true)
     {
-        auto res = fut.get();
         if (!res.is_success()) {
-            throw client_error(res);
+            return make_unexpected(client_error(res));
         }
         // we should raise here, as we are doing a non-subdoc request and can't specify
         // access_deleted.  TODO: consider changing client to return document_not_found
         if (res.is_deleted && res.values.empty()) {
             res.ec = couchbase::error::key_value_errc::document_not_found;
-            throw client_error(res);
+            return make_unexpected(client_error(res));
         }
         if (!res.values.empty() && !ignore_subdoc_errors) {
-            for (auto v : res.values) {
+            for (const auto& v : res.values) {
                 if (v.status != subdoc_result::status_type::success) {
-                    throw client_error(res);
+                    return make_unexpected(client_error(res));
                 }
             }
         }
         return res;
     }
 
+    static inline result wrap_operation_future(std::future<result>& fut, bool ignore_subdoc_errors = true)
+    {
+        auto res = check_operation_result(fut.get(), ignore_subdoc_errors);
+        if (!res) {
+            throw res.error();
+        }
+        return std::move(res.value());
+    }
+
     static inline void wrap_collection_call(result& res, std::function<void(result&)> call)
     {
         call(res);
@@ -236,13 +288,82 @@ namespace transactions
     static const size_t DEFAULT_RETRY_OP_MAX_RETRIES = 100;
     static const double RETRY_OP_JITTER = 0.1; // means +/- 10% for jitter.
     static const size_t DEFAULT_RETRY_OP_EXPONENT_CAP = 8;
-    static inline double jitter()
+
+    /**
+     * Small, fast, non-cryptographic PRNG (xoshiro256**, seeded via splitmix64).
+     *
+     * Used for retry jitter, where we only need cheap, reasonably uniform numbers.  Each thread gets its own instance
+     * (see @ref jitter_generator), so there is no shared state between retrying threads.
+     */
+    class jitter_prng
     {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        static std::uniform_real_distribution<> dist(1 - RETRY_OP_JITTER, 1 + RETRY_OP_JITTER);
+      public:
+        explicit jitter_prng(uint64_t seed)
+        {
+            reseed(seed);
+        }
+
+        void reseed(uint64_t seed)
+        {
+            for (auto& s : state_) {
+                s = splitmix64(seed);
+            }
+        }
+
+        uint64_t next()
+        {
+            const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+            const uint64_t t = state_[1] << 17;
+            state_[2] ^= state_[0];
+            state_[3] ^= state_[1];
+            state_[1] ^= state_[2];
+            state_[0] ^= state_[3];
+            state_[2] ^= t;
+            state_[3] = rotl(state_[3], 45);
+            return result;
+        }
+
+        // uniformly distributed in [0, 1)
+        double next_double()
+        {
+            return static_cast<double>(next() >> 11) * (1.0 / static_cast<double>(uint64_t(1) << 53));
+        }
 
-        return dist(gen);
+      private:
+        uint64_t state_[4];
+
+        static uint64_t rotl(uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        static uint64_t splitmix64(uint64_t& x)
+        {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+    };
+
+    // One generator per thread, shared by every translation unit (hence inline rather than static).
+    inline jitter_prng& jitter_generator()
+    {
+        thread_local jitter_prng gen((static_cast<uint64_t>(std::random_device{}()) << 32) ^
+                                     std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        return gen;
+    }
+
+    // Reseed the calling thread's jitter generator, so tests can get a repeatable sequence of delays.
+    inline void seed_jitter(uint64_t seed)
+    {
+        jitter_generator().reseed(seed);
+    }
+
+    // returns a value uniformly distributed in [1 - RETRY_OP_JITTER, 1 + RETRY_OP_JITTER)
+    inline double jitter()
+    {
+        return (1 - RETRY_OP_JITTER) + 2 * RETRY_OP_JITTER * jitter_generator().next_double();
     }
 
     template<typename R, typename R1, typename P1, typename R2, typename P2, typename R3, typename P3>
@@ -331,24 +452,38 @@ namespace transactions
         {
         }
         void operator()() const
+        {
+            (*this)(1.0);
+        }
+        // as above, but the delay (after capping at max_delay) is multiplied by scale
+        void operator()(double scale) const
+        {
+            if (!try_wait(scale)) {
+                throw retry_operation_timeout("timed out");
+            }
+        }
+        // non-throwing version of the above, returns false (without waiting) once timed out
+        bool try_wait(double scale = 1.0) const
         {
             auto now = std::chrono::steady_clock::now();
             if (!end_time) {
                 end_time = std::chrono::steady_clock::now() + timeout;
-                return;
+                return true;
             }
             if (now > *end_time) {
-                throw retry_operation_timeout("timed out");
+                return false;
             }
             auto delay = initial_delay * (jitter() * pow(2, retries++));
             if (delay > max_delay) {
                 delay = max_delay;
             }
+            delay *= scale;
             if (now + delay > *end_time) {
                 std::this_thread::sleep_for(*end_time - now);
             } else {
                 std::this_thread::sleep_for(delay);
             }
+            return true;
         }
     };
 
@@ -366,13 +501,71 @@ namespace transactions
         }
         void operator()()
         {
-            if (retries++ >= max_retries) {
+            if (!try_wait()) {
                 throw retry_operation_retries_exhausted("retries exhausted");
             }
+        }
+        // non-throwing version of the above, returns false (without waiting) once retries are exhausted
+        bool try_wait()
+        {
+            if (retries++ >= max_retries) {
+                return false;
+            }
             std::this_thread::sleep_for(delay);
+            return true;
         }
     };
 
+    /**
+     * Exception-free counterpart of the retry_op_* family.  Each try returns an empty optional to ask to be retried (rather
+     * than throwing retry_operation), or an expected holding the value or a final error.  Between tries we call
+     * delay.try_wait(), and return an empty optional if that says we are out of retries or time.
+     */
+    template<typename R, typename E, typename Delay>
+    std::optional<expected<R, E>> retry_expected(Delay& delay, const std::function<std::optional<expected<R, E>>()>& func)
+    {
+        while (true) {
+            auto outcome = func();
+            if (outcome) {
+                return outcome;
+            }
+            if (!delay.try_wait()) {
+                return {};
+            }
+        }
+    }
+
+    // Lists the buckets on the cluster, without opening them.  Throws client_error if the listing fails.
+    static std::list<std::string> get_bucket_names(cluster& c)
+    {
+        couchbase::operations::management::bucket_get_all_request req{};
+        // don't wrap this one, as the kv timeout isn't appropriate here.
+        auto barrier = std::make_shared<std::promise<std::list<std::string>>>();
+        auto f = barrier->get_future();
+        c.execute(req, [barrier](couchbase::operations::management::bucket_get_all_response resp) {
+            if (resp.ctx.ec) {
+                barrier->set_exception(
+                  std::make_exception_ptr(client_error(FAIL_OTHER, "error listing buckets: " + resp.ctx.ec.message())));
+                return;
+            }
+            std::list<std::string> names;
+            for (const auto& b : resp.buckets) {
+                names.push_back(b.name);
+            }
+            barrier->set_value(std::move(names));
+        });
+        return f.get();
+    }
+
+    // Opens a single bucket, returning the error (if any).
+    static std::error_code open_bucket(cluster& c, const std::string& bucket_name)
+    {
+        auto barrier = std::make_shared<std::promise<std::error_code>>();
+        auto f = barrier->get_future();
+        c.open_bucket(bucket_name, [barrier](std::error_code ec) { barrier->set_value(ec); });
+        return f.get();
+    }
+
     static std::list<std::string> get_and_open_buckets(cluster& c)
     {
         couchbase::operations::management::bucket_get_all_request req{};
@@ -22,6 +22,7 @@
 #include <couchbase/operations/document_query.hxx>
 #include <couchbase/transactions/durability_level.hxx>
 #include <couchbase/transactions/transaction_config.hxx>
+#include <couchbase/transactions/transaction_priority.hxx>
 
 using couchbase::operations::query_request;
 using couchbase::transactions::durability_level;
@@ -84,6 +85,21 @@ class per_transaction_config
         return custom_metadata_collection_;
     }
 
+    /**
+     * Set the priority of this transaction.  Higher priority transactions back off less under contention, see
+     * @ref transaction_priority.  Defaults to NORMAL.
+     */
+    per_transaction_config& priority(transaction_priority priority)
+    {
+        priority_ = priority;
+        return *this;
+    }
+
+    std::optional<transaction_priority> priority() const
+    {
+        return priority_;
+    }
+
     transaction_config apply(const transaction_config& conf) const
     {
         transaction_config retval = conf;
@@ -111,6 +127,7 @@ class per_transaction_config
     std::optional<milliseconds> kv_timeout_;
     std::optional<nanoseconds> expiration_time_;
     std::optional<transaction_keyspace> custom_metadata_collection_;
+    std::optional<transaction_priority> priority_;
 };
 
 } // namespace couchbase::transactions
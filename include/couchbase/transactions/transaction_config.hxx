@@ -18,10 +18,12 @@
 #include <chrono>
 #include <couchbase/operations/document_query.hxx>
 #include <couchbase/support.hxx>
+#include <couchbase/transactions/cleanup_report.hxx>
 #include <couchbase/transactions/durability_level.hxx>
 #include <couchbase/transactions/transaction_keyspace.hxx>
 #include <memory>
 #include <optional>
+#include <string>
 
 namespace couchbase
 {
@@ -176,6 +178,12 @@ namespace transactions
          * @brief Get lost attempts cleanup loop status.
          * @see @ref cleanup_window() for description of the lost attempts cleanup loop.
          *
+         * Of all the transactions objects in a process using the same cluster, metadata collection and lost attempts
+         * cleanup settings (the cleanup window, KV timeout, lookups in flight, scan threads, throttling, rendezvous hashing,
+         * durable heartbeats and checkpoint path), only one runs the loop at a time, and only it appears in the client record.
+         * Its cleanup report callback is the one called, and it is the only one with lost attempts reports.  When it is
+         * closed, another takes over.  Objects with different settings each run their own loop.
+         *
          * @return If false, no lost attempts cleanup threads will be launched.
          */
         CB_NODISCARD bool cleanup_lost_attempts() const
@@ -207,6 +215,259 @@ namespace transactions
             return cleanup_client_attempts_;
         }
 
+        /**
+         * @brief Set the number of ATR lookups the lost attempts cleanup keeps in flight.
+         * @see @ref cleanup_atr_lookups_in_flight()
+         *
+         * @param value Maximum number of concurrent ATR lookups, per bucket.
+         */
+        void cleanup_atr_lookups_in_flight(size_t value)
+        {
+            cleanup_atr_lookups_in_flight_ = value;
+        }
+
+        /**
+         * @brief Get the number of ATR lookups the lost attempts cleanup keeps in flight.
+         *
+         * The lost attempts cleanup spreads its lookups of the active transaction records in a bucket evenly
+         * over the @ref cleanup_window(), and allows up to this many of them to be outstanding at once, so one
+         * slow lookup doesn't hold up the rest of the pass.
+         *
+         * @return Maximum number of concurrent ATR lookups, per bucket.
+         */
+        CB_NODISCARD size_t cleanup_atr_lookups_in_flight() const
+        {
+            return cleanup_atr_lookups_in_flight_;
+        }
+
+        /**
+         * @brief Set the number of threads the lost attempts cleanup uses to scan buckets.
+         * @see @ref cleanup_bucket_scan_threads()
+         *
+         * @param value Number of bucket scan threads.
+         */
+        void cleanup_bucket_scan_threads(size_t value)
+        {
+            cleanup_bucket_scan_threads_ = value;
+        }
+
+        /**
+         * @brief Get the number of threads the lost attempts cleanup uses to scan buckets.
+         *
+         * Each bucket is scanned once per @ref cleanup_window(), by a pool of this many threads.  If there are
+         * more buckets than threads, scans queue for a free thread, so some buckets will be scanned less often.
+         *
+         * @return Number of bucket scan threads.
+         */
+        CB_NODISCARD size_t cleanup_bucket_scan_threads() const
+        {
+            return cleanup_bucket_scan_threads_;
+        }
+
+        /**
+         * @brief Set the number of threads cleaning up this client's own failed attempts.
+         * @see @ref cleanup_client_attempts_threads()
+         *
+         * @param value Number of client attempts cleanup threads.
+         */
+        void cleanup_client_attempts_threads(size_t value)
+        {
+            cleanup_client_attempts_threads_ = value;
+        }
+
+        /**
+         * @brief Get the number of threads cleaning up this client's own failed attempts.
+         *
+         * When @ref cleanup_client_attempts() is enabled, attempts which fail to complete are queued and cleaned up
+         * in the background by this many threads.
+         *
+         * @return Number of client attempts cleanup threads.
+         */
+        CB_NODISCARD size_t cleanup_client_attempts_threads() const
+        {
+            return cleanup_client_attempts_threads_;
+        }
+
+        /**
+         * @brief Set the foreground latency target for cleanup throttling.
+         * @see @ref cleanup_foreground_latency_target()
+         *
+         * @param target p99 latency of transactional KV operations above which cleanup slows down, or no value to
+         *        never throttle cleanup.
+         */
+        void cleanup_foreground_latency_target(std::optional<std::chrono::milliseconds> target)
+        {
+            cleanup_foreground_latency_target_ = target;
+        }
+
+        /**
+         * @brief Get the foreground latency target for cleanup throttling.
+         *
+         * Cleanup shares the cluster connections with transactions.  While the p99 latency of the KV operations
+         * done by transactions is above this target, cleanup slows down, to no less than @ref cleanup_min_rate()
+         * of its full rate.
+         *
+         * @return The latency target, if cleanup is throttled.
+         */
+        CB_NODISCARD std::optional<std::chrono::milliseconds> cleanup_foreground_latency_target() const
+        {
+            return cleanup_foreground_latency_target_;
+        }
+
+        /**
+         * @brief Set the minimum rate of cleanup, when throttled.
+         * @see @ref cleanup_min_rate()
+         *
+         * @param rate Fraction of its full rate, between 0 and 1.
+         */
+        void cleanup_min_rate(double rate)
+        {
+            cleanup_min_rate_ = rate;
+        }
+
+        /**
+         * @brief Get the minimum rate of cleanup, when throttled.
+         *
+         * However slow foreground transactions are, cleanup doesn't run slower than this fraction of its full rate,
+         * so lost attempts are still cleaned up eventually.  For instance at 0.25, a lost attempts pass takes no more
+         * than 4 cleanup windows.
+         *
+         * @return Fraction of its full rate.
+         */
+        CB_NODISCARD double cleanup_min_rate() const
+        {
+            return cleanup_min_rate_;
+        }
+
+        /**
+         * @brief Set whether lost attempts cleanup shares out ATRs by rendezvous hashing.
+         * @see @ref cleanup_rendezvous_hashing()
+         *
+         * @param enabled True to share out ATRs by rendezvous hashing, false to stripe them.
+         */
+        void cleanup_rendezvous_hashing(bool enabled)
+        {
+            cleanup_rendezvous_hashing_ = enabled;
+        }
+
+        /**
+         * @brief Get whether lost attempts cleanup shares out ATRs by rendezvous hashing.
+         *
+         * By default, each of the N active clients checks every Nth ATR, so whenever a client joins or leaves almost every
+         * ATR changes owner.  With rendezvous hashing only about 1/N of them do, which suits fleets whose size changes often.
+         * Every client cleaning up the same buckets must use the same setting, or some ATRs may not be checked at all until
+         * their clients agree again.
+         *
+         * @return True if ATRs are shared out by rendezvous hashing.
+         */
+        CB_NODISCARD bool cleanup_rendezvous_hashing() const
+        {
+            return cleanup_rendezvous_hashing_;
+        }
+
+        /**
+         * @brief Set whether this client's heartbeats in the client record are durable writes.
+         * @see @ref cleanup_durable_heartbeats()
+         *
+         * @param durable True to write heartbeats with the configured durability level, false to write them without.
+         */
+        void cleanup_durable_heartbeats(bool durable)
+        {
+            cleanup_durable_heartbeats_ = durable;
+        }
+
+        /**
+         * @brief Get whether this client's heartbeats in the client record are durable writes.
+         *
+         * Each client cleaning up lost attempts regularly writes a heartbeat to the client record in every bucket, so the
+         * other clients know it is still alive.  With many clients that document is written often, and durable writes to it
+         * can be a bottleneck.  A heartbeat lost in a failover just means other clients may briefly think this one has gone,
+         * and check some of its ATRs too, so with many clients it can be worth turning this off.
+         *
+         * @return True if heartbeats are written with the configured durability level.
+         */
+        CB_NODISCARD bool cleanup_durable_heartbeats() const
+        {
+            return cleanup_durable_heartbeats_;
+        }
+
+        /**
+         * @brief Set where to keep a local journal of this client's attempts.
+         * @see @ref cleanup_journal_path()
+         *
+         * @param path A file, which will be created if it doesn't exist.
+         */
+        void cleanup_journal_path(const std::string& path)
+        {
+            cleanup_journal_path_ = path;
+        }
+
+        /**
+         * @brief Get where to keep a local journal of this client's attempts, if anywhere.
+         *
+         * If the process crashes, its unfinished attempts are normally only cleaned up once they have expired and a lost
+         * attempts scan gets to their ATRs, which can take a few cleanup windows, leaving their documents locked meanwhile.
+         * With a journal, the next transactions object to use it cleans them up as soon as it starts.  Each transactions
+         * object needs a journal file of its own, but it should be the same one each time the process starts.
+         *
+         * @return The path of the journal, if there is one.
+         */
+        CB_NODISCARD std::optional<std::string> cleanup_journal_path() const
+        {
+            return cleanup_journal_path_;
+        }
+
+        /**
+         * @brief Set where to keep the lost attempts cleanup's progress between runs.
+         * @see @ref cleanup_checkpoint_path()
+         *
+         * @param path A file, which will be created if it doesn't exist.
+         */
+        void cleanup_checkpoint_path(const std::string& path)
+        {
+            cleanup_checkpoint_path_ = path;
+        }
+
+        /**
+         * @brief Get where to keep the lost attempts cleanup's progress between runs, if anywhere.
+         *
+         * The lost attempts cleanup looks first at the ATRs which had attempts in them last time, then at those it has
+         * left longest.  Normally it only remembers this while it runs, so after a restart it has to start from scratch.  With
+         * a checkpoint file, written at the end of each pass over a bucket, a restarted client carries on where it left off.
+         * Losing the file or having it out of date does no harm.
+         *
+         * @return The path of the checkpoint file, if there is one.
+         */
+        CB_NODISCARD std::optional<std::string> cleanup_checkpoint_path() const
+        {
+            return cleanup_checkpoint_path_;
+        }
+
+        /**
+         * @brief Set a callback for reports from the lost attempts cleanup.
+         * @see @ref cleanup_report_callback()
+         *
+         * @param callback Called with each report.
+         */
+        void cleanup_report_callback(lost_attempts_report_handler callback)
+        {
+            cleanup_report_callback_ = std::move(callback);
+        }
+
+        /**
+         * @brief Get the callback for reports from the lost attempts cleanup, if any.
+         *
+         * At the end of each pass over a bucket, the lost attempts cleanup reports what it found and did, including the
+         * fullest ATRs, which can warn of transactions about to fail with FAIL_ATR_FULL.  The callback is called on a cleanup
+         * thread, so it should be quick.
+         *
+         * @return The callback, which may be empty.
+         */
+        CB_NODISCARD const lost_attempts_report_handler& cleanup_report_callback() const
+        {
+            return cleanup_report_callback_;
+        }
+
         void custom_metadata_collection(const transaction_keyspace& keyspace)
         {
             custom_metadata_collection_ = keyspace;
@@ -254,6 +515,16 @@ namespace transactions
         std::optional<std::chrono::milliseconds> kv_timeout_;
         bool cleanup_lost_attempts_;
         bool cleanup_client_attempts_;
+        size_t cleanup_atr_lookups_in_flight_;
+        size_t cleanup_bucket_scan_threads_;
+        size_t cleanup_client_attempts_threads_;
+        std::optional<std::chrono::milliseconds> cleanup_foreground_latency_target_;
+        double cleanup_min_rate_;
+        bool cleanup_rendezvous_hashing_;
+        bool cleanup_durable_heartbeats_;
+        std::optional<std::string> cleanup_journal_path_;
+        std::optional<std::string> cleanup_checkpoint_path_;
+        lost_attempts_report_handler cleanup_report_callback_;
         std::unique_ptr<attempt_context_testing_hooks> attempt_context_hooks_;
         std::unique_ptr<cleanup_testing_hooks> cleanup_hooks_;
         couchbase::query_scan_consistency scan_consistency_;
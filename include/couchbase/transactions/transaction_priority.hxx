@@ -0,0 +1,51 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <string>
+
+namespace couchbase
+{
+namespace transactions
+{
+    /**
+     * @brief Relative priority of a transaction, under contention
+     *
+     * Higher priority transactions back off for less time between attempts, and when waiting on a document that another
+     * transaction has staged a write to, so they tend to win conflicts with lower priority transactions in the same process.
+     * Independently of priority, a transaction backs off less the more attempts it has made, so that old transactions are
+     * not starved by fresh ones.
+     */
+    enum class transaction_priority {
+        LOW = 0x00,
+        NORMAL = 0x01,
+        HIGH = 0x02
+    };
+
+    static std::string transaction_priority_to_string(transaction_priority p)
+    {
+        switch (p) {
+            case transaction_priority::LOW:
+                return "LOW";
+            case transaction_priority::NORMAL:
+                return "NORMAL";
+            case transaction_priority::HIGH:
+                return "HIGH";
+        }
+        return "NORMAL";
+    }
+} // namespace transactions
+} // namespace couchbase
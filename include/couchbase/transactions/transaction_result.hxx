@@ -15,6 +15,8 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <map>
 #include <string>
 
 namespace couchbase
@@ -31,6 +33,13 @@ namespace transactions
     struct transaction_result {
         std::string transaction_id;
         bool unstaging_complete;
+        /** Number of attempts the transaction made.  Consistently high values indicate starvation under contention. */
+        size_t attempts{ 0 };
+        /**
+         * Number of retries each stage of the commit needed, over all the attempts.  A stage that keeps needing retries points
+         * at what is slowing commits down.  Stages that needed none are left out.
+         */
+        std::map<std::string, size_t> commit_retries{};
     };
 } // namespace transactions
 } // namespace couchbase
@@ -0,0 +1,721 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "../src/transactions/atr_ids.hxx"
+#include <couchbase/document_id.hxx>
+#include <couchbase/internal/nlohmann/json.hpp>
+#include <couchbase/support.hxx>
+#include <couchbase/transactions/durability_level.hxx>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace couchbase::transactions
+{
+
+// The subset of KV statuses the transactions code acts on.
+enum class mock_status {
+    success,
+    doc_not_found,
+    doc_exists,
+    cas_mismatch,
+    path_not_found,
+    path_exists,
+    path_mismatch,
+    path_invalid,
+    value_invalid,
+    // as when an ATR is full
+    value_too_large,
+    durability_impossible,
+    durability_ambiguous,
+    temporary_failure,
+    timeout,
+};
+
+enum class mock_subdoc_op {
+    get,
+    exists,
+    get_count,
+    get_doc,
+    dict_add,
+    dict_upsert,
+    replace,
+    remove,
+    set_doc,
+    remove_doc,
+};
+
+enum class mock_store_semantics {
+    replace,
+    upsert,
+    insert,
+};
+
+enum class mock_op {
+    any,
+    get,
+    insert,
+    upsert,
+    remove,
+    lookup_in,
+    mutate_in,
+};
+
+struct mock_spec {
+    mock_subdoc_op op;
+    bool xattr{ false };
+    std::string path;
+    // JSON, as the subdoc API takes it
+    std::string value{};
+    bool create_parents{ false };
+    // expand ${Mutation.CAS}, ${Mutation.seqno} and ${Mutation.value_crc32c} in the value
+    bool expand_macros{ false };
+};
+
+struct mock_lookup_in_request {
+    couchbase::document_id id;
+    std::vector<mock_spec> specs;
+    bool access_deleted{ false };
+};
+
+struct mock_mutate_in_request {
+    couchbase::document_id id;
+    std::vector<mock_spec> specs;
+    uint64_t cas{ 0 };
+    mock_store_semantics store_semantics{ mock_store_semantics::replace };
+    bool access_deleted{ false };
+    bool create_as_deleted{ false };
+    durability_level durability{ durability_level::NONE };
+};
+
+// for get, insert, upsert and remove
+struct mock_doc_request {
+    couchbase::document_id id;
+    std::string value{};
+    uint64_t cas{ 0 };
+    durability_level durability{ durability_level::NONE };
+};
+
+struct mock_field {
+    mock_status status{ mock_status::success };
+    std::string value{};
+};
+
+struct mock_response {
+    mock_status status{ mock_status::success };
+    uint64_t cas{ 0 };
+    bool deleted{ false };
+    // the document body, for get
+    std::string value{};
+    // one per spec, for lookup_in.  For a failed mutate_in, the status of the spec that failed is in failed_spec.
+    std::vector<mock_field> fields{};
+    std::optional<size_t> failed_spec{};
+};
+
+struct mock_fault {
+    mock_op op{ mock_op::any };
+    // only ops on keys starting with this
+    std::string key_prefix{};
+    mock_status status{ mock_status::temporary_failure };
+    // how many times to fail, or if 0, fail this fraction of the ops that match, indefinitely
+    size_t times{ 1 };
+    double probability{ 0 };
+    // the op takes effect, but still reports the failure - as with an ambiguous durable write, or a timeout after the
+    // write reached the server
+    bool applied{ false };
+};
+
+struct mock_kv_latency {
+    std::chrono::microseconds read{ 0 };
+    std::chrono::microseconds write{ 0 };
+    // added to writes with a durability level
+    std::chrono::microseconds durable_write{ 0 };
+};
+
+/**
+ * An in-memory stand-in for the KV service, as the transactions code uses it: full document gets and writes, and
+ * lookup_in/mutate_in of the body and of xattrs, with CAS, tombstones (access_deleted, create_as_deleted), the $document
+ * and $vbucket virtual xattrs, and mutation macros.  Documents are partitioned into vbuckets as the server does, each with its
+ * own lock.  CAS values are the HLC in nanoseconds, and the clock can be moved forward to make things expire.
+ *
+ * Every op can be slowed down, and made to fail, by key and op.  The handlers passed to execute() are called on the calling
+ * thread, once the op and its latency are done.  mock_kv_client runs the transactions code itself over one.
+ */
+class mock_kv
+{
+  public:
+    static constexpr const char* cas_macro = "${Mutation.CAS}";
+    static constexpr const char* seqno_macro = "${Mutation.seqno}";
+    static constexpr const char* crc32c_macro = "${Mutation.value_crc32c}";
+    static constexpr size_t num_vbuckets = 1024;
+
+    explicit mock_kv(mock_kv_latency latency = {}, uint64_t seed = 0)
+      : latency_(latency)
+      , random_(seed)
+    {
+    }
+
+    mock_kv(const mock_kv&) = delete;
+    mock_kv& operator=(const mock_kv&) = delete;
+
+    template<typename Handler>
+    void execute(const mock_lookup_in_request& req, Handler&& handler)
+    {
+        handler(lookup_in(req));
+    }
+
+    template<typename Handler>
+    void execute(const mock_mutate_in_request& req, Handler&& handler)
+    {
+        handler(mutate_in(req));
+    }
+
+    mock_response get(const mock_doc_request& req)
+    {
+        return run(mock_op::get, req.id, latency_.read, [&](document* doc, vbucket&) {
+            mock_response resp;
+            if (doc == nullptr || doc->deleted) {
+                resp.status = mock_status::doc_not_found;
+                return resp;
+            }
+            resp.cas = doc->cas;
+            resp.value = doc->body;
+            return resp;
+        });
+    }
+
+    mock_response insert(const mock_doc_request& req)
+    {
+        return run(mock_op::insert, req.id, write_latency(req.durability), [&](document* doc, vbucket& vb) {
+            if (doc != nullptr && !doc->deleted) {
+                return mock_response{ mock_status::doc_exists };
+            }
+            return store(vb, req.id, doc, req.value);
+        });
+    }
+
+    mock_response upsert(const mock_doc_request& req)
+    {
+        return run(mock_op::upsert, req.id, write_latency(req.durability), [&](document* doc, vbucket& vb) {
+            return store(vb, req.id, doc, req.value);
+        });
+    }
+
+    mock_response remove(const mock_doc_request& req)
+    {
+        return run(mock_op::remove, req.id, write_latency(req.durability), [&](document* doc, vbucket& vb) {
+            if (doc == nullptr || doc->deleted) {
+                return mock_response{ mock_status::doc_not_found };
+            }
+            if (req.cas != 0 && req.cas != doc->cas) {
+                return mock_response{ mock_status::cas_mismatch };
+            }
+            make_tombstone(*doc);
+            bump(vb, *doc);
+            return mock_response{ mock_status::success, doc->cas, true };
+        });
+    }
+
+    mock_response lookup_in(const mock_lookup_in_request& req)
+    {
+        return run(mock_op::lookup_in, req.id, latency_.read, [&](document* doc, vbucket&) {
+            mock_response resp;
+            if (doc == nullptr || (doc->deleted && !req.access_deleted)) {
+                resp.status = mock_status::doc_not_found;
+                return resp;
+            }
+            resp.cas = doc->cas;
+            resp.deleted = doc->deleted;
+            auto body = parse_body(*doc);
+            for (const auto& spec : req.specs) {
+                resp.fields.push_back(lookup(spec, *doc, body));
+            }
+            return resp;
+        });
+    }
+
+    mock_response mutate_in(const mock_mutate_in_request& req)
+    {
+        return run(mock_op::mutate_in, req.id, write_latency(req.durability), [&](document* existing, vbucket& vb) {
+            mock_response resp;
+            bool exists = existing != nullptr && (!existing->deleted || req.access_deleted);
+            if (req.store_semantics == mock_store_semantics::replace && !exists) {
+                resp.status = mock_status::doc_not_found;
+                return resp;
+            }
+            if (req.store_semantics == mock_store_semantics::insert && existing != nullptr && !existing->deleted) {
+                resp.status = mock_status::doc_exists;
+                return resp;
+            }
+            if (exists && req.cas != 0 && req.cas != existing->cas) {
+                resp.status = mock_status::cas_mismatch;
+                return resp;
+            }
+            // work on a copy, so that if any spec fails none of them take effect
+            document doc = exists ? *existing : document{};
+            if (!exists) {
+                doc.deleted = req.create_as_deleted;
+            }
+            auto cas = next_cas();
+            auto body = parse_body(doc);
+            bool removing = false;
+            for (size_t i = 0; i < req.specs.size(); i++) {
+                const auto& spec = req.specs[i];
+                if (spec.op == mock_subdoc_op::remove_doc) {
+                    removing = true;
+                    continue;
+                }
+                if (spec.op == mock_subdoc_op::set_doc) {
+                    body = nlohmann::json::parse(expand(spec, cas, vb.seqno + 1, body), nullptr, false);
+                    if (body.is_discarded()) {
+                        return failed(i, mock_status::value_invalid);
+                    }
+                    continue;
+                }
+                if (!spec.xattr && doc.deleted && !req.create_as_deleted) {
+                    return failed(i, mock_status::path_not_found);
+                }
+                auto status = mutate(spec, spec.xattr ? doc.xattrs : body, cas, vb.seqno + 1, body);
+                if (status != mock_status::success) {
+                    return failed(i, status);
+                }
+            }
+            doc.body = body.is_null() ? std::string() : body.dump();
+            if (removing) {
+                make_tombstone(doc);
+            }
+            auto& stored = vb.docs[key_of(req.id)];
+            stored = std::move(doc);
+            bump(vb, stored, cas);
+            resp.cas = stored.cas;
+            resp.deleted = stored.deleted;
+            return resp;
+        });
+    }
+
+    void inject(const mock_fault& fault)
+    {
+        std::lock_guard<std::mutex> lock(faults_mutex_);
+        faults_.push_back(fault);
+    }
+
+    void clear_faults()
+    {
+        std::lock_guard<std::mutex> lock(faults_mutex_);
+        faults_.clear();
+    }
+
+    // Moves the clock (and so the CAS of later mutations, and $vbucket.HLC) forward.
+    void advance_clock(std::chrono::nanoseconds by)
+    {
+        clock_offset_ns_ += static_cast<uint64_t>(by.count());
+    }
+
+    CB_NODISCARD uint64_t now_ns() const
+    {
+        return static_cast<uint64_t>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) +
+               clock_offset_ns_.load();
+    }
+
+    CB_NODISCARD size_t ops(mock_op op = mock_op::any) const
+    {
+        return op_counts_[static_cast<size_t>(op)].load();
+    }
+
+    CB_NODISCARD size_t faults_injected() const
+    {
+        return faults_injected_.load();
+    }
+
+    // How ${Mutation.CAS} is written into a document: the hex of the byte-swapped CAS, as the server writes it.
+    static std::string cas_macro_value(uint64_t cas)
+    {
+        uint64_t swapped = 0;
+        for (size_t i = 0; i < sizeof(cas); i++) {
+            swapped = (swapped << 8) | ((cas >> (8 * i)) & 0xff);
+        }
+        return hex(swapped, 16);
+    }
+
+    // CRC-32C (Castagnoli), as the server computes value_crc32c
+    static uint32_t crc32c(const std::string& data)
+    {
+        static const auto table = []() {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < t.size(); i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) != 0 ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        uint32_t crc = 0xFFFFFFFF;
+        for (auto c : data) {
+            crc = table[(crc ^ static_cast<uint8_t>(c)) & 0xff] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+  private:
+    struct document {
+        std::string body;
+        nlohmann::json xattrs = nlohmann::json::object();
+        uint64_t cas{ 0 };
+        uint64_t seqno{ 0 };
+        uint64_t revid{ 0 };
+        bool deleted{ false };
+    };
+
+    struct vbucket {
+        std::mutex mutex;
+        std::map<std::string, document> docs;
+        uint64_t seqno{ 0 };
+    };
+
+    static std::string key_of(const couchbase::document_id& id)
+    {
+        return id.scope() + "." + id.collection() + "." + id.key();
+    }
+
+    static std::string hex(uint64_t value, int digits)
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "0x%0*llx", digits, static_cast<unsigned long long>(value));
+        return buf;
+    }
+
+    static std::string crc32c_of(const std::string& body)
+    {
+        return hex(crc32c(body), 8);
+    }
+
+    vbucket& vbucket_for(const couchbase::document_id& id)
+    {
+        auto vbid = atr_ids::vbucket_for_key(id.key()) % num_vbuckets;
+        std::lock_guard<std::mutex> lock(buckets_mutex_);
+        auto& vbs = buckets_[id.bucket()];
+        if (!vbs) {
+            vbs = std::make_unique<std::array<vbucket, num_vbuckets>>();
+        }
+        return (*vbs)[vbid];
+    }
+
+    template<typename Op>
+    mock_response run(mock_op op, const couchbase::document_id& id, std::chrono::microseconds latency, Op&& body)
+    {
+        op_counts_[static_cast<size_t>(mock_op::any)]++;
+        op_counts_[static_cast<size_t>(op)]++;
+        auto fault = take_fault(op, id.key());
+        mock_response resp;
+        if (!fault || fault->applied) {
+            auto& vb = vbucket_for(id);
+            std::lock_guard<std::mutex> lock(vb.mutex);
+            auto it = vb.docs.find(key_of(id));
+            resp = body(it == vb.docs.end() ? nullptr : &it->second, vb);
+        }
+        if (fault) {
+            resp.status = fault->status;
+        }
+        if (latency.count() > 0) {
+            std::this_thread::sleep_for(latency);
+        }
+        return resp;
+    }
+
+    std::optional<mock_fault> take_fault(mock_op op, const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(faults_mutex_);
+        for (auto it = faults_.begin(); it != faults_.end(); ++it) {
+            if ((it->op != mock_op::any && it->op != op) || key.rfind(it->key_prefix, 0) != 0) {
+                continue;
+            }
+            if (it->times == 0) {
+                if (std::uniform_real_distribution<double>(0, 1)(random_) >= it->probability) {
+                    continue;
+                }
+                faults_injected_++;
+                return *it;
+            }
+            auto fault = *it;
+            if (--it->times == 0) {
+                faults_.erase(it);
+            }
+            faults_injected_++;
+            return fault;
+        }
+        return {};
+    }
+
+    std::chrono::microseconds write_latency(durability_level durability) const
+    {
+        return durability == durability_level::NONE ? latency_.write : latency_.write + latency_.durable_write;
+    }
+
+    uint64_t next_cas()
+    {
+        auto now = now_ns();
+        auto last = last_cas_.load();
+        uint64_t next;
+        do {
+            next = std::max(now, last + 1);
+        } while (!last_cas_.compare_exchange_weak(last, next));
+        return next;
+    }
+
+    // call with the vbucket locked
+    void bump(vbucket& vb, document& doc, std::optional<uint64_t> cas = {})
+    {
+        doc.cas = cas ? *cas : next_cas();
+        doc.seqno = ++vb.seqno;
+        doc.revid++;
+    }
+
+    mock_response store(vbucket& vb, const couchbase::document_id& id, document* existing, const std::string& value)
+    {
+        auto& doc = existing != nullptr ? *existing : vb.docs[key_of(id)];
+        if (doc.deleted) {
+            doc.xattrs = nlohmann::json::object();
+        }
+        doc.body = value;
+        doc.deleted = false;
+        bump(vb, doc);
+        return { mock_status::success, doc.cas };
+    }
+
+    // the server drops user xattrs when a document is deleted, but keeps system ones (starting with _)
+    static void make_tombstone(document& doc)
+    {
+        auto kept = nlohmann::json::object();
+        for (const auto& [name, value] : doc.xattrs.items()) {
+            if (!name.empty() && name[0] == '_') {
+                kept[name] = value;
+            }
+        }
+        doc.xattrs = kept;
+        doc.body.clear();
+        doc.deleted = true;
+    }
+
+    static nlohmann::json parse_body(const document& doc)
+    {
+        if (doc.body.empty()) {
+            return nlohmann::json();
+        }
+        auto body = nlohmann::json::parse(doc.body, nullptr, false);
+        return body.is_discarded() ? nlohmann::json(doc.body) : body;
+    }
+
+    // "a.b.`c.d`" is a, b, c.d
+    static std::optional<std::vector<std::string>> split_path(const std::string& path)
+    {
+        std::vector<std::string> segments(1);
+        bool quoted = false;
+        for (auto c : path) {
+            if (c == '`') {
+                quoted = !quoted;
+            } else if (c == '.' && !quoted) {
+                segments.emplace_back();
+            } else {
+                segments.back() += c;
+            }
+        }
+        if (quoted || std::any_of(segments.begin(), segments.end(), [](const auto& s) { return s.empty(); })) {
+            return {};
+        }
+        return segments;
+    }
+
+    static const nlohmann::json* find(const nlohmann::json& root, const std::vector<std::string>& segments)
+    {
+        const auto* node = &root;
+        for (const auto& segment : segments) {
+            if (!node->is_object()) {
+                return nullptr;
+            }
+            auto it = node->find(segment);
+            if (it == node->end()) {
+                return nullptr;
+            }
+            node = &*it;
+        }
+        return node;
+    }
+
+    nlohmann::json virtual_xattr(const std::string& name, const document& doc) const
+    {
+        if (name == "$document") {
+            return { { "CAS", hex(doc.cas, 16) },
+                     { "revid", std::to_string(doc.revid) },
+                     { "seqno", hex(doc.seqno, 16) },
+                     { "exptime", 0 },
+                     { "flags", 0 },
+                     { "value_bytes", doc.body.size() },
+                     { "value_crc32c", crc32c_of(doc.body) },
+                     { "deleted", doc.deleted },
+                     { "last_modified", std::to_string(doc.cas / 1000000000) } };
+        }
+        return { { "HLC", { { "now", std::to_string(now_ns() / 1000000000) }, { "mode", "real" } } } };
+    }
+
+    mock_field lookup(const mock_spec& spec, const document& doc, const nlohmann::json& body) const
+    {
+        if (spec.op == mock_subdoc_op::get_doc) {
+            return { mock_status::success, doc.body };
+        }
+        auto segments = split_path(spec.path);
+        if (!segments) {
+            return { mock_status::path_invalid };
+        }
+        const nlohmann::json* found;
+        nlohmann::json virtual_root;
+        if (spec.xattr && segments->front().front() == '$') {
+            if (segments->front() != "$document" && segments->front() != "$vbucket") {
+                return { mock_status::path_invalid };
+            }
+            virtual_root[segments->front()] = virtual_xattr(segments->front(), doc);
+            found = find(virtual_root, *segments);
+        } else {
+            found = find(spec.xattr ? doc.xattrs : body, *segments);
+        }
+        if (found == nullptr) {
+            return { mock_status::path_not_found };
+        }
+        switch (spec.op) {
+            case mock_subdoc_op::exists:
+                return { mock_status::success };
+            case mock_subdoc_op::get_count:
+                if (!found->is_object() && !found->is_array()) {
+                    return { mock_status::path_mismatch };
+                }
+                return { mock_status::success, std::to_string(found->size()) };
+            default:
+                return { mock_status::success, found->dump() };
+        }
+    }
+
+    static std::string replace_all(std::string s, const std::string& from, const std::string& to)
+    {
+        for (auto pos = s.find(from); pos != std::string::npos; pos = s.find(from, pos + to.size())) {
+            s.replace(pos, from.size(), to);
+        }
+        return s;
+    }
+
+    std::string expand(const mock_spec& spec, uint64_t cas, uint64_t seqno, const nlohmann::json& body) const
+    {
+        if (!spec.expand_macros) {
+            return spec.value;
+        }
+        auto value = replace_all(spec.value, cas_macro, cas_macro_value(cas));
+        value = replace_all(value, seqno_macro, hex(seqno, 16));
+        return replace_all(value, crc32c_macro, crc32c_of(body.is_null() ? std::string() : body.dump()));
+    }
+
+    mock_status mutate(const mock_spec& spec, nlohmann::json& root, uint64_t cas, uint64_t seqno, const nlohmann::json& body) const
+    {
+        auto segments = split_path(spec.path);
+        if (!segments || segments->front().front() == '$') {
+            return mock_status::path_invalid;
+        }
+        if (root.is_null()) {
+            root = nlohmann::json::object();
+        }
+        auto* parent = &root;
+        for (size_t i = 0; i + 1 < segments->size(); i++) {
+            if (!parent->is_object()) {
+                return mock_status::path_mismatch;
+            }
+            auto it = parent->find((*segments)[i]);
+            if (it == parent->end()) {
+                if (!spec.create_parents) {
+                    return mock_status::path_not_found;
+                }
+                it = parent->emplace((*segments)[i], nlohmann::json::object()).first;
+            }
+            parent = &*it;
+        }
+        if (!parent->is_object()) {
+            return mock_status::path_mismatch;
+        }
+        const auto& leaf = segments->back();
+        bool exists = parent->contains(leaf);
+        switch (spec.op) {
+            case mock_subdoc_op::remove:
+                if (!exists) {
+                    return mock_status::path_not_found;
+                }
+                parent->erase(leaf);
+                return mock_status::success;
+            case mock_subdoc_op::dict_add:
+                if (exists) {
+                    return mock_status::path_exists;
+                }
+                break;
+            case mock_subdoc_op::replace:
+                if (!exists) {
+                    return mock_status::path_not_found;
+                }
+                break;
+            case mock_subdoc_op::dict_upsert:
+                break;
+            default:
+                return mock_status::path_invalid;
+        }
+        auto value = nlohmann::json::parse(expand(spec, cas, seqno, body), nullptr, false);
+        if (value.is_discarded()) {
+            return mock_status::value_invalid;
+        }
+        (*parent)[leaf] = std::move(value);
+        return mock_status::success;
+    }
+
+    static mock_response failed(size_t spec, mock_status status)
+    {
+        mock_response resp;
+        resp.status = status;
+        resp.failed_spec = spec;
+        return resp;
+    }
+
+    const mock_kv_latency latency_;
+    std::mutex buckets_mutex_;
+    std::map<std::string, std::unique_ptr<std::array<vbucket, num_vbuckets>>> buckets_;
+    std::atomic<uint64_t> last_cas_{ 0 };
+    std::atomic<uint64_t> clock_offset_ns_{ 0 };
+    std::array<std::atomic<size_t>, 7> op_counts_{};
+    std::atomic<size_t> faults_injected_{ 0 };
+    std::mutex faults_mutex_;
+    std::vector<mock_fault> faults_;
+    std::mt19937_64 random_;
+};
+} // namespace couchbase::transactions
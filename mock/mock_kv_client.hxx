@@ -0,0 +1,309 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "mock_kv.hxx"
+#include <couchbase/transactions/internal/kv_client.hxx>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace couchbase::transactions
+{
+
+/**
+ * Runs the transactions code over a mock_kv: each request is translated into the mock's terms, and its response back into
+ * the client's, with the mock's statuses as the error codes cluster::execute() would give.
+ *
+ * As with a real cluster, the handlers are called on threads of the client's own, not the one calling execute(), so a caller
+ * holding a lock while it waits for the response behaves as it would against a server.  The destructor waits for the ops
+ * already queued.
+ */
+class mock_kv_client : public kv_client
+{
+  public:
+    explicit mock_kv_client(mock_kv& kv, size_t threads = 4)
+      : kv_(kv)
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, threads); i++) {
+            threads_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~mock_kv_client() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thr : threads_) {
+            thr.join();
+        }
+    }
+
+    mock_kv_client(const mock_kv_client&) = delete;
+    mock_kv_client& operator=(const mock_kv_client&) = delete;
+
+    void execute(operations::lookup_in_request req, handler<operations::lookup_in_response> handler) override
+    {
+        using flags = protocol::lookup_in_request_body::lookup_in_specs;
+        mock_lookup_in_request mreq{ req.id, {}, req.access_deleted };
+        for (const auto& entry : req.specs.entries) {
+            mreq.specs.push_back({ subdoc_op(entry.opcode), (entry.flags & flags::path_flag_xattr) != 0, entry.path });
+        }
+        post([this, id = req.id, mreq = std::move(mreq), handler = std::move(handler)]() {
+            auto mresp = kv_.lookup_in(mreq);
+            operations::lookup_in_response resp{};
+            resp.ctx.id = id;
+            resp.ctx.ec = error_code(mresp.status, false);
+            if (mresp.status == mock_status::success) {
+                resp.cas.value = mresp.cas;
+                resp.deleted = mresp.deleted;
+                for (size_t i = 0; i < mresp.fields.size(); i++) {
+                    typename decltype(resp.fields)::value_type field{};
+                    field.path = mreq.specs[i].path;
+                    field.status = field_status(mresp.fields[i].status);
+                    field.exists = mresp.fields[i].status == mock_status::success;
+                    field.value = mresp.fields[i].value;
+                    resp.fields.push_back(std::move(field));
+                }
+            }
+            handler(std::move(resp));
+        });
+    }
+
+    void execute(operations::mutate_in_request req, handler<operations::mutate_in_response> handler) override
+    {
+        using flags = protocol::mutate_in_request_body::mutate_in_specs;
+        mock_mutate_in_request mreq{ req.id, {} };
+        mreq.cas = req.cas.value;
+        mreq.store_semantics = store_semantics(req.store_semantics);
+        mreq.access_deleted = req.access_deleted;
+        mreq.create_as_deleted = req.create_as_deleted;
+        mreq.durability = durability(req.durability_level);
+        for (const auto& entry : req.specs.entries) {
+            mreq.specs.push_back({ subdoc_op(entry.opcode),
+                                   (entry.flags & flags::path_flag_xattr) != 0,
+                                   entry.path,
+                                   as_string(entry.param),
+                                   (entry.flags & flags::path_flag_create_parents) != 0,
+                                   (entry.flags & flags::path_flag_expand_macros) != 0 });
+        }
+        post([this, id = req.id, mreq = std::move(mreq), handler = std::move(handler)]() {
+            auto mresp = kv_.mutate_in(mreq);
+            operations::mutate_in_response resp{};
+            resp.ctx.id = id;
+            resp.ctx.ec = error_code(mresp.status, true);
+            if (mresp.failed_spec) {
+                resp.first_error_index = *mresp.failed_spec;
+            }
+            if (mresp.status == mock_status::success) {
+                resp.cas.value = mresp.cas;
+                resp.deleted = mresp.deleted;
+            }
+            for (size_t i = 0; i < mreq.specs.size(); i++) {
+                typename decltype(resp.fields)::value_type field{};
+                field.path = mreq.specs[i].path;
+                field.status = mresp.failed_spec && *mresp.failed_spec == i ? field_status(mresp.status) : protocol::status::success;
+                resp.fields.push_back(std::move(field));
+            }
+            handler(std::move(resp));
+        });
+    }
+
+    void execute(operations::insert_request req, handler<operations::insert_response> handler) override
+    {
+        mock_doc_request mreq{ req.id, as_string(req.value), 0, durability(req.durability_level) };
+        post([this, id = req.id, mreq = std::move(mreq), handler = std::move(handler)]() {
+            auto mresp = kv_.insert(mreq);
+            operations::insert_response resp{};
+            resp.ctx.id = id;
+            resp.ctx.ec = error_code(mresp.status, true);
+            resp.cas.value = mresp.cas;
+            handler(std::move(resp));
+        });
+    }
+
+    void execute(operations::remove_request req, handler<operations::remove_response> handler) override
+    {
+        mock_doc_request mreq{ req.id, {}, req.cas.value, durability(req.durability_level) };
+        post([this, id = req.id, mreq = std::move(mreq), handler = std::move(handler)]() {
+            auto mresp = kv_.remove(mreq);
+            operations::remove_response resp{};
+            resp.ctx.id = id;
+            resp.ctx.ec = error_code(mresp.status, true);
+            resp.cas.value = mresp.cas;
+            handler(std::move(resp));
+        });
+    }
+
+    // The error code cluster::execute() gives for the status.  A timeout is ambiguous for a write, which may have happened.
+    static std::error_code error_code(mock_status status, bool write)
+    {
+        switch (status) {
+            case mock_status::success:
+                return {};
+            case mock_status::doc_not_found:
+                return error::key_value_errc::document_not_found;
+            case mock_status::doc_exists:
+                return error::key_value_errc::document_exists;
+            case mock_status::cas_mismatch:
+                return error::common_errc::cas_mismatch;
+            case mock_status::path_not_found:
+                return error::key_value_errc::path_not_found;
+            case mock_status::path_exists:
+                return error::key_value_errc::path_exists;
+            case mock_status::path_mismatch:
+                return error::key_value_errc::path_mismatch;
+            case mock_status::path_invalid:
+                return error::key_value_errc::path_invalid;
+            case mock_status::value_invalid:
+                return error::key_value_errc::value_invalid;
+            case mock_status::value_too_large:
+                return error::key_value_errc::value_too_large;
+            case mock_status::durability_impossible:
+                return error::key_value_errc::durability_impossible;
+            case mock_status::durability_ambiguous:
+                return error::key_value_errc::durability_ambiguous;
+            case mock_status::temporary_failure:
+                return error::common_errc::temporary_failure;
+            case mock_status::timeout:
+                return write ? error::common_errc::ambiguous_timeout : error::common_errc::unambiguous_timeout;
+        }
+        return error::common_errc::internal_server_failure;
+    }
+
+  private:
+    template<typename Bytes>
+    static std::string as_string(const Bytes& bytes)
+    {
+        return { reinterpret_cast<const char*>(bytes.data()), bytes.size() };
+    }
+
+    template<typename Opcode>
+    static mock_subdoc_op subdoc_op(Opcode opcode)
+    {
+        switch (static_cast<protocol::subdoc_opcode>(opcode)) {
+            case protocol::subdoc_opcode::get:
+                return mock_subdoc_op::get;
+            case protocol::subdoc_opcode::exists:
+                return mock_subdoc_op::exists;
+            case protocol::subdoc_opcode::get_count:
+                return mock_subdoc_op::get_count;
+            case protocol::subdoc_opcode::get_doc:
+                return mock_subdoc_op::get_doc;
+            case protocol::subdoc_opcode::dict_add:
+                return mock_subdoc_op::dict_add;
+            case protocol::subdoc_opcode::dict_upsert:
+                return mock_subdoc_op::dict_upsert;
+            case protocol::subdoc_opcode::replace:
+                return mock_subdoc_op::replace;
+            case protocol::subdoc_opcode::remove:
+                return mock_subdoc_op::remove;
+            case protocol::subdoc_opcode::set_doc:
+                return mock_subdoc_op::set_doc;
+            case protocol::subdoc_opcode::remove_doc:
+                return mock_subdoc_op::remove_doc;
+            default:
+                throw std::logic_error("mock_kv_client: unsupported subdoc opcode " + std::to_string(static_cast<int>(opcode)));
+        }
+    }
+
+    static mock_store_semantics store_semantics(protocol::mutate_in_request_body::store_semantics_type semantics)
+    {
+        switch (semantics) {
+            case protocol::mutate_in_request_body::store_semantics_type::upsert:
+                return mock_store_semantics::upsert;
+            case protocol::mutate_in_request_body::store_semantics_type::insert:
+                return mock_store_semantics::insert;
+            default:
+                return mock_store_semantics::replace;
+        }
+    }
+
+    static durability_level durability(protocol::durability_level level)
+    {
+        switch (level) {
+            case protocol::durability_level::none:
+                return durability_level::NONE;
+            case protocol::durability_level::majority_and_persist_to_active:
+                return durability_level::MAJORITY_AND_PERSIST_TO_ACTIVE;
+            case protocol::durability_level::persist_to_majority:
+                return durability_level::PERSIST_TO_MAJORITY;
+            default:
+                return durability_level::MAJORITY;
+        }
+    }
+
+    static protocol::status field_status(mock_status status)
+    {
+        switch (status) {
+            case mock_status::success:
+                return protocol::status::success;
+            case mock_status::path_not_found:
+                return protocol::status::subdoc_path_not_found;
+            case mock_status::path_exists:
+                return protocol::status::subdoc_path_exists;
+            case mock_status::path_mismatch:
+                return protocol::status::subdoc_path_mismatch;
+            case mock_status::value_invalid:
+                return protocol::status::subdoc_value_cannot_insert;
+            default:
+                return protocol::status::subdoc_path_invalid;
+        }
+    }
+
+    void post(std::function<void()> op)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(op));
+        }
+        cv_.notify_one();
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            auto op = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            op();
+            lock.lock();
+        }
+    }
+
+    mock_kv& kv_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    bool stopping_{ false };
+    std::vector<std::thread> threads_;
+};
+} // namespace couchbase::transactions
@@ -16,6 +16,8 @@
 #pragma once
 
 #include <cstdint>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <string>
 #include <utility>
@@ -26,6 +28,7 @@
 #include <couchbase/transactions/transaction_config.hxx>
 
 #include "couchbase/transactions/internal/atr_entry.hxx"
+#include "couchbase/transactions/internal/kv_client.hxx"
 #include "couchbase/transactions/internal/utils.hxx"
 
 namespace couchbase
@@ -35,14 +38,25 @@ namespace transactions
     class active_transaction_record
     {
       public:
-        // TODO: we should get the kv_timeout and put it in the request (pass in the transaction_config)
         template<typename Callback>
-        static void get_atr(cluster& cluster, const couchbase::document_id& atr_id, Callback&& cb)
+        static void get_atr(kv_client& kv, const couchbase::document_id& atr_id, Callback&& cb)
+        {
+            get_atr(kv, atr_id, std::nullopt, std::forward<Callback>(cb));
+        }
+
+        template<typename Callback>
+        static void get_atr(kv_client& kv,
+                            const couchbase::document_id& atr_id,
+                            std::optional<std::chrono::milliseconds> timeout,
+                            Callback&& cb)
         {
             couchbase::operations::lookup_in_request req{ atr_id };
             req.specs.add_spec(protocol::subdoc_opcode::get, true, ATR_FIELD_ATTEMPTS);
             req.specs.add_spec(protocol::subdoc_opcode::get, true, "$vbucket");
-            cluster.execute(req, [atr_id, cb = std::move(cb)](couchbase::operations::lookup_in_response resp) {
+            if (timeout) {
+                req.timeout = *timeout;
+            }
+            kv.execute(req, [atr_id, cb = std::move(cb)](couchbase::operations::lookup_in_response resp) {
                 try {
                     if (resp.ctx.ec == couchbase::error::key_value_errc::document_not_found) {
                         // that's ok, just return an empty one.
@@ -65,11 +79,50 @@ namespace transactions
             });
         }
 
-        static std::optional<active_transaction_record> get_atr(cluster& cluster, const couchbase::document_id& atr_id)
+        /**
+         * Cheap check of how many attempts an ATR holds, without fetching or parsing them.  A missing ATR, or one with no
+         * attempts field, holds none.  Any other problem with the attempts field is reported as path_invalid, in which case
+         * the caller should fetch the whole ATR to find out more.
+         */
+        template<typename Callback>
+        static void get_atr_occupancy(kv_client& kv,
+                                      const couchbase::document_id& atr_id,
+                                      std::optional<std::chrono::milliseconds> timeout,
+                                      Callback&& cb)
+        {
+            couchbase::operations::lookup_in_request req{ atr_id };
+            req.specs.add_spec(protocol::subdoc_opcode::get_count, true, ATR_FIELD_ATTEMPTS);
+            if (timeout) {
+                req.timeout = *timeout;
+            }
+            kv.execute(req, [cb = std::move(cb)](couchbase::operations::lookup_in_response resp) {
+                if (resp.ctx.ec == couchbase::error::key_value_errc::document_not_found) {
+                    return cb({}, 0);
+                }
+                if (resp.ctx.ec) {
+                    return cb(resp.ctx.ec, 0);
+                }
+                if (resp.fields[0].status == protocol::status::subdoc_path_not_found) {
+                    return cb({}, 0);
+                }
+                if (resp.fields[0].status != protocol::status::success) {
+                    return cb(couchbase::error::key_value_errc::path_invalid, 0);
+                }
+                // if we can't make sense of the count, have the caller fetch the whole thing.
+                size_t count = std::numeric_limits<size_t>::max();
+                try {
+                    count = static_cast<size_t>(std::stoull(resp.fields[0].value));
+                } catch (const std::exception&) {
+                }
+                cb({}, count);
+            });
+        }
+
+        static std::optional<active_transaction_record> get_atr(kv_client& kv, const couchbase::document_id& atr_id)
         {
             auto barrier = std::promise<std::optional<active_transaction_record>>();
             auto f = barrier.get_future();
-            get_atr(cluster, atr_id, [&](std::error_code ec, std::optional<active_transaction_record> atr) {
+            get_atr(kv, atr_id, [&](std::error_code ec, std::optional<active_transaction_record> atr) {
                 if (!ec) {
                     return barrier.set_value(atr);
                 }
@@ -77,9 +130,10 @@ namespace transactions
             });
             return f.get();
         }
-        active_transaction_record(const couchbase::document_id& id, uint64_t, std::vector<atr_entry> entries)
+        active_transaction_record(const couchbase::document_id& id, uint64_t, std::vector<atr_entry> entries, size_t size_bytes = 0)
           : id_(std::move(id))
           , entries_(std::move(entries))
+          , size_bytes_(size_bytes)
         {
         }
 
@@ -88,9 +142,16 @@ namespace transactions
             return entries_;
         }
 
+        // size of the attempts as fetched, which is what counts towards the ATR filling up.
+        CB_NODISCARD size_t size_bytes() const
+        {
+            return size_bytes_;
+        }
+
       private:
         couchbase::document_id id_;
         std::vector<atr_entry> entries_;
+        size_t size_bytes_;
 
         /**
          * ${Mutation.CAS} is written by kvengine with 'macroToString(htonll(info.cas))'.  Discussed this with KV team and, though there is
@@ -121,23 +182,34 @@ namespace transactions
             return ret / 1000000;
         }
 
-        static inline std::optional<std::vector<doc_record>> process_document_ids(nlohmann::json& entry, std::string key)
+        static std::optional<lazy_doc_records::span> span_of(const std::unordered_map<std::string, lazy_doc_records::span>& spans,
+                                                             const std::string& attempt_id)
         {
-            if (entry.count(key) == 0) {
+            auto it = spans.find(attempt_id);
+            if (it == spans.end()) {
                 return {};
             }
-            std::vector<doc_record> records;
-            records.reserve(entry[key].size());
-            for (auto& record : entry[key]) {
-                records.push_back(doc_record::create_from(record));
-            }
-            return std::move(records);
+            return it->second;
         }
+
         static inline active_transaction_record map_to_atr(const couchbase::operations::lookup_in_response& resp)
         {
             std::vector<atr_entry> entries;
+            size_t size_bytes = 0;
             if (resp.fields[0].status == protocol::status::success) {
-                auto attempts = nlohmann::json::parse(resp.fields[0].value);
+                // Don't build the document lists of the entries, most of them will be skipped by cleanup.  Those that are needed
+                // are parsed from the raw attempts later, by lazy_doc_records.
+                auto raw_attempts = std::make_shared<const std::string>(resp.fields[0].value);
+                size_bytes = raw_attempts->size();
+                auto attempts =
+                  nlohmann::json::parse(*raw_attempts, [](int depth, nlohmann::json::parse_event_t event, nlohmann::json& parsed) {
+                      if (depth != 2 || event != nlohmann::json::parse_event_t::key) {
+                          return true;
+                      }
+                      const auto& key = parsed.get_ref<const std::string&>();
+                      return key != ATR_FIELD_DOCS_INSERTED && key != ATR_FIELD_DOCS_REPLACED && key != ATR_FIELD_DOCS_REMOVED;
+                  });
+                auto spans = lazy_doc_records::index(*raw_attempts);
                 auto vbucket = default_json_serializer::deserialize<nlohmann::json>(resp.fields[1].value);
                 auto now_ns = now_ns_from_vbucket(vbucket);
                 entries.reserve(attempts.size());
@@ -155,9 +227,7 @@ namespace transactions
                       parse_mutation_cas(val.value(ATR_FIELD_TIMESTAMP_ROLLBACK_COMPLETE, "")),
                       val.count(ATR_FIELD_EXPIRES_AFTER_MSECS) ? std::make_optional(val[ATR_FIELD_EXPIRES_AFTER_MSECS].get<std::uint32_t>())
                                                                : std::optional<std::uint32_t>(),
-                      process_document_ids(val, ATR_FIELD_DOCS_INSERTED),
-                      process_document_ids(val, ATR_FIELD_DOCS_REPLACED),
-                      process_document_ids(val, ATR_FIELD_DOCS_REMOVED),
+                      std::make_shared<const lazy_doc_records>(raw_attempts, span_of(spans, element.key())),
                       val.contains(ATR_FIELD_FORWARD_COMPAT) ? std::make_optional(val[ATR_FIELD_FORWARD_COMPAT].get<nlohmann::json>())
                                                              : std::nullopt,
                       now_ns,
@@ -165,7 +235,7 @@ namespace transactions
                                                                : std::nullopt);
                 }
             }
-            return active_transaction_record(resp.ctx.id, resp.cas.value, std::move(entries));
+            return active_transaction_record(resp.ctx.id, resp.cas.value, std::move(entries), size_bytes);
         }
     };
 
@@ -25,23 +25,30 @@
 #include "couchbase/transactions/internal/transactions_cleanup.hxx"
 #include "couchbase/transactions/internal/utils.hxx"
 #include "forward_compat.hxx"
+#include "lookup_pipeline.hxx"
 
+#include <algorithm>
+#include <exception>
+#include <iterator>
 #include <optional>
+#include <type_traits>
 
 #include <couchbase/transactions.hxx>
 #include <couchbase/transactions/exceptions.hxx>
 
 namespace tx = couchbase::transactions;
 
-// NOTE: priority queue outputs largest to smallest - since we want the least
+// NOTE: heaps output largest to smallest - since we want the least
 // recent statr time first, this returns true if lhs > rhs
 bool
-tx::compare_atr_entries::operator()(atr_cleanup_entry& lhs, atr_cleanup_entry& rhs)
+tx::compare_atr_entries::operator()(const atr_cleanup_entry& lhs, const atr_cleanup_entry& rhs) const
 {
     return lhs.min_start_time_ > rhs.min_start_time_;
 }
 // wait a bit after an attempt is expired before cleaning it.
 const uint32_t tx::atr_cleanup_entry::safety_margin_ms_ = 1500;
+// max number of documents of one entry to clean concurrently.
+const size_t tx::atr_cleanup_entry::max_docs_in_flight_ = 16;
 
 tx::atr_cleanup_entry::atr_cleanup_entry(const couchbase::document_id& atr_id,
                                          const std::string& attempt_id,
@@ -83,14 +90,103 @@ tx::atr_cleanup_entry::atr_cleanup_entry(attempt_context& ctx)
     cleanup_ = &ctx_impl.overall_.cleanup();
 }
 
+namespace
+{
+// Runs the KV mutation, then calls done with the error it failed with, if any.
+template<typename Request>
 void
+execute_then(const tx::transactions_cleanup& cleanup, Request& req, std::function<void(std::exception_ptr)> done)
+{
+    cleanup.kv().execute(req, [done = std::move(done)](typename Request::response_type resp) {
+        auto res = [&resp]() {
+            if constexpr (std::is_same_v<typename Request::response_type, couchbase::operations::mutate_in_response>) {
+                return tx::result::create_from_subdoc_response(resp);
+            } else {
+                return tx::result::create_from_mutation_response(resp);
+            }
+        }();
+        auto checked = tx::check_operation_result(std::move(res));
+        done(checked ? nullptr : std::make_exception_ptr(checked.error()));
+    });
+}
+
+couchbase::operations::lookup_in_request
+doc_lookup_request(const couchbase::document_id& id)
+{
+    couchbase::operations::lookup_in_request req{ id };
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, ATR_ID);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, TRANSACTION_ID);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, ATTEMPT_ID);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, STAGED_DATA);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, ATR_BUCKET_NAME);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, ATR_SCOPE_NAME);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, ATR_COLL_NAME);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, TRANSACTION_RESTORE_PREFIX_ONLY);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, TYPE);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, "$document");
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, CRC32_OF_STAGING);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, FORWARD_COMPAT);
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::get_doc, false, "");
+    req.access_deleted = true;
+    return req;
+}
+
+// The looked up document, if it is still staged for the attempt and so needs cleaning.  Raises a client_error if the lookup
+// failed, unless that was because the document has gone.
+std::optional<tx::transaction_get_result>
+staged_doc_to_clean(std::shared_ptr<spdlog::logger> logger,
+                    const tx::doc_record& dr,
+                    const std::string& attempt_id,
+                    bool require_crc_to_match,
+                    tx::result lookup)
+{
+    auto checked = tx::check_operation_result(std::move(lookup));
+    if (!checked) {
+        if (checked.error().ec() == tx::FAIL_DOC_NOT_FOUND) {
+            logger->error("document {} not found - ignoring ", dr);
+            return {};
+        }
+        logger->error("got error {}, not ignoring this", checked.error().what());
+        throw checked.error();
+    }
+    const auto& res = checked.value();
+    if (res.values.empty()) {
+        logger->trace("cannot create a transaction document from {}, ignoring", res);
+        return {};
+    }
+    auto doc = tx::transaction_get_result::create_from(dr.document_id(), res);
+    // now lets decide if we call the function or not
+    if (!(doc.links().has_staged_content() || doc.links().is_document_being_removed()) || !doc.links().has_staged_write()) {
+        logger->trace("document {} has no staged content - assuming it was "
+                      "committed and skipping",
+                      dr.id());
+        return {};
+    } else if (doc.links().staged_attempt_id() != attempt_id) {
+        logger->trace(
+          "document {} staged for different attempt {}, skipping", dr.id(), doc.links().staged_attempt_id().value_or("<none>)"));
+        return {};
+    }
+    if (require_crc_to_match) {
+        if (!doc.metadata()->crc32() || !doc.links().crc32_of_staging() || doc.links().crc32_of_staging() != doc.metadata()->crc32()) {
+            logger->trace("document {} crc32 {} doesn't match staged value {}, skipping",
+                          dr.id(),
+                          doc.metadata()->crc32().value_or("<none>"),
+                          doc.links().crc32_of_staging().value_or("<none>"));
+            return {};
+        }
+    }
+    return doc;
+}
+} // namespace
+
+bool
 tx::atr_cleanup_entry::clean(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result)
 {
     logger->trace("cleaning {}", *this);
     // get atr entry if needed
     atr_entry entry;
     if (nullptr == atr_entry_) {
-        auto atr = tx::active_transaction_record::get_atr(cleanup_->cluster_ref(), atr_id_);
+        auto atr = tx::active_transaction_record::get_atr(cleanup_->kv(), atr_id_);
         if (atr) {
             // now get the specific attempt
             auto it =
@@ -100,17 +196,31 @@ tx::atr_cleanup_entry::clean(std::shared_ptr<spdlog::logger> logger, transaction
                 return check_atr_and_cleanup(logger, result);
             } else {
                 logger->trace("could not find attempt {}, nothing to clean", attempt_id_);
-                return;
+                return false;
             }
         } else {
             logger->trace("could not find atr {}, nothing to clean", atr_id_);
-            return;
+            return false;
         }
     }
-    check_atr_and_cleanup(logger, result);
+    return check_atr_and_cleanup(logger, result);
 }
 
-void
+bool
+tx::atr_cleanup_entry::clean(std::shared_ptr<spdlog::logger> logger, atr_removal_batch& batch)
+{
+    removal_batch_ = &batch;
+    try {
+        auto cleaned = clean(logger);
+        removal_batch_ = nullptr;
+        return cleaned;
+    } catch (...) {
+        removal_batch_ = nullptr;
+        throw;
+    }
+}
+
+bool
 tx::atr_cleanup_entry::check_atr_and_cleanup(std::shared_ptr<spdlog::logger> logger, transactions_cleanup_attempt* result)
 {
     // ExtStoreDurability: this is the first point where we're guaranteed to have the ATR entry
@@ -125,7 +235,7 @@ tx::atr_cleanup_entry::check_atr_and_cleanup(std::shared_ptr<spdlog::logger> log
     //              check_if_expired_, atr_entry_->has_expired(safety_margin_ms_),safety_margin_ms_);
     if (check_if_expired_ && !atr_entry_->has_expired(safety_margin_ms_)) {
         logger->trace("{} not expired, nothing to clean", *this);
-        return;
+        return false;
     }
     if (result) {
         result->state(atr_entry_->state());
@@ -144,7 +254,7 @@ tx::atr_cleanup_entry::check_atr_and_cleanup(std::shared_ptr<spdlog::logger> log
     if (ec) {
         throw client_error(*ec, "on_cleanup_completed hook threw error");
     }
-    return;
+    return true;
 }
 
 void
@@ -172,72 +282,49 @@ void
 tx::atr_cleanup_entry::do_per_doc(std::shared_ptr<spdlog::logger> logger,
                                   std::vector<tx::doc_record> docs,
                                   bool require_crc_to_match,
-                                  const std::function<void(std::shared_ptr<spdlog::logger>, transaction_get_result&, bool)>& call)
-{
-    for (auto& dr : docs) {
-        try {
-            couchbase::operations::lookup_in_request req{ dr.document_id() };
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, ATR_ID);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, TRANSACTION_ID);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, ATTEMPT_ID);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, STAGED_DATA);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, ATR_BUCKET_NAME);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, ATR_SCOPE_NAME);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, ATR_COLL_NAME);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, TRANSACTION_RESTORE_PREFIX_ONLY);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, TYPE);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, "$document");
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, CRC32_OF_STAGING);
-            req.specs.add_spec(protocol::subdoc_opcode::get, true, FORWARD_COMPAT);
-            req.specs.add_spec(protocol::subdoc_opcode::get_doc, false, "");
-            req.access_deleted = true;
-            wrap_request(req, cleanup_->config());
-            // now a blocking lookup_in...
-            auto barrier = std::make_shared<std::promise<result>>();
-            cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::lookup_in_response resp) {
-                barrier->set_value(result::create_from_subdoc_response<>(resp));
-            });
-            auto f = barrier->get_future();
-            auto res = wrap_operation_future(f);
-
-            if (res.values.empty()) {
-                logger->trace("cannot create a transaction document from {}, ignoring", res);
-                continue;
-            }
-            auto doc = transaction_get_result::create_from(dr.document_id(), res);
-            // now lets decide if we call the function or not
-            if (!(doc.links().has_staged_content() || doc.links().is_document_being_removed()) || !doc.links().has_staged_write()) {
-                logger->trace("document {} has no staged content - assuming it was "
-                              "committed and skipping",
-                              dr.id());
-                continue;
-            } else if (doc.links().staged_attempt_id() != attempt_id_) {
-                logger->trace(
-                  "document {} staged for different attempt {}, skipping", dr.id(), doc.links().staged_attempt_id().value_or("<none>)"));
-                continue;
-            }
-            if (require_crc_to_match) {
-                if (!doc.metadata()->crc32() || !doc.links().crc32_of_staging() ||
-                    doc.links().crc32_of_staging() != doc.metadata()->crc32()) {
-                    logger->trace("document {} crc32 {} doesn't match staged value {}, skipping",
-                                  dr.id(),
-                                  doc.metadata()->crc32().value_or("<none>"),
-                                  doc.links().crc32_of_staging().value_or("<none>"));
-                    continue;
-                }
-            }
-            call(logger, doc, res.is_deleted);
-        } catch (const client_error& e) {
-            error_class ec = e.ec();
-            switch (ec) {
-                case FAIL_DOC_NOT_FOUND:
-                    logger->error("document {} not found - ignoring ", dr);
-                    break;
-                default:
-                    logger->error("got error {}, not ignoring this", e.what());
-                    throw;
-            }
+                                  const per_doc_fn& call)
+{
+    // The documents are independent of one another, so up to max_docs_in_flight_ of their KV ops are in flight at once: first
+    // they are all looked up, then those still staged for this attempt are cleaned.  Only the KV ops are asynchronous, the rest
+    // (including the testing hooks) runs on this thread.  A failure on one document doesn't stop the others being cleaned, but
+    // is raised once they are all done, so the entry isn't removed from the ATR.
+    std::exception_ptr first_error;
+    auto keep_error = [&first_error](std::exception_ptr err) {
+        if (err && !first_error) {
+            first_error = err;
         }
+    };
+    std::vector<std::pair<transaction_get_result, bool>> staged;
+    lookup_pipeline<result> lookups(docs.size(), max_docs_in_flight_);
+    lookups.run(
+      [&](size_t index, lookup_pipeline<result>::done_fn done) {
+          auto req = doc_lookup_request(docs[index].document_id());
+          wrap_request(req, cleanup_->config());
+          cleanup_->kv().execute(
+            req, [done](couchbase::operations::lookup_in_response resp) { done(result::create_from_subdoc_response<>(resp)); });
+      },
+      [&](size_t index, result res) {
+          try {
+              auto is_deleted = res.is_deleted;
+              if (auto doc = staged_doc_to_clean(logger, docs[index], attempt_id_, require_crc_to_match, std::move(res)); doc) {
+                  staged.emplace_back(std::move(*doc), is_deleted);
+              }
+          } catch (...) {
+              keep_error(std::current_exception());
+          }
+      });
+    lookup_pipeline<std::exception_ptr> cleans(staged.size(), max_docs_in_flight_);
+    cleans.run(
+      [&](size_t index, lookup_pipeline<std::exception_ptr>::done_fn done) {
+          try {
+              call(logger, staged[index].first, staged[index].second, done);
+          } catch (...) {
+              done(std::current_exception());
+          }
+      },
+      [&](size_t, std::exception_ptr err) { keep_error(err); });
+    if (first_error) {
+        std::rethrow_exception(first_error);
     }
 }
 
@@ -247,42 +334,38 @@ tx::atr_cleanup_entry::commit_docs(std::shared_ptr<spdlog::logger> logger,
                                    durability_level dl)
 {
     if (docs) {
-        do_per_doc(logger, *docs, true, [&](std::shared_ptr<spdlog::logger> logger, tx::transaction_get_result& doc, bool) {
-            if (doc.links().has_staged_content()) {
-                auto content = doc.links().staged_content();
-                auto ec = cleanup_->config().cleanup_hooks().before_commit_doc(doc.id().key());
-                if (ec) {
-                    throw client_error(*ec, "before_commit_doc hook threw error");
-                }
-                if (doc.links().is_deleted()) {
-                    couchbase::operations::insert_request req{ doc.id() };
-                    req.value = couchbase::utils::to_binary(content);
-                    auto barrier = std::make_shared<std::promise<result>>();
-                    auto f = barrier->get_future();
-                    cleanup_->cluster_ref().execute(wrap_durable_request(req, cleanup_->config(), dl),
-                                                    [barrier](couchbase::operations::insert_response resp) {
-                                                        barrier->set_value(result::create_from_mutation_response(resp));
-                                                    });
-                    tx::wrap_operation_future(f);
-                } else {
-                    couchbase::operations::mutate_in_request req{ doc.id() };
-                    req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
-                    req.specs.add_spec(protocol::subdoc_opcode::set_doc, false, false, false, {}, content);
-                    req.cas.value = doc.cas();
-                    req.store_semantics = protocol::mutate_in_request_body::store_semantics_type::replace;
-                    wrap_durable_request(req, cleanup_->config(), dl);
-                    auto barrier = std::make_shared<std::promise<result>>();
-                    auto f = barrier->get_future();
-                    cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
-                        barrier->set_value(result::create_from_subdoc_response(resp));
-                    });
-                    tx::wrap_operation_future(f);
-                }
-                logger->trace("commit_docs replaced content of doc {} with {}", doc.id(), content);
-            } else {
-                logger->trace("commit_docs skipping document {}, no staged content", doc.id());
-            }
-        });
+        do_per_doc(logger,
+                   *docs,
+                   true,
+                   [&](std::shared_ptr<spdlog::logger> logger, tx::transaction_get_result& doc, bool, doc_done_fn done) {
+                       if (!doc.links().has_staged_content()) {
+                           logger->trace("commit_docs skipping document {}, no staged content", doc.id());
+                           return done(nullptr);
+                       }
+                       auto content = doc.links().staged_content();
+                       auto ec = cleanup_->config().cleanup_hooks().before_commit_doc(doc.id().key());
+                       if (ec) {
+                           throw client_error(*ec, "before_commit_doc hook threw error");
+                       }
+                       auto committed = [logger, id = doc.id(), content, done](std::exception_ptr err) {
+                           if (!err) {
+                               logger->trace("commit_docs replaced content of doc {} with {}", id, content);
+                           }
+                           done(err);
+                       };
+                       if (doc.links().is_deleted()) {
+                           couchbase::operations::insert_request req{ doc.id() };
+                           req.value = couchbase::utils::to_binary(content);
+                           execute_then(*cleanup_, wrap_durable_request(req, cleanup_->config(), dl), committed);
+                       } else {
+                           couchbase::operations::mutate_in_request req{ doc.id() };
+                           req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
+                           req.specs.add_spec(protocol::subdoc_opcode::set_doc, false, false, false, {}, content);
+                           req.cas.value = doc.cas();
+                           req.store_semantics = protocol::mutate_in_request_body::store_semantics_type::replace;
+                           execute_then(*cleanup_, wrap_durable_request(req, cleanup_->config(), dl), committed);
+                       }
+                   });
     }
 }
 void
@@ -291,36 +374,32 @@ tx::atr_cleanup_entry::remove_docs(std::shared_ptr<spdlog::logger> logger,
                                    durability_level dl)
 {
     if (docs) {
-        do_per_doc(logger, *docs, true, [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool is_deleted) {
-            auto ec = cleanup_->config().cleanup_hooks().before_remove_doc(doc.id().key());
-            if (ec) {
-                throw client_error(*ec, "before_remove_doc hook threw error");
-            }
-            if (is_deleted) {
-                couchbase::operations::mutate_in_request req{ doc.id() };
-                req.specs.add_spec(couchbase::protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
-                req.cas.value = doc.cas();
-                req.access_deleted = true;
-                wrap_durable_request(req, cleanup_->config(), dl);
-                auto barrier = std::make_shared<std::promise<result>>();
-                auto f = barrier->get_future();
-                cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
-                    barrier->set_value(result::create_from_subdoc_response(resp));
-                });
-                tx::wrap_operation_future(f);
-            } else {
-                couchbase::operations::remove_request req{ doc.id() };
-                req.cas.value = doc.cas();
-                wrap_durable_request(req, cleanup_->config(), dl);
-                auto barrier = std::make_shared<std::promise<result>>();
-                auto f = barrier->get_future();
-                cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::remove_response resp) {
-                    barrier->set_value(result::create_from_mutation_response(resp));
-                });
-                tx::wrap_operation_future(f);
-            }
-            logger->trace("remove_docs removed doc {}", doc.id());
-        });
+        do_per_doc(logger,
+                   *docs,
+                   true,
+                   [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool is_deleted, doc_done_fn done) {
+                       auto ec = cleanup_->config().cleanup_hooks().before_remove_doc(doc.id().key());
+                       if (ec) {
+                           throw client_error(*ec, "before_remove_doc hook threw error");
+                       }
+                       auto removed = [logger, id = doc.id(), done](std::exception_ptr err) {
+                           if (!err) {
+                               logger->trace("remove_docs removed doc {}", id);
+                           }
+                           done(err);
+                       };
+                       if (is_deleted) {
+                           couchbase::operations::mutate_in_request req{ doc.id() };
+                           req.specs.add_spec(couchbase::protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
+                           req.cas.value = doc.cas();
+                           req.access_deleted = true;
+                           execute_then(*cleanup_, wrap_durable_request(req, cleanup_->config(), dl), removed);
+                       } else {
+                           couchbase::operations::remove_request req{ doc.id() };
+                           req.cas.value = doc.cas();
+                           execute_then(*cleanup_, wrap_durable_request(req, cleanup_->config(), dl), removed);
+                       }
+                   });
     }
 }
 
@@ -330,27 +409,26 @@ tx::atr_cleanup_entry::remove_docs_staged_for_removal(std::shared_ptr<spdlog::lo
                                                       durability_level dl)
 {
     if (docs) {
-        do_per_doc(logger, *docs, true, [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool) {
-            if (doc.links().is_document_being_removed()) {
-                auto ec = cleanup_->config().cleanup_hooks().before_remove_doc_staged_for_removal(doc.id().key());
-                if (ec) {
-                    throw client_error(*ec, "before_remove_doc_staged_for_removal hook threw error");
-                }
-                couchbase::operations::remove_request req{ doc.id() };
-                req.cas.value = doc.cas();
-                wrap_durable_request(req, cleanup_->config(), dl);
-                auto barrier = std::make_shared<std::promise<result>>();
-                auto f = barrier->get_future();
-                cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::remove_response resp) {
-                    barrier->set_value(result::create_from_mutation_response(resp));
-                });
-                tx::wrap_operation_future(f);
-                logger->trace("remove_docs_staged_for_removal removed doc {}", doc.id());
-            } else {
+        do_per_doc(logger, *docs, true, [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool, doc_done_fn done) {
+            if (!doc.links().is_document_being_removed()) {
                 logger->trace("remove_docs_staged_for_removal found document {} not "
                               "marked for removal, skipping",
                               doc.id());
+                return done(nullptr);
+            }
+            auto ec = cleanup_->config().cleanup_hooks().before_remove_doc_staged_for_removal(doc.id().key());
+            if (ec) {
+                throw client_error(*ec, "before_remove_doc_staged_for_removal hook threw error");
             }
+            couchbase::operations::remove_request req{ doc.id() };
+            req.cas.value = doc.cas();
+            wrap_durable_request(req, cleanup_->config(), dl);
+            execute_then(*cleanup_, req, [logger, id = doc.id(), done](std::exception_ptr err) {
+                if (!err) {
+                    logger->trace("remove_docs_staged_for_removal removed doc {}", id);
+                }
+                done(err);
+            });
         });
     }
 }
@@ -361,7 +439,7 @@ tx::atr_cleanup_entry::remove_txn_links(std::shared_ptr<spdlog::logger> logger,
                                         durability_level dl)
 {
     if (docs) {
-        do_per_doc(logger, *docs, false, [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool) {
+        do_per_doc(logger, *docs, false, [&](std::shared_ptr<spdlog::logger> logger, transaction_get_result& doc, bool, doc_done_fn done) {
             auto ec = cleanup_->config().cleanup_hooks().before_remove_links(doc.id().key());
             if (ec) {
                 throw client_error(*ec, "before_remove_links hook threw error");
@@ -371,17 +449,43 @@ tx::atr_cleanup_entry::remove_txn_links(std::shared_ptr<spdlog::logger> logger,
             req.access_deleted = true;
             req.cas.value = doc.cas();
             wrap_durable_request(req, cleanup_->config(), dl);
-            auto barrier = std::make_shared<std::promise<result>>();
-            auto f = barrier->get_future();
-            cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
-                barrier->set_value(result::create_from_subdoc_response(resp));
+            execute_then(*cleanup_, req, [logger, id = doc.id(), done](std::exception_ptr err) {
+                if (!err) {
+                    logger->trace("remove_txn_links removed links for doc {}", id);
+                }
+                done(err);
             });
-            tx::wrap_operation_future(f);
-            logger->trace("remove_txn_links removed links for doc {}", doc.id());
         });
     }
 }
 
+namespace
+{
+// removes all the entries from the ATR in a single mutate_in, raising a client_error if that fails.
+void
+remove_atr_entries(const tx::transactions_cleanup& cleanup,
+                   const couchbase::document_id& atr_id,
+                   const std::vector<tx::atr_removal_batch::removal>& entries,
+                   tx::durability_level dl)
+{
+    couchbase::operations::mutate_in_request req{ atr_id };
+    for (const auto& entry : entries) {
+        if (entry.pending) {
+            req.specs.add_spec(
+              couchbase::protocol::subdoc_opcode::dict_add, true, false, false, "attempts." + entry.attempt_id + ".p", "{}");
+        }
+        req.specs.add_spec(couchbase::protocol::subdoc_opcode::remove, true, "attempts." + entry.attempt_id);
+    }
+    tx::wrap_durable_request(req, cleanup.config(), dl);
+    auto barrier = std::make_shared<std::promise<tx::result>>();
+    auto f = barrier->get_future();
+    cleanup.kv().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        barrier->set_value(tx::result::create_from_subdoc_response(resp));
+    });
+    tx::wrap_operation_future(f);
+}
+} // namespace
+
 void
 tx::atr_cleanup_entry::cleanup_entry(std::shared_ptr<spdlog::logger> logger, durability_level dl)
 {
@@ -390,18 +494,13 @@ tx::atr_cleanup_entry::cleanup_entry(std::shared_ptr<spdlog::logger> logger, dur
         if (ec) {
             throw client_error(*ec, "before_atr_remove hook threw error");
         }
-        couchbase::operations::mutate_in_request req{ atr_id_ };
-        if (atr_entry_->state() == tx::attempt_state::PENDING) {
-            req.specs.add_spec(protocol::subdoc_opcode::dict_add, true, false, false, "attempts." + atr_entry_->attempt_id() + ".p", "{}");
+        atr_removal_batch::removal removal{ atr_entry_->attempt_id(), atr_entry_->state() == tx::attempt_state::PENDING };
+        if (removal_batch_ != nullptr) {
+            removal_batch_->add(atr_id_, dl, std::move(removal));
+            logger->trace("attempt {} will be removed with the rest of its batch", attempt_id_);
+            return;
         }
-        req.specs.add_spec(protocol::subdoc_opcode::remove, true, "attempts." + atr_entry_->attempt_id());
-        wrap_durable_request(req, cleanup_->config(), dl);
-        auto barrier = std::make_shared<std::promise<result>>();
-        auto f = barrier->get_future();
-        cleanup_->cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
-            barrier->set_value(result::create_from_subdoc_response(resp));
-        });
-        tx::wrap_operation_future(f);
+        remove_atr_entries(*cleanup_, atr_id_, { removal }, dl);
         logger->trace("successfully removed attempt {}", attempt_id_);
     } catch (const client_error& e) {
         error_class ec = e.ec();
@@ -416,45 +515,273 @@ tx::atr_cleanup_entry::cleanup_entry(std::shared_ptr<spdlog::logger> logger, dur
     }
 }
 
+void
+tx::atr_removal_batch::add(const couchbase::document_id& atr_id, durability_level dl, removal entry)
+{
+    auto it = std::find_if(atrs_.begin(), atrs_.end(), [&](const atr_removals& r) {
+        return r.dl == dl && r.atr_id.bucket() == atr_id.bucket() && r.atr_id.scope() == atr_id.scope() &&
+               r.atr_id.collection() == atr_id.collection() && r.atr_id.key() == atr_id.key();
+    });
+    if (it == atrs_.end()) {
+        atrs_.push_back({ atr_id, dl, {} });
+        it = std::prev(atrs_.end());
+    }
+    it->entries.push_back(std::move(entry));
+}
+
+size_t
+tx::atr_removal_batch::size() const
+{
+    size_t count = 0;
+    for (const auto& atr : atrs_) {
+        count += atr.entries.size();
+    }
+    return count;
+}
+
+void
+tx::atr_removal_batch::flush(const transactions_cleanup& cleanup, std::shared_ptr<spdlog::logger> logger)
+{
+    flush(
+      [&cleanup](const couchbase::document_id& atr_id, const std::vector<removal>& entries, durability_level dl) {
+          remove_atr_entries(cleanup, atr_id, entries, dl);
+      },
+      std::move(logger));
+}
+
+void
+tx::atr_removal_batch::flush(const remove_fn& remove, std::shared_ptr<spdlog::logger> logger)
+{
+    auto atrs = std::move(atrs_);
+    atrs_.clear();
+    for (const auto& atr : atrs) {
+        std::vector<removal> chunk;
+        size_t specs = 0;
+        auto send = [&]() {
+            if (chunk.empty()) {
+                return;
+            }
+            try {
+                remove(atr.atr_id, chunk, atr.dl);
+                logger->trace("removed {} attempts from atr {}", chunk.size(), atr.atr_id);
+            } catch (const std::exception& e) {
+                // The whole request fails if any one entry can't be removed (it may have been removed by someone else already,
+                // for instance), so fall back to removing them one by one.
+                logger->debug(
+                  "removing {} attempts from atr {} failed with {}, removing them one at a time", chunk.size(), atr.atr_id, e.what());
+                for (const auto& entry : chunk) {
+                    try {
+                        remove(atr.atr_id, { entry }, atr.dl);
+                        logger->trace("successfully removed attempt {}", entry.attempt_id);
+                    } catch (const client_error& e) {
+                        if (e.ec() == FAIL_PATH_NOT_FOUND) {
+                            logger->trace("attempt {} already removed from atr {}", entry.attempt_id, atr.atr_id);
+                        } else {
+                            logger->error("cleanup couldn't remove attempt {} due to {}", entry.attempt_id, e.what());
+                        }
+                    } catch (const std::exception& e) {
+                        logger->error("cleanup couldn't remove attempt {} due to {}", entry.attempt_id, e.what());
+                    }
+                }
+            }
+            chunk.clear();
+            specs = 0;
+        };
+        for (const auto& entry : atr.entries) {
+            size_t needed = entry.pending ? 2 : 1;
+            if (specs + needed > max_specs) {
+                send();
+            }
+            chunk.push_back(entry);
+            specs += needed;
+        }
+        send();
+    }
+}
+
 bool
 tx::atr_cleanup_entry::ready() const
 {
     return std::chrono::steady_clock::now() > min_start_time_;
 }
 
+std::string
+tx::atr_cleanup_queue::key_for(const atr_cleanup_entry& entry)
+{
+    const auto& id = entry.atr_id();
+    return id.bucket() + "/" + id.scope() + "/" + id.collection() + "/" + id.key() + "/" + entry.attempt_id();
+}
+
+std::string
+tx::atr_cleanup_queue::atr_key_for(const atr_cleanup_entry& entry)
+{
+    const auto& id = entry.atr_id();
+    return id.bucket() + "/" + id.scope() + "/" + id.collection() + "/" + id.key();
+}
+
+void
+tx::atr_cleanup_queue::unlink(const std::string& atr_key, const atr_entries& atr)
+{
+    if (atr.entries.empty()) {
+        return;
+    }
+    atr_front front{ atr.entries.begin()->first, atr_key };
+    fronts_.erase(front);
+    if (!atr.claimed) {
+        unclaimed_fronts_.erase(front);
+    }
+}
+
+void
+tx::atr_cleanup_queue::link(const std::string& atr_key, const atr_entries& atr)
+{
+    if (atr.entries.empty()) {
+        return;
+    }
+    atr_front front{ atr.entries.begin()->first, atr_key };
+    fronts_.insert(front);
+    if (!atr.claimed) {
+        unclaimed_fronts_.insert(front);
+    }
+}
+
+std::optional<std::string>
+tx::atr_cleanup_queue::next_atr(bool check_time, bool claim_atr) const
+{
+    // only the first entry of an unclaimed ATR can be claimed, so each ATR is cleaned in order.
+    const auto& fronts = claim_atr ? unclaimed_fronts_ : fronts_;
+    if (fronts.empty()) {
+        return {};
+    }
+    const auto& [ready_at, atr_key] = *fronts.begin();
+    if (check_time && clock::now() <= ready_at) {
+        return {};
+    }
+    return atr_key;
+}
+
+tx::atr_cleanup_entry
+tx::atr_cleanup_queue::take(const std::string& atr_key, bool claim_atr)
+{
+    auto atr = atrs_.find(atr_key);
+    unlink(atr_key, atr->second);
+    auto first = atr->second.entries.begin();
+    auto top = std::move(first->second);
+    atr->second.entries.erase(first);
+    atr->second.claimed = atr->second.claimed || claim_atr;
+    link(atr_key, atr->second);
+    if (atr->second.entries.empty() && !atr->second.claimed) {
+        atrs_.erase(atr);
+    }
+    size_--;
+    keys_.erase(key_for(top));
+    return top;
+}
+
 std::optional<tx::atr_cleanup_entry>
-tx::atr_cleanup_queue::pop(bool check_time)
+tx::atr_cleanup_queue::pop(bool check_time, bool claim_atr)
 {
     std::unique_lock<std::mutex> lock(mutex_);
-    if (!queue_.empty()) {
-        if (!check_time || (check_time && queue_.top().ready())) {
-            // copy it
-            tx::atr_cleanup_entry top = queue_.top();
-            // pop it
-            queue_.pop();
-            return { top };
+    if (auto atr_key = next_atr(check_time, claim_atr); atr_key) {
+        return take(*atr_key, claim_atr);
+    }
+    return {};
+}
+
+std::optional<tx::atr_cleanup_entry>
+tx::atr_cleanup_queue::wait_pop(bool claim_atr)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!closed_) {
+        if (auto atr_key = next_atr(true, claim_atr); atr_key) {
+            return take(*atr_key, claim_atr);
+        }
+        // sleep until exactly when the next entry we could take is ready, unless something earlier is pushed (or an ATR is
+        // released) in the meantime.
+        const auto& fronts = claim_atr ? unclaimed_fronts_ : fronts_;
+        if (fronts.empty()) {
+            cv_.wait(lock);
+        } else {
+            cv_.wait_until(lock, fronts.begin()->first);
         }
     }
     return {};
 }
 
+void
+tx::atr_cleanup_queue::release(const atr_cleanup_entry& entry)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto atr_key = atr_key_for(entry);
+    if (auto atr = atrs_.find(atr_key); atr != atrs_.end() && atr->second.claimed) {
+        unlink(atr_key, atr->second);
+        atr->second.claimed = false;
+        link(atr_key, atr->second);
+        if (atr->second.entries.empty()) {
+            atrs_.erase(atr);
+        }
+    }
+    if (entry.queued_at() != std::chrono::steady_clock::time_point{}) {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - entry.queued_at());
+        stats_.cleaned++;
+        stats_.total_latency += latency;
+        stats_.max_latency = std::max(stats_.max_latency, latency);
+    }
+    // any of the waiters could be waiting on this ATR.
+    cv_.notify_all();
+}
+
 size_t
 tx::atr_cleanup_queue::size() const
 {
     std::unique_lock<std::mutex> lock(mutex_);
-    return queue_.size();
+    return size_;
 }
 
-void
+tx::atr_cleanup_queue_stats
+tx::atr_cleanup_queue::stats() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+bool
 tx::atr_cleanup_queue::push(attempt_context& ctx)
+{
+    return push(atr_cleanup_entry(ctx));
+}
+
+bool
+tx::atr_cleanup_queue::push(const atr_cleanup_entry& e)
 {
     std::unique_lock<std::mutex> lock(mutex_);
-    queue_.emplace(ctx);
+    if (!keys_.insert(key_for(e)).second) {
+        stats_.deduplicated++;
+        return false;
+    }
+    if (size_ >= capacity_) {
+        keys_.erase(key_for(e));
+        stats_.dropped++;
+        return false;
+    }
+    auto atr_key = atr_key_for(e);
+    auto& atr = atrs_[atr_key];
+    unlink(atr_key, atr);
+    auto queued = atr.entries.emplace(e.min_start_time(), e);
+    queued->second.queued_at(clock::now());
+    link(atr_key, atr);
+    size_++;
+    stats_.queued++;
+    stats_.high_water_mark = std::max(stats_.high_water_mark, size_);
+    // wake one waiter - if this is now the front, it needs to shorten its wait.
+    cv_.notify_one();
+    return true;
 }
 
 void
-tx::atr_cleanup_queue::push(const atr_cleanup_entry& e)
+tx::atr_cleanup_queue::close()
 {
     std::unique_lock<std::mutex> lock(mutex_);
-    return queue_.push(e);
+    closed_ = true;
+    cv_.notify_all();
 }
@@ -14,6 +14,8 @@
  *   limitations under the License.
  */
 
+#include <algorithm>
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -23,6 +25,32 @@
 
 namespace tx = couchbase::transactions;
 
+namespace
+{
+// The weights must agree between clients, whatever platform or SDK version they run on, so they can't use std::hash.
+// FNV-1a over the client and the ATR, then the splitmix64 finalizer, as FNV alone mixes the last few bytes poorly.
+uint64_t
+rendezvous_weight(const std::string& client_uuid, const std::string& atr_id)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix_in = [&h](const std::string& s) {
+        for (auto c : s) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 0x100000001b3ULL;
+        }
+    };
+    mix_in(client_uuid);
+    mix_in("/");
+    mix_in(atr_id);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+} // namespace
+
 const std::vector<std::string> ATR_IDS({
   "_txn:atr-0-#14",     "_txn:atr-1-#10b6",   "_txn:atr-2-#cc8",    "_txn:atr-3-#f08",     "_txn:atr-4-#c7",     "_txn:atr-5-#11a",
   "_txn:atr-6-#a",      "_txn:atr-7-#2c4",    "_txn:atr-8-#4c",     "_txn:atr-9-#0",       "_txn:atr-10-#b8a",   "_txn:atr-11-#89e",
@@ -219,3 +247,45 @@ tx::atr_ids::vbucket_for_key(const std::string& key)
     uint32_t digest = utils::hash_crc32(key.data(), key.size());
     return static_cast<size_t>(digest % num_vbuckets);
 }
+
+const std::string&
+tx::atr_ids::owner_of(const std::string& atr_id, const std::vector<std::string>& client_uuids)
+{
+    if (client_uuids.empty()) {
+        throw std::invalid_argument("no clients to own atr " + atr_id);
+    }
+    const std::string* owner = nullptr;
+    uint64_t best = 0;
+    for (const auto& client : client_uuids) {
+        auto weight = rendezvous_weight(client, atr_id);
+        // ties are vanishingly unlikely, but break them by uuid so the order of the list doesn't matter.
+        if (owner == nullptr || weight > best || (weight == best && client < *owner)) {
+            owner = &client;
+            best = weight;
+        }
+    }
+    return *owner;
+}
+
+std::vector<std::string>
+tx::atr_ids::assigned_to(const std::string& client_uuid, const std::vector<std::string>& client_uuids)
+{
+    std::vector<std::string> atrs;
+    for (const auto& atr : ATR_IDS) {
+        if (owner_of(atr, client_uuids) == client_uuid) {
+            atrs.push_back(atr);
+        }
+    }
+    return atrs;
+}
+
+std::vector<std::string>
+tx::atr_ids::strided_for(size_t client_index, size_t num_clients)
+{
+    std::vector<std::string> atrs;
+    auto stride = std::max<size_t>(1, num_clients);
+    for (auto idx = client_index; idx < ATR_IDS.size(); idx += stride) {
+        atrs.push_back(ATR_IDS[idx]);
+    }
+    return atrs;
+}
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <string>
 #include <vector>
 
 namespace couchbase
@@ -28,6 +29,21 @@ namespace transactions
         static const std::string& atr_id_for_vbucket(size_t vbucket_id);
         static size_t vbucket_for_key(const std::string& key);
         static const std::vector<std::string>& all();
+
+        /**
+         * Which of the active clients is responsible for cleaning up an ATR, by rendezvous (highest random weight) hashing.
+         *
+         * Every client that has the same list of active clients, in any order, comes up with the same owner, and when a client
+         * joins or leaves only the ATRs it gains or loses change hands - roughly 1/N of them - so the rest keep their owner.
+         */
+        static const std::string& owner_of(const std::string& atr_id, const std::vector<std::string>& client_uuids);
+
+        // All the ATRs owned by a client, in the order of all().
+        static std::vector<std::string> assigned_to(const std::string& client_uuid, const std::vector<std::string>& client_uuids);
+
+        // The ATRs of the client at an index in the sorted list of active clients, when they are shared out by striding:
+        // client i takes every num_clients'th ATR, starting with the i'th.  This is how the other SDKs share them out.
+        static std::vector<std::string> strided_for(size_t client_index, size_t num_clients);
     };
 
 } // namespace transactions
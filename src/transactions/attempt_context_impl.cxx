@@ -49,6 +49,9 @@ attempt_context_impl::attempt_context_impl(transaction_context& transaction_ctx)
   , is_done_(false)
   , staged_mutations_(new staged_mutation_queue())
   , hooks_(overall_.config().attempt_context_hooks())
+  , commit_retries_([this]() { return overall_.remaining(); },
+                    [this]() { return expiry_overtime_mode_.load(); },
+                    overall_.config().kv_timeout().value_or(couchbase::timeout_defaults::key_value_durable_timeout))
 {
     // put a new transaction_attempt in the context...
     overall_.add_attempt();
@@ -230,17 +233,30 @@ attempt_context_impl::create_staging_request(const couchbase::document_id& id,
                                              const transaction_get_result* document,
                                              const std::string type,
                                              std::optional<std::string> content)
+{
+    auto req = create_staging_request(id, document, type, content, transaction_id(), this->id(), *atr_id_);
+    return wrap_durable_request(req, overall_.config(), op_timeout_cap());
+}
+
+couchbase::operations::mutate_in_request
+attempt_context_impl::create_staging_request(const couchbase::document_id& id,
+                                             const transaction_get_result* document,
+                                             const std::string& type,
+                                             const std::optional<std::string>& content,
+                                             const std::string& transaction_id,
+                                             const std::string& attempt_id,
+                                             const couchbase::document_id& atr_id)
 {
     couchbase::operations::mutate_in_request req{ id };
     auto txn = nlohmann::json::object();
     txn["id"] = nlohmann::json::object();
-    txn["id"]["txn"] = transaction_id();
-    txn["id"]["atmpt"] = this->id();
+    txn["id"]["txn"] = transaction_id;
+    txn["id"]["atmpt"] = attempt_id;
     txn["atr"] = nlohmann::json::object();
-    txn["atr"]["id"] = atr_id();
-    txn["atr"]["bkt"] = atr_id_->bucket();
-    txn["atr"]["scp"] = atr_id_->scope();
-    txn["atr"]["coll"] = atr_id_->collection();
+    txn["atr"]["id"] = atr_id.key();
+    txn["atr"]["bkt"] = atr_id.bucket();
+    txn["atr"]["scp"] = atr_id.scope();
+    txn["atr"]["coll"] = atr_id.collection();
     txn["op"] = nlohmann::json::object();
     txn["op"]["type"] = type;
 
@@ -262,8 +278,7 @@ attempt_context_impl::create_staging_request(const couchbase::document_id& id,
         req.specs.add_spec(protocol::subdoc_opcode::dict_upsert, true, false, false, "txn.op.stgd", content.value());
     }
     req.specs.add_spec(protocol::subdoc_opcode::dict_upsert, true, true, true, "txn.op.crc32", mutate_in_macro::VALUE_CRC_32C);
-
-    return wrap_durable_request(req, overall_.config());
+    return req;
 }
 
 void
@@ -353,24 +368,24 @@ attempt_context_impl::create_staged_replace(const transaction_get_result& docume
         return error_handler(*ec, "before_staged_replace hook raised error");
     }
     trace("about to replace doc {} with cas {} in txn {}", document.id(), document.cas(), overall_.transaction_id());
-    overall_.cluster_ref().execute(req,
-                                   [this, document = std::move(document), content, cb, error_handler = std::move(error_handler)](
-                                     couchbase::operations::mutate_in_response resp) {
-                                       auto ec = error_class_from_response(resp);
-                                       if (!ec) {
-                                           auto err = hooks_.after_staged_replace_complete(this, document.id().key());
-                                           if (err) {
-                                               return error_handler(*err, "after_staged_replace_commit hook returned error");
-                                           }
-                                           transaction_get_result out = document;
-                                           out.cas(resp.cas.value);
-                                           trace("replace staged content, result {}", out);
-                                           staged_mutations_->add(staged_mutation(out, content, staged_mutation_type::REPLACE));
-                                           return op_completed_with_callback(std::move(cb), std::optional<transaction_get_result>(out));
-                                       } else {
-                                           return error_handler(*ec, resp.ctx.ec.message());
-                                       }
-                                   });
+    execute_kv(req,
+               [this, document = std::move(document), content, cb, error_handler = std::move(error_handler)](
+                 couchbase::operations::mutate_in_response resp) {
+                   auto ec = error_class_from_response(resp);
+                   if (!ec) {
+                       auto err = hooks_.after_staged_replace_complete(this, document.id().key());
+                       if (err) {
+                           return error_handler(*err, "after_staged_replace_commit hook returned error");
+                       }
+                       transaction_get_result out = document;
+                       out.cas(resp.cas.value);
+                       trace("replace staged content, result {}", out);
+                       staged_mutations_->add(staged_mutation(out, content, staged_mutation_type::REPLACE));
+                       return op_completed_with_callback(std::move(cb), std::optional<transaction_get_result>(out));
+                   } else {
+                       return error_handler(*ec, resp.ctx.ec.message());
+                   }
+               });
 }
 
 transaction_get_result
@@ -474,7 +489,8 @@ void
 attempt_context_impl::check_atr_entry_for_blocking_document(const transaction_get_result& doc, Delay delay, Handler&& cb)
 {
     try {
-        delay();
+        // higher priority (or older) transactions poll the blocking transaction more often, so they tend to win the doc.
+        delay(overall_.backoff_scale());
         if (auto ec = hooks_.before_check_atr_entry_for_blocking_doc(this, doc.id().key())) {
             return cb(transaction_operation_failed(FAIL_WRITE_WRITE_CONFLICT, "document is in another transaction").retry());
         }
@@ -483,7 +499,7 @@ attempt_context_impl::check_atr_entry_for_blocking_document(const transaction_ge
                                       doc.links().atr_collection_name().value(),
                                       doc.links().atr_id().value());
         active_transaction_record::get_atr(
-          cluster_ref(),
+          overall_.kv(),
           atr_id,
           [this, delay = std::move(delay), cb = std::move(cb), doc = std::move(doc)](std::error_code err,
                                                                                      std::optional<active_transaction_record> atr) {
@@ -581,7 +597,7 @@ attempt_context_impl::remove(const transaction_get_result& document, VoidCallbac
                     auto req = create_staging_request(document.id(), &document, "remove");
                     req.cas.value = document.cas();
                     req.access_deleted = document.links().is_deleted();
-                    overall_.cluster_ref().execute(
+                    execute_kv(
                       req,
                       [this, document = std::move(document), cb = std::move(cb), error_handler = std::move(error_handler)](
                         couchbase::operations::mutate_in_response resp) {
@@ -632,10 +648,10 @@ attempt_context_impl::remove_staged_insert(const couchbase::document_id& id, Voi
 
     couchbase::operations::mutate_in_request req{ id };
     req.specs.add_spec(protocol::subdoc_opcode::remove, true, "txn");
-    wrap_durable_request(req, overall_.config());
+    wrap_durable_request(req, overall_.config(), op_timeout_cap());
     req.access_deleted = true;
 
-    overall_.cluster_ref().execute(
+    execute_kv(
       req, [this, id = std::move(id), cb, error_handler = std::move(error_handler)](couchbase::operations::mutate_in_response resp) {
           auto ec = error_class_from_response(resp);
           if (!ec) {
@@ -1200,7 +1216,7 @@ attempt_context_impl::rollback_with_query(VoidCallback&& cb)
 void
 attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
 {
-    retry_op<void>([this, &ambiguity_resolution_mode]() {
+    while (true) {
         try {
             std::string prefix(ATR_FIELD_ATTEMPTS + "." + id() + ".");
             couchbase::operations::mutate_in_request req{ atr_id_.value() };
@@ -1213,7 +1229,7 @@ attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
             req.specs.add_spec(
               protocol::subdoc_opcode::dict_upsert, true, false, true, prefix + ATR_FIELD_START_COMMIT, mutate_in_macro::CAS);
             req.specs.add_spec(protocol::subdoc_opcode::dict_add, true, false, false, prefix + ATR_FIELD_PREVENT_COLLLISION, jsonify(0));
-            wrap_durable_request(req, overall_.config());
+            wrap_durable_request(req, overall_.config(), op_timeout_cap());
             auto ec = error_if_expired_and_not_in_overtime(STAGE_ATR_COMMIT, {});
             if (ec) {
                 throw client_error(*ec, "atr_commit check for expiry threw error");
@@ -1226,7 +1242,7 @@ attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
             auto barrier = std::make_shared<std::promise<result>>();
             auto f = barrier->get_future();
             trace("updating atr {}", req.id);
-            overall_.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+            execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
                 barrier->set_value(result::create_from_subdoc_response(resp));
             });
             auto res = wrap_operation_future(f, false);
@@ -1235,6 +1251,7 @@ attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
                 throw client_error(*ec, "after_atr_commit hook raised error");
             }
             state(attempt_state::COMMITTED);
+            return;
         } catch (const client_error& e) {
             error_class ec = e.ec();
             switch (ec) {
@@ -1251,16 +1268,15 @@ attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
                 case FAIL_AMBIGUOUS:
                     debug("atr_commit got FAIL_AMBIGUOUS, resolving ambiguity...");
                     ambiguity_resolution_mode = true;
-                    throw retry_operation(e.what());
+                    break;
                 case FAIL_TRANSIENT:
                     if (ambiguity_resolution_mode) {
-                        throw retry_operation(e.what());
+                        break;
                     }
                     throw transaction_operation_failed(ec, e.what()).retry();
 
                 case FAIL_PATH_ALREADY_EXISTS:
-                    // Need retry_op as atr_commit_ambiguity_resolution can throw retry_operation
-                    return retry_op<void>([&]() { return atr_commit_ambiguity_resolution(); });
+                    return atr_commit_ambiguity_resolution();
                 case FAIL_HARD: {
                     auto out = transaction_operation_failed(ec, e.what()).no_rollback();
                     if (ambiguity_resolution_mode) {
@@ -1308,60 +1324,82 @@ attempt_context_impl::atr_commit(bool ambiguity_resolution_mode)
                 }
             }
         }
-    });
+        if (!commit_retries_.try_wait(STAGE_ATR_COMMIT)) {
+            auto out = transaction_operation_failed(FAIL_EXPIRY, "atr_commit ran out of time retrying").no_rollback();
+            if (ambiguity_resolution_mode) {
+                out.ambiguous();
+            } else {
+                out.expired();
+            }
+            throw out;
+        }
+    }
 }
 
 void
 attempt_context_impl::atr_commit_ambiguity_resolution()
 {
-    try {
-        auto ec = error_if_expired_and_not_in_overtime(STAGE_ATR_COMMIT_AMBIGUITY_RESOLUTION, {});
-        if (ec) {
-            throw client_error(*ec, "atr_commit_ambiguity_resolution raised error");
-        }
-        if (!!(ec = hooks_.before_atr_commit_ambiguity_resolution(this))) {
-            throw client_error(*ec, "before_atr_commit_ambiguity_resolution hook threw error");
-        }
-        std::string prefix(ATR_FIELD_ATTEMPTS + "." + id() + ".");
-        couchbase::operations::lookup_in_request req{ atr_id_.value() };
-        req.specs.add_spec(protocol::subdoc_opcode::get, true, prefix + ATR_FIELD_STATUS);
-        wrap_request(req, overall_.config());
-        auto barrier = std::make_shared<std::promise<result>>();
-        auto f = barrier->get_future();
-        overall_.cluster_ref().execute(req, [barrier](couchbase::operations::lookup_in_response resp) {
-            barrier->set_value(result::create_from_subdoc_response(resp));
-        });
-        auto res = wrap_operation_future(f);
-        auto atr_status_raw = res.values[0].content_as<std::string>();
-        debug("atr_commit_ambiguity_resolution read atr state {}", atr_status_raw);
-        auto atr_status = attempt_state_value(atr_status_raw);
-        switch (atr_status) {
-            case attempt_state::COMMITTED:
-                return;
-            case attempt_state::ABORTED:
-                // aborted by another process?
-                throw transaction_operation_failed(FAIL_OTHER, "transaction aborted externally").retry();
-            default:
-                throw transaction_operation_failed(FAIL_OTHER, "unexpected state found on ATR ambiguity resolution")
-                  .cause(ILLEGAL_STATE_EXCEPTION)
-                  .no_rollback();
+    while (true) {
+        try {
+            auto ec = error_if_expired_and_not_in_overtime(STAGE_ATR_COMMIT_AMBIGUITY_RESOLUTION, {});
+            if (ec) {
+                throw client_error(*ec, "atr_commit_ambiguity_resolution raised error");
+            }
+            if (!!(ec = hooks_.before_atr_commit_ambiguity_resolution(this))) {
+                throw client_error(*ec, "before_atr_commit_ambiguity_resolution hook threw error");
+            }
+            std::string prefix(ATR_FIELD_ATTEMPTS + "." + id() + ".");
+            couchbase::operations::lookup_in_request req{ atr_id_.value() };
+            req.specs.add_spec(protocol::subdoc_opcode::get, true, prefix + ATR_FIELD_STATUS);
+            wrap_request(req, overall_.config(), op_timeout_cap());
+            auto barrier = std::make_shared<std::promise<result>>();
+            auto f = barrier->get_future();
+            execute_kv(req, [barrier](couchbase::operations::lookup_in_response resp) {
+                barrier->set_value(result::create_from_subdoc_response(resp));
+            });
+            auto res = wrap_operation_future(f);
+            auto atr_status_raw = res.values[0].content_as<std::string>();
+            debug("atr_commit_ambiguity_resolution read atr state {}", atr_status_raw);
+            auto atr_status = attempt_state_value(atr_status_raw);
+            switch (atr_status) {
+                case attempt_state::COMMITTED:
+                    return;
+                case attempt_state::ABORTED:
+                    // aborted by another process?
+                    throw transaction_operation_failed(FAIL_OTHER, "transaction aborted externally").retry();
+                default:
+                    throw transaction_operation_failed(FAIL_OTHER, "unexpected state found on ATR ambiguity resolution")
+                      .cause(ILLEGAL_STATE_EXCEPTION)
+                      .no_rollback();
+            }
+        } catch (const client_error& e) {
+            error_class ec = e.ec();
+            switch (ec) {
+                case FAIL_EXPIRY:
+                    throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
+                case FAIL_HARD:
+                    throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
+                case FAIL_TRANSIENT:
+                case FAIL_OTHER:
+                    break;
+                case FAIL_PATH_NOT_FOUND:
+                    throw transaction_operation_failed(ec, e.what())
+                      .cause(ACTIVE_TRANSACTION_RECORD_ENTRY_NOT_FOUND)
+                      .no_rollback()
+                      .ambiguous();
+                case FAIL_DOC_NOT_FOUND:
+                    throw transaction_operation_failed(ec, e.what())
+                      .cause(ACTIVE_TRANSACTION_RECORD_NOT_FOUND)
+                      .no_rollback()
+                      .ambiguous();
+                default:
+                    throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
+            }
         }
-    } catch (const client_error& e) {
-        error_class ec = e.ec();
-        switch (ec) {
-            case FAIL_EXPIRY:
-                throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
-            case FAIL_HARD:
-                throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
-            case FAIL_TRANSIENT:
-            case FAIL_OTHER:
-                throw retry_operation(e.what());
-            case FAIL_PATH_NOT_FOUND:
-                throw transaction_operation_failed(ec, e.what()).cause(ACTIVE_TRANSACTION_RECORD_ENTRY_NOT_FOUND).no_rollback().ambiguous();
-            case FAIL_DOC_NOT_FOUND:
-                throw transaction_operation_failed(ec, e.what()).cause(ACTIVE_TRANSACTION_RECORD_NOT_FOUND).no_rollback().ambiguous();
-            default:
-                throw transaction_operation_failed(ec, e.what()).no_rollback().ambiguous();
+        if (!commit_retries_.try_wait(STAGE_ATR_COMMIT_AMBIGUITY_RESOLUTION)) {
+            throw transaction_operation_failed(FAIL_EXPIRY, "atr_commit_ambiguity_resolution ran out of time retrying")
+              .no_rollback()
+              .ambiguous();
         }
     }
 }
@@ -1383,10 +1421,10 @@ attempt_context_impl::atr_complete()
         std::string prefix(ATR_FIELD_ATTEMPTS + "." + id());
         couchbase::operations::mutate_in_request req{ atr_id_.value() };
         req.specs.add_spec(protocol::subdoc_opcode::remove, true, prefix);
-        wrap_durable_request(req, overall_.config());
+        wrap_durable_request(req, overall_.config(), op_timeout_cap());
         auto barrier = std::make_shared<std::promise<result>>();
         auto f = barrier->get_future();
-        overall_.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         wrap_operation_future(f);
@@ -1445,9 +1483,15 @@ attempt_context_impl::commit()
             throw transaction_operation_failed(FAIL_EXPIRY, "transaction expired").expired();
         }
         if (atr_id_ && !atr_id_->key().empty() && !is_done_) {
-            retry_op_exp<void>([&]() { atr_commit(false); });
-            staged_mutations_->commit(*this);
-            atr_complete();
+            try {
+                atr_commit(false);
+                staged_mutations_->commit(*this);
+                atr_complete();
+            } catch (...) {
+                record_commit_retries();
+                throw;
+            }
+            record_commit_retries();
             is_done_ = true;
         } else {
             // no mutation, no need to commit
@@ -1463,6 +1507,16 @@ attempt_context_impl::commit()
     }
 }
 
+void
+attempt_context_impl::record_commit_retries()
+{
+    auto retries = commit_retries_.retries();
+    for (const auto& [stage, count] : retries) {
+        debug("commit stage {} used {} retries", stage, count);
+    }
+    overall_.current_attempt().commit_retries = std::move(retries);
+}
+
 void
 attempt_context_impl::atr_abort()
 {
@@ -1485,10 +1539,10 @@ attempt_context_impl::atr_abort()
         req.specs.add_spec(
           protocol::subdoc_opcode::dict_upsert, true, true, true, prefix + ATR_FIELD_TIMESTAMP_ROLLBACK_START, mutate_in_macro::CAS);
         staged_mutations_->extract_to(prefix, req);
-        wrap_durable_request(req, overall_.config());
+        wrap_durable_request(req, overall_.config(), op_timeout_cap());
         auto barrier = std::make_shared<std::promise<result>>();
         auto f = barrier->get_future();
-        overall_.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         wrap_operation_future(f);
@@ -1540,10 +1594,10 @@ attempt_context_impl::atr_rollback_complete()
         std::string prefix(ATR_FIELD_ATTEMPTS + "." + id());
         couchbase::operations::mutate_in_request req{ atr_id_.value() };
         req.specs.add_spec(protocol::subdoc_opcode::remove, true, prefix);
-        wrap_durable_request(req, overall_.config());
+        wrap_durable_request(req, overall_.config(), op_timeout_cap());
         auto barrier = std::make_shared<std::promise<result>>();
         auto f = barrier->get_future();
-        overall_.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         wrap_operation_future(f);
@@ -1696,6 +1750,15 @@ attempt_context_impl::error_if_expired_and_not_in_overtime(const std::string& st
     return {};
 }
 
+std::optional<std::chrono::milliseconds>
+attempt_context_impl::op_timeout_cap() const
+{
+    if (expiry_overtime_mode_.load()) {
+        return {};
+    }
+    return std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(overall_.remaining()));
+}
+
 void
 attempt_context_impl::check_expiry_during_commit_or_rollback(const std::string& stage, std::optional<const std::string> doc_id)
 {
@@ -1796,8 +1859,8 @@ attempt_context_impl::set_atr_pending_locked(const couchbase::document_id& id, s
             req.specs.add_spec(protocol::subdoc_opcode::set_doc, false, false, false, std::string(""), jsonify(std::string({ 0x00 })));
             req.store_semantics = protocol::mutate_in_request_body::store_semantics_type::upsert;
 
-            wrap_durable_request(req, overall_.config());
-            overall_.cluster_ref().execute(req, [this, fn, error_handler](couchbase::operations::mutate_in_response resp) {
+            wrap_durable_request(req, overall_.config(), op_timeout_cap());
+            execute_kv(req, [this, fn, error_handler](couchbase::operations::mutate_in_response resp) {
                 auto ec = error_class_from_response(resp);
                 if (!ec) {
                     ec = hooks_.after_atr_pending(this);
@@ -1895,7 +1958,7 @@ attempt_context_impl::do_get(const couchbase::document_id& id, const std::option
                                                                doc->links().atr_collection_name().value(),
                                                                doc->links().atr_id().value() };
                             active_transaction_record::get_atr(
-                              cluster_ref(),
+                              overall_.kv(),
                               doc_atr_id,
                               [this, id, doc, cb = std::move(cb)](std::error_code ec, std::optional<active_transaction_record> atr) {
                                   if (!ec && atr) {
@@ -1996,9 +2059,9 @@ attempt_context_impl::get_doc(
     req.specs.add_spec(protocol::subdoc_opcode::get, true, FORWARD_COMPAT);
     req.specs.add_spec(protocol::subdoc_opcode::get_doc, false, "");
     req.access_deleted = true;
-    wrap_request(req, overall_.config());
+    wrap_request(req, overall_.config(), op_timeout_cap());
     try {
-        overall_.cluster_ref().execute(req, [this, id, cb = std::move(cb)](couchbase::operations::lookup_in_response resp) {
+        execute_kv(req, [this, id, cb = std::move(cb)](couchbase::operations::lookup_in_response resp) {
             auto ec = error_class_from_response(resp);
             if (ec) {
                 trace("get_doc got error {} : {}", resp.ctx.ec.message(), *ec);
@@ -2159,8 +2222,8 @@ attempt_context_impl::create_staged_insert(const couchbase::document_id& id,
     req.cas.value = cas;
     req.store_semantics = cas == 0 ? protocol::mutate_in_request_body::store_semantics_type::insert
                                    : protocol::mutate_in_request_body::store_semantics_type::replace;
-    wrap_durable_request(req, overall_.config());
-    overall_.cluster_ref().execute(req, [this, id, content, cas, cb, delay](couchbase::operations::mutate_in_response resp) {
+    wrap_durable_request(req, overall_.config(), op_timeout_cap());
+    execute_kv(req, [this, id, content, cas, cb, delay](couchbase::operations::mutate_in_response resp) {
         auto ec = hooks_.after_staged_insert_complete(this, id.key());
         if (ec) {
             return create_staged_insert_error_handler(id, content, cas, std::move(delay), cb, *ec, "after_staged_insert hook threw error");
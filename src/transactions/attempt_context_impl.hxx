@@ -21,6 +21,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 
 #include <couchbase/transactions/async_attempt_context.hxx>
@@ -33,6 +34,7 @@
 #include "couchbase/transactions/internal/exceptions_internal.hxx"
 #include "couchbase/transactions/internal/transaction_context.hxx"
 #include "error_list.hxx"
+#include "retry_controller.hxx"
 #include "waitable_op_list.hxx"
 
 namespace couchbase
@@ -61,6 +63,8 @@ namespace transactions
         error_list errors_;
         std::mutex mutex_;
         waitable_op_list op_list_;
+        // bounds (and counts) all the retries on the commit path
+        retry_controller commit_retries_;
 
         // commit needs to access the hooks
         friend class staged_mutation_queue;
@@ -283,6 +287,20 @@ namespace transactions
 
         cluster& cluster_ref();
 
+        // Execute a KV op, recording its latency so that cleanup can back off if it is slowing transactions down.
+        template<typename Request, typename Handler>
+        void execute_kv(Request&& req, Handler&& handler)
+        {
+            using response_type = typename std::decay_t<Request>::response_type;
+            auto start = std::chrono::steady_clock::now();
+            overall_.kv().execute(
+              std::forward<Request>(req),
+              [&throttle = overall_.cleanup().throttle(), start, handler = std::forward<Handler>(handler)](response_type resp) mutable {
+                  throttle.record(std::chrono::steady_clock::now() - start);
+                  handler(std::move(resp));
+              });
+        }
+
       public:
         attempt_context_impl(transaction_context& transaction_ctx);
         ~attempt_context_impl();
@@ -334,6 +352,9 @@ namespace transactions
         void state(attempt_state s)
         {
             overall_.current_attempt().state = s;
+            if (atr_id_) {
+                overall_.cleanup().journal_attempt(*atr_id_, id(), s);
+            }
         }
 
         CB_NODISCARD const std::string atr_id()
@@ -370,6 +391,10 @@ namespace transactions
 
         std::optional<error_class> error_if_expired_and_not_in_overtime(const std::string& stage, std::optional<const std::string> doc_id);
 
+        // Cap on the timeout of a KV op issued now, so it cannot outlive the transaction.  Empty in expiry-overtime mode, where
+        // we deliberately run past expiry to finish a commit or rollback.
+        CB_NODISCARD std::optional<std::chrono::milliseconds> op_timeout_cap() const;
+
         staged_mutation* check_for_own_write(const couchbase::document_id& id);
 
         template<typename Handler>
@@ -385,6 +410,8 @@ namespace transactions
 
         void atr_commit_ambiguity_resolution();
 
+        void record_commit_retries();
+
         void atr_complete();
 
         void atr_abort();
@@ -406,6 +433,18 @@ namespace transactions
                                                                         const std::string type,
                                                                         std::optional<std::string> content = std::nullopt);
 
+      public:
+        // The staging request for this attempt, without durability or timeout.  Static so it can be benchmarked without a cluster.
+        static couchbase::operations::mutate_in_request create_staging_request(const couchbase::document_id& in,
+                                                                               const transaction_get_result* document,
+                                                                               const std::string& type,
+                                                                               const std::optional<std::string>& content,
+                                                                               const std::string& transaction_id,
+                                                                               const std::string& attempt_id,
+                                                                               const couchbase::document_id& atr_id);
+
+      private:
+
         template<typename Handler, typename Delay>
         void create_staged_insert(const couchbase::document_id& id, const std::string& content, uint64_t cas, Delay&& delay, Handler&& cb);
 
@@ -0,0 +1,181 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace couchbase::transactions
+{
+
+/**
+ * Runs a scan of each bucket once per interval, on a fixed pool of worker threads.
+ *
+ * Each bucket has its own cadence: its next scan is due one interval after its last one started, regardless of how the
+ * other buckets are doing, so a slow bucket only delays itself.  When more scans are due than there are workers, the one
+ * that has been due longest runs first.  Buckets can be added and removed while the scheduler runs; a scan that is in
+ * progress when its bucket is removed is allowed to finish.
+ *
+ * With some jitter, each interval is shortened by a random fraction of up to that much, so that many processes started at
+ * the same time (and all scheduling the same work) drift apart rather than hitting the cluster in lockstep.
+ */
+class bucket_scan_scheduler
+{
+  public:
+    using scan_fn = std::function<void(const std::string&)>;
+
+    bucket_scan_scheduler(size_t workers, std::chrono::milliseconds interval, scan_fn scan, double jitter = 0)
+      : interval_(interval)
+      , jitter_(std::clamp(jitter, 0.0, 1.0))
+      , scan_(std::move(scan))
+      , random_(std::random_device{}())
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, workers); i++) {
+            workers_.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    ~bucket_scan_scheduler()
+    {
+        stop();
+    }
+
+    bucket_scan_scheduler(const bucket_scan_scheduler&) = delete;
+    bucket_scan_scheduler& operator=(const bucket_scan_scheduler&) = delete;
+
+    // A newly added bucket is due for a scan immediately.  Adding a bucket that is already scheduled does nothing.
+    void add_bucket(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.emplace(name, task{ std::chrono::steady_clock::now() }).second) {
+            cv_.notify_one();
+        }
+    }
+
+    void remove_bucket(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.erase(name);
+    }
+
+    std::set<std::string> buckets() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::set<std::string> names;
+        for (const auto& [name, t] : tasks_) {
+            names.insert(name);
+        }
+        return names;
+    }
+
+    // The interval, shortened by a random fraction of up to jitter of it.
+    static std::chrono::steady_clock::duration jittered(std::chrono::milliseconds interval, double jitter, std::mt19937& random)
+    {
+        if (jitter == 0) {
+            return interval;
+        }
+        std::uniform_real_distribution<double> shorten_by(0, jitter);
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * (1 - shorten_by(random)));
+    }
+
+    // Stops the workers, waiting for any scans in progress to return.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopped_) {
+                return;
+            }
+            stopped_ = true;
+            cv_.notify_all();
+        }
+        for (auto& thr : workers_) {
+            if (thr.joinable()) {
+                thr.join();
+            }
+        }
+    }
+
+  private:
+    struct task {
+        std::chrono::steady_clock::time_point due;
+        bool scanning{ false };
+    };
+
+    void worker_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopped_) {
+            auto next = tasks_.end();
+            for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+                if (!it->second.scanning && (next == tasks_.end() || it->second.due < next->second.due)) {
+                    next = it;
+                }
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (next == tasks_.end()) {
+                cv_.wait(lock);
+                continue;
+            }
+            if (next->second.due > now) {
+                cv_.wait_until(lock, next->second.due);
+                continue;
+            }
+            auto name = next->first;
+            next->second.scanning = true;
+            lock.unlock();
+            try {
+                scan_(name);
+            } catch (...) {
+                // the scan function is expected to deal with its own errors, just don't let them kill the worker.
+            }
+            lock.lock();
+            // the bucket may have been removed (and even re-added) while we were scanning it.
+            if (auto it = tasks_.find(name); it != tasks_.end() && it->second.scanning) {
+                it->second.scanning = false;
+                it->second.due = now + next_interval();
+            }
+            cv_.notify_one();
+        }
+    }
+
+    // call with the lock held
+    std::chrono::steady_clock::duration next_interval()
+    {
+        return jittered(interval_, jitter_, random_);
+    }
+
+    const std::chrono::milliseconds interval_;
+    const double jitter_;
+    const scan_fn scan_;
+    std::mt19937 random_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<std::string, task> tasks_;
+    bool stopped_{ false };
+    std::vector<std::thread> workers_;
+};
+} // namespace couchbase::transactions
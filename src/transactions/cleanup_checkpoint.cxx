@@ -0,0 +1,139 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <couchbase/internal/nlohmann/json.hpp>
+
+#include "cleanup_checkpoint.hxx"
+#include "uid_generator.hxx"
+
+namespace tx = couchbase::transactions;
+
+namespace
+{
+constexpr int CHECKPOINT_VERSION = 1;
+} // namespace
+
+void
+tx::cleanup_checkpoint::load()
+{
+    if (!path_ || !std::filesystem::exists(*path_)) {
+        return;
+    }
+    std::ifstream in(*path_);
+    if (!in) {
+        throw std::runtime_error("could not open cleanup checkpoint " + *path_);
+    }
+    auto j = nlohmann::json::parse(in);
+    if (j.value("version", 0) != CHECKPOINT_VERSION) {
+        throw std::runtime_error("cleanup checkpoint " + *path_ + " has an unknown version");
+    }
+    std::map<std::string, std::map<std::string, atr_progress>> buckets;
+    for (const auto& [bucket_name, atrs] : j.at("buckets").items()) {
+        auto& progress = buckets[bucket_name];
+        for (const auto& [atr_id, p] : atrs.items()) {
+            // [entries, scanned_ms]
+            progress[atr_id] = { p.at(0).get<size_t>(), p.at(1).get<uint64_t>() };
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    buckets_ = std::move(buckets);
+}
+
+void
+tx::cleanup_checkpoint::save() const
+{
+    if (!path_) {
+        return;
+    }
+    // A save must not replace the file with an older snapshot than the last, so only one at a time.
+    std::lock_guard<std::mutex> saving(save_mutex_);
+    nlohmann::json j;
+    j["version"] = CHECKPOINT_VERSION;
+    auto& buckets = j["buckets"] = nlohmann::json::object();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [bucket_name, atrs] : buckets_) {
+            auto& b = buckets[bucket_name] = nlohmann::json::object();
+            for (const auto& [atr_id, p] : atrs) {
+                b[atr_id] = { p.entries, p.scanned_ms };
+            }
+        }
+    }
+    // Other processes, or other transactions objects, may be saving to the same path, so each save has a temporary file of
+    // its own.  The last rename wins, which is fine, as each is a whole checkpoint.
+    auto tmp = *path_ + "." + uid_generator::next() + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << j.dump();
+        if (!out) {
+            out.close();
+            std::error_code ignored;
+            std::filesystem::remove(tmp, ignored);
+            throw std::runtime_error("could not write cleanup checkpoint " + tmp);
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, *path_, ec);
+    if (ec) {
+        std::error_code ignored;
+        std::filesystem::remove(tmp, ignored);
+        throw std::filesystem::filesystem_error("could not replace cleanup checkpoint", tmp, *path_, ec);
+    }
+}
+
+void
+tx::cleanup_checkpoint::scanned(const std::string& bucket_name, const std::string& atr_id, size_t entries)
+{
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+    std::lock_guard<std::mutex> lock(mutex_);
+    buckets_[bucket_name][atr_id] = { entries, static_cast<uint64_t>(now.count()) };
+}
+
+void
+tx::cleanup_checkpoint::prioritise(const std::string& bucket_name, std::vector<std::string>& atr_ids) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = buckets_.find(bucket_name);
+    if (it == buckets_.end()) {
+        return;
+    }
+    const auto& atrs = it->second;
+    auto progress_of = [&](const std::string& atr_id) {
+        auto p = atrs.find(atr_id);
+        return p == atrs.end() ? atr_progress{} : p->second;
+    };
+    std::stable_sort(atr_ids.begin(), atr_ids.end(), [&](const std::string& a, const std::string& b) {
+        auto pa = progress_of(a);
+        auto pb = progress_of(b);
+        if (pa.entries != pb.entries) {
+            return pa.entries > pb.entries;
+        }
+        return pa.scanned_ms < pb.scanned_ms;
+    });
+}
+
+std::map<std::string, tx::atr_progress>
+tx::cleanup_checkpoint::progress(const std::string& bucket_name) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = buckets_.find(bucket_name);
+    return it == buckets_.end() ? std::map<std::string, atr_progress>{} : it->second;
+}
@@ -0,0 +1,85 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <couchbase/support.hxx>
+
+namespace couchbase::transactions
+{
+
+struct atr_progress {
+    // attempts in the ATR when it was last looked at
+    size_t entries{ 0 };
+    // when it was last looked at, in ms since the epoch, or 0 if never
+    uint64_t scanned_ms{ 0 };
+};
+
+/**
+ * What the lost attempts cleanup has learnt about each ATR in each bucket, so each pass can look where the work is likely to
+ * be first.
+ *
+ * With a path, it can be saved to and loaded from a local file, so a restarted client picks up where it left off rather than
+ * starting from scratch.  The file is a hint: if it is missing, out of date, or from a client that had different ATRs to
+ * look at, the worst that happens is that the ATRs are looked at in a less useful order.
+ */
+class cleanup_checkpoint
+{
+  public:
+    explicit cleanup_checkpoint(std::optional<std::string> path = {})
+      : path_(std::move(path))
+    {
+    }
+
+    // Replaces what is known with what is in the file, if there is one.  Throws if it can't be read or parsed.
+    void load();
+
+    // Writes what is known to the file, replacing it in one go, so a crash mid-save leaves the old one.  Safe to call from
+    // several threads at once.  Throws on failure.
+    void save() const;
+
+    CB_NODISCARD const std::optional<std::string>& path() const
+    {
+        return path_;
+    }
+
+    void scanned(const std::string& bucket_name, const std::string& atr_id, size_t entries);
+
+    /**
+     * Puts the ATRs in the order to look at them: those which had attempts in them last time first, busiest first, then the
+     * rest, those not looked at for longest (or ever) first.  In a steady state this keeps each ATR at the same point in
+     * each pass, and after a restart it starts with what has been left longest.
+     */
+    void prioritise(const std::string& bucket_name, std::vector<std::string>& atr_ids) const;
+
+    CB_NODISCARD std::map<std::string, atr_progress> progress(const std::string& bucket_name) const;
+
+  private:
+    const std::optional<std::string> path_;
+    mutable std::mutex mutex_;
+    // held for the whole of a save, the other just while taking a snapshot
+    mutable std::mutex save_mutex_;
+    std::map<std::string, std::map<std::string, atr_progress>> buckets_;
+};
+} // namespace couchbase::transactions
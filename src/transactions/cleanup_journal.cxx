@@ -0,0 +1,384 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "cleanup_journal.hxx"
+
+namespace tx = couchbase::transactions;
+
+namespace
+{
+// Each region starts with this, then its generation, zero-padded so that the header is always the same size.
+constexpr char header_prefix[] = "cleanup-journal\t";
+constexpr size_t generation_digits = 20;
+constexpr size_t header_size = sizeof(header_prefix) - 1 + generation_digits + 1;
+
+std::string
+header_for(uint64_t generation)
+{
+    auto digits = std::to_string(generation);
+    return header_prefix + std::string(generation_digits - digits.size(), '0') + digits + "\n";
+}
+
+// The region's generation, if it starts with a whole header.
+std::optional<uint64_t>
+generation_of(const std::string& header)
+{
+    constexpr size_t prefix_size = sizeof(header_prefix) - 1;
+    if (header.size() < header_size || header.compare(0, prefix_size, header_prefix) != 0 || header[header_size - 1] != '\n') {
+        return {};
+    }
+    uint64_t generation = 0;
+    for (size_t i = prefix_size; i < header_size - 1; i++) {
+        if (header[i] < '0' || header[i] > '9') {
+            return {};
+        }
+        generation = generation * 10 + static_cast<uint64_t>(header[i] - '0');
+    }
+    return generation;
+}
+
+// Which of the regions of an existing file of this size, starting with these, has the newest generation - if either is whole.
+std::optional<std::pair<size_t, uint64_t>>
+newest_region(const std::string& first, const std::string& second, size_t size)
+{
+    if (size % 2 != 0 || size / 2 < header_size) {
+        return {};
+    }
+    auto a = generation_of(first);
+    auto b = generation_of(second);
+    if (b && (!a || *b > *a)) {
+        return std::make_pair(size_t{ 1 }, *b);
+    }
+    if (a) {
+        return std::make_pair(size_t{ 0 }, *a);
+    }
+    return {};
+}
+
+bool
+is_finished(tx::attempt_state state)
+{
+    return state == tx::attempt_state::COMPLETED || state == tx::attempt_state::ROLLED_BACK;
+}
+
+#ifdef _WIN32
+[[noreturn]] void
+throw_last_error(const std::string& what)
+{
+    throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+}
+
+// as much of a header as there is at offset
+std::string
+read_at(HANDLE file, size_t offset)
+{
+    std::string buf(header_size, '\0');
+    OVERLAPPED at{};
+    at.Offset = static_cast<DWORD>(offset);
+    at.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+    DWORD read = 0;
+    if (!ReadFile(file, buf.data(), static_cast<DWORD>(buf.size()), &read, &at)) {
+        read = 0;
+    }
+    buf.resize(read);
+    return buf;
+}
+#else
+[[noreturn]] void
+throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+[[noreturn]] void
+close_and_throw(int fd, const std::string& what)
+{
+    auto err = errno;
+    ::close(fd);
+    errno = err;
+    throw_errno(what);
+}
+
+// as much of a header as there is at offset
+std::string
+read_at(int fd, size_t offset)
+{
+    std::string buf(header_size, '\0');
+    auto read = ::pread(fd, buf.data(), buf.size(), static_cast<off_t>(offset));
+    buf.resize(read > 0 ? static_cast<size_t>(read) : 0);
+    return buf;
+}
+#endif
+} // namespace
+
+tx::cleanup_journal::cleanup_journal(const std::string& path, size_t capacity)
+  : path_(path)
+  , capacity_(capacity)
+{
+    if (capacity < 2 * (header_size + 1)) {
+        throw std::invalid_argument("cleanup journal capacity " + std::to_string(capacity) + " is too small");
+    }
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        throw_last_error("could not open cleanup journal " + path);
+    }
+    OVERLAPPED whole_file{};
+    if (!LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &whole_file)) {
+        auto err = GetLastError();
+        CloseHandle(file_);
+        SetLastError(err);
+        throw_last_error("cleanup journal " + path + " is in use by another transactions object");
+    }
+    LARGE_INTEGER existing_size;
+    if (!GetFileSizeEx(file_, &existing_size)) {
+        auto err = GetLastError();
+        CloseHandle(file_);
+        SetLastError(err);
+        throw_last_error("could not size cleanup journal " + path);
+    }
+    auto existing = static_cast<size_t>(existing_size.QuadPart);
+    auto newest = newest_region(read_at(file_, 0), read_at(file_, existing / 2), existing);
+    if (newest) {
+        capacity_ = existing;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(capacity_), nullptr);
+    if (mapping_ == nullptr) {
+        CloseHandle(file_);
+        throw_last_error("could not map cleanup journal " + path);
+    }
+    data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, capacity_));
+    if (data_ == nullptr) {
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+        throw_last_error("could not map cleanup journal " + path);
+    }
+#else
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw_errno("could not open cleanup journal " + path);
+    }
+    // the lock goes with the descriptor, so it is released however this process ends.
+    if (::flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+        close_and_throw(fd_, "cleanup journal " + path + " is in use by another transactions object");
+    }
+    auto end = ::lseek(fd_, 0, SEEK_END);
+    if (end < 0) {
+        close_and_throw(fd_, "could not size cleanup journal " + path);
+    }
+    auto existing = static_cast<size_t>(end);
+    auto newest = newest_region(read_at(fd_, 0), read_at(fd_, existing / 2), existing);
+    if (newest) {
+        capacity_ = existing;
+    } else if (::ftruncate(fd_, static_cast<off_t>(capacity_)) != 0) {
+        close_and_throw(fd_, "could not size cleanup journal " + path);
+    }
+    auto* mapped = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED) {
+        close_and_throw(fd_, "could not map cleanup journal " + path);
+    }
+    data_ = static_cast<char*>(mapped);
+#endif
+    region_size_ = capacity_ / 2;
+    if (!newest) {
+        // nothing to recover, so start afresh in the first region
+        std::memset(data_, 0, capacity_);
+        generation_ = 1;
+        write_region(active_, generation_, {});
+        used_ = header_size;
+        return;
+    }
+    active_ = newest->first;
+    generation_ = newest->second;
+    // Nothing is cleaning the recovered attempts up yet, so they stay where they are in the journal (and are recovered again
+    // should this run crash too) until they are recorded as finished.
+    auto unfinished = replay(region() + header_size, region_size_ - header_size, used_);
+    used_ += header_size;
+    // clears a line cut short by the crash, which the next one appended would otherwise run on from
+    std::memset(region() + used_, 0, region_size_ - used_);
+    for (auto& [key, r] : unfinished) {
+        recovered_.push_back(r);
+        outstanding_.emplace(key, std::move(r));
+    }
+}
+
+tx::cleanup_journal::~cleanup_journal()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+#else
+    ::munmap(data_, capacity_);
+    ::close(fd_);
+#endif
+}
+
+std::string
+tx::cleanup_journal::key_for(const couchbase::document_id& atr_id, const std::string& attempt_id)
+{
+    return atr_id.bucket() + "/" + atr_id.scope() + "/" + atr_id.collection() + "/" + atr_id.key() + "/" + attempt_id;
+}
+
+std::string
+tx::cleanup_journal::to_line(const journal_record& r)
+{
+    // none of these can contain a tab or a newline
+    return std::string(attempt_state_name(r.state)) + "\t" + r.atr_id.bucket() + "\t" + r.atr_id.scope() + "\t" +
+           r.atr_id.collection() + "\t" + r.atr_id.key() + "\t" + r.attempt_id + "\n";
+}
+
+std::map<std::string, tx::journal_record>
+tx::cleanup_journal::replay(const char* data, size_t size, size_t& replayed)
+{
+    std::map<std::string, journal_record> unfinished;
+    size_t start = 0;
+    while (start < size && data[start] != '\0') {
+        auto end = start;
+        while (end < size && data[end] != '\n' && data[end] != '\0') {
+            end++;
+        }
+        if (end == size || data[end] != '\n') {
+            // cut short
+            break;
+        }
+        std::istringstream fields(std::string(data + start, end - start));
+        std::string state, bucket, scope, collection, key, attempt_id;
+        if (std::getline(fields, state, '\t') && std::getline(fields, bucket, '\t') && std::getline(fields, scope, '\t') &&
+            std::getline(fields, collection, '\t') && std::getline(fields, key, '\t') && std::getline(fields, attempt_id)) {
+            journal_record r{ { bucket, scope, collection, key }, attempt_id, attempt_state_value(state) };
+            auto k = key_for(r.atr_id, r.attempt_id);
+            if (is_finished(r.state)) {
+                unfinished.erase(k);
+            } else {
+                unfinished.insert_or_assign(k, std::move(r));
+            }
+        }
+        start = end + 1;
+    }
+    replayed = start;
+    return unfinished;
+}
+
+void
+tx::cleanup_journal::record(const couchbase::document_id& atr_id, const std::string& attempt_id, attempt_state state)
+{
+    journal_record r{ atr_id, attempt_id, state };
+    auto line = to_line(r);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto k = key_for(atr_id, attempt_id);
+    if (is_finished(state)) {
+        if (outstanding_.erase(k) == 0) {
+            // never recorded starting (perhaps it was dropped), so no need to record it finishing
+            return;
+        }
+    } else {
+        outstanding_.insert_or_assign(k, r);
+    }
+    if (!append(line)) {
+        compact();
+        if (!append(line)) {
+            dropped_++;
+        }
+    }
+}
+
+char*
+tx::cleanup_journal::region(size_t index) const
+{
+    return data_ + index * region_size_;
+}
+
+char*
+tx::cleanup_journal::region() const
+{
+    return region(active_);
+}
+
+bool
+tx::cleanup_journal::append(const std::string& line)
+{
+    if (used_ + line.size() > region_size_) {
+        return false;
+    }
+    std::memcpy(region() + used_, line.data(), line.size());
+    used_ += line.size();
+    return true;
+}
+
+void
+tx::cleanup_journal::compact()
+{
+    std::string live;
+    for (const auto& [key, r] : outstanding_) {
+        live += to_line(r);
+    }
+    if (header_size + live.size() > region_size_) {
+        return;
+    }
+    // the active region is left alone, so should this crash part way, replay still has it
+    auto target = 1 - active_;
+    write_region(target, generation_ + 1, live);
+    active_ = target;
+    generation_++;
+    used_ = header_size + live.size();
+}
+
+void
+tx::cleanup_journal::write_region(size_t index, uint64_t generation, const std::string& body)
+{
+    auto* target = region(index);
+    // Replay ignores a region without a whole header, so the header goes in last, once the body is there to go with it.  The
+    // fences stop the compiler moving the stores across each other; a store to the mapping is in the file as soon as it is made.
+    std::memset(target, 0, region_size_);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    std::memcpy(target + header_size, body.data(), body.size());
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    auto header = header_for(generation);
+    std::memcpy(target, header.data(), header.size());
+}
+
+size_t
+tx::cleanup_journal::outstanding() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return outstanding_.size();
+}
+
+size_t
+tx::cleanup_journal::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
@@ -0,0 +1,115 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <couchbase/document_id.hxx>
+#include <couchbase/support.hxx>
+#include <couchbase/transactions/attempt_state.hxx>
+
+namespace couchbase::transactions
+{
+
+struct journal_record {
+    couchbase::document_id atr_id;
+    std::string attempt_id;
+    attempt_state state;
+};
+
+/**
+ * A local, append-only record of the state of this process's attempts, so that after a crash the next run can clean them up
+ * straight away rather than waiting for them to expire and be found by a lost attempts scan.
+ *
+ * Records are lines of text appended to a memory-mapped file of fixed size: once the copy in memory is written, it survives
+ * the process crashing, without a syscall per record.  (It needn't survive the machine crashing - the lost attempts scan
+ * will get those attempts eventually anyway.)  A line cut short by a crash is ignored.
+ *
+ * The file is two regions, each starting with a header giving its generation, and records go to the one with the newest.  When
+ * that fills up, the attempts which are still outstanding are written to the other, whose header goes in last with the next
+ * generation, so a crash at any point leaves one or other region whole.  If that doesn't make room, the record is dropped.
+ *
+ * Opening the journal reads what the previous run left behind, and carries on from there: the attempts that run never
+ * finished stay outstanding until they are recorded as finished.  An existing journal keeps the size it was made with, as
+ * that says where its second region starts.  The file is locked while open, so each journal is only used by one transactions
+ * object at a time.
+ */
+class cleanup_journal
+{
+  public:
+    static constexpr size_t default_capacity = 4 * 1024 * 1024;
+
+    // throws std::system_error if the file can't be opened and mapped, or another transactions object has it open, and
+    // std::invalid_argument if the capacity is too small to hold anything.
+    explicit cleanup_journal(const std::string& path, size_t capacity = default_capacity);
+    ~cleanup_journal();
+
+    cleanup_journal(const cleanup_journal&) = delete;
+    cleanup_journal& operator=(const cleanup_journal&) = delete;
+
+    // Attempts the previous run started but never finished (in that they never got to COMPLETED or ROLLED_BACK).  They are
+    // outstanding in this run too, until recorded as finished.
+    CB_NODISCARD const std::vector<journal_record>& recovered() const
+    {
+        return recovered_;
+    }
+
+    void record(const couchbase::document_id& atr_id, const std::string& attempt_id, attempt_state state);
+
+    // Attempts this run has started, or recovered, but not yet finished.
+    CB_NODISCARD size_t outstanding() const;
+
+    // Records dropped since the journal was opened, because it was full.
+    CB_NODISCARD size_t dropped() const;
+
+  private:
+    static std::string to_line(const journal_record& r);
+    // replays the records in a region's body, setting replayed to how much of it held whole lines
+    static std::map<std::string, journal_record> replay(const char* data, size_t size, size_t& replayed);
+    static std::string key_for(const couchbase::document_id& atr_id, const std::string& attempt_id);
+
+    CB_NODISCARD char* region(size_t index) const;
+    CB_NODISCARD char* region() const;
+    bool append(const std::string& line);
+    void compact();
+    void write_region(size_t index, uint64_t generation, const std::string& body);
+
+    const std::string path_;
+    size_t capacity_;
+    size_t region_size_{ 0 };
+    char* data_{ nullptr };
+    // the region records go to, and its generation
+    size_t active_{ 0 };
+    uint64_t generation_{ 0 };
+    // how much of the active region is in use, header included
+    size_t used_{ 0 };
+    size_t dropped_{ 0 };
+#ifdef _WIN32
+    void* file_{ nullptr };
+    void* mapping_{ nullptr };
+#else
+    int fd_{ -1 };
+#endif
+    mutable std::mutex mutex_;
+    std::map<std::string, journal_record> outstanding_;
+    std::vector<journal_record> recovered_;
+};
+} // namespace couchbase::transactions
@@ -40,6 +40,11 @@ namespace transactions
     /**
      * Hooks purely for testing purposes.  If you're an end-user looking at these for any reason, then please contact us first
      * about your use-case: we are always open to adding good ideas into the transactions library.
+     *
+     * The hooks are called concurrently, from each of the client attempts cleanup threads and the lost attempts cleanup thread,
+     * so must be thread-safe.  While cleaning an attempt, the per-document hooks (before_commit_doc, before_remove_doc,
+     * before_remove_doc_staged_for_removal and before_remove_links) are called on the thread cleaning it, but while the KV ops of
+     * other documents of the attempt are still in flight, so a hook can't assume the documents before it have been cleaned.
      */
     struct cleanup_testing_hooks {
         error_func3 before_commit_doc = noop1;
@@ -0,0 +1,136 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace couchbase::transactions
+{
+
+/**
+ * Issues a fixed number of asynchronous lookups, with a bounded number in flight, and hands each result to the calling thread
+ * as it completes.
+ *
+ * With a window, the lookups are spread evenly over it: lookup k is not issued before k slots into the window (or as soon after
+ * as there is room), so a slow lookup doesn't eat into the time for the rest.  Without one, they are issued as fast as there is
+ * room.  A throttle level below 1 spreads the remaining slots further apart, and allows proportionally fewer in flight.
+ *
+ * The results are handled on the thread calling run(), which can block.  The state the lookups complete into is shared with
+ * them, so if run() returns early (because it was stopped, or issue or handle threw) any still in flight can safely complete
+ * later.
+ */
+template<typename Result>
+class lookup_pipeline
+{
+  public:
+    using done_fn = std::function<void(Result)>;
+    // issues lookup index, which must call done exactly once, from any thread
+    using issue_fn = std::function<void(size_t index, done_fn done)>;
+    using handle_fn = std::function<void(size_t index, Result result)>;
+
+    lookup_pipeline(size_t count, size_t max_in_flight, std::chrono::microseconds window = std::chrono::microseconds(0))
+      : count_(count)
+      , max_in_flight_(std::max<size_t>(1, max_in_flight))
+      , slot_interval_(window / static_cast<int64_t>(std::max<size_t>(1, count)))
+      , state_(std::make_shared<state>())
+    {
+    }
+
+    // The throttle level (0, 1] is read before each lookup is issued.
+    lookup_pipeline& throttle(std::function<double()> level)
+    {
+        level_ = std::move(level);
+        return *this;
+    }
+
+    // run() checks this at least once per poll interval, and returns false as soon as it says to stop.
+    lookup_pipeline& running(std::function<bool()> running, std::chrono::milliseconds poll_interval = std::chrono::milliseconds(100))
+    {
+        running_ = std::move(running);
+        poll_interval_ = poll_interval;
+        return *this;
+    }
+
+    // Returns true once every lookup has been issued and handled, false if stopped first.
+    bool run(const issue_fn& issue, const handle_fn& handle)
+    {
+        auto slot_time = std::chrono::steady_clock::now();
+        size_t next = 0;
+        size_t handled = 0;
+        while (handled < count_) {
+            if (running_ && !running_()) {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            auto now = std::chrono::steady_clock::now();
+            auto level = level_ ? std::clamp(level_(), 0.01, 1.0) : 1.0;
+            auto next_slot = next < count_ ? slot_time : std::chrono::steady_clock::time_point::max();
+            bool have_room = state_->in_flight < std::max<size_t>(1, static_cast<size_t>(static_cast<double>(max_in_flight_) * level));
+            if (next < count_ && have_room && now >= next_slot) {
+                state_->in_flight++;
+                lock.unlock();
+                auto index = next++;
+                slot_time += std::chrono::duration_cast<std::chrono::steady_clock::duration>(slot_interval_ / level);
+                issue(index, [s = state_, index](Result result) {
+                    std::lock_guard<std::mutex> lock(s->mutex);
+                    s->in_flight--;
+                    s->completed.emplace_back(index, std::move(result));
+                    s->cv.notify_one();
+                });
+                continue;
+            }
+            if (state_->completed.empty()) {
+                // wake for the next slot, a completed lookup, or periodically to notice we've been stopped.
+                auto wake = now + poll_interval_;
+                if (have_room && next_slot < wake) {
+                    wake = next_slot;
+                }
+                state_->cv.wait_until(lock, wake, [&]() { return !state_->completed.empty(); });
+                continue;
+            }
+            auto completed = std::move(state_->completed.front());
+            state_->completed.pop_front();
+            lock.unlock();
+            handled++;
+            handle(completed.first, std::move(completed.second));
+        }
+        return true;
+    }
+
+  private:
+    struct state {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t in_flight{ 0 };
+        std::deque<std::pair<size_t, Result>> completed;
+    };
+
+    const size_t count_;
+    const size_t max_in_flight_;
+    const std::chrono::microseconds slot_interval_;
+    std::function<double()> level_;
+    std::function<bool()> running_;
+    std::chrono::milliseconds poll_interval_{ 100 };
+    std::shared_ptr<state> state_;
+};
+} // namespace couchbase::transactions
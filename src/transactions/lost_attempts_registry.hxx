@@ -0,0 +1,137 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <couchbase/transactions/transaction_config.hxx>
+
+namespace couchbase::transactions
+{
+
+/**
+ * Makes sure only one transactions object in the process looks for lost attempts in the same place.
+ *
+ * Every transactions object with lost attempts cleanup enabled joins under a key (see key_for) naming the cluster, where its
+ * metadata lives, and the settings of its lost attempts cleanup.  The first to join for a key leads: it alone scans the ATRs
+ * and heartbeats in the client record, so N transactions objects sharing a cluster cost the same as one.  Objects with
+ * different settings (a different cleanup window, say) get different keys, so each runs its own cleanup as configured.  When
+ * the leader leaves, the longest-standing member left takes over, and when the last one leaves the key is forgotten.
+ */
+class lost_attempts_registry
+{
+  public:
+    using member_id = const void*;
+    // called, with the registry locked, when a member becomes the leader.  It should just start the work, not wait for it.
+    using lead_fn = std::function<void()>;
+
+    static lost_attempts_registry& instance()
+    {
+        static lost_attempts_registry registry;
+        return registry;
+    }
+
+    /**
+     * The key for a transactions object on the cluster with the config.  Everything that changes what its lost attempts
+     * cleanup does is in it, other than the testing hooks and the report callback, which can't be compared: those of whichever
+     * object leads are used.
+     */
+    static std::string key_for(const void* cluster, const transaction_config& config)
+    {
+        std::ostringstream key;
+        key << cluster << "/";
+        if (auto metadata = config.custom_metadata_collection(); metadata) {
+            key << metadata->bucket << "." << metadata->scope << "." << metadata->collection;
+        }
+        key << "/window=" << config.cleanup_window().count();
+        key << ",kv_timeout=" << (config.kv_timeout() ? config.kv_timeout()->count() : -1);
+        key << ",lookups_in_flight=" << config.cleanup_atr_lookups_in_flight();
+        key << ",scan_threads=" << config.cleanup_bucket_scan_threads();
+        auto latency_target = config.cleanup_foreground_latency_target();
+        key << ",latency_target=" << (latency_target ? latency_target->count() : -1);
+        key << ",min_rate=" << config.cleanup_min_rate();
+        key << ",rendezvous=" << config.cleanup_rendezvous_hashing();
+        key << ",durable_heartbeats=" << config.cleanup_durable_heartbeats();
+        key << ",checkpoint=" << config.cleanup_checkpoint_path().value_or("");
+        return key.str();
+    }
+
+    // Returns true if the member leads (in which case on_lead has already been called).
+    bool join(const std::string& key, member_id id, lead_fn on_lead)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& members = members_[key];
+        members.push_back({ id, std::move(on_lead) });
+        if (members.size() == 1) {
+            members.front().on_lead();
+            return true;
+        }
+        return false;
+    }
+
+    // Leaving a key the member isn't in does nothing, so this is safe to call more than once.
+    void leave(const std::string& key, member_id id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = members_.find(key);
+        if (it == members_.end()) {
+            return;
+        }
+        auto& members = it->second;
+        auto member = std::find_if(members.begin(), members.end(), [id](const auto& m) { return m.id == id; });
+        if (member == members.end()) {
+            return;
+        }
+        bool was_leader = member == members.begin();
+        members.erase(member);
+        if (members.empty()) {
+            members_.erase(it);
+        } else if (was_leader) {
+            members.front().on_lead();
+        }
+    }
+
+    member_id leader(const std::string& key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = members_.find(key);
+        return it == members_.end() ? nullptr : it->second.front().id;
+    }
+
+    size_t members(const std::string& key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = members_.find(key);
+        return it == members_.end() ? 0 : it->second.size();
+    }
+
+  private:
+    struct member {
+        member_id id;
+        lead_fn on_lead;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::vector<member>> members_;
+};
+} // namespace couchbase::transactions
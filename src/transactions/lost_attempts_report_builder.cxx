@@ -0,0 +1,96 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <algorithm>
+#include <exception>
+
+#include "couchbase/transactions/internal/logging.hxx"
+#include "lost_attempts_report_builder.hxx"
+
+namespace tx = couchbase::transactions;
+
+tx::lost_attempts_report_builder::lost_attempts_report_builder(const std::string& bucket_name,
+                                                               size_t num_active_clients,
+                                                               size_t atrs_assigned,
+                                                               std::chrono::milliseconds budget)
+{
+    report_.bucket_name = bucket_name;
+    report_.num_active_clients = num_active_clients;
+    report_.atrs_assigned = atrs_assigned;
+    report_.budget = budget;
+}
+
+void
+tx::lost_attempts_report_builder::failed()
+{
+    report_.atrs_failed++;
+}
+
+bool
+tx::lost_attempts_report_builder::scanned(const std::string& atr_key, const std::vector<atr_entry>& entries, size_t bytes)
+{
+    report_.atrs_scanned++;
+    if (entries.empty()) {
+        return false;
+    }
+    report_.atrs_occupied++;
+    report_.bytes_read += bytes;
+    occupancies_.push_back({ atr_key, entries.size(), bytes });
+    for (const auto& entry : entries) {
+        report_.entries_by_state[entry.state()]++;
+    }
+    if (bytes > lost_attempts_report::near_full_bytes) {
+        report_.atrs_near_full++;
+        return true;
+    }
+    return false;
+}
+
+void
+tx::lost_attempts_report_builder::cleaned(size_t num_cleaned, size_t num_failed)
+{
+    report_.entries_cleaned += num_cleaned;
+    report_.entries_failed += num_failed;
+}
+
+tx::lost_attempts_report
+tx::lost_attempts_report_builder::finish(std::chrono::milliseconds elapsed)
+{
+    report_.elapsed = elapsed;
+    auto fullest = std::min(occupancies_.size(), lost_attempts_report::max_fullest_atrs);
+    std::partial_sort(occupancies_.begin(), occupancies_.begin() + fullest, occupancies_.end(), [](const auto& a, const auto& b) {
+        return a.bytes > b.bytes;
+    });
+    occupancies_.resize(fullest);
+    report_.fullest_atrs = std::move(occupancies_);
+    occupancies_.clear();
+    return report_;
+}
+
+void
+tx::lost_attempts_report_builder::deliver(const lost_attempts_report_handler& callback, const lost_attempts_report& report)
+{
+    if (!callback) {
+        return;
+    }
+    try {
+        callback(report);
+    } catch (const std::exception& e) {
+        lost_attempts_cleanup_log->error("cleanup report callback for {} raised {}", report.bucket_name, e.what());
+    } catch (...) {
+        lost_attempts_cleanup_log->error("cleanup report callback for {} raised an unknown exception", report.bucket_name);
+    }
+}
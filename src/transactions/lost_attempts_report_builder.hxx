@@ -0,0 +1,64 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <couchbase/support.hxx>
+#include <couchbase/transactions/cleanup_report.hxx>
+#include <couchbase/transactions/internal/atr_entry.hxx>
+
+namespace couchbase::transactions
+{
+
+/**
+ * Tallies what one lost attempts pass over a bucket finds, as it finds it, into the report handed out at the end of the pass.
+ */
+class lost_attempts_report_builder
+{
+  public:
+    lost_attempts_report_builder(const std::string& bucket_name,
+                                 size_t num_active_clients,
+                                 size_t atrs_assigned,
+                                 std::chrono::milliseconds budget);
+
+    // The lookup of an ATR failed.
+    void failed();
+    // An ATR was looked at, and had these entries, taking this many bytes.  Returns whether it is near full.
+    bool scanned(const std::string& atr_key, const std::vector<atr_entry>& entries, size_t bytes);
+    // Expired attempts in an ATR were cleaned up, or failed to be.
+    void cleaned(size_t num_cleaned, size_t num_failed);
+
+    // ATRs looked at so far, whether or not the lookup succeeded.
+    CB_NODISCARD size_t atrs_done() const
+    {
+        return report_.atrs_scanned + report_.atrs_failed;
+    }
+
+    // Completes the report, keeping just the fullest ATRs, largest first.
+    lost_attempts_report finish(std::chrono::milliseconds elapsed);
+
+    // Calls the callback, if any, with the report.  Anything it raises is logged rather than passed on, as this runs on the
+    // cleanup threads.
+    static void deliver(const lost_attempts_report_handler& callback, const lost_attempts_report& report);
+
+  private:
+    lost_attempts_report report_;
+    std::vector<atr_occupancy> occupancies_;
+};
+} // namespace couchbase::transactions
@@ -0,0 +1,151 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "couchbase/transactions/internal/utils.hxx"
+
+namespace couchbase::transactions
+{
+
+/**
+ * Drives all the retry loops on the commit path of an attempt, so that between them they are bounded by a single deadline.
+ *
+ * Before expiry, retries back off exponentially but never sleep past the transaction's expiry.  Once the attempt is in
+ * expiry-overtime mode, it gets a fixed overtime budget (starting when overtime was first noticed) to finish.  If an op
+ * keeps retrying past expiry without entering overtime, the same budget past expiry is the hard limit.  The number of
+ * retries used by each stage is recorded, for diagnostics.
+ */
+class retry_controller
+{
+  public:
+    retry_controller(std::function<std::chrono::nanoseconds()> remaining,
+                     std::function<bool()> in_overtime,
+                     std::chrono::milliseconds overtime_budget,
+                     std::chrono::milliseconds initial_delay = std::chrono::milliseconds(1),
+                     std::chrono::milliseconds max_delay = std::chrono::milliseconds(100))
+      : remaining_(std::move(remaining))
+      , in_overtime_(std::move(in_overtime))
+      , overtime_budget_(overtime_budget)
+      , initial_delay_(initial_delay)
+      , max_delay_(max_delay)
+    {
+    }
+
+    // Wait before retrying the given stage.  Returns false, without waiting, once the deadline has passed.
+    bool try_wait(const std::string& stage)
+    {
+        auto delay = next_delay(stage);
+        if (!delay) {
+            return false;
+        }
+        if (delay->count() > 0) {
+            std::this_thread::sleep_for(*delay);
+        }
+        return true;
+    }
+
+    // Decides whether the given stage can retry, and if so counts the retry and says how long to wait first.
+    std::optional<std::chrono::steady_clock::duration> next_delay(const std::string& stage)
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point wake_by;
+        size_t retries;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto expiry = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(remaining_());
+            if (in_overtime_()) {
+                if (!overtime_deadline_) {
+                    overtime_deadline_ = now + overtime_budget_;
+                }
+                deadline = *overtime_deadline_;
+                wake_by = deadline;
+            } else {
+                deadline = expiry + overtime_budget_;
+                // don't sleep past expiry, so the op gets to notice it.
+                wake_by = now < expiry ? expiry : deadline;
+            }
+            if (now >= deadline) {
+                return {};
+            }
+            retries = retries_[stage]++;
+        }
+        auto delay = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          initial_delay_ * (jitter() * std::pow(2, std::min<size_t>(retries, DEFAULT_RETRY_OP_EXPONENT_CAP))));
+        delay = std::min<std::chrono::steady_clock::duration>(delay, max_delay_);
+        return std::min(delay, wake_by - now);
+    }
+
+    // Adapts this controller to the Delay interface of retry_expected, for one stage.
+    class stage_delay
+    {
+      public:
+        stage_delay(retry_controller& controller, std::string stage)
+          : controller_(controller)
+          , stage_(std::move(stage))
+        {
+        }
+
+        bool try_wait()
+        {
+            return controller_.try_wait(stage_);
+        }
+
+      private:
+        retry_controller& controller_;
+        std::string stage_;
+    };
+
+    stage_delay for_stage(const std::string& stage)
+    {
+        return stage_delay(*this, stage);
+    }
+
+    CB_NODISCARD std::map<std::string, size_t> retries() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return retries_;
+    }
+
+    CB_NODISCARD size_t retries(const std::string& stage) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = retries_.find(stage);
+        return it == retries_.end() ? 0 : it->second;
+    }
+
+  private:
+    std::function<std::chrono::nanoseconds()> remaining_;
+    std::function<bool()> in_overtime_;
+    const std::chrono::milliseconds overtime_budget_;
+    const std::chrono::milliseconds initial_delay_;
+    const std::chrono::milliseconds max_delay_;
+    std::optional<std::chrono::steady_clock::time_point> overtime_deadline_;
+    std::map<std::string, size_t> retries_;
+    mutable std::mutex mutex_;
+};
+} // namespace couchbase::transactions
@@ -187,10 +187,10 @@ tx::staged_mutation_queue::rollback_insert(attempt_context_impl& ctx, staged_mut
         req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
         req.access_deleted = true;
         req.cas.value = item.doc().cas();
-        wrap_durable_request(req, ctx.overall_.config());
+        wrap_durable_request(req, ctx.overall_.config(), ctx.op_timeout_cap());
         auto barrier = std::make_shared<std::promise<result>>();
         auto f = barrier->get_future();
-        ctx.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        ctx.execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         auto res = wrap_operation_future(f);
@@ -241,10 +241,10 @@ tx::staged_mutation_queue::rollback_remove_or_replace(attempt_context_impl& ctx,
         couchbase::operations::mutate_in_request req{ item.doc().id() };
         req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
         req.cas.value = item.doc().cas();
-        wrap_durable_request(req, ctx.overall_.config());
+        wrap_durable_request(req, ctx.overall_.config(), ctx.op_timeout_cap());
         auto barrier = std::make_shared<std::promise<result>>();
         auto f = barrier->get_future();
-        ctx.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        ctx.execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         auto res = wrap_operation_future(f);
@@ -275,116 +275,138 @@ tx::staged_mutation_queue::rollback_remove_or_replace(attempt_context_impl& ctx,
         }
     }
 }
+namespace
+{
+// one try of commit_doc or remove_doc: empty means try again, otherwise success or the final error.
+using doc_try_result = std::optional<tx::expected<void, tx::transaction_operation_failed>>;
+} // namespace
+
 void
 tx::staged_mutation_queue::commit_doc(attempt_context_impl& ctx, staged_mutation& item, bool ambiguity_resolution_mode, bool cas_zero_mode)
 {
-    retry_op<void>([&] {
+    // This is on the hot path when committing, so retries are signalled by return value rather than by throwing.
+    auto handle_error = [&](error_class ec, const std::string& what) -> doc_try_result {
+        if (ctx.expiry_overtime_mode_.load()) {
+            return make_unexpected(transaction_operation_failed(FAIL_EXPIRY, "expired during commit").no_rollback().failed_post_commit());
+        }
+        switch (ec) {
+            case FAIL_AMBIGUOUS:
+                ctx.trace("FAIL_AMBIGUOUS in commit_doc, retrying");
+                ambiguity_resolution_mode = true;
+                return {};
+            case FAIL_CAS_MISMATCH:
+            case FAIL_DOC_ALREADY_EXISTS:
+                if (ambiguity_resolution_mode) {
+                    return make_unexpected(transaction_operation_failed(ec, what).no_rollback().failed_post_commit());
+                }
+                ctx.trace("cas mismatch or doc exists in commit_doc, retrying with cas zero");
+                ambiguity_resolution_mode = true;
+                cas_zero_mode = true;
+                return {};
+            default:
+                return make_unexpected(transaction_operation_failed(ec, what).no_rollback().failed_post_commit());
+        }
+    };
+    auto delay = ctx.commit_retries_.for_stage(STAGE_COMMIT_DOC);
+    auto outcome = retry_expected<void, transaction_operation_failed>(delay, [&]() -> doc_try_result {
         ctx.trace(
           "commit doc {}, cas_zero_mode {}, ambiguity_resolution_mode {}", item.doc().id(), cas_zero_mode, ambiguity_resolution_mode);
-        try {
-            ctx.check_expiry_during_commit_or_rollback(STAGE_COMMIT_DOC, std::optional<const std::string>(item.doc().id().key()));
-            auto ec = ctx.hooks_.before_doc_committed(&ctx, item.doc().id().key());
-            if (ec) {
-                throw client_error(*ec, "before_doc_committed hook threw error");
-            }
+        ctx.check_expiry_during_commit_or_rollback(STAGE_COMMIT_DOC, std::optional<const std::string>(item.doc().id().key()));
+        auto ec = ctx.hooks_.before_doc_committed(&ctx, item.doc().id().key());
+        if (ec) {
+            return handle_error(*ec, "before_doc_committed hook threw error");
+        }
 
-            // move staged content into doc
-            ctx.trace("commit doc id {}, content {}, cas {}", item.doc().id(), item.content(), item.doc().cas());
+        // move staged content into doc
+        ctx.trace("commit doc id {}, content {}, cas {}", item.doc().id(), item.content(), item.doc().cas());
 
-            result res;
-            if (item.type() == staged_mutation_type::INSERT && !cas_zero_mode) {
-                couchbase::operations::insert_request req{ item.doc().id() };
-                auto content = item.doc().content<nlohmann::json>().dump();
-                req.value = couchbase::utils::to_binary(content);
-                wrap_durable_request(req, ctx.overall_.config());
-                auto barrier = std::make_shared<std::promise<result>>();
-                auto f = barrier->get_future();
-                ctx.cluster_ref().execute(req, [barrier](couchbase::operations::insert_response resp) {
-                    barrier->set_value(result::create_from_mutation_response(resp));
-                });
-                res = wrap_operation_future(f);
-            } else {
-                couchbase::operations::mutate_in_request req{ item.doc().id() };
-                req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
-                req.specs.add_spec(protocol::subdoc_opcode::set_doc, false, false, false, "", item.content());
-                req.store_semantics = protocol::mutate_in_request_body::store_semantics_type::replace;
-                req.cas.value = cas_zero_mode ? 0 : item.doc().cas();
-                wrap_durable_request(req, ctx.overall_.config());
-                auto barrier = std::make_shared<std::promise<result>>();
-                auto f = barrier->get_future();
-                ctx.cluster_ref().execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
-                    barrier->set_value(result::create_from_subdoc_response(resp));
-                });
-                res = wrap_operation_future(f);
-            }
-            ctx.trace("commit doc result {}", res);
-            // TODO: mutation tokens
-            ec = ctx.hooks_.after_doc_committed_before_saving_cas(&ctx, item.doc().id().key());
-            if (ec) {
-                throw client_error(*ec, "after_doc_committed_before_saving_cas threw error");
-            }
-            item.doc().cas(res.cas);
-            ec = ctx.hooks_.after_doc_committed(&ctx, item.doc().id().key());
-            if (ec) {
-                throw client_error(*ec, "after_doc_committed threw error");
-            }
-        } catch (const client_error& e) {
-            error_class ec = e.ec();
-            if (ctx.expiry_overtime_mode_.load()) {
-                throw transaction_operation_failed(FAIL_EXPIRY, "expired during commit").no_rollback().failed_post_commit();
-            }
-            switch (ec) {
-                case FAIL_AMBIGUOUS:
-                    ambiguity_resolution_mode = true;
-                    throw retry_operation("FAIL_AMBIGUOUS in commit_doc");
-                case FAIL_CAS_MISMATCH:
-                case FAIL_DOC_ALREADY_EXISTS:
-                    if (ambiguity_resolution_mode) {
-                        throw transaction_operation_failed(ec, e.what()).no_rollback().failed_post_commit();
-                    }
-                    ambiguity_resolution_mode = true;
-                    cas_zero_mode = true;
-                    throw retry_operation("FAIL_DOC_ALREADY_EXISTS in commit_doc");
-                default:
-                    throw transaction_operation_failed(ec, e.what()).no_rollback().failed_post_commit();
-            }
+        auto barrier = std::make_shared<std::promise<result>>();
+        auto f = barrier->get_future();
+        if (item.type() == staged_mutation_type::INSERT && !cas_zero_mode) {
+            couchbase::operations::insert_request req{ item.doc().id() };
+            auto content = item.doc().content<nlohmann::json>().dump();
+            req.value = couchbase::utils::to_binary(content);
+            wrap_durable_request(req, ctx.overall_.config(), ctx.op_timeout_cap());
+            ctx.execute_kv(req, [barrier](couchbase::operations::insert_response resp) {
+                barrier->set_value(result::create_from_mutation_response(resp));
+            });
+        } else {
+            couchbase::operations::mutate_in_request req{ item.doc().id() };
+            req.specs.add_spec(protocol::subdoc_opcode::remove, true, TRANSACTION_INTERFACE_PREFIX_ONLY);
+            req.specs.add_spec(protocol::subdoc_opcode::set_doc, false, false, false, "", item.content());
+            req.store_semantics = protocol::mutate_in_request_body::store_semantics_type::replace;
+            req.cas.value = cas_zero_mode ? 0 : item.doc().cas();
+            wrap_durable_request(req, ctx.overall_.config(), ctx.op_timeout_cap());
+            ctx.execute_kv(req, [barrier](couchbase::operations::mutate_in_response resp) {
+                barrier->set_value(result::create_from_subdoc_response(resp));
+            });
+        }
+        auto res = check_operation_result(f.get());
+        if (!res) {
+            return handle_error(res.error().ec(), res.error().what());
+        }
+        ctx.trace("commit doc result {}", res.value());
+        // TODO: mutation tokens
+        ec = ctx.hooks_.after_doc_committed_before_saving_cas(&ctx, item.doc().id().key());
+        if (ec) {
+            return handle_error(*ec, "after_doc_committed_before_saving_cas threw error");
         }
+        item.doc().cas(res.value().cas);
+        ec = ctx.hooks_.after_doc_committed(&ctx, item.doc().id().key());
+        if (ec) {
+            return handle_error(*ec, "after_doc_committed threw error");
+        }
+        return doc_try_result(std::in_place);
     });
+    if (!outcome) {
+        throw transaction_operation_failed(FAIL_EXPIRY, "ran out of time retrying commit_doc").no_rollback().failed_post_commit();
+    }
+    if (!outcome->has_value()) {
+        throw outcome->error();
+    }
 }
 
 void
 tx::staged_mutation_queue::remove_doc(attempt_context_impl& ctx, staged_mutation& item)
 {
-    retry_op<void>([&] {
-        try {
-            ctx.check_expiry_during_commit_or_rollback(STAGE_REMOVE_DOC, std::optional<const std::string>(item.doc().id().key()));
-            auto ec = ctx.hooks_.before_doc_removed(&ctx, item.doc().id().key());
-            if (ec) {
-                throw client_error(*ec, "before_doc_removed hook threw error");
-            }
-            couchbase::operations::remove_request req{ item.doc().id() };
-            wrap_durable_request(req, ctx.overall_.config());
-            auto barrier = std::make_shared<std::promise<result>>();
-            auto f = barrier->get_future();
-            ctx.cluster_ref().execute(req, [barrier](couchbase::operations::remove_response resp) {
-                barrier->set_value(result::create_from_mutation_response(resp));
-            });
-            wrap_operation_future(f);
-            ec = ctx.hooks_.after_doc_removed_pre_retry(&ctx, item.doc().id().key());
-            if (ec) {
-                throw client_error(*ec, "after_doc_removed_pre_retry threw error");
-            }
-        } catch (const client_error& e) {
-            error_class ec = e.ec();
-            if (ctx.expiry_overtime_mode_.load()) {
-                throw transaction_operation_failed(ec, e.what()).no_rollback().failed_post_commit();
-            }
-            switch (ec) {
-                case FAIL_AMBIGUOUS:
-                    throw retry_operation("remove_doc got FAIL_AMBIGUOUS");
-                default:
-                    throw transaction_operation_failed(ec, e.what()).no_rollback().failed_post_commit();
-            }
+    auto handle_error = [&](error_class ec, const std::string& what) -> doc_try_result {
+        if (ctx.expiry_overtime_mode_.load()) {
+            return make_unexpected(transaction_operation_failed(ec, what).no_rollback().failed_post_commit());
+        }
+        if (ec == FAIL_AMBIGUOUS) {
+            ctx.trace("remove_doc got FAIL_AMBIGUOUS, retrying");
+            return {};
+        }
+        return make_unexpected(transaction_operation_failed(ec, what).no_rollback().failed_post_commit());
+    };
+    auto delay = ctx.commit_retries_.for_stage(STAGE_REMOVE_DOC);
+    auto outcome = retry_expected<void, transaction_operation_failed>(delay, [&]() -> doc_try_result {
+        ctx.check_expiry_during_commit_or_rollback(STAGE_REMOVE_DOC, std::optional<const std::string>(item.doc().id().key()));
+        auto ec = ctx.hooks_.before_doc_removed(&ctx, item.doc().id().key());
+        if (ec) {
+            return handle_error(*ec, "before_doc_removed hook threw error");
+        }
+        couchbase::operations::remove_request req{ item.doc().id() };
+        wrap_durable_request(req, ctx.overall_.config(), ctx.op_timeout_cap());
+        auto barrier = std::make_shared<std::promise<result>>();
+        auto f = barrier->get_future();
+        ctx.execute_kv(req, [barrier](couchbase::operations::remove_response resp) {
+            barrier->set_value(result::create_from_mutation_response(resp));
+        });
+        auto res = check_operation_result(f.get());
+        if (!res) {
+            return handle_error(res.error().ec(), res.error().what());
         }
+        ec = ctx.hooks_.after_doc_removed_pre_retry(&ctx, item.doc().id().key());
+        if (ec) {
+            return handle_error(*ec, "after_doc_removed_pre_retry threw error");
+        }
+        return doc_try_result(std::in_place);
     });
+    if (!outcome) {
+        throw transaction_operation_failed(FAIL_EXPIRY, "ran out of time retrying remove_doc").no_rollback().failed_post_commit();
+    }
+    if (!outcome->has_value()) {
+        throw outcome->error();
+    }
 }
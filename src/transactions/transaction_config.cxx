@@ -29,6 +29,13 @@ namespace transactions
       , expiration_time_(std::chrono::seconds(15))
       , cleanup_lost_attempts_(true)
       , cleanup_client_attempts_(true)
+      , cleanup_atr_lookups_in_flight_(4)
+      , cleanup_bucket_scan_threads_(8)
+      , cleanup_client_attempts_threads_(2)
+      , cleanup_foreground_latency_target_(std::chrono::milliseconds(100))
+      , cleanup_min_rate_(0.1)
+      , cleanup_rendezvous_hashing_(false)
+      , cleanup_durable_heartbeats_(true)
       , attempt_context_hooks_(new attempt_context_testing_hooks())
       , cleanup_hooks_(new cleanup_testing_hooks())
       , scan_consistency_(couchbase::query_scan_consistency::request_plus)
@@ -41,8 +48,19 @@ namespace transactions
       : level_(config.durability_level())
       , cleanup_window_(config.cleanup_window())
       , expiration_time_(config.expiration_time())
+      , kv_timeout_(config.kv_timeout())
       , cleanup_lost_attempts_(config.cleanup_lost_attempts())
       , cleanup_client_attempts_(config.cleanup_client_attempts())
+      , cleanup_atr_lookups_in_flight_(config.cleanup_atr_lookups_in_flight())
+      , cleanup_bucket_scan_threads_(config.cleanup_bucket_scan_threads())
+      , cleanup_client_attempts_threads_(config.cleanup_client_attempts_threads())
+      , cleanup_foreground_latency_target_(config.cleanup_foreground_latency_target())
+      , cleanup_min_rate_(config.cleanup_min_rate())
+      , cleanup_rendezvous_hashing_(config.cleanup_rendezvous_hashing())
+      , cleanup_durable_heartbeats_(config.cleanup_durable_heartbeats())
+      , cleanup_journal_path_(config.cleanup_journal_path())
+      , cleanup_checkpoint_path_(config.cleanup_checkpoint_path())
+      , cleanup_report_callback_(config.cleanup_report_callback())
       , attempt_context_hooks_(new attempt_context_testing_hooks(config.attempt_context_hooks()))
       , cleanup_hooks_(new cleanup_testing_hooks(config.cleanup_hooks()))
       , scan_consistency_(config.scan_consistency())
@@ -56,8 +74,19 @@ namespace transactions
         level_ = c.durability_level();
         cleanup_window_ = c.cleanup_window();
         expiration_time_ = c.expiration_time();
+        kv_timeout_ = c.kv_timeout();
         cleanup_lost_attempts_ = c.cleanup_lost_attempts();
         cleanup_client_attempts_ = c.cleanup_client_attempts();
+        cleanup_atr_lookups_in_flight_ = c.cleanup_atr_lookups_in_flight();
+        cleanup_bucket_scan_threads_ = c.cleanup_bucket_scan_threads();
+        cleanup_client_attempts_threads_ = c.cleanup_client_attempts_threads();
+        cleanup_foreground_latency_target_ = c.cleanup_foreground_latency_target();
+        cleanup_min_rate_ = c.cleanup_min_rate();
+        cleanup_rendezvous_hashing_ = c.cleanup_rendezvous_hashing();
+        cleanup_durable_heartbeats_ = c.cleanup_durable_heartbeats();
+        cleanup_journal_path_ = c.cleanup_journal_path();
+        cleanup_checkpoint_path_ = c.cleanup_checkpoint_path();
+        cleanup_report_callback_ = c.cleanup_report_callback();
         attempt_context_hooks_.reset(new attempt_context_testing_hooks(c.attempt_context_hooks()));
         cleanup_hooks_.reset(new cleanup_testing_hooks(c.cleanup_hooks()));
         scan_consistency_ = c.scan_consistency();
@@ -29,6 +29,7 @@ namespace transactions
       : transaction_id_(uid_generator::next())
       , transactions_(txns)
       , config_(config.apply(txns.config()))
+      , priority_(config.priority().value_or(transaction_priority::NORMAL))
       , start_time_client_(std::chrono::steady_clock::now())
       , deferred_elapsed_(0)
       , cleanup_(txns.cleanup())
@@ -68,6 +69,27 @@ namespace transactions
         return is_expired;
     }
 
+    // after this many attempts, a transaction's backoff is halved (then a third after twice as many, etc)
+    static const double BACKOFF_AGE_ATTEMPTS = 8.0;
+
+    CB_NODISCARD double transaction_context::backoff_scale() const
+    {
+        double scale = 1.0;
+        switch (priority_) {
+            case transaction_priority::LOW:
+                scale = 2.0;
+                break;
+            case transaction_priority::NORMAL:
+                scale = 1.0;
+                break;
+            case transaction_priority::HIGH:
+                scale = 0.5;
+                break;
+        }
+        auto previous_attempts = attempts_.empty() ? 0 : attempts_.size() - 1;
+        return scale / (1.0 + static_cast<double>(previous_attempts) / BACKOFF_AGE_ATTEMPTS);
+    }
+
     void transaction_context::retry_delay()
     {
         // when we retry an operation, we typically call that function recursively.  So, we need to
@@ -84,7 +106,7 @@ namespace transactions
             // the first time we call the delay, it just records an end time.  After that, it
             // actually delays.
             try {
-                (*delay_)();
+                (*delay_)(backoff_scale());
                 current_attempt_context_ = std::make_shared<attempt_context_impl>(*this);
                 txn_log->info("starting attempt {}/{}/{}/", num_attempts(), transaction_id(), current_attempt_context_->id());
                 cb(nullptr);
@@ -13,6 +13,8 @@
  *   See the License for the specific language governing permissions and
  *   limitations under the License.
  */
+#include <algorithm>
+
 #include <couchbase/transactions/internal/transaction_context.hxx>
 #include <couchbase/transactions/transaction_query_options.hxx>
 
@@ -30,10 +32,10 @@ transaction_query_options::wrap_request(const couchbase::transactions::transacti
     if (!req.scan_consistency) {
         req.scan_consistency = txn_context.config().scan_consistency();
     }
-    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(txn_context.remaining());
+    // never negative - once expired, the query service will report the expiry itself.
+    auto remaining = std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(txn_context.remaining()));
     req.timeout = remaining + extra;
     req.raw["txtimeout"] = fmt::format("\"{}ms\"", remaining.count());
-    req.timeout = std::chrono::duration_cast<std::chrono::milliseconds>(txn_context.remaining()) + extra;
     return req;
 }
 } // namespace couchbase::transactions
\ No newline at end of file
@@ -16,6 +16,7 @@
 
 #include "attempt_context_impl.hxx"
 #include "couchbase/transactions/internal/exceptions_internal.hxx"
+#include "couchbase/transactions/internal/kv_client.hxx"
 #include "couchbase/transactions/internal/logging.hxx"
 #include "couchbase/transactions/internal/transaction_context.hxx"
 #include "couchbase/transactions/internal/transactions_cleanup.hxx"
@@ -25,9 +26,15 @@
 namespace tx = couchbase::transactions;
 
 tx::transactions::transactions(cluster& cluster, const transaction_config& config)
+  : transactions(cluster, config, std::make_shared<cluster_kv_client>(cluster))
+{
+}
+
+tx::transactions::transactions(cluster& cluster, const transaction_config& config, std::shared_ptr<kv_client> kv)
   : cluster_(cluster)
+  , kv_(std::move(kv))
   , config_(config)
-  , cleanup_(new transactions_cleanup(cluster_, config_))
+  , cleanup_(new transactions_cleanup(cluster_, kv_, config_))
 {
     txn_log->info("couchbase transactions {}{} creating new transaction object", VERSION_STR, VERSION_SHA);
     // if the config specifies custom metadata collection, lets be sure to open that bucket
@@ -17,15 +17,22 @@
 #include <algorithm>
 #include <chrono>
 #include <functional>
+#include <iterator>
 #include "active_transaction_record.hxx"
 #include "atr_ids.hxx"
 #include "attempt_context_impl.hxx"
+#include "bucket_scan_scheduler.hxx"
+#include "cleanup_checkpoint.hxx"
+#include "cleanup_journal.hxx"
 #include "cleanup_testing_hooks.hxx"
 #include "couchbase/transactions/internal/client_record.hxx"
 #include "couchbase/transactions/internal/logging.hxx"
 #include "couchbase/transactions/internal/transaction_fields.hxx"
 #include "couchbase/transactions/internal/transactions_cleanup.hxx"
 #include "couchbase/transactions/internal/utils.hxx"
+#include "lookup_pipeline.hxx"
+#include "lost_attempts_registry.hxx"
+#include "lost_attempts_report_builder.hxx"
 #include "uid_generator.hxx"
 
 namespace tx = couchbase::transactions;
@@ -38,19 +45,61 @@ tx::transactions_cleanup_attempt::transactions_cleanup_attempt(const tx::atr_cle
 {
 }
 
-tx::transactions_cleanup::transactions_cleanup(couchbase::cluster& cluster, const tx::transaction_config& config)
+tx::transactions_cleanup::transactions_cleanup(couchbase::cluster& cluster,
+                                               std::shared_ptr<kv_client> kv,
+                                               const tx::transaction_config& config)
   : cluster_(cluster)
+  , kv_(std::move(kv))
   , config_(config)
   , client_uuid_(uid_generator::next())
+  , throttle_(config.cleanup_foreground_latency_target(), config.cleanup_min_rate())
+  , checkpoint_(std::make_unique<cleanup_checkpoint>(config.cleanup_checkpoint_path()))
   , running_(false)
 {
+    try {
+        checkpoint_->load();
+    } catch (const std::exception& e) {
+        // just a hint, so carry on without it
+        lost_attempts_cleanup_log->warn("could not load cleanup checkpoint {}, starting afresh: {}", *checkpoint_->path(), e.what());
+    }
+    if (config.cleanup_journal_path()) {
+        journal_ = std::make_unique<cleanup_journal>(*config.cleanup_journal_path());
+        // These were left unfinished by a previous run which crashed, so nothing is going to finish them - clean them up now
+        // rather than waiting for them to expire.
+        const auto& recovered = journal_->recovered();
+        if (!config.cleanup_client_attempts()) {
+            attempt_cleanup_log->warn(
+              "{} unfinished attempts found in journal {}, but client attempts cleanup is disabled, leaving them to lost attempts cleanup",
+              recovered.size(),
+              *config.cleanup_journal_path());
+            // handed over, so this journal has no more use for them
+            for (const auto& r : recovered) {
+                journal_->record(r.atr_id, r.attempt_id, attempt_state::COMPLETED);
+            }
+        } else {
+            for (const auto& r : recovered) {
+                atr_queue_.push(atr_cleanup_entry(r.atr_id, r.attempt_id, *this));
+            }
+            attempt_cleanup_log->info("{} unfinished attempts found in journal {}, queued for cleanup",
+                                      recovered.size(),
+                                      *config.cleanup_journal_path());
+        }
+    }
     if (config.cleanup_client_attempts()) {
         running_ = true;
-        cleanup_thr_ = std::thread(std::bind(&transactions_cleanup::attempts_loop, this));
+        for (size_t i = 0; i < std::max<size_t>(1, config.cleanup_client_attempts_threads()); i++) {
+            cleanup_thrs_.emplace_back(std::bind(&transactions_cleanup::attempts_loop, this));
+        }
     }
     if (config.cleanup_lost_attempts()) {
         running_ = true;
-        lost_attempts_thr_ = std::thread(std::bind(&transactions_cleanup::lost_attempts_loop, this));
+        // Only one transactions object per cluster, metadata location and cleanup settings needs to look for lost attempts.  If
+        // this one isn't it, it takes over when the one that is closes.
+        lost_attempts_key_ = lost_attempts_registry::key_for(&cluster_, config_);
+        lost_attempts_registry::instance().join(lost_attempts_key_, this, [this]() {
+            lost_attempts_cleanup_log->info("{} leading lost attempts cleanup for {}", static_cast<void*>(this), lost_attempts_key_);
+            lost_attempts_thr_ = std::thread(std::bind(&transactions_cleanup::lost_attempts_loop, this));
+        });
     }
 }
 
@@ -115,6 +164,17 @@ tx::transactions_cleanup::interruptable_wait(std::chrono::duration<R, P> delay)
     return running_.load();
 }
 
+namespace
+{
+// An ATR lookup, handed back from the client's IO threads to the thread scanning the bucket (which does the actual cleanup, as
+// that blocks).
+struct atr_lookup {
+    std::error_code ec;
+    // only fetched if the occupancy probe found attempts in it.
+    std::optional<tx::active_transaction_record> atr;
+};
+} // namespace
+
 void
 tx::transactions_cleanup::clean_lost_attempts_in_bucket(const std::string& bucket_name)
 {
@@ -123,101 +183,211 @@ tx::transactions_cleanup::clean_lost_attempts_in_bucket(const std::string& bucke
         lost_attempts_cleanup_log->info("{} cleanup of {} complete", static_cast<void*>(this), bucket_name);
         return;
     }
-    auto details = get_active_clients(bucket_name, client_uuid_);
-    auto all_atrs = atr_ids::all();
-
-    // TXNCXX-232 - dynamically adjust the budget for fetching each ATR, based on how long is left of the cleanup window and how many are
-    // left to fetch
-    auto atrs_handled_by_this_client = all_atrs.size() / details.num_active_clients;
-    std::chrono::microseconds cleanup_window = std::chrono::duration_cast<std::chrono::microseconds>(config_.cleanup_window());
+    auto details = membership(bucket_name);
+    std::vector<std::string> atrs;
+    if (config_.cleanup_rendezvous_hashing()) {
+        // only the ATRs gained or lost by a client joining or leaving change hands, so the rest keep their occupancy history.
+        atrs = atr_ids::assigned_to(details.client_uuid, details.active_client_ids);
+    } else {
+        atrs = atr_ids::strided_for(details.index_of_this_client, details.num_active_clients);
+    }
+    // look at the ATRs which had attempts in them last time first, then those left longest, as they are where the work is likely
+    // to be.
+    checkpoint_->prioritise(bucket_name, atrs);
+
+    // TXNCXX-232 - spread the lookups evenly over the cleanup window.  Each lookup is issued when its slot in the window comes
+    // up (or as soon after as the pipeline has room), and up to cleanup_atr_lookups_in_flight() can be outstanding at once, so
+    // a slow ATR doesn't eat into the time for the rest.
+    auto cleanup_window = std::chrono::duration_cast<std::chrono::microseconds>(config_.cleanup_window());
+    auto max_in_flight = std::max<size_t>(1, config_.cleanup_atr_lookups_in_flight());
     auto start = std::chrono::steady_clock::now();
-    lost_attempts_cleanup_log->info("{} {} active clients (including this one), {} atrs to check in {}ms",
+    lost_attempts_cleanup_log->info("{} {} active clients (including this one), {} atrs to check in {}ms, {} lookups in flight",
                                     static_cast<void*>(this),
                                     details.num_active_clients,
-                                    all_atrs.size(),
-                                    config_.cleanup_window().count());
-
-    for (auto it = all_atrs.begin() + details.index_of_this_client; it < all_atrs.end(); it += details.num_active_clients) {
-        auto atrs_left_for_this_client = std::distance(it, all_atrs.end()) / std::max<size_t>(1, details.num_active_clients);
-        auto now = std::chrono::steady_clock::now();
-        std::chrono::microseconds elapsed_in_cleanup_window = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
-        std::chrono::microseconds remaining_in_cleanup_window = cleanup_window - elapsed_in_cleanup_window;
-        std::chrono::microseconds budget_for_this_atr =
-          std::chrono::microseconds(remaining_in_cleanup_window.count() / std::max<size_t>(1, atrs_left_for_this_client));
-
-        // clean the ATR entry
-        std::string atr_id = *it;
-        if (!running_.load()) {
-            lost_attempts_cleanup_log->debug("{} cleanup of {} complete", static_cast<void*>(this), bucket_name);
+                                    atrs.size(),
+                                    config_.cleanup_window().count(),
+                                    max_in_flight);
+
+    lost_attempts_report_builder report(bucket_name, details.num_active_clients, atrs.size(), config_.cleanup_window());
+    std::vector<couchbase::document_id> atr_ids;
+    atr_ids.reserve(atrs.size());
+    for (const auto& atr : atrs) {
+        atr_ids.push_back(config_.atr_id_from_bucket_and_key(bucket_name, atr));
+    }
+    // When cleanup is throttled (see cleanup_throttle), the lookups are spread further apart, and fewer are in flight.
+    lookup_pipeline<atr_lookup> pipeline(atrs.size(), max_in_flight, cleanup_window);
+    pipeline.throttle([this]() { return throttle_.level(); }).running([this]() { return running_.load(); }, cleanup_loop_delay_);
+    auto issue = [this, &atr_ids](size_t index, lookup_pipeline<atr_lookup>::done_fn done) {
+        const auto& id = atr_ids[index];
+        auto timeout = config_.kv_timeout();
+        auto fetched = [done](std::error_code ec, std::optional<active_transaction_record> atr) { done({ ec, std::move(atr) }); };
+        // Most ATRs are empty most of the time, so first just count the attempts, and only fetch and parse the ATR when there are
+        // some.
+        active_transaction_record::get_atr_occupancy(
+          *kv_, id, timeout, [kv = kv_, id, timeout, fetched](std::error_code ec, size_t occupancy) {
+              // path_invalid means there are attempts, but they couldn't be counted, so fetch them anyway.
+              if (ec != couchbase::error::key_value_errc::path_invalid && (ec || occupancy == 0)) {
+                  return fetched(ec, std::nullopt);
+              }
+              active_transaction_record::get_atr(*kv, id, timeout, fetched);
+          });
+    };
+    auto handle = [&](size_t index, atr_lookup lookup) {
+        const auto& atr_id = atr_ids[index];
+        if (lookup.ec) {
+            lost_attempts_cleanup_log->error(
+              "{} cleanup of atr {} failed with {}, moving on", static_cast<void*>(this), atr_id.key(), lookup.ec.message());
+            report.failed();
+            return;
+        }
+        if (!lookup.atr) {
+            report.scanned(atr_id.key(), {}, 0);
+            checkpoint_->scanned(bucket_name, atr_id.key(), 0);
             return;
         }
+        const auto& entries = lookup.atr->entries();
+        checkpoint_->scanned(bucket_name, atr_id.key(), entries.size());
+        if (report.scanned(atr_id.key(), entries, lookup.atr->size_bytes())) {
+            lost_attempts_cleanup_log->warn("{} atr {} in {} is near full, with {} attempts taking {} bytes",
+                                            static_cast<void*>(this),
+                                            atr_id.key(),
+                                            bucket_name,
+                                            entries.size(),
+                                            lookup.atr->size_bytes());
+        }
         try {
-            auto id = config_.atr_id_from_bucket_and_key(bucket_name, atr_id);
-            handle_atr_cleanup(id);
-
+            auto stats = clean_atr_entries(atr_id, *lookup.atr);
+            report.cleaned(stats.num_cleaned, stats.num_failed);
         } catch (const std::runtime_error& err) {
             lost_attempts_cleanup_log->error(
-              "{} cleanup of atr {} failed with {}, moving on", static_cast<void*>(this), atr_id, err.what());
+              "{} cleanup of atr {} failed with {}, moving on", static_cast<void*>(this), atr_id.key(), err.what());
         }
+    };
+    if (!pipeline.run(issue, handle)) {
+        // any lookups still in flight only hold on to the pipeline's state and the kv_client, which they share, so it's fine to
+        // leave them.
+        lost_attempts_cleanup_log->debug("{} cleanup of {} stopped with {} atrs left",
+                                         static_cast<void*>(this),
+                                         bucket_name,
+                                         atrs.size() - report.atrs_done());
+        // so that a restart picks up where this left off, rather than losing what was scanned so far
+        save_checkpoint();
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    auto summary = report.finish(elapsed);
+    lost_attempts_cleanup_log->info(
+      "{} cleanup of {} complete in {}ms of {}ms, {} of {} atrs had attempts ({} near full), {} attempts cleaned, {} failed",
+      static_cast<void*>(this),
+      bucket_name,
+      summary.elapsed.count(),
+      summary.budget.count(),
+      summary.atrs_occupied,
+      summary.atrs_assigned,
+      summary.atrs_near_full,
+      summary.entries_cleaned,
+      summary.entries_failed);
+    save_checkpoint();
+    {
+        std::lock_guard<std::mutex> lock(reports_mutex_);
+        reports_[bucket_name] = summary;
+    }
+    lost_attempts_report_builder::deliver(config_.cleanup_report_callback(), summary);
+}
 
-        auto atr_end = std::chrono::steady_clock::now();
-        std::chrono::microseconds atr_used = std::chrono::duration_cast<std::chrono::microseconds>(atr_end - now);
-        std::chrono::microseconds atr_left = budget_for_this_atr - atr_used;
-
-        // Too verbose to log, but leaving here commented as it may be useful later for internal debugging
-        /*lost_attempts_cleanup_log->info("{} {} atrs_left_for_this_client={} elapsed_in_cleanup_window={}us "
-                                        "remaining_in_cleanup_window={}us budget_for_this_atr={}us atr_used={}us atr_left={}us",
-                                        bucket_name,
-                                        atr_id,
-                                        atrs_left_for_this_client,
-                                        elapsed_in_cleanup_window.count(),
-                                        remaining_in_cleanup_window.count(),
-                                        budget_for_this_atr.count(),
-                                        atr_used.count(),
-                                        atr_left.count());*/
-
-        if (atr_left.count() > 0 && atr_left.count() < 1000000000) { // safety check protects against bugs
-            std::this_thread::sleep_for(atr_left);
-        }
+void
+tx::transactions_cleanup::save_checkpoint()
+{
+    try {
+        checkpoint_->save();
+    } catch (const std::exception& e) {
+        lost_attempts_cleanup_log->warn(
+          "{} could not save cleanup checkpoint {}: {}", static_cast<void*>(this), *checkpoint_->path(), e.what());
     }
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start);
-    lost_attempts_cleanup_log->info("{} cleanup of {} complete in {}s", static_cast<void*>(this), bucket_name, elapsed.count());
+}
+
+std::vector<tx::lost_attempts_report>
+tx::transactions_cleanup::lost_attempts_reports() const
+{
+    std::lock_guard<std::mutex> lock(reports_mutex_);
+    std::vector<lost_attempts_report> reports;
+    for (const auto& [bucket_name, report] : reports_) {
+        reports.push_back(report);
+    }
+    return reports;
 }
 
 const tx::atr_cleanup_stats
 tx::transactions_cleanup::handle_atr_cleanup(const couchbase::document_id& atr_id, std::vector<transactions_cleanup_attempt>* results)
 {
-    atr_cleanup_stats stats;
-    auto atr = active_transaction_record::get_atr(cluster_, atr_id);
+    auto atr = active_transaction_record::get_atr(*kv_, atr_id);
     if (atr) {
-        // ok, loop through the attempts and clean them all.  The entry will
-        // check if expired, nothing much to do here except call clean.
-        stats.exists = true;
-        stats.num_entries = atr->entries().size();
-        for (const auto& entry : atr->entries()) {
-            // If we were passed results, then we are testing, and want to set the
-            // check_if_expired to false.
-            atr_cleanup_entry cleanup_entry(entry, atr_id, *this, results == nullptr);
-            try {
-                if (results) {
-                    results->emplace_back(cleanup_entry);
-                }
-                cleanup_entry.clean(lost_attempts_cleanup_log, results ? &results->back() : nullptr);
-                if (results) {
-                    results->back().success(true);
-                }
-            } catch (const std::exception& e) {
-                lost_attempts_cleanup_log->error(
-                  "{} cleanup of {} failed: {}, moving on", static_cast<void*>(this), cleanup_entry, e.what());
-                if (results) {
-                    results->back().success(false);
-                }
-            }
+        return clean_atr_entries(atr_id, *atr, results);
+    }
+    return {};
+}
+
+const tx::atr_cleanup_stats
+tx::transactions_cleanup::clean_atr_entries(const couchbase::document_id& atr_id,
+                                            const active_transaction_record& atr,
+                                            std::vector<transactions_cleanup_attempt>* results)
+{
+    atr_cleanup_stats stats;
+    // ok, loop through the attempts and clean them all.  The entry will
+    // check if expired, nothing much to do here except call clean.
+    stats.exists = true;
+    stats.num_entries = atr.entries().size();
+    // Removals of the cleaned entries are saved up and done together at the end, rather than with one durable write each.  Not
+    // when testing though, as the tests expect each entry to be removed before its on_cleanup_completed hook is called.
+    atr_removal_batch batch;
+    for (const auto& entry : atr.entries()) {
+        // If we were passed results, then we are testing, and want to set the
+        // check_if_expired to false.
+        atr_cleanup_entry cleanup_entry(entry, atr_id, *this, results == nullptr);
+        if (results == nullptr) {
+            auto cleaned = clean_entry(cleanup_entry, batch, lost_attempts_cleanup_log);
+            stats.num_cleaned += cleaned.value_or(false) ? 1 : 0;
+            stats.num_failed += cleaned ? 0 : 1;
+            continue;
+        }
+        results->emplace_back(cleanup_entry);
+        try {
+            stats.num_cleaned += cleanup_entry.clean(lost_attempts_cleanup_log, &results->back()) ? 1 : 0;
+            results->back().success(true);
+        } catch (const std::exception& e) {
+            lost_attempts_cleanup_log->error("{} cleanup of {} failed: {}, moving on", static_cast<void*>(this), cleanup_entry, e.what());
+            stats.num_failed++;
+            results->back().success(false);
         }
     }
+    flush_removals(batch, lost_attempts_cleanup_log);
     return stats;
 }
 
+std::optional<bool>
+tx::transactions_cleanup::clean_entry(atr_cleanup_entry& entry, atr_removal_batch& batch, std::shared_ptr<spdlog::logger> logger)
+{
+    try {
+        return entry.clean(logger, batch);
+    } catch (const std::exception& e) {
+        logger->error("{} cleanup of {} failed: {}, moving on", static_cast<void*>(this), entry, e.what());
+    } catch (...) {
+        // catch everything, as this runs on the cleanup threads
+        logger->error("{} cleanup of {} failed, moving on", static_cast<void*>(this), entry);
+    }
+    return {};
+}
+
+void
+tx::transactions_cleanup::flush_removals(atr_removal_batch& batch, std::shared_ptr<spdlog::logger> logger)
+{
+    if (batch.size() == 0) {
+        return;
+    }
+    logger->trace("{} removing {} cleaned up attempts from their atrs", static_cast<void*>(this), batch.size());
+    batch.flush(*this, logger);
+}
+
 void
 tx::transactions_cleanup::create_client_record(const std::string& bucket_name)
 {
@@ -235,7 +405,7 @@ tx::transactions_cleanup::create_client_record(const std::string& bucket_name)
         if (ec) {
             throw client_error(*ec, "client_record_before_create hook raised error");
         }
-        cluster_.execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+        kv_->execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
             barrier->set_value(result::create_from_subdoc_response(resp));
         });
         wrap_operation_future(f);
@@ -260,6 +430,8 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
     if (config_.cleanup_window() < min_retry) {
         min_retry = config_.cleanup_window();
     }
+    // none of the ops below should outlive the retry loop they are in
+    auto deadline = std::chrono::steady_clock::now() + config_.cleanup_window();
     return retry_op_exponential_backoff_timeout<client_record_details>(
       min_retry, std::chrono::seconds(1), config_.cleanup_window(), [&]() -> client_record_details {
           client_record_details details;
@@ -269,18 +441,21 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
               couchbase::operations::lookup_in_request req{ id };
               req.specs.add_spec(protocol::subdoc_opcode::get, true, FIELD_RECORDS);
               req.specs.add_spec(protocol::subdoc_opcode::get, true, "$vbucket");
-              wrap_request(req, config_);
+              wrap_request(req, config_, time_until(deadline));
               auto barrier = std::make_shared<std::promise<result>>();
               auto f = barrier->get_future();
               auto ec = config_.cleanup_hooks().client_record_before_get(bucket_name);
               if (ec) {
                   throw client_error(*ec, "client_record_before_get hook raised error");
               }
-              cluster_.execute(req, [barrier](couchbase::operations::lookup_in_response resp) {
+              kv_->execute(req, [barrier](couchbase::operations::lookup_in_response resp) {
                   barrier->set_value(result::create_from_subdoc_response(resp));
               });
               auto res = wrap_operation_future(f);
               std::vector<std::string> active_client_uids;
+              // what this client last wrote, so we don't rewrite it when it hasn't changed
+              std::optional<uint64_t> our_expires_ms;
+              std::optional<uint64_t> our_num_atrs;
               auto hlc = res.values[1].content_as<nlohmann::json>();
               auto now_ms = now_ns_from_vbucket(hlc) / 1000000;
               details.override_enabled = false;
@@ -307,6 +482,12 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
                               auto expires_ms = cl[FIELD_EXPIRES].get<uint64_t>();
                               auto expired_period = static_cast<int64_t>(now_ms) - static_cast<int64_t>(heartbeat_ms);
                               bool has_expired = expired_period >= static_cast<int64_t>(expires_ms) && now_ms > heartbeat_ms;
+                              if (other_client_uuid == uuid) {
+                                  our_expires_ms = expires_ms;
+                                  if (cl.contains(FIELD_NUM_ATRS)) {
+                                      our_num_atrs = cl[FIELD_NUM_ATRS].get<uint64_t>();
+                                  }
+                              }
                               if (has_expired && other_client_uuid != uuid) {
                                   details.expired_client_ids.push_back(other_client_uuid);
                               } else {
@@ -324,7 +505,7 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
                 std::distance(active_client_uids.begin(), std::find(active_client_uids.begin(), active_client_uids.end(), uuid));
               details.num_active_clients = static_cast<uint32_t>(active_client_uids.size());
               details.index_of_this_client = static_cast<uint32_t>(this_idx);
-              details.num_active_clients = static_cast<uint32_t>(active_client_uids.size());
+              details.active_client_ids = active_client_uids;
               details.num_expired_clients = static_cast<uint32_t>(details.expired_client_ids.size());
               details.num_existing_clients = details.num_expired_clients + details.num_active_clients;
               details.client_uuid = uuid;
@@ -336,7 +517,8 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
                   return details;
               }
 
-              // update client record, maybe cleanup some as well...
+              // update client record, maybe cleanup some as well...  None of these are conditional on the cas of the record,
+              // so heartbeats from many clients don't conflict with each other.
               couchbase::operations::mutate_in_request mutate_req{ id };
               mutate_req.specs.add_spec(protocol::subdoc_opcode::dict_upsert,
                                         true,
@@ -344,32 +526,50 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
                                         true,
                                         FIELD_CLIENTS + "." + uuid + "." + FIELD_HEARTBEAT,
                                         mutate_in_macro::CAS);
-              mutate_req.specs.add_spec(protocol::subdoc_opcode::dict_upsert,
-                                        true,
-                                        true,
-                                        false,
-                                        FIELD_CLIENTS + "." + uuid + "." + FIELD_EXPIRES,
-                                        jsonify(config_.cleanup_window().count() / 2 + SAFETY_MARGIN_EXPIRY_MS));
-              mutate_req.specs.add_spec(protocol::subdoc_opcode::dict_upsert,
-                                        true,
-                                        true,
-                                        false,
-                                        FIELD_CLIENTS + "." + uuid + "." + FIELD_NUM_ATRS,
-                                        jsonify(atr_ids::all().size()));
-              for (size_t idx = 0; idx < std::min(details.expired_client_ids.size(), static_cast<size_t>(12)); idx++) {
-                  lost_attempts_cleanup_log->trace("adding {} to list of clients to be removed when updating this client",
-                                                   details.expired_client_ids[idx]);
-                  mutate_req.specs.add_spec(protocol::subdoc_opcode::remove, true, FIELD_CLIENTS + "." + details.expired_client_ids[idx]);
+              uint64_t expires_ms = config_.cleanup_window().count() + SAFETY_MARGIN_EXPIRY_MS;
+              if (our_expires_ms != expires_ms) {
+                  mutate_req.specs.add_spec(protocol::subdoc_opcode::dict_upsert,
+                                            true,
+                                            true,
+                                            false,
+                                            FIELD_CLIENTS + "." + uuid + "." + FIELD_EXPIRES,
+                                            jsonify(expires_ms));
+              }
+              if (our_num_atrs != atr_ids::all().size()) {
+                  mutate_req.specs.add_spec(protocol::subdoc_opcode::dict_upsert,
+                                            true,
+                                            true,
+                                            false,
+                                            FIELD_CLIENTS + "." + uuid + "." + FIELD_NUM_ATRS,
+                                            jsonify(atr_ids::all().size()));
+              }
+              // Every active client sees the same expired clients, so leave each one to be removed by just one of them, rather
+              // than all racing to (and all but one failing, as removing a path that has gone fails the whole mutation).
+              size_t removing = 0;
+              for (const auto& expired_id : details.expired_client_ids) {
+                  if (removing == 12) {
+                      break;
+                  }
+                  if (atr_ids::owner_of(expired_id, active_client_uids) != uuid) {
+                      continue;
+                  }
+                  lost_attempts_cleanup_log->trace("adding {} to list of clients to be removed when updating this client", expired_id);
+                  mutate_req.specs.add_spec(protocol::subdoc_opcode::remove, true, FIELD_CLIENTS + "." + expired_id);
+                  removing++;
               }
               ec = config_.cleanup_hooks().client_record_before_update(bucket_name);
               if (ec) {
                   throw client_error(*ec, "client_record_before_update hook raised error");
               }
-              wrap_durable_request(mutate_req, config_);
+              if (config_.cleanup_durable_heartbeats()) {
+                  wrap_durable_request(mutate_req, config_, time_until(deadline));
+              } else {
+                  wrap_request(mutate_req, config_, time_until(deadline));
+              }
               auto mutate_barrier = std::make_shared<std::promise<result>>();
               auto mutate_f = mutate_barrier->get_future();
               lost_attempts_cleanup_log->trace("updating record");
-              cluster_.execute(mutate_req, [mutate_barrier](couchbase::operations::mutate_in_response resp) {
+              kv_->execute(mutate_req, [mutate_barrier](couchbase::operations::mutate_in_response resp) {
                   mutate_barrier->set_value(result::create_from_subdoc_response(resp));
               });
               res = wrap_operation_future(mutate_f);
@@ -392,6 +592,44 @@ tx::transactions_cleanup::get_active_clients(const std::string& bucket_name, con
       });
 }
 
+void
+tx::transactions_cleanup::heartbeat(const std::string& bucket_name)
+{
+    auto details = get_active_clients(bucket_name, client_uuid_);
+    std::lock_guard<std::mutex> lock(membership_mutex_);
+    if (auto it = membership_.find(bucket_name); it != membership_.end()) {
+        const auto& before = it->second.active_client_ids;
+        const auto& after = details.active_client_ids;
+        // both are sorted
+        std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(details.joined_client_ids));
+        std::set_difference(before.begin(), before.end(), after.begin(), after.end(), std::back_inserter(details.left_client_ids));
+        if (!details.joined_client_ids.empty() || !details.left_client_ids.empty()) {
+            lost_attempts_cleanup_log->info("{} clients in {} changed, {} joined and {} left, {} now active",
+                                            static_cast<void*>(this),
+                                            bucket_name,
+                                            details.joined_client_ids.size(),
+                                            details.left_client_ids.size(),
+                                            details.num_active_clients);
+        }
+    }
+    membership_[bucket_name] = std::move(details);
+}
+
+tx::client_record_details
+tx::transactions_cleanup::membership(const std::string& bucket_name)
+{
+    {
+        std::lock_guard<std::mutex> lock(membership_mutex_);
+        if (auto it = membership_.find(bucket_name); it != membership_.end()) {
+            return it->second;
+        }
+    }
+    // the first scan of a bucket can beat its first heartbeat.
+    heartbeat(bucket_name);
+    std::lock_guard<std::mutex> lock(membership_mutex_);
+    return membership_[bucket_name];
+}
+
 void
 tx::transactions_cleanup::remove_client_record_from_all_buckets(const std::string& uuid)
 {
@@ -414,7 +652,7 @@ tx::transactions_cleanup::remove_client_record_from_all_buckets(const std::strin
                       wrap_durable_request(req, config_);
                       auto barrier = std::make_shared<std::promise<result>>();
                       auto f = barrier->get_future();
-                      cluster_.execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
+                      kv_->execute(req, [barrier](couchbase::operations::mutate_in_response resp) {
                           barrier->set_value(result::create_from_subdoc_response(resp));
                       });
                       wrap_operation_future(f);
@@ -443,36 +681,78 @@ tx::transactions_cleanup::remove_client_record_from_all_buckets(const std::strin
     }
 }
 
+void
+tx::transactions_cleanup::refresh_buckets(bucket_scan_scheduler& scans, bucket_scan_scheduler& heartbeats)
+{
+    auto names = get_bucket_names(cluster_);
+    auto scheduled = scans.buckets();
+    for (const auto& name : names) {
+        if (scheduled.erase(name) > 0) {
+            continue;
+        }
+        // only new buckets need opening
+        if (auto ec = open_bucket(cluster_, name); ec) {
+            lost_attempts_cleanup_log->error("{} could not open bucket {}: {}, will retry", static_cast<void*>(this), name, ec.message());
+            continue;
+        }
+        lost_attempts_cleanup_log->info("{} scheduling cleanup of bucket {}", static_cast<void*>(this), name);
+        heartbeats.add_bucket(name);
+        scans.add_bucket(name);
+    }
+    // anything left has been dropped from the cluster
+    for (const auto& name : scheduled) {
+        lost_attempts_cleanup_log->info("{} bucket {} has gone, no longer cleaning it", static_cast<void*>(this), name);
+        scans.remove_bucket(name);
+        heartbeats.remove_bucket(name);
+        std::lock_guard<std::mutex> lock(membership_mutex_);
+        membership_.erase(name);
+    }
+}
+
 void
 tx::transactions_cleanup::lost_attempts_loop()
 {
-    lost_attempts_cleanup_log->info("{} starting lost attempts loop", static_cast<void*>(this));
-    while (running_.load()) {
-        std::list<std::thread> workers;
-        try {
-            auto names = get_and_open_buckets(cluster_);
-            lost_attempts_cleanup_log->info("{} creating {} tasks to clean buckets", static_cast<void*>(this), names.size());
-            // TODO consider std::async here.
-            for (const auto& name : names) {
-                workers.emplace_back([&]() {
-                    try {
-                        clean_lost_attempts_in_bucket(name);
-                    } catch (const std::runtime_error& e) {
-                        lost_attempts_cleanup_log->error(
-                          "{} got error {} attempting to clean {}", static_cast<void*>(this), e.what(), name);
-                    }
-                });
+    lost_attempts_cleanup_log->info("{} starting lost attempts loop, with {} bucket scan threads",
+                                    static_cast<void*>(this),
+                                    config_.cleanup_bucket_scan_threads());
+    {
+        // Each bucket is scanned on its own cadence by a fixed pool of threads, rather than spawning a thread per bucket every
+        // pass and waiting for the slowest.  This thread just keeps the set of buckets up to date.
+        bucket_scan_scheduler scheduler(config_.cleanup_bucket_scan_threads(), config_.cleanup_window(), [this](const std::string& name) {
+            try {
+                clean_lost_attempts_in_bucket(name);
+            } catch (const std::exception& e) {
+                lost_attempts_cleanup_log->error("{} got error {} attempting to clean {}", static_cast<void*>(this), e.what(), name);
             }
-            for (auto& thr : workers) {
-                if (thr.joinable()) {
-                    thr.join();
-                }
+        });
+        // Heartbeats are on their own schedule, once per cleanup window like the scans (so a fleet of 200 clients writes the
+        // client record 200 times a window, rather than 400 when it was every half window).  This client never looks expired to
+        // the others, as the expiry it writes is a cleanup window plus a safety margin.  They are jittered so a fleet of clients
+        // started together doesn't write to the client record all at once.
+        bucket_scan_scheduler heartbeats(
+          2,
+          config_.cleanup_window(),
+          [this](const std::string& name) {
+              try {
+                  heartbeat(name);
+              } catch (const std::exception& e) {
+                  lost_attempts_cleanup_log->error("{} got error {} heartbeating in {}", static_cast<void*>(this), e.what(), name);
+              }
+          },
+          heartbeat_jitter_);
+        do {
+            try {
+                refresh_buckets(scheduler, heartbeats);
+            } catch (const std::exception& e) {
+                lost_attempts_cleanup_log->error("{} got error {} refreshing buckets, retrying in {}s",
+                                                 static_cast<void*>(this),
+                                                 e.what(),
+                                                 bucket_refresh_interval_.count());
             }
-        } catch (const std::exception& e) {
-            lost_attempts_cleanup_log->error(
-              "{} got error {}, rescheduling in {}ms", static_cast<void*>(this), e.what(), config_.cleanup_window().count());
-            interruptable_wait(config_.cleanup_window());
-        }
+        } while (interruptable_wait(bucket_refresh_interval_));
+        // the scans notice running_ is false, so this won't wait long.
+        scheduler.stop();
+        heartbeats.stop();
     }
     remove_client_record_from_all_buckets(client_uuid_);
 }
@@ -522,23 +802,52 @@ tx::transactions_cleanup::attempts_loop()
 {
     try {
         attempt_cleanup_log->debug("cleanup attempts loop starting...");
-        while (interruptable_wait(cleanup_loop_delay_)) {
-            while (auto entry = atr_queue_.pop()) {
-                if (!running_.load()) {
-                    attempt_cleanup_log->debug("loop stopping - {} entries on queue", atr_queue_.size());
-                    return;
+        // entries which are ready together have their removals from the ATRs batched up.
+        atr_removal_batch batch;
+        // The entries cleaned since the last flush, and whether each was.  Their ATRs stay claimed until their removals are
+        // done, so no entry is cleaned before the one ahead of it in its ATR is gone.
+        std::vector<std::pair<atr_cleanup_entry, bool>> unflushed;
+        // but don't hold too many ATRs back from the other workers
+        const size_t max_unflushed = 64;
+        auto flush = [&]() {
+            flush_removals(batch, attempt_cleanup_log);
+            for (const auto& [entry, cleaned] : unflushed) {
+                if (cleaned) {
+                    // as far as the journal is concerned, it's done with now.  If it failed, it's left for lost attempts cleanup.
+                    journal_attempt(entry.atr_id(), entry.attempt_id(), attempt_state::COMPLETED);
                 }
-                if (entry) {
-                    attempt_cleanup_log->trace("beginning cleanup on {}", *entry);
-                    try {
-                        entry->clean(attempt_cleanup_log);
-                    } catch (...) {
-                        // catch everything as we don't want to raise out of this thread
-                        attempt_cleanup_log->info("got error cleaning {}, leaving for lost txn cleanup", entry.value());
-                    }
+                atr_queue_.release(entry);
+            }
+            unflushed.clear();
+        };
+        while (running_.load()) {
+            // claiming the entry's ATR keeps the other workers off it until we're done, so each ATR is cleaned in order.
+            auto entry = atr_queue_.pop(true, true);
+            if (!entry) {
+                // nothing more ready right now, so it's a good time to do the removals.
+                flush();
+                entry = atr_queue_.wait_pop(true);
+                if (!entry) {
+                    // closed
+                    break;
                 }
             }
+            attempt_cleanup_log->trace("beginning cleanup on {}", *entry);
+            auto started = std::chrono::steady_clock::now();
+            auto cleaned = clean_entry(*entry, batch, attempt_cleanup_log).has_value();
+            unflushed.emplace_back(std::move(*entry), cleaned);
+            if (unflushed.size() >= max_unflushed) {
+                flush();
+            }
+            // when throttled, rest in proportion to the time spent cleaning, so we only run at the throttled fraction of the time.
+            if (auto level = throttle_.level(); level < 1.0) {
+                auto spent = std::chrono::steady_clock::now() - started;
+                auto rest = std::chrono::duration_cast<std::chrono::milliseconds>(spent * (1 / level - 1));
+                attempt_cleanup_log->trace("cleanup throttled to {}, resting for {}ms", level, rest.count());
+                interruptable_wait(rest);
+            }
         }
+        flush();
         attempt_cleanup_log->info("stopping - {} entries on queue", atr_queue_.size());
     } catch (const std::runtime_error& e) {
         attempt_cleanup_log->error("got error {} in attempts_loop", e.what());
@@ -557,25 +866,44 @@ tx::transactions_cleanup::add_attempt(attempt_context& ctx)
             return;
         default:
             if (config_.cleanup_client_attempts()) {
-                attempt_cleanup_log->debug("adding attempt {} to cleanup queue", ctx_impl.id());
-                atr_queue_.push(ctx);
+                if (atr_queue_.push(ctx)) {
+                    attempt_cleanup_log->debug("added attempt {} to cleanup queue", ctx_impl.id());
+                } else {
+                    // see cleanup_queue_stats() for which
+                    attempt_cleanup_log->debug("attempt {} already queued or queue full, not adding to cleanup queue", ctx_impl.id());
+                }
             } else {
                 attempt_cleanup_log->trace("not cleaning client attempts, ignoring {}", ctx_impl.id());
             }
     }
 }
 
+void
+tx::transactions_cleanup::journal_attempt(const couchbase::document_id& atr_id, const std::string& attempt_id, attempt_state state)
+{
+    if (journal_) {
+        journal_->record(atr_id, attempt_id, state);
+    }
+}
+
 void
 tx::transactions_cleanup::close()
 {
+    // before stopping anything, so we can't be handed the lost attempts cleanup while stopping.
+    if (!lost_attempts_key_.empty()) {
+        lost_attempts_registry::instance().leave(lost_attempts_key_, this);
+    }
     {
         std::unique_lock<std::mutex> lock(mutex_);
         running_ = false;
         cv_.notify_all();
     }
-    if (cleanup_thr_.joinable()) {
-        cleanup_thr_.join();
-        attempt_cleanup_log->info("cleanup attempt thread closed");
+    atr_queue_.close();
+    for (auto& thr : cleanup_thrs_) {
+        if (thr.joinable()) {
+            thr.join();
+            attempt_cleanup_log->info("cleanup attempt thread closed");
+        }
     }
     if (lost_attempts_thr_.joinable()) {
         lost_attempts_thr_.join();
@@ -0,0 +1,276 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "transactions_env.h"
+#include <couchbase/transactions.hxx>
+#include <couchbase/transactions/internal/atr_cleanup_entry.hxx>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+// the entries only need a cleanup to refer to, which needn't be running.
+transactions_cleanup&
+idle_cleanup()
+{
+    static transaction_config cfg = []() {
+        transaction_config c;
+        c.cleanup_client_attempts(false);
+        c.cleanup_lost_attempts(false);
+        return c;
+    }();
+    static transactions txns(TransactionsTestEnvironment::get_cluster(), cfg);
+    return txns.cleanup();
+}
+
+atr_cleanup_entry
+entry(const std::string& attempt_id, milliseconds ready_in = milliseconds(0), const std::string& atr = "_txn:atr-0-#1")
+{
+    atr_cleanup_entry e({ "default", "_default", "_default", atr }, attempt_id, idle_cleanup());
+    e.min_start_time(steady_clock::now() + ready_in);
+    return e;
+}
+} // namespace
+
+TEST(AtrCleanupQueue, PopsInOrderOfReadiness)
+{
+    atr_cleanup_queue queue;
+    ASSERT_TRUE(queue.push(entry("later", milliseconds(20))));
+    ASSERT_TRUE(queue.push(entry("now")));
+    ASSERT_TRUE(queue.push(entry("much-later", milliseconds(40))));
+    ASSERT_EQ("now", queue.pop()->attempt_id());
+    // not ready yet, unless we don't care
+    ASSERT_FALSE(queue.pop());
+    ASSERT_EQ("later", queue.pop(false)->attempt_id());
+    ASSERT_EQ("much-later", queue.wait_pop()->attempt_id());
+    ASSERT_EQ(0u, queue.size());
+}
+
+TEST(AtrCleanupQueue, DeduplicatesByAtrAndAttempt)
+{
+    atr_cleanup_queue queue;
+    ASSERT_TRUE(queue.push(entry("a")));
+    ASSERT_FALSE(queue.push(entry("a")));
+    // same attempt id, but a different atr, is a different entry
+    ASSERT_TRUE(queue.push(entry("a", milliseconds(0), "_txn:atr-1-#2")));
+    ASSERT_EQ(2u, queue.size());
+    ASSERT_EQ(1u, queue.stats().deduplicated);
+    // once popped, it can be queued again
+    queue.pop();
+    queue.pop();
+    ASSERT_TRUE(queue.push(entry("a")));
+}
+
+TEST(AtrCleanupQueue, IsBounded)
+{
+    atr_cleanup_queue queue(3);
+    for (int i = 0; i < 5; i++) {
+        queue.push(entry(std::to_string(i)));
+    }
+    ASSERT_EQ(3u, queue.size());
+    auto stats = queue.stats();
+    ASSERT_EQ(3u, stats.queued);
+    ASSERT_EQ(2u, stats.dropped);
+    ASSERT_EQ(3u, stats.high_water_mark);
+}
+
+TEST(AtrCleanupQueue, WaitPopWakesWhenFrontIsReady)
+{
+    atr_cleanup_queue queue;
+    queue.push(entry("a", milliseconds(100)));
+    auto start = steady_clock::now();
+    std::thread pusher([&]() {
+        std::this_thread::sleep_for(milliseconds(20));
+        queue.push(entry("b", milliseconds(10)));
+    });
+    auto popped = queue.wait_pop();
+    auto elapsed = steady_clock::now() - start;
+    pusher.join();
+    // b is pushed later, but is ready sooner
+    ASSERT_TRUE(popped);
+    ASSERT_EQ("b", popped->attempt_id());
+    ASSERT_GE(elapsed, milliseconds(30));
+}
+
+TEST(AtrCleanupQueue, CloseWakesWaiters)
+{
+    atr_cleanup_queue queue;
+    std::thread closer([&]() {
+        std::this_thread::sleep_for(milliseconds(20));
+        queue.close();
+    });
+    auto popped = queue.wait_pop();
+    closer.join();
+    ASSERT_FALSE(popped);
+}
+
+TEST(AtrCleanupQueue, ManyConsumersGetEachEntryOnce)
+{
+    atr_cleanup_queue queue;
+    std::atomic<size_t> popped{ 0 };
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < 4; i++) {
+        consumers.emplace_back([&]() {
+            while (queue.wait_pop()) {
+                popped++;
+            }
+        });
+    }
+    for (int i = 0; i < 1000; i++) {
+        queue.push(entry(std::to_string(i), milliseconds(i % 10)));
+    }
+    auto deadline = steady_clock::now() + seconds(5);
+    while (popped.load() < 1000 && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(5));
+    }
+    queue.close();
+    for (auto& thr : consumers) {
+        thr.join();
+    }
+    ASSERT_EQ(1000u, popped.load());
+}
+
+TEST(AtrCleanupQueue, ClaimingAnAtrHoldsBackItsOtherEntries)
+{
+    atr_cleanup_queue queue;
+    queue.push(entry("first"));
+    queue.push(entry("second", milliseconds(1)));
+    queue.push(entry("other-atr", milliseconds(2), "_txn:atr-1-#2"));
+    std::this_thread::sleep_for(milliseconds(10));
+    auto first = queue.pop(true, true);
+    ASSERT_EQ("first", first->attempt_id());
+    // second is ready, but its ATR is still being cleaned
+    ASSERT_EQ("other-atr", queue.pop(true, true)->attempt_id());
+    ASSERT_FALSE(queue.pop(true, true));
+    ASSERT_EQ(1u, queue.size());
+    queue.release(*first);
+    ASSERT_EQ("second", queue.pop(true, true)->attempt_id());
+}
+
+TEST(AtrCleanupQueue, ReleaseWakesWaitersOnThatAtr)
+{
+    atr_cleanup_queue queue;
+    queue.push(entry("first"));
+    queue.push(entry("second"));
+    auto first = queue.wait_pop(true);
+    std::thread releaser([&]() {
+        std::this_thread::sleep_for(milliseconds(20));
+        queue.release(*first);
+    });
+    auto start = steady_clock::now();
+    auto second = queue.wait_pop(true);
+    auto elapsed = steady_clock::now() - start;
+    releaser.join();
+    ASSERT_TRUE(second);
+    ASSERT_EQ("second", second->attempt_id());
+    ASSERT_GE(elapsed, milliseconds(15));
+}
+
+TEST(AtrCleanupQueue, ManyWorkersCleanEachAtrInOrder)
+{
+    atr_cleanup_queue queue;
+    std::mutex mutex;
+    std::map<std::string, std::vector<int>> cleaned;
+    std::map<std::string, int> in_progress;
+    bool overlapped = false;
+    for (int i = 0; i < 200; i++) {
+        auto atr = "_txn:atr-" + std::to_string(i % 5);
+        queue.push(entry(std::to_string(i), milliseconds(i / 20), atr));
+    }
+    std::vector<std::thread> workers;
+    for (int w = 0; w < 4; w++) {
+        workers.emplace_back([&]() {
+            while (auto e = queue.wait_pop(true)) {
+                const auto& atr = e->atr_id().key();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    overlapped = overlapped || in_progress[atr]++ > 0;
+                    cleaned[atr].push_back(std::stoi(e->attempt_id()));
+                }
+                std::this_thread::sleep_for(microseconds(100));
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    in_progress[atr]--;
+                }
+                queue.release(*e);
+            }
+        });
+    }
+    auto deadline = steady_clock::now() + seconds(5);
+    while (queue.stats().cleaned < 200 && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(5));
+    }
+    queue.close();
+    for (auto& thr : workers) {
+        thr.join();
+    }
+    ASSERT_FALSE(overlapped);
+    for (const auto& [atr, ids] : cleaned) {
+        ASSERT_TRUE(std::is_sorted(ids.begin(), ids.end())) << atr;
+    }
+    auto stats = queue.stats();
+    ASSERT_EQ(200u, stats.cleaned);
+    ASSERT_GE(stats.max_latency, stats.mean_latency());
+    ASSERT_GT(stats.mean_latency(), microseconds(0));
+}
+
+TEST(AtrCleanupQueue, EntriesReadyTogetherPopInTheOrderPushed)
+{
+    atr_cleanup_queue queue;
+    auto ready_at = steady_clock::now();
+    for (int i = 0; i < 5; i++) {
+        auto e = entry(std::to_string(i));
+        e.min_start_time(ready_at);
+        queue.push(e);
+    }
+    for (int i = 0; i < 5; i++) {
+        auto popped = queue.pop(true, true);
+        ASSERT_EQ(std::to_string(i), popped->attempt_id());
+        queue.release(*popped);
+    }
+}
+
+TEST(AtrCleanupQueue, OtherAtrsPopQuicklyBehindAClaimedOne)
+{
+    atr_cleanup_queue queue(100000);
+    queue.push(entry("busy"));
+    auto busy = queue.pop(true, true);
+    for (int i = 0; i < 50000; i++) {
+        queue.push(entry(std::to_string(i)));
+    }
+    for (int i = 0; i < 1000; i++) {
+        queue.push(entry("other-" + std::to_string(i), milliseconds(0), "_txn:atr-" + std::to_string(i + 1)));
+    }
+    std::this_thread::sleep_for(milliseconds(1));
+    // each pop skips past all the entries of the claimed ATR without looking at them
+    auto start = steady_clock::now();
+    for (int i = 0; i < 1000; i++) {
+        auto popped = queue.pop(true, true);
+        ASSERT_TRUE(popped);
+        ASSERT_NE(busy->atr_id().key(), popped->atr_id().key());
+    }
+    ASSERT_LT(steady_clock::now() - start, milliseconds(500));
+    ASSERT_FALSE(queue.pop(true, true));
+    queue.release(*busy);
+    ASSERT_EQ("0", queue.pop(true, true)->attempt_id());
+}
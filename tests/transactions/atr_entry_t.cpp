@@ -0,0 +1,118 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <couchbase/transactions/internal/atr_entry.hxx>
+#include <gtest/gtest.h>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const std::string raw_attempts = R"({
+    "attempt-1": {"st": "COMMITTED",
+                  "ins": [{"bkt": "default", "scp": "_default", "col": "_default", "id": "inserted"}],
+                  "rep": [{"bkt": "default", "scp": "_default", "col": "_default", "id": "replaced-1"},
+                          {"bkt": "default", "scp": "_default", "col": "_default", "id": "replaced-2"}]},
+    "attempt-2": {"st": "PENDING",
+                  "rem": [{"bkt": "other", "scp": "s", "col": "c", "id": "removed"}]}
+})";
+
+atr_entry
+lazy_entry(const std::string& attempt_id, std::shared_ptr<const std::string> raw)
+{
+    auto spans = lazy_doc_records::index(*raw);
+    auto span = spans.count(attempt_id) ? std::make_optional(spans.at(attempt_id)) : std::nullopt;
+    return atr_entry("default",
+                     "_txn:atr-0-#1",
+                     attempt_id,
+                     attempt_state::COMMITTED,
+                     {},
+                     {},
+                     {},
+                     {},
+                     {},
+                     {},
+                     std::make_shared<const lazy_doc_records>(std::move(raw), span),
+                     {},
+                     0,
+                     {});
+}
+} // namespace
+
+TEST(LazyDocRecords, ParsesOnlyTheRequestedEntry)
+{
+    auto raw = std::make_shared<const std::string>(raw_attempts);
+    auto entry = lazy_entry("attempt-1", raw);
+    ASSERT_EQ(1u, entry.inserted_ids()->size());
+    ASSERT_EQ("inserted", entry.inserted_ids()->front().id());
+    ASSERT_EQ(2u, entry.replaced_ids()->size());
+    ASSERT_EQ("replaced-2", entry.replaced_ids()->back().id());
+    ASSERT_FALSE(entry.removed_ids());
+
+    auto other = lazy_entry("attempt-2", raw);
+    ASSERT_FALSE(other.inserted_ids());
+    ASSERT_FALSE(other.replaced_ids());
+    ASSERT_EQ(1u, other.removed_ids()->size());
+    ASSERT_EQ("other", other.removed_ids()->front().bucket_name());
+    ASSERT_EQ("c", other.removed_ids()->front().collection_name());
+}
+
+TEST(LazyDocRecords, MissingEntryHasNoDocs)
+{
+    auto entry = lazy_entry("not-there", std::make_shared<const std::string>(raw_attempts));
+    ASSERT_FALSE(entry.inserted_ids());
+    ASSERT_FALSE(entry.replaced_ids());
+    ASSERT_FALSE(entry.removed_ids());
+}
+
+TEST(LazyDocRecords, ParsedOnlyWhenAskedAndOnlyOnce)
+{
+    auto raw = std::make_shared<const std::string>(raw_attempts);
+    auto entry = lazy_entry("attempt-1", raw);
+    // not parsed yet, so still holding on to the raw attempts
+    ASSERT_EQ(2, raw.use_count());
+    auto copy = entry;
+    ASSERT_EQ(1u, copy.inserted_ids()->size());
+    // parsing releases the raw attempts, and copies share the parsed lists
+    ASSERT_EQ(1, raw.use_count());
+    ASSERT_EQ(2u, entry.replaced_ids()->size());
+}
+
+TEST(LazyDocRecords, IndexFindsEachEntry)
+{
+    auto spans = lazy_doc_records::index(raw_attempts);
+    ASSERT_EQ(2u, spans.size());
+    for (const auto& [attempt_id, span] : spans) {
+        auto entry = nlohmann::json::parse(raw_attempts.substr(span.offset, span.length));
+        ASSERT_TRUE(entry.is_object()) << attempt_id;
+        ASSERT_EQ(attempt_id == "attempt-1" ? "COMMITTED" : "PENDING", entry["st"].get<std::string>());
+    }
+}
+
+TEST(LazyDocRecords, IndexCopesWithAwkwardJson)
+{
+    // strings holding braces, quotes and commas, escaped keys, nested arrays and scalar values
+    std::string raw = R"( { "a\"b" : {"x": "}],{\"", "y": [[1, {"z": "]"}], 2]} , "c":3,"d" :"e"} )";
+    auto spans = lazy_doc_records::index(raw);
+    ASSERT_EQ(3u, spans.size());
+    ASSERT_EQ(nlohmann::json::parse(R"({"x": "}],{\"", "y": [[1, {"z": "]"}], 2]})"),
+              nlohmann::json::parse(raw.substr(spans.at("a\"b").offset, spans.at("a\"b").length)));
+    ASSERT_EQ(3, nlohmann::json::parse(raw.substr(spans.at("c").offset, spans.at("c").length)).get<int>());
+    ASSERT_EQ("e", nlohmann::json::parse(raw.substr(spans.at("d").offset, spans.at("d").length)).get<std::string>());
+    ASSERT_TRUE(lazy_doc_records::index("{}").empty());
+    ASSERT_THROW(lazy_doc_records::index(R"({"a": {"b": 1})"), std::runtime_error);
+    ASSERT_THROW(lazy_doc_records::index("[]"), std::runtime_error);
+}
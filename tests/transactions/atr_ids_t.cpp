@@ -0,0 +1,90 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/atr_ids.hxx"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+std::vector<std::string>
+clients(size_t n)
+{
+    std::vector<std::string> uuids;
+    for (size_t i = 0; i < n; i++) {
+        uuids.push_back("client-" + std::to_string(i));
+    }
+    return uuids;
+}
+
+std::map<std::string, std::string>
+owners(const std::vector<std::string>& uuids)
+{
+    std::map<std::string, std::string> result;
+    for (const auto& atr : atr_ids::all()) {
+        result[atr] = atr_ids::owner_of(atr, uuids);
+    }
+    return result;
+}
+} // namespace
+
+TEST(AtrIds, RendezvousAssignsEveryAtrExactlyOnce)
+{
+    auto uuids = clients(7);
+    size_t total = 0;
+    for (const auto& uuid : uuids) {
+        auto atrs = atr_ids::assigned_to(uuid, uuids);
+        // roughly evenly, too
+        ASSERT_GT(atrs.size(), atr_ids::all().size() / 7 / 2);
+        ASSERT_LT(atrs.size(), atr_ids::all().size() / 7 * 2);
+        total += atrs.size();
+    }
+    ASSERT_EQ(atr_ids::all().size(), total);
+}
+
+TEST(AtrIds, RendezvousDoesNotDependOnClientOrder)
+{
+    auto uuids = clients(5);
+    auto reversed = uuids;
+    std::reverse(reversed.begin(), reversed.end());
+    ASSERT_EQ(owners(uuids), owners(reversed));
+}
+
+TEST(AtrIds, RendezvousMovesFewAtrsWhenAClientJoins)
+{
+    auto before = owners(clients(10));
+    auto after = owners(clients(11));
+    size_t moved = 0;
+    for (const auto& [atr, owner] : before) {
+        if (after[atr] != owner) {
+            // only to the new client
+            ASSERT_EQ("client-10", after[atr]);
+            moved++;
+        }
+    }
+    // about 1/11 of them, where striding would move nearly all
+    ASSERT_GT(moved, atr_ids::all().size() / 11 / 2);
+    ASSERT_LT(moved, atr_ids::all().size() / 11 * 2);
+}
+
+TEST(AtrIds, RendezvousWithOneClientOwnsEverything)
+{
+    ASSERT_EQ(atr_ids::all(), atr_ids::assigned_to("only", { "only" }));
+}
@@ -0,0 +1,152 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <couchbase/transactions/internal/atr_cleanup_entry.hxx>
+#include <couchbase/transactions/internal/exceptions_internal.hxx>
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+// Records each request the batch makes, failing any holding one of the bad attempts.
+struct fake_remover {
+    struct request {
+        std::string atr;
+        std::vector<std::string> attempt_ids;
+        size_t specs;
+    };
+
+    std::vector<request> requests;
+    std::set<std::string> bad_attempts;
+    // removing one of these on its own finds it already gone
+    std::set<std::string> missing_attempts;
+
+    atr_removal_batch::remove_fn fn()
+    {
+        return [this](const couchbase::document_id& atr_id, const std::vector<atr_removal_batch::removal>& entries, durability_level) {
+            request req{ atr_id.key(), {}, 0 };
+            bool fail = false;
+            bool missing = false;
+            for (const auto& entry : entries) {
+                req.attempt_ids.push_back(entry.attempt_id);
+                req.specs += entry.pending ? 2 : 1;
+                fail = fail || bad_attempts.count(entry.attempt_id) > 0 || missing_attempts.count(entry.attempt_id) > 0;
+                missing = missing || missing_attempts.count(entry.attempt_id) > 0;
+            }
+            requests.push_back(req);
+            if (missing && entries.size() == 1) {
+                throw client_error(FAIL_PATH_NOT_FOUND, "path not found");
+            }
+            if (fail) {
+                throw client_error(FAIL_OTHER, "failed");
+            }
+        };
+    }
+};
+
+couchbase::document_id
+atr(const std::string& key)
+{
+    return { "default", "_default", "_default", key };
+}
+
+std::shared_ptr<spdlog::logger>
+logger()
+{
+    return spdlog::default_logger();
+}
+} // namespace
+
+TEST(AtrRemovalBatch, GroupsRemovalsByAtr)
+{
+    atr_removal_batch batch;
+    batch.add(atr("atr-1"), durability_level::MAJORITY, { "a", false });
+    batch.add(atr("atr-2"), durability_level::MAJORITY, { "b", false });
+    batch.add(atr("atr-1"), durability_level::MAJORITY, { "c", true });
+    // a different durability can't go in the same request
+    batch.add(atr("atr-1"), durability_level::NONE, { "d", false });
+    ASSERT_EQ(4u, batch.size());
+
+    fake_remover remover;
+    batch.flush(remover.fn(), logger());
+    ASSERT_EQ(0u, batch.size());
+    ASSERT_EQ(3u, remover.requests.size());
+    ASSERT_EQ("atr-1", remover.requests[0].atr);
+    ASSERT_EQ((std::vector<std::string>{ "a", "c" }), remover.requests[0].attempt_ids);
+    ASSERT_EQ(3u, remover.requests[0].specs);
+    ASSERT_EQ("atr-2", remover.requests[1].atr);
+    ASSERT_EQ(std::vector<std::string>{ "b" }, remover.requests[1].attempt_ids);
+    ASSERT_EQ("atr-1", remover.requests[2].atr);
+    ASSERT_EQ(std::vector<std::string>{ "d" }, remover.requests[2].attempt_ids);
+
+    // and it's empty once flushed
+    batch.flush(remover.fn(), logger());
+    ASSERT_EQ(3u, remover.requests.size());
+}
+
+TEST(AtrRemovalBatch, SplitsAtTheSpecLimit)
+{
+    atr_removal_batch batch;
+    // 20 plain entries, then 8 pending ones taking 2 specs each: 36 specs in all
+    for (int i = 0; i < 20; i++) {
+        batch.add(atr("atr-1"), durability_level::MAJORITY, { "plain-" + std::to_string(i), false });
+    }
+    for (int i = 0; i < 8; i++) {
+        batch.add(atr("atr-1"), durability_level::MAJORITY, { "pending-" + std::to_string(i), true });
+    }
+    fake_remover remover;
+    batch.flush(remover.fn(), logger());
+    size_t removed = 0;
+    for (const auto& req : remover.requests) {
+        ASSERT_LE(req.specs, atr_removal_batch::max_specs);
+        removed += req.attempt_ids.size();
+    }
+    ASSERT_EQ(28u, removed);
+    // the first 16 plain ones fill a request, then 4 plain and 6 pending (16 specs), then the 2 pending left
+    ASSERT_EQ(3u, remover.requests.size());
+    ASSERT_EQ(16u, remover.requests[0].specs);
+    ASSERT_EQ(16u, remover.requests[1].specs);
+    ASSERT_EQ(4u, remover.requests[2].specs);
+}
+
+TEST(AtrRemovalBatch, FallsBackToOneAtATimeOnFailure)
+{
+    atr_removal_batch batch;
+    for (const auto& id : { "a", "bad", "gone", "d" }) {
+        batch.add(atr("atr-1"), durability_level::MAJORITY, { id, false });
+    }
+    batch.add(atr("atr-2"), durability_level::MAJORITY, { "e", false });
+    fake_remover remover;
+    remover.bad_attempts = { "bad" };
+    remover.missing_attempts = { "gone" };
+    // errors removing single entries are logged, not raised
+    ASSERT_NO_THROW(batch.flush(remover.fn(), logger()));
+    // the failed group, then each of its entries on its own, then the other ATR untouched by the failure
+    ASSERT_EQ(6u, remover.requests.size());
+    ASSERT_EQ(4u, remover.requests[0].attempt_ids.size());
+    for (size_t i = 1; i <= 4; i++) {
+        ASSERT_EQ(1u, remover.requests[i].attempt_ids.size());
+        ASSERT_EQ("atr-1", remover.requests[i].atr);
+    }
+    ASSERT_EQ("bad", remover.requests[2].attempt_ids.front());
+    ASSERT_EQ("atr-2", remover.requests[5].atr);
+    ASSERT_EQ(std::vector<std::string>{ "e" }, remover.requests[5].attempt_ids);
+}
@@ -0,0 +1,194 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/bucket_scan_scheduler.hxx"
+#include <atomic>
+#include <future>
+#include <gtest/gtest.h>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+// counts scans per bucket, and the most scans ever running at once
+struct scan_counter {
+    std::mutex mutex;
+    std::map<std::string, size_t> scans;
+    std::atomic<size_t> running{ 0 };
+    std::atomic<size_t> max_running{ 0 };
+
+    void scan(const std::string& name, milliseconds takes)
+    {
+        auto now_running = ++running;
+        auto prev = max_running.load();
+        while (now_running > prev && !max_running.compare_exchange_weak(prev, now_running)) {
+        }
+        std::this_thread::sleep_for(takes);
+        --running;
+        std::lock_guard<std::mutex> lock(mutex);
+        scans[name]++;
+    }
+
+    size_t count(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return scans[name];
+    }
+};
+
+// Waits for the condition, or until it's clear it isn't coming.  The tests wait for what the scheduler must do, rather than
+// counting what it did in a fixed time, which a loaded machine can't be relied on for.
+bool
+eventually(const std::function<bool()>& condition)
+{
+    auto deadline = steady_clock::now() + seconds(10);
+    while (!condition()) {
+        if (steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    return true;
+}
+} // namespace
+
+TEST(BucketScanScheduler, ScansEachBucketOncePerInterval)
+{
+    scan_counter counter;
+    auto start = steady_clock::now();
+    {
+        bucket_scan_scheduler scheduler(2, milliseconds(100), [&](const std::string& name) { counter.scan(name, milliseconds(0)); });
+        scheduler.add_bucket("a");
+        scheduler.add_bucket("b");
+        ASSERT_TRUE(eventually([&]() { return counter.count("a") >= 3 && counter.count("b") >= 3; }));
+    }
+    // scanned straight away, then no more than once per interval
+    auto most = static_cast<size_t>((steady_clock::now() - start) / milliseconds(100)) + 1;
+    for (const auto& name : { "a", "b" }) {
+        ASSERT_LE(counter.count(name), most);
+    }
+}
+
+TEST(BucketScanScheduler, SlowBucketDoesNotHoldUpTheOthers)
+{
+    scan_counter counter;
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    bool fast_scanned = false;
+    size_t slow_scans = 0;
+    {
+        bucket_scan_scheduler scheduler(2, milliseconds(50), [&](const std::string& name) {
+            if (name == "slow") {
+                released.wait();
+            }
+            counter.scan(name, milliseconds(0));
+        });
+        scheduler.add_bucket("slow");
+        scheduler.add_bucket("fast");
+        // while the slow one is stuck in its first scan
+        fast_scanned = eventually([&]() { return counter.count("fast") >= 5; });
+        slow_scans = counter.count("slow");
+        // before asserting, as the scheduler waits for the slow scan to return
+        release.set_value();
+    }
+    ASSERT_TRUE(fast_scanned);
+    ASSERT_EQ(0u, slow_scans);
+    ASSERT_GE(counter.count("slow"), 1u);
+}
+
+TEST(BucketScanScheduler, NeverRunsMoreScansThanWorkers)
+{
+    scan_counter counter;
+    {
+        bucket_scan_scheduler scheduler(3, milliseconds(10), [&](const std::string& name) { counter.scan(name, milliseconds(20)); });
+        for (int i = 0; i < 20; i++) {
+            scheduler.add_bucket("bucket" + std::to_string(i));
+        }
+        // they all get a turn
+        ASSERT_TRUE(eventually([&]() {
+            for (int i = 0; i < 20; i++) {
+                if (counter.count("bucket" + std::to_string(i)) < 2) {
+                    return false;
+                }
+            }
+            return true;
+        }));
+    }
+    ASSERT_LE(counter.max_running.load(), 3u);
+}
+
+TEST(BucketScanScheduler, RemovedBucketsAreNotScanned)
+{
+    scan_counter counter;
+    bucket_scan_scheduler scheduler(1, milliseconds(50), [&](const std::string& name) { counter.scan(name, milliseconds(0)); });
+    scheduler.add_bucket("a");
+    scheduler.add_bucket("b");
+    ASSERT_TRUE(eventually([&]() { return counter.count("a") >= 1 && counter.count("b") >= 1; }));
+    scheduler.remove_bucket("b");
+    ASSERT_EQ(std::set<std::string>{ "a" }, scheduler.buckets());
+    auto scans_of_a = counter.count("a");
+    auto scans_of_b = counter.count("b");
+    ASSERT_TRUE(eventually([&]() { return counter.count("a") >= scans_of_a + 3; }));
+    // allowing for a scan of b that was already in progress when it was removed
+    ASSERT_LE(counter.count("b"), scans_of_b + 1);
+}
+
+TEST(BucketScanScheduler, AddingABucketTwiceSchedulesItOnce)
+{
+    scan_counter counter;
+    bucket_scan_scheduler scheduler(4, seconds(10), [&](const std::string& name) { counter.scan(name, milliseconds(0)); });
+    scheduler.add_bucket("a");
+    scheduler.add_bucket("a");
+    ASSERT_TRUE(eventually([&]() { return counter.count("a") >= 1; }));
+    // give a second scan the chance to show up, if there were going to be one
+    std::this_thread::sleep_for(milliseconds(50));
+    ASSERT_EQ(1u, counter.count("a"));
+    ASSERT_EQ(1u, scheduler.buckets().size());
+}
+
+TEST(BucketScanScheduler, StopWaitsForScansInProgress)
+{
+    std::atomic<bool> started{ false };
+    std::atomic<bool> finished{ false };
+    bucket_scan_scheduler scheduler(1, seconds(10), [&](const std::string&) {
+        started = true;
+        std::this_thread::sleep_for(milliseconds(100));
+        finished = true;
+    });
+    scheduler.add_bucket("a");
+    ASSERT_TRUE(eventually([&]() { return started.load(); }));
+    scheduler.stop();
+    ASSERT_TRUE(finished.load());
+}
+
+TEST(BucketScanScheduler, JitterOnlyShortensTheInterval)
+{
+    std::mt19937 random(42);
+    std::set<steady_clock::duration::rep> intervals;
+    for (int i = 0; i < 1000; i++) {
+        auto interval = bucket_scan_scheduler::jittered(milliseconds(50), 0.5, random);
+        ASSERT_GE(interval, milliseconds(25));
+        ASSERT_LE(interval, milliseconds(50));
+        intervals.insert(interval.count());
+    }
+    // they don't all come at the same interval, and they use the whole range
+    ASSERT_GT(intervals.size(), 1u);
+    ASSERT_LT(*intervals.begin(), steady_clock::duration(milliseconds(30)).count());
+    ASSERT_GT(*intervals.rbegin(), steady_clock::duration(milliseconds(45)).count());
+
+    ASSERT_EQ(milliseconds(50), bucket_scan_scheduler::jittered(milliseconds(50), 0, random));
+}
@@ -0,0 +1,165 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/cleanup_checkpoint.hxx"
+#include "helpers.hxx"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+class CleanupCheckpoint : public TempFileTest
+{
+};
+} // namespace
+
+TEST_F(CleanupCheckpoint, PrioritisesOccupiedThenLeastRecentlyScanned)
+{
+    cleanup_checkpoint checkpoint;
+    checkpoint.scanned("default", "c", 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    checkpoint.scanned("default", "a", 0);
+    checkpoint.scanned("default", "b", 2);
+    checkpoint.scanned("default", "e", 5);
+    std::vector<std::string> atrs{ "a", "b", "c", "d", "e" };
+    checkpoint.prioritise("default", atrs);
+    // d has never been scanned
+    std::vector<std::string> expected{ "e", "b", "d", "c", "a" };
+    ASSERT_EQ(expected, atrs);
+
+    // nothing known about this bucket, so the order is left alone
+    std::vector<std::string> other{ "a", "b", "c" };
+    checkpoint.prioritise("other", other);
+    ASSERT_EQ((std::vector<std::string>{ "a", "b", "c" }), other);
+}
+
+TEST_F(CleanupCheckpoint, SurvivesRestart)
+{
+    {
+        cleanup_checkpoint checkpoint(path_);
+        checkpoint.load();
+        checkpoint.scanned("default", "a", 3);
+        checkpoint.scanned("travel-sample", "b", 0);
+        checkpoint.save();
+    }
+    cleanup_checkpoint checkpoint(path_);
+    checkpoint.load();
+    auto progress = checkpoint.progress("default");
+    ASSERT_EQ(1, progress.size());
+    ASSERT_EQ(3, progress["a"].entries);
+    ASSERT_GT(progress["a"].scanned_ms, 0);
+    ASSERT_EQ(1, checkpoint.progress("travel-sample").size());
+}
+
+TEST_F(CleanupCheckpoint, MissingFileIsEmpty)
+{
+    cleanup_checkpoint checkpoint(path_);
+    checkpoint.load();
+    ASSERT_TRUE(checkpoint.progress("default").empty());
+}
+
+TEST_F(CleanupCheckpoint, CorruptFileThrowsAndKeepsWhatIsKnown)
+{
+    {
+        std::ofstream out(path_);
+        out << "{\"version\":1,\"buckets\":{\"default\":";
+    }
+    cleanup_checkpoint checkpoint(path_);
+    checkpoint.scanned("default", "a", 1);
+    ASSERT_ANY_THROW(checkpoint.load());
+    ASSERT_EQ(1, checkpoint.progress("default").size());
+}
+
+TEST_F(CleanupCheckpoint, WithoutPathSaveDoesNothing)
+{
+    cleanup_checkpoint checkpoint;
+    checkpoint.scanned("default", "a", 1);
+    ASSERT_NO_THROW(checkpoint.save());
+    ASSERT_NO_THROW(checkpoint.load());
+    ASSERT_EQ(1, checkpoint.progress("default").size());
+}
+
+TEST_F(CleanupCheckpoint, SavesFromSeveralThreadsAtOnce)
+{
+    cleanup_checkpoint checkpoint(path_);
+    std::vector<std::thread> savers;
+    std::atomic<size_t> failed{ 0 };
+    for (int t = 0; t < 4; t++) {
+        savers.emplace_back([&, t]() {
+            for (int i = 0; i < 50; i++) {
+                checkpoint.scanned("default", std::to_string(t) + "-" + std::to_string(i), 1);
+                try {
+                    checkpoint.save();
+                } catch (...) {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (auto& thr : savers) {
+        thr.join();
+    }
+    ASSERT_EQ(0u, failed.load());
+    // whichever save was last had everything
+    cleanup_checkpoint reloaded(path_);
+    reloaded.load();
+    ASSERT_EQ(200u, reloaded.progress("default").size());
+}
+
+TEST_F(CleanupCheckpoint, SavesFromSeveralObjectsSharingAPath)
+{
+    // as two processes, or two transactions objects, with the same checkpoint path would
+    std::vector<std::unique_ptr<cleanup_checkpoint>> checkpoints;
+    std::vector<std::thread> savers;
+    std::atomic<size_t> failed{ 0 };
+    for (int t = 0; t < 4; t++) {
+        checkpoints.push_back(std::make_unique<cleanup_checkpoint>(path_));
+    }
+    for (int t = 0; t < 4; t++) {
+        savers.emplace_back([&, t]() {
+            for (int i = 0; i < 50; i++) {
+                checkpoints[t]->scanned("default", std::to_string(t) + "-" + std::to_string(i), 1);
+                try {
+                    checkpoints[t]->save();
+                } catch (...) {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (auto& thr : savers) {
+        thr.join();
+    }
+    ASSERT_EQ(0u, failed.load());
+    // the last to save wins, and it has all of its own progress
+    cleanup_checkpoint reloaded(path_);
+    reloaded.load();
+    ASSERT_EQ(50u, reloaded.progress("default").size());
+    // and no temporary files are left behind
+    auto name = std::filesystem::path(path_).filename().string();
+    for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(path_).parent_path())) {
+        auto other = entry.path().filename().string();
+        ASSERT_FALSE(other.rfind(name + ".", 0) == 0 && other.size() > 4 && other.substr(other.size() - 4) == ".tmp") << other;
+    }
+}
@@ -0,0 +1,232 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/cleanup_journal.hxx"
+#include "helpers.hxx"
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <system_error>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const couchbase::document_id atr{ "default", "_default", "_default", "_txn:atr-0-#1" };
+
+class CleanupJournal : public TempFileTest
+{
+  protected:
+    std::string read_file()
+    {
+        std::ifstream in(path_, std::ios::binary);
+        return { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    }
+
+    void write_file(const std::string& bytes)
+    {
+        std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+        out << bytes;
+    }
+
+    std::set<std::string> recovered_ids()
+    {
+        cleanup_journal journal(path_, 1024);
+        std::set<std::string> ids;
+        for (const auto& r : journal.recovered()) {
+            ids.insert(r.attempt_id);
+        }
+        return ids;
+    }
+};
+} // namespace
+
+TEST_F(CleanupJournal, RecoversOnlyUnfinishedAttempts)
+{
+    {
+        cleanup_journal journal(path_);
+        ASSERT_TRUE(journal.recovered().empty());
+        journal.record(atr, "committed", attempt_state::PENDING);
+        journal.record(atr, "committed", attempt_state::COMMITTED);
+        journal.record(atr, "completed", attempt_state::PENDING);
+        journal.record(atr, "completed", attempt_state::COMMITTED);
+        journal.record(atr, "completed", attempt_state::COMPLETED);
+        journal.record(atr, "aborted", attempt_state::PENDING);
+        journal.record(atr, "aborted", attempt_state::ABORTED);
+        journal.record(atr, "rolled-back", attempt_state::PENDING);
+        journal.record(atr, "rolled-back", attempt_state::ROLLED_BACK);
+        ASSERT_EQ(2u, journal.outstanding());
+        // the process "crashes" here, never finishing the other two
+    }
+    cleanup_journal journal(path_);
+    ASSERT_EQ(2u, journal.recovered().size());
+    for (const auto& r : journal.recovered()) {
+        ASSERT_EQ(atr.key(), r.atr_id.key());
+        if (r.attempt_id == "committed") {
+            ASSERT_EQ(attempt_state::COMMITTED, r.state);
+        } else {
+            ASSERT_EQ("aborted", r.attempt_id);
+            ASSERT_EQ(attempt_state::ABORTED, r.state);
+        }
+    }
+}
+
+TEST_F(CleanupJournal, KeepsRecoveredAttemptsUntilFinished)
+{
+    {
+        cleanup_journal journal(path_);
+        journal.record(atr, "a", attempt_state::PENDING);
+        journal.record(atr, "b", attempt_state::COMMITTED);
+    }
+    {
+        // this run crashes before cleaning either up
+        cleanup_journal journal(path_);
+        ASSERT_EQ(2u, journal.recovered().size());
+        ASSERT_EQ(2u, journal.outstanding());
+    }
+    {
+        // this one gets one of them done
+        cleanup_journal journal(path_);
+        ASSERT_EQ(2u, journal.recovered().size());
+        journal.record(atr, "b", attempt_state::COMPLETED);
+        ASSERT_EQ(1u, journal.outstanding());
+    }
+    {
+        cleanup_journal journal(path_);
+        ASSERT_EQ(1u, journal.recovered().size());
+        ASSERT_EQ("a", journal.recovered().front().attempt_id);
+        ASSERT_EQ(attempt_state::PENDING, journal.recovered().front().state);
+        journal.record(atr, "a", attempt_state::COMPLETED);
+    }
+    cleanup_journal journal(path_);
+    ASSERT_TRUE(journal.recovered().empty());
+}
+
+TEST_F(CleanupJournal, RefusesASecondOpen)
+{
+    cleanup_journal journal(path_);
+    journal.record(atr, "a", attempt_state::PENDING);
+    ASSERT_THROW(cleanup_journal{ path_ }, std::system_error);
+    // and the first is untouched by the attempt
+    ASSERT_EQ(1u, journal.outstanding());
+}
+
+TEST_F(CleanupJournal, IgnoresALineCutShort)
+{
+    {
+        cleanup_journal journal(path_, 1024);
+        journal.record(atr, "finished-writing", attempt_state::PENDING);
+    }
+    {
+        // the process crashed while appending the next
+        auto bytes = read_file();
+        std::string cut = "PENDING\tdefault\t_default\t_defa";
+        bytes.replace(bytes.find('\0'), cut.size(), cut);
+        write_file(bytes);
+    }
+    {
+        cleanup_journal journal(path_, 1024);
+        ASSERT_EQ(1u, journal.recovered().size());
+        ASSERT_EQ("finished-writing", journal.recovered().front().attempt_id);
+        // and the next line appended doesn't run on from the one cut short
+        journal.record(atr, "after", attempt_state::PENDING);
+    }
+    cleanup_journal journal(path_, 1024);
+    ASSERT_EQ(2u, journal.recovered().size());
+}
+
+TEST_F(CleanupJournal, ReplaysAJournalLeftHalfRewritten)
+{
+    // Record attempts until one of them fills the first region, and it is rewritten into the second, keeping the file as it
+    // was just before that and the attempts outstanding either side.
+    std::string before;
+    std::set<std::string> outstanding_before;
+    std::set<std::string> outstanding;
+    {
+        cleanup_journal journal(path_, 1024);
+        auto rewrites = [&](const std::string& id, attempt_state state) {
+            before = read_file();
+            outstanding_before = outstanding;
+            journal.record(atr, id, state);
+            if (state == attempt_state::PENDING) {
+                outstanding.insert(id);
+            } else {
+                outstanding.erase(id);
+            }
+            return read_file().compare(512, 16, "cleanup-journal\t") == 0;
+        };
+        for (int i = 0;; i++) {
+            ASSERT_LT(i, 100);
+            // one in three is left outstanding
+            if (rewrites(std::to_string(i), attempt_state::PENDING) ||
+                (i % 3 != 0 && rewrites(std::to_string(i), attempt_state::COMPLETED))) {
+                break;
+            }
+        }
+        ASSERT_EQ(0u, journal.dropped());
+    }
+    auto after = read_file();
+    ASSERT_EQ(1024u, after.size());
+    ASSERT_EQ(before.substr(0, 512), after.substr(0, 512));
+    ASSERT_NE(outstanding_before, outstanding);
+
+    // each point the rewrite could have crashed at
+    auto rewritten = after.substr(512);
+    auto header_size = rewritten.find('\n') + 1;
+    std::vector<std::string> part_way{
+        std::string(512, '\0'),                                                           // zeroed
+        std::string(header_size, '\0') + rewritten.substr(header_size),                    // body written, header not yet
+        rewritten.substr(0, header_size - 1) + '\0' + rewritten.substr(header_size),       // header cut short
+        rewritten.substr(0, header_size / 2) + std::string(header_size - header_size / 2, '\0') + rewritten.substr(header_size),
+    };
+    for (const auto& region : part_way) {
+        write_file(after.substr(0, 512) + region);
+        ASSERT_EQ(outstanding_before, recovered_ids());
+    }
+    write_file(after);
+    ASSERT_EQ(outstanding, recovered_ids());
+}
+
+TEST_F(CleanupJournal, CompactsWhenFull)
+{
+    {
+        cleanup_journal journal(path_, 1024);
+        // far more than fits, but only a couple outstanding at once
+        for (int i = 0; i < 1000; i++) {
+            journal.record(atr, std::to_string(i), attempt_state::PENDING);
+            if (i > 0) {
+                journal.record(atr, std::to_string(i - 1), attempt_state::COMPLETED);
+            }
+        }
+        ASSERT_EQ(0u, journal.dropped());
+        ASSERT_EQ(1u, journal.outstanding());
+    }
+    cleanup_journal journal(path_, 1024);
+    ASSERT_EQ(1u, journal.recovered().size());
+    ASSERT_EQ("999", journal.recovered().front().attempt_id);
+}
+
+TEST_F(CleanupJournal, DropsRecordsWhenTooManyAreOutstanding)
+{
+    cleanup_journal journal(path_, 512);
+    for (int i = 0; i < 100; i++) {
+        journal.record(atr, std::to_string(i), attempt_state::PENDING);
+    }
+    ASSERT_GT(journal.dropped(), 0u);
+    ASSERT_EQ(100u, journal.outstanding());
+}
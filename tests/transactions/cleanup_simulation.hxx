@@ -0,0 +1,524 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "../../src/transactions/atr_ids.hxx"
+#include <couchbase/support.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace couchbase::transactions
+{
+
+struct cleanup_simulation_config {
+    std::chrono::milliseconds cleanup_window{ 60000 };
+    bool rendezvous_hashing{ false };
+    // as transactions_cleanup uses for its heartbeats
+    double heartbeat_jitter{ 0.2 };
+    // added to the cleanup window to give the expiry each client writes in the client record (SAFETY_MARGIN_EXPIRY_MS)
+    std::chrono::milliseconds expiry_safety_margin{ 2000 };
+    // how long a failed heartbeat waits before trying again
+    std::chrono::milliseconds heartbeat_retry{ 1000 };
+    // how long cleaning up one lost attempt takes, during which it is still in its ATR for others to find
+    std::chrono::milliseconds attempt_cleanup_time{ 20 };
+    // lost attempts (of clients which crashed mid-transaction) turn up at this rate, in random ATRs, and can be cleaned up
+    // once they expire
+    double lost_attempts_per_second{ 1 };
+    std::chrono::milliseconds attempt_expiry{ 15000 };
+    uint64_t seed{ 0 };
+};
+
+// What the modelled clients did - see cleanup_simulation for why these are not measurements of transactions_cleanup itself.
+struct cleanup_simulation_results {
+    std::chrono::milliseconds elapsed{ 0 };
+    size_t active_clients{ 0 };
+    size_t clients_in_record{ 0 };
+
+    // Longest time any ATR went without being looked at (including ones still waiting at the end), and the 99th percentile
+    // of the time between consecutive lookups of the same ATR.
+    std::chrono::milliseconds max_coverage_gap{ 0 };
+    std::chrono::milliseconds p99_coverage_gap{ 0 };
+    size_t atr_lookups{ 0 };
+    // lookups of an ATR less than half a cleanup window after a different client looked at it, which a stable share out of
+    // the ATRs would never do
+    size_t duplicate_lookups{ 0 };
+
+    size_t lost_attempts{ 0 };
+    size_t attempts_cleaned{ 0 };
+    // found expired while another client was already cleaning them up
+    size_t duplicate_cleanups{ 0 };
+    // still not cleaned up at the end, more than a cleanup window after they expired
+    size_t attempts_overdue{ 0 };
+    // from an attempt expiring to it being cleaned up
+    std::chrono::milliseconds p50_cleanup_latency{ 0 };
+    std::chrono::milliseconds p99_cleanup_latency{ 0 };
+    std::chrono::milliseconds max_cleanup_latency{ 0 };
+
+    size_t client_record_reads{ 0 };
+    size_t client_record_writes{ 0 };
+    size_t client_record_failed_writes{ 0 };
+    size_t clients_removed{ 0 };
+    double client_record_writes_per_second{ 0 };
+
+    template<typename OStream>
+    friend OStream& operator<<(OStream& os, const cleanup_simulation_results& r)
+    {
+        os << "cleanup_simulation_results{";
+        os << "elapsed: " << r.elapsed.count() << "ms";
+        os << ", active_clients: " << r.active_clients;
+        os << ", clients_in_record: " << r.clients_in_record;
+        os << ", max_coverage_gap: " << r.max_coverage_gap.count() << "ms";
+        os << ", p99_coverage_gap: " << r.p99_coverage_gap.count() << "ms";
+        os << ", atr_lookups: " << r.atr_lookups;
+        os << ", duplicate_lookups: " << r.duplicate_lookups;
+        os << ", lost_attempts: " << r.lost_attempts;
+        os << ", attempts_cleaned: " << r.attempts_cleaned;
+        os << ", duplicate_cleanups: " << r.duplicate_cleanups;
+        os << ", attempts_overdue: " << r.attempts_overdue;
+        os << ", cleanup_latency p50/p99/max: " << r.p50_cleanup_latency.count() << "/" << r.p99_cleanup_latency.count() << "/"
+           << r.max_cleanup_latency.count() << "ms";
+        os << ", client_record reads/writes/failed: " << r.client_record_reads << "/" << r.client_record_writes << "/"
+           << r.client_record_failed_writes;
+        os << ", clients_removed: " << r.clients_removed;
+        os << ", client_record_writes_per_second: " << r.client_record_writes_per_second;
+        os << "}";
+        return os;
+    }
+};
+
+/**
+ * A deterministic, discrete-event model of the lost attempts cleanup shared between many clients, in virtual time.
+ *
+ * This does not run transactions_cleanup.  That runs on threads of its own, waiting in real time, so it can't be run in
+ * virtual time without a clock threaded through it and everything it uses - and hundreds of them in real time would take a
+ * cleanup window per pass.  So this is a model of the algorithm, written by hand from transactions_cleanup, and what it
+ * measures (the coverage of the ATRs, the duplicate lookups and cleanups, and the writes to the client record) is how the
+ * algorithm behaves with a given configuration, as designed.  It says nothing about whether the client behaves so: a bug in
+ * transactions_cleanup doesn't show up here, and that is for the tests which run it against a cluster.  Use it to compare
+ * ways of sharing out the ATRs, and cleanup windows and client counts, before changing them.
+ *
+ * The model: each client heartbeats in the client record every cleanup window (less some jitter), and reads the active
+ * clients from it, removing the expired ones it owns.  Each client looks at its share of the ATRs once per cleanup window,
+ * with the lookups spread evenly over the window, sharing them out from the active clients as of its last heartbeat.
+ * Clients can join, leave (removing themselves from the client record) and crash (leaving their entry to expire) at any
+ * time, and the override can be set.  KV ops are instant, and never fail other than a client record write removing an
+ * entry that has already gone.  The same config and seed always give the same results.
+ *
+ * Only the atr_ids functions, which decide the share out, are the client's own.  The rest is a copy, so must be kept in
+ * step with:
+ *  - heartbeat() and get_active_clients() in transactions_cleanup.cxx, for the heartbeat interval and jitter, the expiry
+ *    written (the cleanup window plus SAFETY_MARGIN_EXPIRY_MS), and removing expired clients;
+ *  - refresh_buckets() and lost_attempts_loop(), for scheduling the heartbeats and the passes over the ATRs;
+ *  - clean_lost_attempts_in_bucket() and lookup_pipeline, for spreading the lookups over the window.
+ */
+class cleanup_simulation
+{
+  public:
+    using time_point = std::chrono::milliseconds;
+
+    explicit cleanup_simulation(cleanup_simulation_config config)
+      : config_(config)
+      , random_(config.seed)
+    {
+        schedule_lost_attempt();
+    }
+
+    CB_NODISCARD time_point now() const
+    {
+        return now_;
+    }
+
+    // Returns the uuid of the new client.
+    std::string join(time_point at)
+    {
+        auto uuid = new_uuid();
+        schedule(at, [this, uuid]() {
+            clients_[uuid].alive = true;
+            heartbeat(uuid);
+            scan(uuid);
+        });
+        return uuid;
+    }
+
+    std::vector<std::string> join(time_point at, size_t count)
+    {
+        std::vector<std::string> uuids;
+        for (size_t i = 0; i < count; i++) {
+            uuids.push_back(join(at));
+        }
+        return uuids;
+    }
+
+    // Closes the client, which removes its entry from the client record.
+    void leave(time_point at, const std::string& uuid)
+    {
+        schedule(at, [this, uuid]() {
+            if (stop(uuid)) {
+                results_.client_record_reads++;
+                results_.client_record_writes++;
+                record_.erase(uuid);
+            }
+        });
+    }
+
+    void crash(time_point at, const std::string& uuid)
+    {
+        schedule(at, [this, uuid]() { stop(uuid); });
+    }
+
+    // Crashes some of the clients that are running at the time, chosen at random.
+    void crash(time_point at, size_t count)
+    {
+        schedule(at, [this, count]() {
+            auto running = alive_clients();
+            std::shuffle(running.begin(), running.end(), random_);
+            running.resize(std::min(count, running.size()));
+            for (const auto& uuid : running) {
+                stop(uuid);
+            }
+        });
+    }
+
+    // While the override is active, clients read the client record but don't write to it.
+    void set_override(time_point at, time_point expires)
+    {
+        schedule(at, [this, expires]() { override_expires_ = expires; });
+    }
+
+    void run_until(time_point until)
+    {
+        while (!events_.empty() && events_.top().at <= until) {
+            auto e = events_.top();
+            events_.pop();
+            now_ = e.at;
+            e.fn();
+        }
+        now_ = until;
+    }
+
+    // Forget everything measured so far (but not the state of the ATRs and clients), to measure from now on.
+    void reset_results()
+    {
+        results_ = {};
+        gaps_.clear();
+        cleanup_latencies_.clear();
+        measuring_from_ = now_;
+    }
+
+    CB_NODISCARD cleanup_simulation_results results() const
+    {
+        auto r = results_;
+        r.elapsed = now_ - measuring_from_;
+        r.active_clients = alive_clients().size();
+        r.clients_in_record = record_.size();
+        auto gaps = gaps_;
+        for (const auto& atr : atr_ids::all()) {
+            auto it = atrs_.find(atr);
+            auto last = it == atrs_.end() ? measuring_from_ : std::max(it->second.last_lookup, measuring_from_);
+            r.max_coverage_gap = std::max(r.max_coverage_gap, now_ - last);
+            if (it == atrs_.end()) {
+                continue;
+            }
+            for (const auto& attempt : it->second.attempts) {
+                r.attempts_overdue += attempt.expires + config_.cleanup_window < now_ ? 1 : 0;
+            }
+        }
+        for (auto gap : gaps) {
+            r.max_coverage_gap = std::max(r.max_coverage_gap, time_point(gap));
+        }
+        r.p99_coverage_gap = time_point(percentile(gaps, 99));
+        auto latencies = cleanup_latencies_;
+        r.p50_cleanup_latency = time_point(percentile(latencies, 50));
+        r.p99_cleanup_latency = time_point(percentile(latencies, 99));
+        r.max_cleanup_latency = time_point(percentile(latencies, 100));
+        if (r.elapsed.count() > 0) {
+            r.client_record_writes_per_second = static_cast<double>(r.client_record_writes) * 1000 / static_cast<double>(r.elapsed.count());
+        }
+        return r;
+    }
+
+  private:
+    struct event {
+        time_point at;
+        uint64_t seq;
+        std::function<void()> fn;
+
+        bool operator>(const event& other) const
+        {
+            return at != other.at ? at > other.at : seq > other.seq;
+        }
+    };
+
+    struct record_entry {
+        time_point heartbeat;
+        time_point expires;
+    };
+
+    struct client {
+        bool alive{ false };
+        // the active clients as of its last heartbeat, sorted
+        std::vector<std::string> active;
+    };
+
+    struct lost_attempt {
+        time_point expires;
+        std::optional<time_point> cleaning_until;
+    };
+
+    struct atr_state {
+        time_point last_lookup{ 0 };
+        std::string last_client;
+        std::vector<lost_attempt> attempts;
+    };
+
+    void schedule(time_point at, std::function<void()> fn)
+    {
+        events_.push({ std::max(at, now_), next_seq_++, std::move(fn) });
+    }
+
+    std::string new_uuid()
+    {
+        static const char* hex = "0123456789abcdef";
+        std::uniform_int_distribution<int> digit(0, 15);
+        std::string uuid;
+        for (int i = 0; i < 16; i++) {
+            uuid += hex[digit(random_)];
+        }
+        return uuid;
+    }
+
+    std::vector<std::string> alive_clients() const
+    {
+        std::vector<std::string> uuids;
+        for (const auto& [uuid, c] : clients_) {
+            if (c.alive) {
+                uuids.push_back(uuid);
+            }
+        }
+        return uuids;
+    }
+
+    // Returns false if the client wasn't running.
+    bool stop(const std::string& uuid)
+    {
+        auto it = clients_.find(uuid);
+        if (it == clients_.end() || !it->second.alive) {
+            return false;
+        }
+        it->second.alive = false;
+        return true;
+    }
+
+    bool alive(const std::string& uuid) const
+    {
+        auto it = clients_.find(uuid);
+        return it != clients_.end() && it->second.alive;
+    }
+
+    // As transactions_cleanup::get_active_clients, then schedules the next one.
+    void heartbeat(const std::string& uuid)
+    {
+        if (!alive(uuid)) {
+            return;
+        }
+        results_.client_record_reads++;
+        std::vector<std::string> active;
+        std::vector<std::string> expired;
+        for (const auto& [other, entry] : record_) {
+            bool has_expired = now_ - entry.heartbeat >= entry.expires && now_ > entry.heartbeat;
+            if (has_expired && other != uuid) {
+                expired.push_back(other);
+            } else {
+                active.push_back(other);
+            }
+        }
+        if (std::find(active.begin(), active.end(), uuid) == active.end()) {
+            active.push_back(uuid);
+        }
+        std::sort(active.begin(), active.end());
+        clients_[uuid].active = active;
+        if (override_expires_ > now_) {
+            schedule(now_ + next_heartbeat_interval(config_.cleanup_window), [this, uuid]() { heartbeat(uuid); });
+            return;
+        }
+        std::vector<std::string> removing;
+        for (const auto& expired_id : expired) {
+            if (removing.size() == 12) {
+                break;
+            }
+            if (atr_ids::owner_of(expired_id, active) == uuid) {
+                removing.push_back(expired_id);
+            }
+        }
+        results_.client_record_writes++;
+        // removing a path that has gone fails the whole mutation
+        for (const auto& expired_id : removing) {
+            if (record_.count(expired_id) == 0) {
+                results_.client_record_failed_writes++;
+                schedule(now_ + config_.heartbeat_retry, [this, uuid]() { heartbeat(uuid); });
+                return;
+            }
+        }
+        for (const auto& expired_id : removing) {
+            record_.erase(expired_id);
+            results_.clients_removed++;
+        }
+        record_[uuid] = { now_, config_.cleanup_window + config_.expiry_safety_margin };
+        schedule(now_ + next_heartbeat_interval(config_.cleanup_window), [this, uuid]() { heartbeat(uuid); });
+    }
+
+    time_point next_heartbeat_interval(time_point interval)
+    {
+        std::uniform_real_distribution<double> shorten_by(0, std::clamp(config_.heartbeat_jitter, 0.0, 1.0));
+        return std::chrono::duration_cast<time_point>(interval * (1 - shorten_by(random_)));
+    }
+
+    // As transactions_cleanup::clean_lost_attempts_in_bucket, with the next pass due a cleanup window after this one started.
+    void scan(const std::string& uuid)
+    {
+        if (!alive(uuid)) {
+            return;
+        }
+        auto atrs = assigned_atrs(uuid, clients_[uuid].active);
+        auto slot = config_.cleanup_window / static_cast<int64_t>(std::max<size_t>(1, atrs.size()));
+        for (size_t i = 0; i < atrs.size(); i++) {
+            schedule(now_ + slot * static_cast<int64_t>(i), [this, uuid, atr = atrs[i]]() { lookup(uuid, atr); });
+        }
+        schedule(now_ + config_.cleanup_window, [this, uuid]() { scan(uuid); });
+    }
+
+    std::vector<std::string> assigned_atrs(const std::string& uuid, const std::vector<std::string>& active)
+    {
+        if (!config_.rendezvous_hashing) {
+            auto idx = std::distance(active.begin(), std::find(active.begin(), active.end(), uuid));
+            return atr_ids::strided_for(static_cast<size_t>(idx), active.size());
+        }
+        // The owner of every ATR is worked out once for each view of the active clients, rather than once per client.
+        auto it = rendezvous_owners_.find(active);
+        if (it == rendezvous_owners_.end()) {
+            if (rendezvous_owners_.size() > 64) {
+                rendezvous_owners_.clear();
+            }
+            std::map<std::string, std::vector<std::string>> owners;
+            for (const auto& atr : atr_ids::all()) {
+                owners[atr_ids::owner_of(atr, active)].push_back(atr);
+            }
+            it = rendezvous_owners_.emplace(active, std::move(owners)).first;
+        }
+        return it->second[uuid];
+    }
+
+    void lookup(const std::string& uuid, const std::string& atr)
+    {
+        if (!alive(uuid)) {
+            return;
+        }
+        results_.atr_lookups++;
+        auto& state = atrs_[atr];
+        if (!state.last_client.empty()) {
+            gaps_.push_back((now_ - std::max(state.last_lookup, measuring_from_)).count());
+            if (state.last_client != uuid && now_ - state.last_lookup < config_.cleanup_window / 2) {
+                results_.duplicate_lookups++;
+            }
+        }
+        state.last_lookup = now_;
+        state.last_client = uuid;
+        for (auto& attempt : state.attempts) {
+            if (attempt.expires > now_) {
+                continue;
+            }
+            if (attempt.cleaning_until && *attempt.cleaning_until > now_) {
+                results_.duplicate_cleanups++;
+                continue;
+            }
+            attempt.cleaning_until = now_ + config_.attempt_cleanup_time;
+            schedule(*attempt.cleaning_until, [this, uuid, atr, expires = attempt.expires]() { cleaned(uuid, atr, expires); });
+        }
+    }
+
+    void cleaned(const std::string& uuid, const std::string& atr, time_point expires)
+    {
+        if (!alive(uuid)) {
+            // crashed part way through, so someone else will have to
+            return;
+        }
+        auto& attempts = atrs_[atr].attempts;
+        auto it = std::find_if(attempts.begin(), attempts.end(), [&](const auto& a) { return a.expires == expires; });
+        if (it == attempts.end()) {
+            return;
+        }
+        attempts.erase(it);
+        results_.attempts_cleaned++;
+        cleanup_latencies_.push_back((now_ - std::max(expires, measuring_from_)).count());
+    }
+
+    void schedule_lost_attempt()
+    {
+        if (config_.lost_attempts_per_second <= 0) {
+            return;
+        }
+        std::exponential_distribution<double> interval(config_.lost_attempts_per_second / 1000);
+        schedule(now_ + time_point(static_cast<int64_t>(interval(random_))), [this]() {
+            std::uniform_int_distribution<size_t> pick(0, atr_ids::all().size() - 1);
+            auto& attempts = atrs_[atr_ids::all()[pick(random_)]].attempts;
+            // two attempts in an ATR expiring at the same time are told apart by the later one expiring a bit later
+            auto expires = now_ + config_.attempt_expiry;
+            while (std::any_of(attempts.begin(), attempts.end(), [&](const auto& a) { return a.expires == expires; })) {
+                expires += time_point(1);
+            }
+            attempts.push_back({ expires, std::nullopt });
+            results_.lost_attempts++;
+            schedule_lost_attempt();
+        });
+    }
+
+    static int64_t percentile(std::vector<int64_t>& values, size_t p)
+    {
+        if (values.empty()) {
+            return 0;
+        }
+        auto idx = std::min(values.size() - 1, values.size() * p / 100);
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(idx), values.end());
+        return values[idx];
+    }
+
+    const cleanup_simulation_config config_;
+    std::mt19937_64 random_;
+    time_point now_{ 0 };
+    time_point measuring_from_{ 0 };
+    uint64_t next_seq_{ 0 };
+    std::priority_queue<event, std::vector<event>, std::greater<>> events_;
+    std::map<std::string, client> clients_;
+    std::map<std::string, record_entry> record_;
+    time_point override_expires_{ 0 };
+    std::map<std::string, atr_state> atrs_;
+    std::map<std::vector<std::string>, std::map<std::string, std::vector<std::string>>> rendezvous_owners_;
+    cleanup_simulation_results results_;
+    std::vector<int64_t> gaps_;
+    std::vector<int64_t> cleanup_latencies_;
+};
+} // namespace couchbase::transactions
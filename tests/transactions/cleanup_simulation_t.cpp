@@ -0,0 +1,150 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "cleanup_simulation.hxx"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+// These check the cleanup algorithm as modelled by cleanup_simulation, not transactions_cleanup itself.
+
+namespace
+{
+const milliseconds window(60000);
+
+cleanup_simulation_config
+config(bool rendezvous = false)
+{
+    cleanup_simulation_config cfg;
+    cfg.cleanup_window = window;
+    cfg.rendezvous_hashing = rendezvous;
+    cfg.seed = 42;
+    return cfg;
+}
+} // namespace
+
+TEST(CleanupModel, SameSeedSameResults)
+{
+    auto run = []() {
+        cleanup_simulation sim(config());
+        sim.join(milliseconds(0), 20);
+        sim.crash(window * 3, 5);
+        sim.run_until(window * 8);
+        std::ostringstream os;
+        os << sim.results();
+        return os.str();
+    };
+    ASSERT_EQ(run(), run());
+}
+
+TEST(CleanupModel, SteadyStateCoversEveryAtrOncePerWindow)
+{
+    cleanup_simulation sim(config());
+    sim.join(milliseconds(0), 200);
+    // let everyone see everyone else
+    sim.run_until(window * 3);
+    sim.reset_results();
+    sim.run_until(window * 10);
+    auto r = sim.results();
+    SCOPED_TRACE(::testing::Message() << r);
+    ASSERT_EQ(200, r.active_clients);
+    ASSERT_EQ(200, r.clients_in_record);
+    ASSERT_EQ(0, r.duplicate_lookups);
+    ASSERT_EQ(0, r.duplicate_cleanups);
+    // each lookup is at the same point in each pass, give or take a slot's rounding
+    ASSERT_LE(r.max_coverage_gap, window + milliseconds(1000));
+    ASSERT_EQ(atr_ids::all().size() * 7, r.atr_lookups);
+    ASSERT_LE(r.max_cleanup_latency, window + milliseconds(1000));
+    ASSERT_EQ(0, r.attempts_overdue);
+    // one heartbeat per window per client, a little more often with the jitter
+    ASSERT_GE(r.client_record_writes, 200 * 7);
+    ASSERT_LE(r.client_record_writes, 200 * 9);
+}
+
+TEST(CleanupModel, CrashedClientsAreRemovedAndTheirAtrsPickedUp)
+{
+    cleanup_simulation sim(config());
+    sim.join(milliseconds(0), 100);
+    sim.run_until(window * 3);
+    sim.crash(window * 3, 30);
+    sim.run_until(window * 3 + milliseconds(1));
+    sim.reset_results();
+    sim.run_until(window * 8);
+    auto r = sim.results();
+    SCOPED_TRACE(::testing::Message() << r);
+    ASSERT_EQ(70, r.active_clients);
+    ASSERT_EQ(70, r.clients_in_record);
+    ASSERT_EQ(30, r.clients_removed);
+    // the crashed clients' ATRs wait for them to expire, be noticed by a heartbeat, and the next pass
+    ASSERT_LE(r.max_coverage_gap, window * 3);
+    ASSERT_EQ(0, r.attempts_overdue);
+}
+
+TEST(CleanupModel, GracefulLeaveNeedsNoExpiry)
+{
+    cleanup_simulation sim(config());
+    auto clients = sim.join(milliseconds(0), 10);
+    sim.run_until(window * 3);
+    sim.reset_results();
+    sim.leave(sim.now(), clients.front());
+    sim.run_until(window * 6);
+    auto r = sim.results();
+    ASSERT_EQ(9, r.active_clients);
+    ASSERT_EQ(9, r.clients_in_record);
+    ASSERT_EQ(0, r.clients_removed);
+    ASSERT_EQ(0, r.client_record_failed_writes);
+}
+
+TEST(CleanupModel, OverrideStopsClientRecordWrites)
+{
+    cleanup_simulation sim(config());
+    sim.join(milliseconds(0), 10);
+    sim.run_until(window * 2);
+    sim.set_override(sim.now(), sim.now() + window * 2);
+    sim.run_until(window * 2 + milliseconds(1));
+    sim.reset_results();
+    sim.run_until(window * 4);
+    auto r = sim.results();
+    ASSERT_EQ(0, r.client_record_writes);
+    ASSERT_GT(r.client_record_reads, 0);
+}
+
+TEST(CleanupModel, RendezvousHashingMovesFewerAtrsOnChurn)
+{
+    auto churn = [](bool rendezvous) {
+        cleanup_simulation sim(config(rendezvous));
+        auto clients = sim.join(milliseconds(0), 50);
+        sim.run_until(window * 3);
+        sim.reset_results();
+        // a rolling restart: one client replaced every 10s
+        for (size_t i = 0; i < 20; i++) {
+            auto at = window * 3 + milliseconds(10000) * static_cast<int64_t>(i);
+            sim.leave(at, clients[i]);
+            sim.join(at);
+        }
+        sim.run_until(window * 10);
+        auto r = sim.results();
+        SCOPED_TRACE(::testing::Message() << (rendezvous ? "rendezvous: " : "striding: ") << r);
+        EXPECT_EQ(0, r.attempts_overdue);
+        return r;
+    };
+    auto striding = churn(false);
+    auto rendezvous = churn(true);
+    ASSERT_LT(rendezvous.duplicate_lookups, striding.duplicate_lookups);
+}
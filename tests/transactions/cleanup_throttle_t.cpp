@@ -0,0 +1,118 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <couchbase/transactions/internal/cleanup_throttle.hxx>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+void
+record(cleanup_throttle& throttle, milliseconds latency, size_t count = 100)
+{
+    for (size_t i = 0; i < count; i++) {
+        throttle.record(latency);
+    }
+}
+} // namespace
+
+TEST(CleanupThrottle, FullRateWithoutTraffic)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.1, milliseconds(0));
+    auto state = throttle.state();
+    ASSERT_EQ(1.0, state.level);
+    ASSERT_FALSE(state.p99);
+    ASSERT_EQ(0u, state.samples);
+}
+
+TEST(CleanupThrottle, DisabledWithoutTarget)
+{
+    cleanup_throttle throttle({}, 0.1, milliseconds(0));
+    record(throttle, seconds(1));
+    auto state = throttle.state();
+    ASSERT_EQ(1.0, state.level);
+    ASSERT_EQ("throttling disabled", state.reason);
+}
+
+TEST(CleanupThrottle, BacksOffWhenForegroundIsSlow)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.1, milliseconds(0));
+    record(throttle, milliseconds(50));
+    auto state = throttle.state();
+    ASSERT_EQ(0.5, state.level);
+    ASSERT_EQ(milliseconds(50), *state.p99);
+    ASSERT_NE(std::string::npos, state.reason.find("over the target"));
+    ASSERT_EQ(0.25, throttle.level());
+}
+
+TEST(CleanupThrottle, NeverBelowMinimumRate)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.2, milliseconds(0));
+    record(throttle, milliseconds(50));
+    for (int i = 0; i < 10; i++) {
+        throttle.level();
+    }
+    auto state = throttle.state();
+    ASSERT_EQ(0.2, state.level);
+    ASSERT_NE(std::string::npos, state.reason.find("minimum"));
+}
+
+TEST(CleanupThrottle, RecoversWhenForegroundIsFast)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.1, milliseconds(0));
+    record(throttle, milliseconds(50));
+    ASSERT_EQ(0.5, throttle.level());
+    // the slow samples are overwritten by fast ones
+    record(throttle, milliseconds(1), 1024);
+    auto level = throttle.level();
+    ASSERT_GT(level, 0.5);
+    for (int i = 0; i < 10; i++) {
+        level = throttle.level();
+    }
+    ASSERT_EQ(1.0, level);
+}
+
+TEST(CleanupThrottle, OnlyReevaluatesPeriodically)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.1, milliseconds(200));
+    record(throttle, milliseconds(50));
+    ASSERT_EQ(0.5, throttle.level());
+    ASSERT_EQ(0.5, throttle.level());
+    std::this_thread::sleep_for(milliseconds(250));
+    ASSERT_EQ(0.25, throttle.level());
+}
+
+TEST(CleanupThrottle, RecordingIsThreadSafe)
+{
+    cleanup_throttle throttle(milliseconds(10), 0.1, milliseconds(0));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&]() { record(throttle, milliseconds(1), 10000); });
+    }
+    threads.emplace_back([&]() {
+        for (int i = 0; i < 100; i++) {
+            throttle.state();
+        }
+    });
+    for (auto& thr : threads) {
+        thr.join();
+    }
+    ASSERT_EQ(1024u, throttle.state().samples);
+}
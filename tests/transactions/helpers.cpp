@@ -14,6 +14,9 @@
  *   limitations under the License.
  */
 #include "helpers.hxx"
+
+#include <cstdio>
+
 bool
 operator==(const SimpleObject& lhs, const SimpleObject& rhs)
 {
@@ -50,3 +53,26 @@ from_json(const nlohmann::json& j, AnotherSimpleObject& o)
 {
     j.at("foo").get_to(o.foo);
 }
+
+namespace
+{
+const char* temp_file_suffixes[] = { "", ".tmp" };
+} // namespace
+
+void
+TempFileTest::SetUp()
+{
+    const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    path_ = ::testing::TempDir() + info->test_suite_name() + "_" + info->name();
+    for (const auto* suffix : temp_file_suffixes) {
+        std::remove((path_ + suffix).c_str());
+    }
+}
+
+void
+TempFileTest::TearDown()
+{
+    for (const auto* suffix : temp_file_suffixes) {
+        std::remove((path_ + suffix).c_str());
+    }
+}
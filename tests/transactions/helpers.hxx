@@ -17,6 +17,7 @@
 #pragma once
 
 #include <couchbase/internal/nlohmann/json.hpp>
+#include <gtest/gtest.h>
 #include <string>
 
 struct SimpleObject {
@@ -45,3 +46,14 @@ to_json(nlohmann::json& j, const AnotherSimpleObject& o);
 
 void
 from_json(const nlohmann::json& j, AnotherSimpleObject& o);
+
+// A fixture for tests of things kept in local files: each test gets a path of its own in the temp dir, with nothing there
+// at the start, and anything left there (or beside it, with a suffix) removed at the end.
+class TempFileTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override;
+    void TearDown() override;
+
+    std::string path_;
+};
@@ -0,0 +1,139 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/lookup_pipeline.hxx"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+// A stand-in for the ATR lookups: each completes on a thread of its own after a delay, and it records when each was issued and
+// the most ever in flight at once.
+struct fake_lookup {
+    explicit fake_lookup(milliseconds takes)
+      : takes(takes)
+    {
+    }
+
+    ~fake_lookup()
+    {
+        for (auto& thr : threads) {
+            thr.join();
+        }
+    }
+
+    void operator()(size_t index, lookup_pipeline<size_t>::done_fn done)
+    {
+        auto now_in_flight = ++in_flight;
+        auto prev = max_in_flight.load();
+        while (now_in_flight > prev && !max_in_flight.compare_exchange_weak(prev, now_in_flight)) {
+        }
+        issued_at.push_back(steady_clock::now());
+        threads.emplace_back([this, index, done]() {
+            std::this_thread::sleep_for(takes);
+            --in_flight;
+            done(index * 2);
+        });
+    }
+
+    milliseconds takes;
+    std::atomic<size_t> in_flight{ 0 };
+    std::atomic<size_t> max_in_flight{ 0 };
+    // only touched by the thread running the pipeline
+    std::vector<steady_clock::time_point> issued_at;
+    std::vector<std::thread> threads;
+};
+} // namespace
+
+TEST(LookupPipeline, HandlesEveryResult)
+{
+    fake_lookup lookup(milliseconds(1));
+    std::vector<size_t> results(50, 0);
+    lookup_pipeline<size_t> pipeline(results.size(), 4);
+    ASSERT_TRUE(pipeline.run(std::ref(lookup), [&](size_t index, size_t result) { results[index] = result + 1; }));
+    for (size_t i = 0; i < results.size(); i++) {
+        ASSERT_EQ(i * 2 + 1, results[i]);
+    }
+}
+
+TEST(LookupPipeline, BoundsLookupsInFlight)
+{
+    fake_lookup lookup(milliseconds(20));
+    lookup_pipeline<size_t> pipeline(40, 5);
+    ASSERT_TRUE(pipeline.run(std::ref(lookup), [](size_t, size_t) {}));
+    ASSERT_EQ(5u, lookup.max_in_flight.load());
+}
+
+TEST(LookupPipeline, ThrottlingAllowsFewerInFlight)
+{
+    fake_lookup lookup(milliseconds(20));
+    lookup_pipeline<size_t> pipeline(40, 8);
+    pipeline.throttle([]() { return 0.25; });
+    ASSERT_TRUE(pipeline.run(std::ref(lookup), [](size_t, size_t) {}));
+    ASSERT_EQ(2u, lookup.max_in_flight.load());
+}
+
+TEST(LookupPipeline, IssuesEachLookupInItsSlot)
+{
+    // 10 lookups in 200ms, so one slot every 20ms
+    fake_lookup lookup(milliseconds(1));
+    lookup_pipeline<size_t> pipeline(10, 4, milliseconds(200));
+    auto start = steady_clock::now();
+    ASSERT_TRUE(pipeline.run(std::ref(lookup), [](size_t, size_t) {}));
+    ASSERT_EQ(10u, lookup.issued_at.size());
+    for (size_t i = 0; i < lookup.issued_at.size(); i++) {
+        ASSERT_GE(lookup.issued_at[i], start + milliseconds(20) * i);
+        // and not late either, as the lookups are quick
+        ASSERT_LT(lookup.issued_at[i], start + milliseconds(20) * i + milliseconds(15));
+    }
+}
+
+TEST(LookupPipeline, SlowLookupsDoNotOverrunTheWindow)
+{
+    // 1024 ATRs in a 1s window, each taking far longer than its slot: with enough in flight they still fit.
+    fake_lookup lookup(milliseconds(20));
+    lookup_pipeline<size_t> pipeline(1024, 32, milliseconds(1000));
+    auto start = steady_clock::now();
+    size_t handled = 0;
+    ASSERT_TRUE(pipeline.run(std::ref(lookup), [&](size_t, size_t) { handled++; }));
+    auto elapsed = steady_clock::now() - start;
+    ASSERT_EQ(1024u, handled);
+    ASSERT_GE(elapsed, milliseconds(999));
+    // the last slot is just short of the window, then its lookup takes 20ms
+    ASSERT_LT(elapsed, milliseconds(1200));
+}
+
+TEST(LookupPipeline, StopsWhenNoLongerRunning)
+{
+    fake_lookup lookup(milliseconds(1));
+    lookup_pipeline<size_t> pipeline(100, 4, milliseconds(1000));
+    std::atomic<bool> running{ true };
+    pipeline.running([&]() { return running.load(); }, milliseconds(10));
+    std::thread stopper([&]() {
+        std::this_thread::sleep_for(milliseconds(100));
+        running = false;
+    });
+    auto start = steady_clock::now();
+    ASSERT_FALSE(pipeline.run(std::ref(lookup), [](size_t, size_t) {}));
+    stopper.join();
+    ASSERT_LT(steady_clock::now() - start, milliseconds(300));
+    ASSERT_LT(lookup.issued_at.size(), 20u);
+}
@@ -0,0 +1,108 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/lost_attempts_registry.hxx"
+#include <gtest/gtest.h>
+
+using namespace couchbase::transactions;
+
+TEST(LostAttemptsRegistry, FirstToJoinLeads)
+{
+    lost_attempts_registry registry;
+    int a, b;
+    int leads_a = 0;
+    int leads_b = 0;
+    ASSERT_TRUE(registry.join("cluster/", &a, [&]() { leads_a++; }));
+    ASSERT_FALSE(registry.join("cluster/", &b, [&]() { leads_b++; }));
+    ASSERT_EQ(&a, registry.leader("cluster/"));
+    ASSERT_EQ(1, leads_a);
+    ASSERT_EQ(0, leads_b);
+    ASSERT_EQ(2u, registry.members("cluster/"));
+}
+
+TEST(LostAttemptsRegistry, KeysAreIndependent)
+{
+    lost_attempts_registry registry;
+    int a, b;
+    ASSERT_TRUE(registry.join("cluster/", &a, []() {}));
+    ASSERT_TRUE(registry.join("cluster/bucket.scope.collection", &b, []() {}));
+    ASSERT_EQ(&b, registry.leader("cluster/bucket.scope.collection"));
+}
+
+TEST(LostAttemptsRegistry, NextMemberTakesOverWhenLeaderLeaves)
+{
+    lost_attempts_registry registry;
+    int a, b, c;
+    int leads_b = 0;
+    int leads_c = 0;
+    registry.join("k", &a, []() {});
+    registry.join("k", &b, [&]() { leads_b++; });
+    registry.join("k", &c, [&]() { leads_c++; });
+    // a follower leaving changes nothing
+    registry.leave("k", &c);
+    ASSERT_EQ(&a, registry.leader("k"));
+    ASSERT_EQ(0, leads_c);
+    registry.leave("k", &a);
+    ASSERT_EQ(&b, registry.leader("k"));
+    ASSERT_EQ(1, leads_b);
+}
+
+TEST(LostAttemptsRegistry, LastToLeaveForgetsTheKey)
+{
+    lost_attempts_registry registry;
+    int a;
+    registry.join("k", &a, []() {});
+    registry.leave("k", &a);
+    // and leaving again is harmless
+    registry.leave("k", &a);
+    ASSERT_EQ(nullptr, registry.leader("k"));
+    ASSERT_EQ(0u, registry.members("k"));
+    int b;
+    ASSERT_TRUE(registry.join("k", &b, []() {}));
+}
+
+TEST(LostAttemptsRegistry, KeyedOnCleanupSettings)
+{
+    int cluster, other_cluster;
+    transaction_config a;
+    transaction_config b;
+    ASSERT_EQ(lost_attempts_registry::key_for(&cluster, a), lost_attempts_registry::key_for(&cluster, b));
+    ASSERT_NE(lost_attempts_registry::key_for(&cluster, a), lost_attempts_registry::key_for(&other_cluster, a));
+    // settings which only affect the transactions, not the cleanup, don't split them up
+    b.expiration_time(std::chrono::seconds(5));
+    ASSERT_EQ(lost_attempts_registry::key_for(&cluster, a), lost_attempts_registry::key_for(&cluster, b));
+    b.custom_metadata_collection("bucket", "scope", "collection");
+    ASSERT_NE(lost_attempts_registry::key_for(&cluster, a), lost_attempts_registry::key_for(&cluster, b));
+}
+
+TEST(LostAttemptsRegistry, InstancesWithDifferentWindowsEachLead)
+{
+    // two transactions objects on one cluster, with different cleanup windows, each run their own cleanup
+    lost_attempts_registry registry;
+    int cluster;
+    transaction_config fast;
+    fast.cleanup_window(std::chrono::seconds(10));
+    transaction_config slow;
+    slow.cleanup_window(std::chrono::seconds(120));
+    int a, b, c;
+    ASSERT_TRUE(registry.join(lost_attempts_registry::key_for(&cluster, fast), &a, []() {}));
+    ASSERT_TRUE(registry.join(lost_attempts_registry::key_for(&cluster, slow), &b, []() {}));
+    // while a third with the same window as one of them leaves it to that one
+    transaction_config also_fast;
+    also_fast.cleanup_window(std::chrono::seconds(10));
+    ASSERT_FALSE(registry.join(lost_attempts_registry::key_for(&cluster, also_fast), &c, []() {}));
+    ASSERT_EQ(&a, registry.leader(lost_attempts_registry::key_for(&cluster, also_fast)));
+}
@@ -0,0 +1,150 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/lost_attempts_report_builder.hxx"
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+std::vector<atr_entry>
+entries(const std::vector<attempt_state>& states)
+{
+    std::vector<atr_entry> result;
+    for (size_t i = 0; i < states.size(); i++) {
+        result.emplace_back("default",
+                            "_txn:atr-0-#1",
+                            "attempt-" + std::to_string(i),
+                            states[i],
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                            0,
+                            std::nullopt,
+                            std::nullopt,
+                            std::nullopt,
+                            std::nullopt,
+                            0,
+                            std::nullopt);
+    }
+    return result;
+}
+
+lost_attempts_report_builder
+builder()
+{
+    return lost_attempts_report_builder("default", 2, 512, milliseconds(60000));
+}
+} // namespace
+
+TEST(LostAttemptsReport, CountsWhatEachAtrHad)
+{
+    auto report = builder();
+    report.scanned("empty", {}, 0);
+    report.scanned("a", entries({ attempt_state::PENDING, attempt_state::COMMITTED }), 200);
+    report.scanned("b", entries({ attempt_state::COMMITTED, attempt_state::ABORTED, attempt_state::COMMITTED }), 300);
+    report.failed();
+    report.cleaned(2, 1);
+    report.cleaned(1, 0);
+    ASSERT_EQ(4u, report.atrs_done());
+
+    auto r = report.finish(milliseconds(1234));
+    ASSERT_EQ("default", r.bucket_name);
+    ASSERT_EQ(2u, r.num_active_clients);
+    ASSERT_EQ(512u, r.atrs_assigned);
+    ASSERT_EQ(3u, r.atrs_scanned);
+    ASSERT_EQ(1u, r.atrs_failed);
+    ASSERT_EQ(2u, r.atrs_occupied);
+    ASSERT_EQ(0u, r.atrs_near_full);
+    ASSERT_EQ(500u, r.bytes_read);
+    ASSERT_EQ(3u, r.entries_cleaned);
+    ASSERT_EQ(1u, r.entries_failed);
+    ASSERT_EQ(milliseconds(1234), r.elapsed);
+    ASSERT_EQ(milliseconds(60000), r.budget);
+    ASSERT_EQ(3u, r.entries_by_state.size());
+    ASSERT_EQ(1u, r.entries_by_state.at(attempt_state::PENDING));
+    ASSERT_EQ(3u, r.entries_by_state.at(attempt_state::COMMITTED));
+    ASSERT_EQ(1u, r.entries_by_state.at(attempt_state::ABORTED));
+}
+
+TEST(LostAttemptsReport, CountsNearFullAtrs)
+{
+    auto report = builder();
+    ASSERT_FALSE(report.scanned("at-the-limit", entries({ attempt_state::PENDING }), lost_attempts_report::near_full_bytes));
+    ASSERT_TRUE(report.scanned("over", entries({ attempt_state::PENDING }), lost_attempts_report::near_full_bytes + 1));
+    ASSERT_TRUE(report.scanned("way-over", entries({ attempt_state::PENDING }), 1024 * 1024));
+    ASSERT_EQ(2u, report.finish(milliseconds(0)).atrs_near_full);
+}
+
+TEST(LostAttemptsReport, ListsJustTheFullestAtrsLargestFirst)
+{
+    auto report = builder();
+    // 25 ATRs, in no particular order of size
+    for (size_t i = 0; i < 25; i++) {
+        auto bytes = (i * 7) % 25 * 100;
+        report.scanned("atr-" + std::to_string(i), entries({ attempt_state::PENDING }), bytes + 1);
+    }
+    auto r = report.finish(milliseconds(0));
+    ASSERT_EQ(lost_attempts_report::max_fullest_atrs, r.fullest_atrs.size());
+    for (size_t i = 0; i < r.fullest_atrs.size(); i++) {
+        ASSERT_EQ((24 - i) * 100 + 1, r.fullest_atrs[i].bytes);
+        ASSERT_EQ(1u, r.fullest_atrs[i].entries);
+    }
+    // the largest was the ATR with (i * 7) % 25 == 24, which is i == 7
+    ASSERT_EQ("atr-7", r.fullest_atrs.front().atr_id);
+}
+
+TEST(LostAttemptsReport, ListsFewerAtrsWhenFewerAreOccupied)
+{
+    auto report = builder();
+    report.scanned("empty", {}, 0);
+    report.scanned("small", entries({ attempt_state::PENDING }), 10);
+    report.scanned("big", entries({ attempt_state::PENDING, attempt_state::PENDING }), 20);
+    auto r = report.finish(milliseconds(0));
+    ASSERT_EQ(2u, r.fullest_atrs.size());
+    ASSERT_EQ("big", r.fullest_atrs[0].atr_id);
+    ASSERT_EQ("small", r.fullest_atrs[1].atr_id);
+}
+
+TEST(LostAttemptsReport, DeliversToTheCallback)
+{
+    auto report = builder();
+    report.scanned("a", entries({ attempt_state::COMMITTED }), 100);
+    auto r = report.finish(milliseconds(10));
+    std::vector<lost_attempts_report> delivered;
+    lost_attempts_report_builder::deliver([&](const lost_attempts_report& got) { delivered.push_back(got); }, r);
+    ASSERT_EQ(1u, delivered.size());
+    ASSERT_EQ("default", delivered.front().bucket_name);
+    ASSERT_EQ(1u, delivered.front().atrs_occupied);
+    ASSERT_EQ("a", delivered.front().fullest_atrs.front().atr_id);
+    // no callback is fine too
+    ASSERT_NO_THROW(lost_attempts_report_builder::deliver({}, r));
+}
+
+TEST(LostAttemptsReport, SwallowsWhateverTheCallbackRaises)
+{
+    auto r = builder().finish(milliseconds(0));
+    ASSERT_NO_THROW(lost_attempts_report_builder::deliver([](const lost_attempts_report&) { throw std::runtime_error("oops"); }, r));
+    ASSERT_NO_THROW(lost_attempts_report_builder::deliver([](const lost_attempts_report&) { throw 42; }, r));
+}
@@ -0,0 +1,134 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../mock/mock_kv_client.hxx"
+#include "transactions_env.h"
+#include <couchbase/transactions.hxx>
+#include <gtest/gtest.h>
+
+#include <future>
+#include <memory>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const couchbase::document_id doc_id{ "default", "_default", "_default", "mock-client-doc" };
+
+template<typename Request>
+auto
+execute(kv_client& client, Request req)
+{
+    using response_type = typename Request::response_type;
+    auto barrier = std::make_shared<std::promise<response_type>>();
+    auto f = barrier->get_future();
+    client.execute(std::move(req), [barrier](response_type resp) { barrier->set_value(std::move(resp)); });
+    return f.get();
+}
+} // namespace
+
+TEST(MockKvClient, TranslatesSubdocRequests)
+{
+    mock_kv kv;
+    mock_kv_client client(kv);
+    kv.insert({ doc_id, R"({"a":1})" });
+
+    couchbase::operations::mutate_in_request mreq{ doc_id };
+    mreq.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_upsert, true, true, false, "txn.id.atmpt", R"("attempt-1")");
+    mreq.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_upsert, true, true, true, "txn.op.cas", R"("${Mutation.CAS}")");
+    auto mutated = execute(client, mreq);
+    ASSERT_FALSE(mutated.ctx.ec);
+    ASSERT_EQ(doc_id.key(), mutated.ctx.id.key());
+
+    couchbase::operations::lookup_in_request lreq{ doc_id };
+    lreq.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, "txn.id.atmpt");
+    lreq.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, "txn.op.cas");
+    lreq.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, "txn.missing");
+    auto looked_up = execute(client, lreq);
+    ASSERT_FALSE(looked_up.ctx.ec);
+    ASSERT_EQ(mutated.cas.value, looked_up.cas.value);
+    ASSERT_EQ(R"("attempt-1")", looked_up.fields[0].value);
+    ASSERT_EQ(R"(")" + mock_kv::cas_macro_value(mutated.cas.value) + R"(")", looked_up.fields[1].value);
+    ASSERT_EQ(couchbase::protocol::status::subdoc_path_not_found, looked_up.fields[2].status);
+    ASSERT_FALSE(looked_up.fields[2].exists);
+
+    // a failed spec fails the whole mutation, and says which it was
+    couchbase::operations::mutate_in_request bad{ doc_id };
+    bad.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_upsert, true, true, false, "txn.id.txn", R"("txn-1")");
+    bad.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_add, true, true, false, "txn.id.atmpt", R"("attempt-2")");
+    auto failed = execute(client, bad);
+    ASSERT_EQ(couchbase::error::key_value_errc::path_exists, failed.ctx.ec);
+    ASSERT_EQ(1u, failed.first_error_index.value());
+    ASSERT_EQ(couchbase::protocol::status::subdoc_path_exists, failed.fields[1].status);
+}
+
+TEST(MockKvClient, TranslatesStatusesToErrorCodes)
+{
+    mock_kv kv;
+    mock_kv_client client(kv);
+    couchbase::operations::remove_request missing{ doc_id };
+    ASSERT_EQ(couchbase::error::key_value_errc::document_not_found, execute(client, missing).ctx.ec);
+
+    couchbase::operations::insert_request insert{ doc_id };
+    insert.value = couchbase::utils::to_binary(R"({"a":1})");
+    auto inserted = execute(client, insert);
+    ASSERT_FALSE(inserted.ctx.ec);
+    ASSERT_EQ(couchbase::error::key_value_errc::document_exists, execute(client, insert).ctx.ec);
+
+    couchbase::operations::remove_request stale{ doc_id };
+    stale.cas.value = inserted.cas.value + 1;
+    ASSERT_EQ(couchbase::error::common_errc::cas_mismatch, execute(client, stale).ctx.ec);
+
+    kv.inject({ mock_op::remove, "", mock_status::timeout });
+    ASSERT_EQ(couchbase::error::common_errc::ambiguous_timeout, execute(client, stale).ctx.ec);
+    kv.inject({ mock_op::lookup_in, "", mock_status::timeout });
+    couchbase::operations::lookup_in_request lookup{ doc_id };
+    lookup.specs.add_spec(couchbase::protocol::subdoc_opcode::get, true, "txn");
+    ASSERT_EQ(couchbase::error::common_errc::unambiguous_timeout, execute(client, lookup).ctx.ec);
+    kv.inject({ mock_op::mutate_in, "", mock_status::value_too_large });
+    couchbase::operations::mutate_in_request full{ doc_id };
+    full.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_upsert, true, false, false, "txn", "{}");
+    ASSERT_EQ(couchbase::error::key_value_errc::value_too_large, execute(client, full).ctx.ec);
+}
+
+TEST(MockKvClient, RunsATransaction)
+{
+    // The cluster is only used for queries and for opening buckets, neither of which this needs: every KV op goes to the mock.
+    mock_kv kv;
+    transaction_config cfg;
+    cfg.cleanup_client_attempts(false);
+    cfg.cleanup_lost_attempts(false);
+    transactions txn(TransactionsTestEnvironment::get_cluster(), cfg, std::make_shared<mock_kv_client>(kv));
+
+    auto replaced = TransactionsTestEnvironment::get_document_id();
+    auto inserted = TransactionsTestEnvironment::get_document_id();
+    kv.upsert({ replaced, R"({"some number":0})" });
+    txn.run([&](attempt_context& ctx) {
+        auto doc = ctx.get(replaced);
+        auto content = doc.content<nlohmann::json>();
+        content["another one"] = 1;
+        ctx.replace(doc, content);
+        ctx.insert(inserted, nlohmann::json{ { "some", "thing" } });
+    });
+    ASSERT_EQ(nlohmann::json::parse(R"({"some number":0,"another one":1})"), nlohmann::json::parse(kv.get({ replaced }).value));
+    ASSERT_EQ(nlohmann::json::parse(R"({"some":"thing"})"), nlohmann::json::parse(kv.get({ inserted }).value));
+
+    // and the staged mutations were unstaged
+    mock_lookup_in_request lookup{ replaced, {} };
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "txn" });
+    ASSERT_EQ(mock_status::path_not_found, kv.lookup_in(lookup).fields[0].status);
+    ASSERT_GT(kv.ops(mock_op::mutate_in), 0u);
+}
@@ -0,0 +1,210 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../mock/mock_kv.hxx"
+#include <gtest/gtest.h>
+
+using namespace couchbase::transactions;
+
+namespace
+{
+const couchbase::document_id doc_id{ "default", "_default", "_default", "mock-doc" };
+
+uint64_t
+cas_from_macro(const std::string& json)
+{
+    // as parse_mutation_cas reads it, but in ns
+    auto swapped = std::stoull(nlohmann::json::parse(json).get<std::string>(), nullptr, 16);
+    uint64_t cas = 0;
+    for (size_t i = 0; i < sizeof(swapped); i++) {
+        cas = (cas << 8) | ((swapped >> (8 * i)) & 0xff);
+    }
+    return cas;
+}
+} // namespace
+
+TEST(MockKv, InsertGetRemoveWithCas)
+{
+    mock_kv kv;
+    auto inserted = kv.insert({ doc_id, R"({"a":1})" });
+    ASSERT_EQ(mock_status::success, inserted.status);
+    ASSERT_EQ(mock_status::doc_exists, kv.insert({ doc_id, R"({"a":2})" }).status);
+    auto got = kv.get({ doc_id });
+    ASSERT_EQ(inserted.cas, got.cas);
+    ASSERT_EQ(R"({"a":1})", got.value);
+    ASSERT_EQ(mock_status::cas_mismatch, kv.remove({ doc_id, "", inserted.cas + 1 }).status);
+    ASSERT_EQ(mock_status::success, kv.remove({ doc_id, "", inserted.cas }).status);
+    ASSERT_EQ(mock_status::doc_not_found, kv.get({ doc_id }).status);
+}
+
+TEST(MockKv, MutateInXattrsWithMacros)
+{
+    mock_kv kv;
+    kv.insert({ doc_id, R"({"a":1})" });
+    mock_mutate_in_request req{ doc_id, {} };
+    req.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.id.atmpt", R"("attempt-1")", true });
+    req.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.op.cas", R"("${Mutation.CAS}")", true, true });
+    auto mutated = kv.mutate_in(req);
+    ASSERT_EQ(mock_status::success, mutated.status);
+
+    mock_lookup_in_request lookup{ doc_id, {} };
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "txn.id.atmpt" });
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "txn.op.cas" });
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "$document.CAS" });
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "$vbucket.HLC.now" });
+    lookup.specs.push_back({ mock_subdoc_op::get_doc, false, "" });
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "txn.missing" });
+    kv.execute(lookup, [&](const mock_response& resp) {
+        ASSERT_EQ(mock_status::success, resp.status);
+        ASSERT_EQ(mutated.cas, resp.cas);
+        ASSERT_EQ(R"("attempt-1")", resp.fields[0].value);
+        ASSERT_EQ(mutated.cas, cas_from_macro(resp.fields[1].value));
+        ASSERT_EQ(mutated.cas, std::stoull(nlohmann::json::parse(resp.fields[2].value).get<std::string>(), nullptr, 16));
+        ASSERT_EQ(kv.now_ns() / 1000000000, std::stoull(nlohmann::json::parse(resp.fields[3].value).get<std::string>()));
+        ASSERT_EQ(R"({"a":1})", resp.fields[4].value);
+        ASSERT_EQ(mock_status::path_not_found, resp.fields[5].status);
+    });
+}
+
+TEST(MockKv, ValueCrc32cIsCastagnoli)
+{
+    // the standard check value, which plain CRC-32 gives as 0xcbf43926
+    ASSERT_EQ(0xe3069283u, mock_kv::crc32c("123456789"));
+    ASSERT_EQ(0u, mock_kv::crc32c(""));
+
+    mock_kv kv;
+    kv.insert({ doc_id, "123456789" });
+    mock_lookup_in_request lookup{ doc_id, {} };
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "$document.value_crc32c" });
+    mock_mutate_in_request req{ doc_id, {} };
+    req.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.op.crc32", R"("${Mutation.value_crc32c}")", true, true });
+    ASSERT_EQ(mock_status::success, kv.mutate_in(req).status);
+    ASSERT_EQ(R"("0xe3069283")", kv.lookup_in(lookup).fields[0].value);
+}
+
+TEST(MockKv, FailedSpecLeavesDocumentAlone)
+{
+    mock_kv kv;
+    auto inserted = kv.insert({ doc_id, R"({"a":1})" });
+    mock_mutate_in_request req{ doc_id, {} };
+    req.specs.push_back({ mock_subdoc_op::dict_upsert, false, "b", "2" });
+    req.specs.push_back({ mock_subdoc_op::dict_add, false, "a", "3" });
+    auto resp = kv.mutate_in(req);
+    ASSERT_EQ(mock_status::path_exists, resp.status);
+    ASSERT_EQ(1, resp.failed_spec);
+    auto got = kv.get({ doc_id });
+    ASSERT_EQ(inserted.cas, got.cas);
+    ASSERT_EQ(R"({"a":1})", got.value);
+
+    mock_mutate_in_request no_parents{ doc_id, {} };
+    no_parents.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.id.atmpt", R"("x")" });
+    ASSERT_EQ(mock_status::path_not_found, kv.mutate_in(no_parents).status);
+}
+
+TEST(MockKv, TombstonesNeedAccessDeleted)
+{
+    mock_kv kv;
+    // as a transaction stages an insert
+    mock_mutate_in_request staged{ doc_id, {} };
+    staged.store_semantics = mock_store_semantics::insert;
+    staged.access_deleted = true;
+    staged.create_as_deleted = true;
+    staged.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.op.type", R"("insert")", true });
+    ASSERT_EQ(mock_status::success, kv.mutate_in(staged).status);
+    ASSERT_EQ(mock_status::doc_not_found, kv.get({ doc_id }).status);
+
+    mock_lookup_in_request lookup{ doc_id, {} };
+    lookup.specs.push_back({ mock_subdoc_op::get, true, "txn.op.type" });
+    ASSERT_EQ(mock_status::doc_not_found, kv.lookup_in(lookup).status);
+    lookup.access_deleted = true;
+    auto found = kv.lookup_in(lookup);
+    ASSERT_EQ(mock_status::success, found.status);
+    ASSERT_TRUE(found.deleted);
+    ASSERT_EQ(R"("insert")", found.fields[0].value);
+
+    // and commits it, by inserting over the tombstone
+    ASSERT_EQ(mock_status::success, kv.insert({ doc_id, R"({"b":2})" }).status);
+    ASSERT_EQ(R"({"b":2})", kv.get({ doc_id }).value);
+
+    // deleting drops user xattrs
+    mock_mutate_in_request tag{ doc_id, {} };
+    tag.specs.push_back({ mock_subdoc_op::dict_upsert, true, "txn.op.type", R"("remove")", true });
+    tag.specs.push_back({ mock_subdoc_op::remove_doc, false, "" });
+    ASSERT_EQ(mock_status::success, kv.mutate_in(tag).status);
+    lookup.specs = { { mock_subdoc_op::exists, true, "txn" } };
+    ASSERT_EQ(mock_status::path_not_found, kv.lookup_in(lookup).fields[0].status);
+}
+
+TEST(MockKv, FaultsByOpAndKey)
+{
+    mock_kv kv;
+    kv.inject({ mock_op::insert, "mock-", mock_status::temporary_failure, 2 });
+    ASSERT_EQ(mock_status::temporary_failure, kv.insert({ doc_id, "{}" }).status);
+    ASSERT_EQ(mock_status::success, kv.insert({ { "default", "_default", "_default", "other" }, "{}" }).status);
+    ASSERT_EQ(mock_status::temporary_failure, kv.insert({ doc_id, "{}" }).status);
+    ASSERT_EQ(mock_status::success, kv.insert({ doc_id, "{}" }).status);
+    ASSERT_EQ(2, kv.faults_injected());
+    ASSERT_EQ(4, kv.ops(mock_op::insert));
+}
+
+TEST(MockKv, AmbiguousFaultsStillApply)
+{
+    mock_kv kv;
+    mock_fault fault;
+    fault.op = mock_op::upsert;
+    fault.status = mock_status::durability_ambiguous;
+    fault.applied = true;
+    kv.inject(fault);
+    ASSERT_EQ(mock_status::durability_ambiguous, kv.upsert({ doc_id, R"({"a":1})" }).status);
+    ASSERT_EQ(R"({"a":1})", kv.get({ doc_id }).value);
+}
+
+TEST(MockKv, ProbabilisticFaultsAreRepeatable)
+{
+    auto failures = []() {
+        mock_kv kv({}, 7);
+        mock_fault fault;
+        fault.times = 0;
+        fault.probability = 0.25;
+        kv.inject(fault);
+        size_t failed = 0;
+        for (int i = 0; i < 1000; i++) {
+            failed += kv.upsert({ doc_id, "{}" }).status != mock_status::success ? 1 : 0;
+        }
+        return failed;
+    };
+    auto failed = failures();
+    ASSERT_EQ(failed, failures());
+    ASSERT_GT(failed, 150);
+    ASSERT_LT(failed, 350);
+}
+
+TEST(MockKv, LatencyAndClock)
+{
+    mock_kv_latency latency;
+    latency.durable_write = std::chrono::milliseconds(20);
+    mock_kv kv(latency);
+    auto start = std::chrono::steady_clock::now();
+    kv.upsert({ doc_id, "{}" });
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+    kv.upsert({ doc_id, "{}", 0, durability_level::MAJORITY });
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+    auto before = kv.upsert({ doc_id, "{}" }).cas;
+    kv.advance_clock(std::chrono::hours(1));
+    auto after = kv.upsert({ doc_id, "{}" }).cas;
+    ASSERT_GE(after - before, static_cast<uint64_t>(std::chrono::nanoseconds(std::chrono::hours(1)).count()));
+}
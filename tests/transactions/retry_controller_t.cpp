@@ -0,0 +1,135 @@
+/*
+ *     Copyright 2021 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "../../src/transactions/retry_controller.hxx"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace couchbase::transactions;
+using namespace std::chrono;
+
+namespace
+{
+// A transaction with however much time remaining the test says, so that the tests check what the controller decides for a
+// given remaining time rather than timing it.
+struct fake_transaction {
+    std::atomic<nanoseconds::rep> remaining;
+    std::atomic<bool> overtime{ false };
+
+    explicit fake_transaction(milliseconds remaining_time)
+      : remaining(duration_cast<nanoseconds>(remaining_time).count())
+    {
+    }
+
+    void expires_in(milliseconds remaining_time)
+    {
+        remaining = duration_cast<nanoseconds>(remaining_time).count();
+    }
+
+    retry_controller controller(milliseconds overtime_budget,
+                                milliseconds initial_delay = milliseconds(1),
+                                milliseconds max_delay = milliseconds(100))
+    {
+        return retry_controller([this]() { return nanoseconds(remaining.load()); },
+                                [this]() { return overtime.load(); },
+                                overtime_budget,
+                                initial_delay,
+                                max_delay);
+    }
+};
+} // namespace
+
+TEST(RetryController, CountsRetriesPerStage)
+{
+    fake_transaction txn(seconds(10));
+    auto controller = txn.controller(milliseconds(100));
+    ASSERT_TRUE(controller.try_wait("a"));
+    ASSERT_TRUE(controller.try_wait("a"));
+    ASSERT_TRUE(controller.try_wait("b"));
+    ASSERT_EQ(2, controller.retries("a"));
+    ASSERT_EQ(1, controller.retries("b"));
+    ASSERT_EQ(0, controller.retries("c"));
+    ASSERT_EQ(2, controller.retries().size());
+}
+
+TEST(RetryController, BacksOffUpToTheMaxDelay)
+{
+    fake_transaction txn(seconds(10));
+    auto controller = txn.controller(milliseconds(100));
+    auto first = controller.next_delay("a");
+    ASSERT_TRUE(first);
+    ASSERT_LE(*first, milliseconds(2));
+    for (int i = 0; i < 10; i++) {
+        controller.next_delay("a");
+    }
+    ASSERT_EQ(steady_clock::duration(milliseconds(100)), controller.next_delay("a"));
+}
+
+TEST(RetryController, StopsAfterExpiryPlusBudget)
+{
+    fake_transaction txn(milliseconds(0));
+    auto controller = txn.controller(milliseconds(50));
+    txn.expires_in(-milliseconds(40));
+    auto delay = controller.next_delay("a");
+    ASSERT_TRUE(delay);
+    // past expiry, it may wait up to the deadline, but not beyond
+    ASSERT_LE(*delay, milliseconds(10));
+    txn.expires_in(-milliseconds(60));
+    ASSERT_FALSE(controller.next_delay("a"));
+    ASSERT_FALSE(controller.try_wait("a"));
+    // the refusals aren't counted as retries
+    ASSERT_EQ(1, controller.retries("a"));
+}
+
+TEST(RetryController, OvertimeBudgetStartsWhenOvertimeNoticed)
+{
+    fake_transaction txn(-hours(1));
+    auto controller = txn.controller(milliseconds(50));
+    txn.overtime = true;
+    // long past expiry plus the budget, but overtime has only just been noticed
+    ASSERT_TRUE(controller.next_delay("a"));
+    // and once noticed, the budget runs from then, whatever the expiry says
+    txn.expires_in(hours(1));
+    std::this_thread::sleep_for(milliseconds(60));
+    ASSERT_FALSE(controller.next_delay("a"));
+}
+
+TEST(RetryController, DoesNotSleepPastExpiry)
+{
+    fake_transaction txn(milliseconds(20));
+    // big initial delay, so without the cap we would sleep well past expiry
+    auto controller = txn.controller(milliseconds(1000), milliseconds(500), milliseconds(500));
+    auto delay = controller.next_delay("a");
+    ASSERT_TRUE(delay);
+    ASSERT_EQ(steady_clock::duration(milliseconds(20)), *delay);
+}
+
+TEST(RetryController, StageDelayAdaptsForRetryExpected)
+{
+    fake_transaction txn(seconds(10));
+    auto controller = txn.controller(milliseconds(100));
+    auto delay = controller.for_stage("stage");
+    int tries = 0;
+    auto outcome = retry_expected<void, client_error>(delay, [&]() -> std::optional<expected<void, client_error>> {
+        if (++tries < 3) {
+            return {};
+        }
+        return expected<void, client_error>();
+    });
+    ASSERT_TRUE(outcome);
+    ASSERT_EQ(2, controller.retries("stage"));
+}
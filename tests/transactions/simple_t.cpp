@@ -14,13 +14,20 @@
  *   limitations under the License.
  */
 
+#include "../../src/transactions/active_transaction_record.hxx"
+#include "../../src/transactions/attempt_context_testing_hooks.hxx"
+#include "../../src/transactions/cleanup_testing_hooks.hxx"
 #include "helpers.hxx"
 #include "transactions_env.h"
 #include <couchbase/errors.hxx>
 #include <couchbase/transactions.hxx>
 #include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
+#include <thread>
 
 using namespace couchbase::transactions;
 
@@ -816,6 +823,100 @@ TEST(SimpleQueryTransactions, QueryCanSetAnyDurability)
     }
 }
 
+TEST(SimpleTransactions, AtrOccupancyProbe)
+{
+    auto& cluster = TransactionsTestEnvironment::get_cluster();
+    cluster_kv_client kv(cluster);
+    auto probe = [&](const couchbase::document_id& id) {
+        std::promise<std::pair<std::error_code, size_t>> barrier;
+        auto f = barrier.get_future();
+        active_transaction_record::get_atr_occupancy(
+          kv, id, std::nullopt, [&](std::error_code ec, size_t occupancy) { barrier.set_value({ ec, occupancy }); });
+        return f.get();
+    };
+    // a missing ATR is empty
+    auto missing = probe(TransactionsTestEnvironment::get_document_id());
+    ASSERT_FALSE(missing.first);
+    ASSERT_EQ(0u, missing.second);
+    // as is one with no attempts
+    auto id = TransactionsTestEnvironment::get_document_id();
+    ASSERT_TRUE(TransactionsTestEnvironment::upsert_doc(id, content.dump()));
+    auto no_attempts = probe(id);
+    ASSERT_FALSE(no_attempts.first);
+    ASSERT_EQ(0u, no_attempts.second);
+    // otherwise, count the attempts without fetching them.  They live in an xattr, as written by a transaction.
+    couchbase::operations::mutate_in_request req{ id };
+    req.store_semantics = couchbase::protocol::mutate_in_request_body::store_semantics_type::upsert;
+    req.specs.add_spec(couchbase::protocol::subdoc_opcode::dict_upsert, true, false, false, "attempts", R"({"a": {}, "b": {}, "c": {}})");
+    std::promise<std::error_code> seeded;
+    auto f = seeded.get_future();
+    cluster.execute(req, [&](couchbase::operations::mutate_in_response resp) { seeded.set_value(resp.ctx.ec); });
+    ASSERT_FALSE(f.get());
+    auto three = probe(id);
+    ASSERT_FALSE(three.first);
+    ASSERT_EQ(3u, three.second);
+}
+
+TEST(SimpleTransactions, CleanupCommitsEveryDocOfAnAttempt)
+{
+    // more documents than cleanup works on at once
+    const size_t num_docs = 40;
+    transaction_config cfg;
+    cfg.cleanup_lost_attempts(false);
+    attempt_context_testing_hooks hooks;
+    // fail just after the commit point, leaving the documents for cleanup to commit
+    hooks.before_doc_committed = [](attempt_context*, const std::string&) { return std::optional<error_class>(FAIL_OTHER); };
+    cleanup_testing_hooks cleanup_hooks;
+    std::mutex mutex;
+    std::map<std::string, size_t> commits;
+    cleanup_hooks.before_commit_doc = [&](const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        commits[key]++;
+        return std::optional<error_class>();
+    };
+    cfg.test_factories(hooks, cleanup_hooks);
+    couchbase::transactions::transactions txn(TransactionsTestEnvironment::get_cluster(), cfg);
+    std::vector<couchbase::document_id> ids;
+    for (size_t i = 0; i < num_docs; i++) {
+        ids.push_back(TransactionsTestEnvironment::get_document_id());
+    }
+    auto result = txn.run([&](attempt_context& ctx) {
+        for (const auto& id : ids) {
+            ctx.insert(id, content);
+        }
+    });
+    ASSERT_FALSE(result.unstaging_complete);
+    for (int i = 0; i < 100 && txn.cleanup().cleanup_queue_stats().cleaned == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(1u, txn.cleanup().cleanup_queue_stats().cleaned);
+    ASSERT_EQ(num_docs, commits.size());
+    for (const auto& id : ids) {
+        ASSERT_EQ(1u, commits[id.key()]);
+        ASSERT_EQ(content, TransactionsTestEnvironment::get_doc(id).content_as<nlohmann::json>());
+    }
+}
+
+TEST(SimpleTransactions, ResultHasCommitRetriesPerStage)
+{
+    transaction_config cfg;
+    attempt_context_testing_hooks hooks;
+    // the first try at committing the ATR is ambiguous, so it is retried
+    std::atomic<int> atr_commits{ 0 };
+    hooks.before_atr_commit = [&](attempt_context*) {
+        return atr_commits++ == 0 ? std::optional<error_class>(FAIL_AMBIGUOUS) : std::nullopt;
+    };
+    cleanup_testing_hooks cleanup_hooks;
+    cfg.test_factories(hooks, cleanup_hooks);
+    couchbase::transactions::transactions txn(TransactionsTestEnvironment::get_cluster(), cfg);
+    auto id = TransactionsTestEnvironment::get_document_id();
+    auto result = txn.run([&](attempt_context& ctx) { ctx.insert(id, content); });
+    ASSERT_TRUE(result.unstaging_complete);
+    ASSERT_EQ(1u, result.attempts);
+    ASSERT_EQ(1u, result.commit_retries.size());
+    ASSERT_EQ(1u, result.commit_retries[STAGE_ATR_COMMIT]);
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -393,3 +393,59 @@ TEST(SimpleTxnContext, CanNotPerTxnConfig)
     ASSERT_EQ(tx.config().expiration_time(), txns.config().expiration_time());
     ASSERT_EQ(tx.config().scan_consistency(), txns.config().scan_consistency());
 }
+
+TEST(SimpleTxnContext, PriorityAffectsBackoff)
+{
+    auto txns = TransactionsTestEnvironment::get_transactions();
+    transaction_context normal(txns);
+    transaction_context high(txns, per_transaction_config().priority(transaction_priority::HIGH));
+    transaction_context low(txns, per_transaction_config().priority(transaction_priority::LOW));
+    ASSERT_EQ(transaction_priority::NORMAL, normal.priority());
+    ASSERT_EQ(transaction_priority::HIGH, high.priority());
+    ASSERT_LT(high.backoff_scale(), normal.backoff_scale());
+    ASSERT_LT(normal.backoff_scale(), low.backoff_scale());
+}
+
+TEST(SimpleTxnContext, OlderTxnsBackOffLess)
+{
+    auto txns = TransactionsTestEnvironment::get_transactions();
+    transaction_context tx(txns);
+    tx.add_attempt();
+    auto first = tx.backoff_scale();
+    for (int i = 0; i < 10; i++) {
+        tx.add_attempt();
+    }
+    ASSERT_LT(tx.backoff_scale(), first);
+}
+
+TEST(SimpleTxnContext, ResultHasNumberOfAttempts)
+{
+    auto txns = TransactionsTestEnvironment::get_transactions();
+    auto id = TransactionsTestEnvironment::get_document_id();
+    ASSERT_TRUE(TransactionsTestEnvironment::upsert_doc(id, tx_content.dump()));
+    auto result = txns.run([&](attempt_context& ctx) { ctx.get(id); });
+    ASSERT_EQ(1, result.attempts);
+}
+
+TEST(SimpleTxnContext, ConfigCopiesCleanupAndTimeoutSettings)
+{
+    transaction_config cfg;
+    cfg.kv_timeout(std::chrono::milliseconds(1234));
+    cfg.cleanup_atr_lookups_in_flight(16);
+    cfg.cleanup_journal_path("journal");
+    cfg.cleanup_checkpoint_path("checkpoint");
+    cfg.cleanup_report_callback([](const lost_attempts_report&) {});
+    transaction_config copied(cfg);
+    ASSERT_EQ(cfg.kv_timeout(), copied.kv_timeout());
+    ASSERT_EQ(16, copied.cleanup_atr_lookups_in_flight());
+    ASSERT_EQ("journal", copied.cleanup_journal_path());
+    ASSERT_EQ("checkpoint", copied.cleanup_checkpoint_path());
+    ASSERT_TRUE(copied.cleanup_report_callback());
+    transaction_config assigned;
+    assigned = cfg;
+    ASSERT_EQ(cfg.kv_timeout(), assigned.kv_timeout());
+    ASSERT_EQ(16, assigned.cleanup_atr_lookups_in_flight());
+    ASSERT_EQ("journal", assigned.cleanup_journal_path());
+    ASSERT_EQ("checkpoint", assigned.cleanup_checkpoint_path());
+    ASSERT_TRUE(assigned.cleanup_report_callback());
+}
@@ -223,6 +223,146 @@ TEST(RetryableOp, CanHaveConstantDelay)
     }
 }
 
+TEST(Jitter, StaysInRange)
+{
+    for (int i = 0; i < 100000; i++) {
+        auto j = jitter();
+        ASSERT_GE(j, 1.0 - RETRY_OP_JITTER);
+        ASSERT_LT(j, 1.0 + RETRY_OP_JITTER);
+    }
+}
+
+TEST(Jitter, SeedingIsDeterministic)
+{
+    vector<double> first;
+    vector<double> second;
+    seed_jitter(42);
+    for (int i = 0; i < 100; i++) {
+        first.push_back(jitter());
+    }
+    seed_jitter(42);
+    for (int i = 0; i < 100; i++) {
+        second.push_back(jitter());
+    }
+    ASSERT_EQ(first, second);
+    seed_jitter(43);
+    ASSERT_NE(first.front(), jitter());
+}
+
+TEST(Jitter, SeedingIsPerThread)
+{
+    seed_jitter(42);
+    auto expected = jitter();
+    double in_thread = 0;
+    thread t([&in_thread] {
+        seed_jitter(42);
+        in_thread = jitter();
+    });
+    t.join();
+    ASSERT_EQ(expected, in_thread);
+}
+
+TEST(Jitter, MeanIsOneOnEachThread)
+{
+    const size_t num_threads = 4;
+    const size_t calls_per_thread = 100000;
+    vector<thread> threads;
+    vector<double> sums(num_threads, 0.0);
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&sums, i, calls_per_thread] {
+            double sum = 0;
+            for (size_t n = 0; n < calls_per_thread; n++) {
+                sum += jitter();
+            }
+            sums[i] = sum;
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto s : sums) {
+        ASSERT_NEAR(1.0, s / calls_per_thread, 0.01);
+    }
+}
+
+TEST(RetryExpected, RetriesUntilValue)
+{
+    int tries = 0;
+    auto delay = constant_delay(chrono::milliseconds(0), 10);
+    auto outcome = retry_expected<int, client_error>(delay, [&]() -> optional<expected<int, client_error>> {
+        if (++tries < 5) {
+            return {};
+        }
+        return expected<int, client_error>(tries);
+    });
+    ASSERT_TRUE(outcome);
+    ASSERT_TRUE(outcome->has_value());
+    ASSERT_EQ(5, outcome->value());
+}
+
+TEST(RetryExpected, ReturnsFinalError)
+{
+    auto delay = constant_delay(chrono::milliseconds(0), 10);
+    auto outcome = retry_expected<void, client_error>(
+      delay, [&]() -> optional<expected<void, client_error>> { return make_unexpected(client_error(FAIL_HARD, "hard")); });
+    ASSERT_TRUE(outcome);
+    ASSERT_FALSE(outcome->has_value());
+    ASSERT_EQ(FAIL_HARD, outcome->error().ec());
+}
+
+TEST(RetryExpected, StopsWhenRetriesExhausted)
+{
+    int tries = 0;
+    auto delay = constant_delay(chrono::milliseconds(0), 10);
+    auto outcome = retry_expected<void, client_error>(delay, [&]() -> optional<expected<void, client_error>> {
+        tries++;
+        return {};
+    });
+    ASSERT_FALSE(outcome);
+    ASSERT_EQ(11, tries);
+}
+
+struct fake_kv_request {
+    chrono::milliseconds timeout{ 2500 };
+    couchbase::protocol::durability_level durability_level{ couchbase::protocol::durability_level::none };
+};
+
+TEST(WrapRequest, NoCapUsesKvTimeout)
+{
+    transaction_config config;
+    config.kv_timeout(chrono::milliseconds(1000));
+    fake_kv_request req;
+    wrap_request(req, config, std::nullopt);
+    ASSERT_EQ(chrono::milliseconds(1000), req.timeout);
+}
+
+TEST(WrapRequest, CapShortensTimeout)
+{
+    transaction_config config;
+    config.kv_timeout(chrono::milliseconds(1000));
+    fake_kv_request req;
+    wrap_durable_request(req, config, chrono::milliseconds(200));
+    ASSERT_EQ(chrono::milliseconds(200), req.timeout);
+    ASSERT_EQ(durability(config.durability_level()), req.durability_level);
+}
+
+TEST(WrapRequest, CapNeverLengthensTimeout)
+{
+    transaction_config config;
+    config.kv_timeout(chrono::milliseconds(1000));
+    fake_kv_request req;
+    wrap_request(req, config, chrono::milliseconds(5000));
+    ASSERT_EQ(chrono::milliseconds(1000), req.timeout);
+}
+
+TEST(WrapRequest, ExpiredCapStillLeavesNonZeroTimeout)
+{
+    transaction_config config;
+    fake_kv_request req;
+    wrap_request(req, config, time_until(chrono::steady_clock::now() - hundred_ms));
+    ASSERT_EQ(chrono::milliseconds(1), req.timeout);
+}
+
 TEST(GetBuckets, CanGetBuckets)
 {
     auto& c = TransactionsTestEnvironment::get_cluster();